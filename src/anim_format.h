@@ -0,0 +1,53 @@
+#pragma once
+
+#include <laml/laml.hpp>
+#include "chunk_file.h"
+
+/****************************************
+*
+*   ANIM FILE LAYOUT (v2+)
+*
+*   A chunked file (see chunk_file.h) with header.count = number of bones.
+*   There is one BONE chunk per bone (chunk index = bone), so a single track can be
+*   read, or streamed in, without touching the others.
+*   v4 added the STRS string table and a name + hash to INFO and SKEL. Older INFO records
+*   are a prefix of the current one. v5 widened the SKEL indices to 32 bits, older SKEL
+*   entries are Anim_Bone_Entry_16.
+*
+* ************************************/
+#define ANIM_CHUNK_INFO     "INFO" // Anim_Info
+#define ANIM_CHUNK_SKELETON "SKEL" // Anim_Bone_Entry[num_bones]
+#define ANIM_CHUNK_STRINGS  "STRS" // string table (chunk_file.h) (v4)
+#define ANIM_CHUNK_BONE     "BONE" // vec3 translation[num_samples], quat rotation[num_samples], vec3 scale[num_samples]
+
+struct Anim_Info {
+    uint32 num_samples;
+    real32 frame_rate;
+    real32 length;
+    uint32 name;             // offset into the string table (v4, was reserved)
+    uint64 name_hash;        // name_hash() of the animation name (v4)
+};
+static_assert(sizeof(Anim_Info) == 24, "Anim_Info size changed");
+const uint32 anim_info_v2_size = 16; // v2 - v3
+
+struct Anim_Bone_Entry {
+    uint32 bone_idx;
+    int32  parent_idx;
+    uint32 name;             // offset into the string table
+    uint32 reserved;
+    uint64 name_hash;        // name_hash() of the bone name
+};
+static_assert(sizeof(Anim_Bone_Entry) == 24, "Anim_Bone_Entry size changed");
+
+// SKEL entry of v2 - v4, with 16-bit indices. v2 - v3 only have the first 4 bytes
+struct Anim_Bone_Entry_16 {
+    uint16 bone_idx;
+    int16  parent_idx;
+    uint32 name;             // (v4)
+    uint64 name_hash;        // (v4)
+};
+static_assert(sizeof(Anim_Bone_Entry_16) == 16, "Anim_Bone_Entry_16 size changed");
+const uint32 anim_bone_entry_v2_size = 4; // v2 - v3
+
+// bytes of one sample of one bone track: translation, rotation, scale
+const uint32 anim_sample_size = (3 + 4 + 3) * sizeof(real32);
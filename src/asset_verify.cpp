@@ -0,0 +1,188 @@
+#include "mesh_converter.h"
+#include "chunk_file.h"
+#include "checksum.h"
+#include "utils.h"
+#include "task_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+// chunks are checksummed in pieces of this size, so huge chunks don't need to fit in memory
+const size_t verify_read_size = 8 * 1024 * 1024;
+
+struct Verify_File {
+    std::string filename;
+    FILE* fid = nullptr;
+    std::string error;          // empty if the file is fine (so far)
+    bool32 chunked = false;     // false for files older than the chunk directory
+    bool32 has_checksums = false;
+    Chunk_File_Header header = {};
+    Chunk_Directory directory;
+};
+
+struct Verify_Chunk {
+    uint32 file_idx;
+    uint32 chunk_idx;
+    bool32 read_failed = false;
+    bool32 crc_failed = false;
+};
+
+// checks everything except the chunk data: header, directory checksum, filesize and END marker
+static void verify_directory(Verify_File& file) {
+    file.fid = fopen(file.filename.c_str(), "rb");
+    if (file.fid == nullptr) {
+        file.error = "could not open file";
+        return;
+    }
+
+    char magic[4] = { 0 };
+    uint32 version = 0;
+    if (!utils::read_at(file.fid, 0, magic, 4) || !utils::read_at(file.fid, 8, &version, sizeof(version))) {
+        file.error = "file too small";
+        return;
+    }
+
+    file.chunked = (memcmp(magic, "MESH", 4) == 0 && version >= 6) ||
+                   (memcmp(magic, "ANIM", 4) == 0 && version >= 2) ||
+                   (memcmp(magic, "LEVL", 4) == 0 && version >= 4) ||
+                   (memcmp(magic, "MATB", 4) == 0);
+    if (!file.chunked)
+        return;
+
+    if (!read_chunk_directory(file.fid, magic, file.header, file.directory)) {
+        file.error = "bad header, directory or directory checksum";
+        return;
+    }
+
+    uint64 filesize = chunk_file_size(file.header);
+    if (utils::file_size(file.fid) != filesize) {
+        file.error = "file size does not match the header";
+        return;
+    }
+
+    char end[4] = { 0 };
+    if (filesize < 4 || !utils::read_at(file.fid, filesize - 4, end, 4) || memcmp(end, "END", 4) != 0) {
+        file.error = "missing END marker";
+        return;
+    }
+
+    file.has_checksums = has_chunk_checksums(file.header);
+}
+
+static void verify_chunk(const Verify_File& file, Verify_Chunk& chunk, std::vector<uint8>& buffer) {
+    const Chunk_Entry& entry = file.directory.entries[chunk.chunk_idx];
+
+    uint32 crc = 0;
+    for (uint64 done = 0; done < entry.size;) {
+        size_t n = (size_t)std::min<uint64>(entry.size - done, verify_read_size);
+        buffer.resize(n);
+        if (!utils::read_at(file.fid, entry.offset + done, buffer.data(), n)) {
+            chunk.read_failed = true;
+            return;
+        }
+        crc = crc32c_update(crc, buffer.data(), n);
+        done += n;
+    }
+    chunk.crc_failed = (crc != entry.crc);
+}
+
+bool verify_files(const Options& opts) {
+    std::vector<Verify_File> files;
+    if (std::filesystem::is_directory(opts.input_filename)) {
+        for (const auto& file : std::filesystem::recursive_directory_iterator(opts.input_filename)) {
+            std::string ext = file.path().extension().string();
+            if (file.is_regular_file() && (ext == ".mesh" || ext == ".anim" || ext == ".level" || ext == ".matb")) {
+                files.emplace_back();
+                files.back().filename = file.path().string();
+            }
+        }
+        std::sort(files.begin(), files.end(), [](const Verify_File& a, const Verify_File& b) { return a.filename < b.filename; });
+    } else {
+        files.emplace_back();
+        files.back().filename = opts.input_filename;
+    }
+
+    if (files.empty()) {
+        printf("No .mesh, .anim, .level or .matb files in [%s]\n", opts.input_filename.c_str());
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    // directories first, then every checksummed chunk of every file as its own job,
+    // so one big file is spread over all threads as well as many small ones
+    parallel_for((uint32)files.size(), [&](uint32 n) { verify_directory(files[n]); });
+
+    std::vector<Verify_Chunk> chunks;
+    uint64 num_bytes = 0;
+    for (uint32 f = 0; f < files.size(); f++) {
+        const Verify_File& file = files[f];
+        if (!file.error.empty() || !file.has_checksums)
+            continue;
+        num_bytes += chunk_file_size(file.header);
+        for (uint32 c = 0; c < file.directory.entries.size(); c++) {
+            const Chunk_Entry& entry = file.directory.entries[c];
+            if (entry.flags & chunk_flag_checksum) {
+                Verify_Chunk chunk;
+                chunk.file_idx = f;
+                chunk.chunk_idx = c;
+                chunks.push_back(chunk);
+            }
+        }
+    }
+
+    parallel_for((uint32)chunks.size(), [&](uint32 n) {
+        thread_local std::vector<uint8> buffer;
+        verify_chunk(files[chunks[n].file_idx], chunks[n], buffer);
+    });
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // report in file order
+    uint32 num_ok = 0, num_failed = 0, num_unchecked = 0;
+    uint32 next_chunk = 0;
+    for (uint32 f = 0; f < files.size(); f++) {
+        Verify_File& file = files[f];
+        uint32 num_checked = 0;
+        for (; next_chunk < chunks.size() && chunks[next_chunk].file_idx == f; next_chunk++) {
+            const Verify_Chunk& chunk = chunks[next_chunk];
+            const Chunk_Entry& entry = file.directory.entries[chunk.chunk_idx];
+            num_checked++;
+            if (!chunk.read_failed && !chunk.crc_failed)
+                continue;
+
+            char index_str[16] = "";
+            if (entry.index != chunk_index_none)
+                snprintf(index_str, sizeof(index_str), "[%d]", entry.index);
+            char error[64];
+            snprintf(error, sizeof(error), "chunk %.4s%s %s", entry.tag, index_str, chunk.read_failed ? "could not be read" : "checksum mismatch");
+            if (!file.error.empty())
+                file.error += ", ";
+            file.error += error;
+        }
+
+        if (!file.error.empty()) {
+            printf("  FAILED    %s: %s\n", file.filename.c_str(), file.error.c_str());
+            num_failed++;
+        } else if (!file.has_checksums) {
+            printf("  unchecked %s (written before checksums)\n", file.filename.c_str());
+            num_unchecked++;
+        } else {
+            printf("  ok        %s (%d chunks)\n", file.filename.c_str(), num_checked);
+            num_ok++;
+        }
+
+        if (file.fid)
+            fclose(file.fid);
+    }
+
+    printf("-----------------------------------------\n");
+    printf("%d files: %d ok, %d failed, %d without checksums\n", (int)files.size(), num_ok, num_failed, num_unchecked);
+    printf("Checked %d chunks, %llu bytes in %.3f s (%.2f GB/s, %s CRC32C)\n", (int)chunks.size(),
+        (unsigned long long)num_bytes, seconds, seconds > 0.0 ? num_bytes / seconds / 1e9 : 0.0,
+        crc32c_hardware() ? "SSE4.2" : "table");
+
+    return num_failed == 0;
+}
@@ -0,0 +1,412 @@
+#include "mesh_converter.h"
+#include "utils.h"
+#include "task_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+typedef std::chrono::steady_clock::time_point Time_Point;
+
+static double seconds_since(Time_Point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+enum batch_stage : uint32 {
+    stage_load,    // reading and parsing the input
+    stage_process, // extracting meshes, materials and animations
+    stage_write,   // encoding and writing the output files
+    num_stages
+};
+static const char* stage_names[num_stages] = { "load", "process", "write" };
+
+struct Batch_Job {
+    OperationModeType mode;
+    std::string input;
+    std::string output_folder;
+    Options opts;
+
+    Conversion_State* state = nullptr; // between the stages
+    bool32 success = false;
+    uint64 input_bytes = 0;
+    double seconds[num_stages] = {};
+    Output_Stats stats;
+    Log_Buffer log;          // everything the conversion printed
+};
+
+// an input file, and the name of its output folder relative to the output root
+struct Batch_Input {
+    std::string filename;
+    std::string name;
+};
+
+static const char* mode_name(OperationModeType mode) {
+    switch (mode) {
+        case SINGLE_MESH_MODE: return "mesh";
+        case LEVEL_MODE:       return "level";
+        case ANIM_MODE:        return "anim";
+        default:               return "?";
+    }
+}
+
+bool32 parse_convert_mode(const std::string& name, OperationModeType& mode) {
+    if (name == "mesh")  { mode = SINGLE_MESH_MODE; return true; }
+    if (name == "level") { mode = LEVEL_MODE;       return true; }
+    if (name == "anim")  { mode = ANIM_MODE;        return true; }
+    return false;
+}
+
+// * matches any run of characters, ? any single one
+static bool32 wildcard_match(const char* pattern, const char* name) {
+    if (*pattern == '\0')
+        return *name == '\0';
+    if (*pattern == '*')
+        return wildcard_match(pattern + 1, name) || (*name != '\0' && wildcard_match(pattern, name + 1));
+    if (*name != '\0' && (*pattern == '?' || *pattern == *name))
+        return wildcard_match(pattern + 1, name + 1);
+    return false;
+}
+
+static std::string without_extension(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("\\/");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return path;
+    return path.substr(0, dot);
+}
+
+// a file as-is, every match of a pattern in its folder, or every .gltf/.glb under a folder (in sorted order)
+static void expand_input(const std::string& input, std::vector<Batch_Input>& out_inputs) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+
+    size_t slash = input.find_last_of("\\/");
+    std::string folder = (slash == std::string::npos) ? std::string() : input.substr(0, slash);
+    std::string pattern = (slash == std::string::npos) ? input : input.substr(slash + 1);
+
+    std::vector<Batch_Input> found;
+    if (pattern.find_first_of("*?") != std::string::npos) {
+        for (const auto& file : fs::directory_iterator(folder.empty() ? "." : folder, ec)) {
+            std::string name = file.path().filename().string();
+            if (file.is_regular_file() && wildcard_match(pattern.c_str(), name.c_str())) {
+                found.push_back({ folder.empty() ? name : folder + '\\' + name, without_extension(name) });
+            }
+        }
+    } else if (fs::is_directory(input, ec)) {
+        for (const auto& file : fs::recursive_directory_iterator(input, ec)) {
+            std::string ext = file.path().extension().string();
+            if (file.is_regular_file() && (ext == ".gltf" || ext == ".glb")) {
+                // the output keeps the folder structure below the input folder
+                std::string relative = fs::relative(file.path(), input, ec).string();
+                std::string filename = file.path().string();
+                std::replace(relative.begin(), relative.end(), '/', '\\');
+                std::replace(filename.begin(), filename.end(), '/', '\\');
+                found.push_back({ filename, without_extension(relative) });
+            }
+        }
+    } else {
+        out_inputs.push_back({ input, without_extension(pattern) });
+        return;
+    }
+
+    if (found.empty()) {
+        printf("[WARNING] '%s' matches no input files\n", input.c_str());
+    }
+    std::sort(found.begin(), found.end(), [](const Batch_Input& a, const Batch_Input& b) { return a.filename < b.filename; });
+    out_inputs.insert(out_inputs.end(), found.begin(), found.end());
+}
+
+// output_folder is a root for the inputs below it. without one, each input is converted next to itself
+static void add_inputs(std::vector<Convert_Input>& inputs, OperationModeType mode, const std::string& input, const std::string& output_folder) {
+    std::vector<Batch_Input> found;
+    expand_input(input, found);
+
+    for (const Batch_Input& in : found) {
+        Convert_Input convert;
+        convert.mode = mode;
+        convert.filename = in.filename;
+        if (output_folder.empty()) {
+            std::string folder, filename, ext;
+            utils::decompose_path(in.filename, folder, filename, ext);
+            convert.output_folder = folder + filename;
+        } else {
+            convert.output_folder = output_folder + '\\' + in.name;
+        }
+        std::replace(convert.output_folder.begin(), convert.output_folder.end(), '/', '\\');
+        inputs.push_back(convert);
+    }
+}
+
+// splits on whitespace, "double quotes" keep paths with spaces together
+static std::vector<std::string> split_manifest_line(const std::string& line) {
+    std::vector<std::string> tokens;
+    for (size_t n = 0; n < line.size();) {
+        if (isspace((unsigned char)line[n])) {
+            n++;
+            continue;
+        }
+        size_t end;
+        if (line[n] == '"') {
+            end = line.find('"', n + 1);
+            if (end == std::string::npos) end = line.size();
+            tokens.push_back(line.substr(n + 1, end - n - 1));
+            n = end + 1;
+        } else {
+            for (end = n; end < line.size() && !isspace((unsigned char)line[end]); end++) {}
+            tokens.push_back(line.substr(n, end - n));
+            n = end;
+        }
+    }
+    return tokens;
+}
+
+// one input per line: '<mode> <input> [output_folder]'. empty lines and lines starting with '#' are skipped
+static bool32 read_manifest(const std::string& filename, const Options& opts, std::vector<Convert_Input>& inputs) {
+    std::ifstream file(filename);
+    if (!file.good()) {
+        printf("[ERROR] Failed to open manifest '%s'\n", filename.c_str());
+        return false;
+    }
+
+    std::string line;
+    for (int line_num = 1; std::getline(file, line); line_num++) {
+        std::vector<std::string> tokens = split_manifest_line(line);
+        if (tokens.empty() || tokens[0][0] == '#')
+            continue;
+
+        OperationModeType mode;
+        if (tokens.size() < 2 || tokens.size() > 3 || !parse_convert_mode(tokens[0], mode)) {
+            printf("[ERROR] %s:%d: expected '<mesh|level|anim> <input> [output_folder]'\n", filename.c_str(), line_num);
+            return false;
+        }
+        std::string input = tokens[1];
+        std::string output = tokens.size() == 3 ? tokens[2] : opts.output_folder;
+        std::replace(input.begin(), input.end(), '/', '\\');
+        std::replace(output.begin(), output.end(), '/', '\\');
+
+        if (tokens.size() == 3 && input.find_first_of("*?") == std::string::npos && !std::filesystem::is_directory(input)) {
+            // a single input goes straight into the given folder
+            inputs.push_back({ mode, input, output });
+        } else {
+            add_inputs(inputs, mode, input, output);
+        }
+    }
+    return true;
+}
+
+// A bounded queue of jobs between two stages. push() blocks while it is full, which holds back
+// the stage in front of it, so no more than capacity loaded inputs wait between two stages.
+struct Stage_Queue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Batch_Job*> jobs; // nullptr marks the end
+    uint32 capacity;
+};
+
+// where the time of a stage went, summed over the batch
+struct Stage_Stats {
+    double busy = 0.0;     // working on a job
+    double starved = 0.0;  // waiting for the stage before it
+    double blocked = 0.0;  // waiting for room in the queue after it
+    uint32 num_jobs = 0;
+};
+
+static void push_job(Stage_Queue& queue, Batch_Job* job, Stage_Stats& stats) {
+    Time_Point start = std::chrono::steady_clock::now();
+    {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        queue.changed.wait(lock, [&]() { return queue.jobs.size() < queue.capacity; });
+        queue.jobs.push_back(job);
+    }
+    queue.changed.notify_all();
+    stats.blocked += seconds_since(start);
+}
+
+static Batch_Job* pop_job(Stage_Queue& queue, Stage_Stats& stats) {
+    Time_Point start = std::chrono::steady_clock::now();
+    Batch_Job* job;
+    {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        queue.changed.wait(lock, [&]() { return !queue.jobs.empty(); });
+        job = queue.jobs.front();
+        queue.jobs.pop_front();
+    }
+    queue.changed.notify_all();
+    stats.starved += seconds_since(start);
+    return job;
+}
+
+// the options a job converts with: the batch's, for its own input and output
+static void setup_job(const Options& opts, Batch_Job& job) {
+    job.opts = opts;
+    job.opts.mode = job.mode;
+    job.opts.input_filename = job.input;
+    job.opts.output_folder = job.output_folder;
+    job.opts.stats = &job.stats;
+    job.opts.batch_inputs.clear();
+    job.opts.manifest.clear();
+
+    std::error_code ec;
+    job.input_bytes = std::filesystem::file_size(job.input, ec);
+    if (ec) job.input_bytes = 0;
+}
+
+// one stage of one job. a job that failed in an earlier stage just passes through
+static void run_stage(batch_stage stage, Batch_Job& job, Stage_Stats& stats) {
+    Time_Point start = std::chrono::steady_clock::now();
+    {
+        // the conversion, and every task it starts, logs into the job
+        Log_Scope scope(job.log);
+        switch (stage) {
+            case stage_load: {
+                log_printf("  output_folder:  %s\n", job.output_folder.c_str());
+                job.state = load_input(job.opts);
+                job.success = (job.state != nullptr);
+            } break;
+            case stage_process: {
+                if (job.success)
+                    job.success = process_input(job.opts, job.state);
+            } break;
+            case stage_write: {
+                if (job.success)
+                    job.success = write_outputs(job.opts, job.state);
+                free_conversion(job.state);
+                job.state = nullptr;
+            } break;
+            default: break;
+        }
+    }
+    job.seconds[stage] = seconds_since(start);
+    stats.busy += job.seconds[stage];
+    stats.num_jobs++;
+}
+
+bool32 find_convert_inputs(const Options& opts, std::vector<Convert_Input>& inputs) {
+    inputs.clear();
+    for (const std::string& input : opts.batch_inputs) {
+        std::string in = input;
+        std::replace(in.begin(), in.end(), '/', '\\');
+        add_inputs(inputs, opts.batch_mode, in, opts.output_folder);
+    }
+    if (!opts.manifest.empty() && !read_manifest(opts.manifest, opts, inputs)) {
+        return false;
+    }
+    if (inputs.empty()) {
+        printf("No inputs to convert.\n");
+        return false;
+    }
+
+    // two inputs writing to the same folder would overwrite each other's files
+    std::unordered_map<std::string, uint32> outputs;
+    for (uint32 n = 0; n < inputs.size(); n++) {
+        auto existing = outputs.emplace(inputs[n].output_folder, n);
+        if (!existing.second) {
+            printf("[ERROR] '%s' and '%s' both write to '%s'\n", inputs[existing.first->second].filename.c_str(),
+                inputs[n].filename.c_str(), inputs[n].output_folder.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool convert_batch(const Options& opts) {
+    std::vector<Convert_Input> inputs;
+    if (!find_convert_inputs(opts, inputs)) {
+        return false;
+    }
+    std::deque<Batch_Job> jobs; // deque: jobs hold a lock and atomics, so they never move
+    for (const Convert_Input& input : inputs) {
+        jobs.emplace_back();
+        jobs.back().mode = input.mode;
+        jobs.back().input = input.filename;
+        jobs.back().output_folder = input.output_folder;
+    }
+
+    uint32 depth = opts.queue_depth ? opts.queue_depth : 2;
+    printf("Converting %d inputs (queue depth %d)...\n", (int)jobs.size(), depth);
+    Time_Point start = std::chrono::steady_clock::now();
+
+    // A pipeline: while one input is written, the next is processed and the one after that loads.
+    // Each stage has its own thread and takes the inputs in order, its work itself is spread over
+    // the pool. The bounded queues between the stages keep the number of inputs in memory fixed.
+    Stage_Queue processing, writing;
+    processing.capacity = depth;
+    writing.capacity = depth;
+    Stage_Stats stats[num_stages];
+
+    std::thread loader([&]() {
+        for (Batch_Job& job : jobs) {
+            setup_job(opts, job);
+            run_stage(stage_load, job, stats[stage_load]);
+            push_job(processing, &job, stats[stage_load]);
+        }
+        push_job(processing, nullptr, stats[stage_load]);
+    });
+    std::thread processor([&]() {
+        while (Batch_Job* job = pop_job(processing, stats[stage_process])) {
+            run_stage(stage_process, *job, stats[stage_process]);
+            push_job(writing, job, stats[stage_process]);
+        }
+        push_job(writing, nullptr, stats[stage_process]);
+    });
+
+    // the writer is this thread. inputs finish in order, and are reported as they do
+    uint32 num_done = 0;
+    while (Batch_Job* job = pop_job(writing, stats[stage_write])) {
+        run_stage(stage_write, *job, stats[stage_write]);
+
+        if (opts.verbose || !job->success) {
+            printf("%s", job->log.text.c_str());
+        }
+        printf("  [%3d/%3d] %-6s %s: %s\n", ++num_done, (int)jobs.size(), job->success ? "ok" : "FAILED",
+            mode_name(job->mode), job->input.c_str());
+    }
+    loader.join();
+    processor.join();
+
+    double seconds = seconds_since(start);
+
+    printf("-----------------------------------------\n");
+    printf("  %-5s %-6s %9s %9s %9s %12s %6s %12s  %s\n", "mode", "result", "load ms", "proc ms", "write ms",
+        "input bytes", "files", "output bytes", "input -> output");
+    uint32 num_failed = 0, num_files = 0, num_unchanged = 0;
+    uint64 input_bytes = 0, output_bytes = 0;
+    for (const Batch_Job& job : jobs) {
+        printf("  %-5s %-6s %9.1f %9.1f %9.1f %12llu %6d %12llu  %s -> %s\n", mode_name(job.mode), job.success ? "ok" : "FAILED",
+            job.seconds[stage_load] * 1000.0, job.seconds[stage_process] * 1000.0, job.seconds[stage_write] * 1000.0,
+            (unsigned long long)job.input_bytes, (int)job.stats.num_files.load(), (unsigned long long)job.stats.num_bytes.load(),
+            job.input.c_str(), job.output_folder.c_str());
+        if (!job.success) num_failed++;
+        num_files += job.stats.num_files;
+        num_unchanged += job.stats.num_unchanged;
+        input_bytes += job.input_bytes;
+        output_bytes += job.stats.num_bytes;
+    }
+    printf("-----------------------------------------\n");
+    printf("%d inputs: %d converted, %d failed\n", (int)jobs.size(), (int)jobs.size() - num_failed, num_failed);
+    printf("Read %llu bytes, wrote %d files (%llu bytes) in %.3f s (%d threads)\n",
+        (unsigned long long)input_bytes, num_files, (unsigned long long)output_bytes, seconds, task_system_threads());
+    if (opts.skip_unchanged) {
+        printf("Touched %d of %d files, %d were unchanged\n", num_files - num_unchanged, num_files, num_unchanged);
+    }
+
+    // the stage that is busy the longest sets the pace, the others wait on it
+    printf("  %-8s %9s %6s %11s %11s\n", "stage", "busy (s)", "util", "starved (s)", "blocked (s)");
+    uint32 slowest = stage_load;
+    for (uint32 n = 0; n < num_stages; n++) {
+        printf("  %-8s %9.3f %5.0f%% %11.3f %11.3f\n", stage_names[n], stats[n].busy,
+            seconds > 0.0 ? 100.0 * stats[n].busy / seconds : 0.0, stats[n].starved, stats[n].blocked);
+        if (stats[n].busy > stats[slowest].busy) slowest = n;
+    }
+    printf("Bound by the %s stage (%s).\n", stage_names[slowest],
+        slowest == stage_process ? "CPU" : slowest == stage_load ? "input I/O and parsing" : "encoding and output I/O");
+
+    return num_failed == 0;
+}
@@ -0,0 +1,271 @@
+#include "block_compression.h"
+#include "utils.h"
+#include "task_system.h"
+
+#include <cstring>
+#include <atomic>
+
+const uint32 lz_min_match     = 4;
+const uint32 lz_last_literals = 5;  // the last 5 bytes are always literals (LZ4 block rules)
+const uint32 lz_match_limit   = 12; // no match starts in the last 12 bytes
+const uint32 lz_hash_bits     = 13;
+const uint32 lz_skip_trigger  = 6;  // search faster through data that does not match
+
+static inline uint32 read32(const uint8* p) {
+    uint32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32 lz_hash(uint32 v) {
+    return (v * 2654435761u) >> (32 - lz_hash_bits);
+}
+
+static inline uint8* write_length(uint8* op, uint32 len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8)len;
+    return op;
+}
+
+size_t lz_compress_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+size_t lz_compress(const uint8* src, size_t size, uint8* dst, size_t capacity) {
+    if (size > lz_max_block_size || capacity < lz_compress_bound(size))
+        return 0;
+
+    // positions fit in 16 bits since blocks are at most 64 KiB
+    uint16 table[1 << lz_hash_bits];
+    memset(table, 0, sizeof(table));
+
+    uint8* op = dst;
+    uint32 anchor = 0;
+    uint32 ip = 1;
+
+    if (size > lz_match_limit) {
+        const uint32 input_limit = size - lz_match_limit;
+        const uint32 match_end = size - lz_last_literals;
+        table[lz_hash(read32(src))] = 0;
+
+        while (ip < input_limit) {
+            uint32 h = lz_hash(read32(src + ip));
+            uint32 ref = table[h];
+            table[h] = (uint16)ip;
+
+            if (ref >= ip || ip - ref > 0xFFFF || read32(src + ref) != read32(src + ip)) {
+                ip += 1 + ((ip - anchor) >> lz_skip_trigger);
+                continue;
+            }
+
+            // extend the match backwards over pending literals, then forwards
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+            uint32 len = lz_min_match;
+            while (ip + len < match_end && src[ip + len] == src[ref + len]) {
+                len++;
+            }
+
+            uint32 num_literals = ip - anchor;
+            uint32 match_code = len - lz_min_match;
+            uint8* token = op++;
+            *token = (uint8)(((num_literals < 15 ? num_literals : 15) << 4) | (match_code < 15 ? match_code : 15));
+            if (num_literals >= 15)
+                op = write_length(op, num_literals - 15);
+            memcpy(op, src + anchor, num_literals);
+            op += num_literals;
+
+            uint32 offset = ip - ref;
+            *op++ = (uint8)(offset & 0xFF);
+            *op++ = (uint8)(offset >> 8);
+            if (match_code >= 15)
+                op = write_length(op, match_code - 15);
+
+            ip += len;
+            anchor = ip;
+
+            // helps the next match start right away
+            if (ip < input_limit)
+                table[lz_hash(read32(src + ip - 2))] = (uint16)(ip - 2);
+        }
+    }
+
+    // the rest are literals
+    uint32 num_literals = size - anchor;
+    *op++ = (uint8)((num_literals < 15 ? num_literals : 15) << 4);
+    if (num_literals >= 15)
+        op = write_length(op, num_literals - 15);
+    memcpy(op, src + anchor, num_literals);
+    op += num_literals;
+
+    return op - dst;
+}
+
+bool32 lz_decompress(const uint8* src, size_t src_size, uint8* dst, size_t dst_size) {
+    const uint8* ip = src;
+    const uint8* const iend = src + src_size;
+    uint8* op = dst;
+    uint8* const oend = dst + dst_size;
+
+    while (ip < iend) {
+        uint32 token = *ip++;
+
+        size_t num_literals = token >> 4;
+        if (num_literals == 15) {
+            uint8 b;
+            do {
+                if (ip >= iend)
+                    return false;
+                b = *ip++;
+                num_literals += b;
+            } while (b == 255);
+        }
+
+        if (num_literals <= 16 && iend - ip >= 16 && oend - op >= 16) {
+            // short run, copy a fixed 16 bytes (the tail gets overwritten later)
+            memcpy(op, ip, 16);
+        } else {
+            if ((size_t)(iend - ip) < num_literals || (size_t)(oend - op) < num_literals)
+                return false;
+            memcpy(op, ip, num_literals);
+        }
+        ip += num_literals;
+        op += num_literals;
+
+        // the last sequence has no match
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return false;
+
+        size_t len = token & 15;
+        if (len == 15) {
+            uint8 b;
+            do {
+                if (ip >= iend)
+                    return false;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len += lz_min_match;
+        if ((size_t)(oend - op) < len)
+            return false;
+
+        const uint8* match = op - offset;
+        if (offset >= 8 && (size_t)(oend - op) >= len + 8) {
+            // 8 bytes at a time, may write up to 7 bytes past the match
+            uint8* copy_end = op + len;
+            do {
+                memcpy(op, match, 8);
+                op += 8;
+                match += 8;
+            } while (op < copy_end);
+            op = copy_end;
+        } else {
+            // overlapping (run-length) or at the very end
+            for (size_t n = 0; n < len; n++) {
+                op[n] = match[n];
+            }
+            op += len;
+        }
+    }
+
+    return ip == iend && op == oend;
+}
+
+bool32 compress_blocks(const void* data, size_t size, std::vector<uint8>& out) {
+    out.clear();
+    if (size == 0)
+        return false;
+
+    const uint8* bytes = (const uint8*)data;
+    uint32 num_blocks = (uint32)((size + compressed_block_size - 1) / compressed_block_size);
+    size_t header_size = (2 + num_blocks) * sizeof(uint32);
+
+    out.resize(header_size);
+    uint32* header = (uint32*)out.data();
+    header[0] = compressed_block_size;
+    header[1] = num_blocks;
+
+    std::vector<uint8> block(lz_compress_bound(compressed_block_size));
+    for (uint32 n = 0; n < num_blocks; n++) {
+        size_t raw_offset = (size_t)n * compressed_block_size;
+        size_t raw_size = size - raw_offset < compressed_block_size ? size - raw_offset : compressed_block_size;
+
+        size_t stored_size = lz_compress(bytes + raw_offset, raw_size, block.data(), block.size());
+        if (stored_size == 0 || stored_size >= raw_size) {
+            // incompressible, store it as-is
+            stored_size = raw_size;
+            memcpy(block.data(), bytes + raw_offset, raw_size);
+        }
+
+        out.insert(out.end(), block.data(), block.data() + stored_size);
+        ((uint32*)out.data())[2 + n] = (uint32)stored_size;
+    }
+
+    if (out.size() >= size) {
+        out.clear();
+        return false;
+    }
+    return true;
+}
+
+bool32 decompress_blocks(const uint8* src, size_t src_size, void* dst, size_t dst_size, bool32 parallel) {
+    if (src_size < 2 * sizeof(uint32))
+        return false;
+
+    uint32 block_size = read32(src);
+    uint32 num_blocks = read32(src + 4);
+    if (block_size == 0 || block_size > lz_max_block_size)
+        return false;
+    if (num_blocks != (dst_size + block_size - 1) / block_size)
+        return false;
+
+    size_t header_size = (2 + (size_t)num_blocks) * sizeof(uint32);
+    if (src_size < header_size)
+        return false;
+
+    // where each block starts in src
+    std::vector<size_t> offsets(num_blocks + 1);
+    offsets[0] = header_size;
+    for (uint32 n = 0; n < num_blocks; n++) {
+        offsets[n + 1] = offsets[n] + read32(src + (2 + n) * sizeof(uint32));
+    }
+    if (offsets[num_blocks] != src_size)
+        return false;
+
+    std::atomic<bool> ok(true);
+    auto decode_block = [&](uint32 n) {
+        size_t raw_offset = (size_t)n * block_size;
+        size_t raw_size = dst_size - raw_offset < block_size ? dst_size - raw_offset : block_size;
+        size_t stored_size = offsets[n + 1] - offsets[n];
+        uint8* out = (uint8*)dst + raw_offset;
+
+        if (stored_size == raw_size) {
+            memcpy(out, src + offsets[n], raw_size);
+        } else if (!lz_decompress(src + offsets[n], stored_size, out, raw_size)) {
+            ok = false;
+        }
+    };
+
+    if (parallel && num_blocks > 1) {
+        parallel_for(num_blocks, decode_block);
+    } else {
+        for (uint32 n = 0; n < num_blocks; n++) {
+            decode_block(n);
+        }
+    }
+
+    return ok;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include <laml/laml.hpp>
+
+/****************************************
+*
+*   BLOCK COMPRESSION
+*
+*   A small LZ77 codec that writes the LZ4 block format (token, literals, 16-bit offset,
+*   match length), so any LZ4 block decoder can read a single block too. It favours
+*   decode speed over ratio: there is no entropy coding, only byte copies.
+*
+*   Compressed chunks are split into independent blocks, so they can be decoded in parallel:
+*
+*   uint32 block_size                   <- raw bytes per block (the last one may be shorter)
+*   uint32 num_blocks
+*   uint32 stored_size[num_blocks]      <- == raw block size if the block is stored as-is
+*   [block] [block] ...
+*
+* ************************************/
+const uint32 lz_max_block_size = 64 * 1024; // offsets are 16 bits
+const uint32 compressed_block_size = lz_max_block_size;
+
+// worst case output size of lz_compress for size bytes of input
+size_t lz_compress_bound(size_t size);
+
+// compresses one block of at most lz_max_block_size bytes.
+// returns the compressed size, or 0 if it did not fit in capacity
+size_t lz_compress(const uint8* src, size_t size, uint8* dst, size_t capacity);
+
+// decompresses one block, which must produce exactly dst_size bytes.
+// returns false on corrupt input, never reads or writes out of bounds.
+bool32 lz_decompress(const uint8* src, size_t src_size, uint8* dst, size_t dst_size);
+
+// Compresses data as independent blocks (layout above) into out.
+// Returns false, and leaves out empty, if that would not make it smaller.
+bool32 compress_blocks(const void* data, size_t size, std::vector<uint8>& out);
+
+// decompresses what compress_blocks wrote into exactly dst_size bytes.
+// with parallel set, blocks are spread over the task system (task_system.h).
+bool32 decompress_blocks(const uint8* src, size_t src_size, void* dst, size_t dst_size, bool32 parallel);
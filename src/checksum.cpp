@@ -0,0 +1,190 @@
+#include "checksum.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CRC32C_X64 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+const uint32 crc32c_polynomial = 0x82F63B78; // 0x1EDC6F41 bit-reversed
+
+// t[0] is the usual byte table, t[k] advances a byte through k more zero bytes
+struct Crc32c_Tables {
+    uint32 t[8][256];
+
+    Crc32c_Tables() {
+        for (uint32 n = 0; n < 256; n++) {
+            uint32 crc = n;
+            for (uint32 bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ crc32c_polynomial : crc >> 1;
+            }
+            t[0][n] = crc;
+        }
+        for (uint32 n = 0; n < 256; n++) {
+            for (uint32 k = 1; k < 8; k++) {
+                t[k][n] = (t[k - 1][n] >> 8) ^ t[0][t[k - 1][n] & 0xFF];
+            }
+        }
+    }
+};
+
+static const Crc32c_Tables& crc32c_tables() {
+    static const Crc32c_Tables tables;
+    return tables;
+}
+
+// slicing-by-8: one 8-byte load and 8 table lookups per step
+static uint32 crc32c_software(uint32 crc, const uint8* p, size_t size) {
+    const Crc32c_Tables& tables = crc32c_tables();
+    while (size >= 8) {
+        uint32 lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = tables.t[7][lo & 0xFF] ^ tables.t[6][(lo >> 8) & 0xFF] ^ tables.t[5][(lo >> 16) & 0xFF] ^ tables.t[4][lo >> 24] ^
+              tables.t[3][hi & 0xFF] ^ tables.t[2][(hi >> 8) & 0xFF] ^ tables.t[1][(hi >> 16) & 0xFF] ^ tables.t[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = tables.t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X64
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("sse4.2")))
+#endif
+static uint32 crc32c_sse42(uint32 crc, const uint8* p, size_t size) {
+    uint64 crc64 = crc;
+    while (size >= 8) {
+        uint64 v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        size -= 8;
+    }
+    crc = (uint32)crc64;
+    while (size--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+static bool32 cpu_has_sse42() {
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[2] & (1 << 20)) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 20)) != 0;
+#endif
+}
+#endif
+
+bool32 crc32c_hardware() {
+#ifdef CRC32C_X64
+    static const bool32 has_sse42 = cpu_has_sse42();
+    return has_sse42;
+#else
+    return false;
+#endif
+}
+
+uint32 crc32c_update(uint32 crc, const void* data, size_t size) {
+    const uint8* p = (const uint8*)data;
+    crc = ~crc;
+#ifdef CRC32C_X64
+    if (crc32c_hardware())
+        return ~crc32c_sse42(crc, p, size);
+#endif
+    return ~crc32c_software(crc, p, size);
+}
+
+uint32 crc32c(const void* data, size_t size) {
+    return crc32c_update(0, data, size);
+}
+
+static const uint64 xxh_prime1 = 0x9E3779B185EBCA87ull;
+static const uint64 xxh_prime2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64 xxh_prime3 = 0x165667B19E3779F9ull;
+static const uint64 xxh_prime4 = 0x85EBCA77C2B2AE63ull;
+static const uint64 xxh_prime5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64 rotl64(uint64 x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64 xxh_round(uint64 acc, uint64 input) {
+    acc += input * xxh_prime2;
+    return rotl64(acc, 31) * xxh_prime1;
+}
+
+static inline uint64 xxh_merge(uint64 acc, uint64 lane) {
+    acc ^= xxh_round(0, lane);
+    return acc * xxh_prime1 + xxh_prime4;
+}
+
+uint64 content_hash(const void* data, size_t size, uint64 seed) {
+    const uint8* p = (const uint8*)data;
+    const uint8* end = p + size;
+    uint64 hash;
+
+    if (size >= 32) {
+        uint64 v1 = seed + xxh_prime1 + xxh_prime2;
+        uint64 v2 = seed + xxh_prime2;
+        uint64 v3 = seed;
+        uint64 v4 = seed - xxh_prime1;
+        while (end - p >= 32) {
+            uint64 w[4];
+            memcpy(w, p, 32);
+            v1 = xxh_round(v1, w[0]);
+            v2 = xxh_round(v2, w[1]);
+            v3 = xxh_round(v3, w[2]);
+            v4 = xxh_round(v4, w[3]);
+            p += 32;
+        }
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxh_merge(hash, v1);
+        hash = xxh_merge(hash, v2);
+        hash = xxh_merge(hash, v3);
+        hash = xxh_merge(hash, v4);
+    } else {
+        hash = seed + xxh_prime5;
+    }
+    hash += (uint64)size;
+
+    while (end - p >= 8) {
+        uint64 w;
+        memcpy(&w, p, 8);
+        hash ^= xxh_round(0, w);
+        hash = rotl64(hash, 27) * xxh_prime1 + xxh_prime4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        uint32 w;
+        memcpy(&w, p, 4);
+        hash ^= (uint64)w * xxh_prime1;
+        hash = rotl64(hash, 23) * xxh_prime2 + xxh_prime3;
+        p += 4;
+    }
+    while (p < end) {
+        hash ^= (uint64)(*p++) * xxh_prime5;
+        hash = rotl64(hash, 11) * xxh_prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= xxh_prime2;
+    hash ^= hash >> 29;
+    hash *= xxh_prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
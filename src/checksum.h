@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+#include <laml/laml.hpp>
+
+/****************************************
+*
+*   CHECKSUMS
+*
+*   CRC32C (Castagnoli polynomial, the one iSCSI/ext4 use), so it maps onto the SSE4.2 crc32
+*   instruction. The instruction is used when the CPU has it (checked once at runtime), with
+*   a slicing-by-8 table fallback otherwise. Both give the same result.
+*
+*       uint32 crc = crc32c(data, size);
+*       crc = crc32c_update(crc, more, more_size); // same as one call over both
+*
+*   content_hash() is a 64-bit hash (XXH64) for keys of whole inputs and outputs, where 32
+*   bits collide too easily. Four independent lanes, 32 bytes per step.
+*
+* ************************************/
+
+uint32 crc32c(const void* data, size_t size);
+// continues a crc over more data. start from 0
+uint32 crc32c_update(uint32 crc, const void* data, size_t size);
+
+// true if crc32c runs on the SSE4.2 instruction
+bool32 crc32c_hardware();
+
+// XXH64 of data. pass a previous hash as the seed to hash several pieces into one key
+uint64 content_hash(const void* data, size_t size, uint64 seed = 0);
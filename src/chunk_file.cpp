@@ -0,0 +1,286 @@
+#include "chunk_file.h"
+#include "file_writer.h"
+#include "block_compression.h"
+#include "geometry_codec.h"
+#include "checksum.h"
+#include "utils.h"
+
+#include <cassert>
+#include <cstring>
+
+// the header and directory of most files fit in this, so they are read in one go
+const size_t directory_read_size = 4096;
+
+Chunk_Entry& Chunk_Directory::add(const char* tag, uint32 index, uint32 count, uint32 stride, uint32 flags) {
+    Chunk_Entry& entry = add_records(tag, index, count, (uint64)count * stride, flags);
+    entry.stride = stride;
+    return entry;
+}
+
+Chunk_Entry& Chunk_Directory::add_records(const char* tag, uint32 index, uint32 count, uint64 size, uint32 flags) {
+    Chunk_Entry entry = {};
+    memcpy(entry.tag, tag, 4);
+    entry.index = index;
+    entry.count = count;
+    entry.size = size;
+    entry.flags = flags;
+    entry.raw_size = size;
+    entries.push_back(entry);
+    return entries.back();
+}
+
+const Chunk_Entry* Chunk_Directory::find(const char* tag, uint32 index) const {
+    for (const Chunk_Entry& entry : entries) {
+        if (entry.index == index && memcmp(entry.tag, tag, 4) == 0)
+            return &entry;
+    }
+    return nullptr;
+}
+
+uint32 String_Table::add(const std::string& string) {
+    auto it = offsets.find(string);
+    if (it != offsets.end())
+        return it->second;
+
+    uint32 offset = data.size();
+    data.insert(data.end(), string.begin(), string.end());
+    data.push_back('\0');
+    offsets[string] = offset;
+    return offset;
+}
+
+uint64 name_hash(const std::string& name) {
+    return utils::hash_string(name);
+}
+
+Chunk_Entry widen_chunk_entry(const Chunk_Entry_32& entry) {
+    Chunk_Entry wide = {};
+    memcpy(wide.tag, entry.tag, 4);
+    wide.index = entry.index;
+    wide.offset = entry.offset;
+    wide.size = entry.size;
+    wide.raw_size = (entry.flags & chunk_flag_encoded) ? entry.raw_size : entry.size;
+    wide.count = entry.count;
+    wide.stride = entry.stride;
+    wide.flags = entry.flags;
+    return wide;
+}
+
+void begin_chunk_file(File_Writer& out, const Chunk_Directory& directory) {
+    // placeholders, end_chunk_file writes the real ones
+    Chunk_File_Header header = {};
+    out.write(header);
+    out.write_array(directory.entries.data(), directory.entries.size());
+}
+
+void begin_chunk(File_Writer& out, Chunk_Entry& entry, uint32 alignment) {
+    uint64 offset = (out.size() + alignment - 1) & ~(uint64)(alignment - 1);
+    out.pad_to(offset);
+    entry.offset = offset;
+    out.begin_checksum();
+}
+
+void end_chunk(File_Writer& out, Chunk_Entry& entry) {
+    assert(out.size() == entry.offset + entry.size);
+    entry.crc = out.end_checksum();
+    entry.flags |= chunk_flag_checksum;
+}
+
+uint64 end_chunk_file(File_Writer& out, const char* magic, uint32 version, uint32 flag, uint32 count,
+                      uint32 alignment, const Chunk_Directory& directory, uint64 timestamp) {
+    out.write_bytes("END", 4); // includes the null terminator
+    uint64 filesize = out.size();
+
+    Chunk_File_Header header = {};
+    memcpy(header.magic, magic, 4);
+    header.filesize = (uint32)filesize;
+    header.filesize_high = (uint32)(filesize >> 32);
+    header.version = version;
+    header.flag = flag;
+    header.timestamp = timestamp;
+    header.count = count;
+    header.num_chunks = directory.entries.size();
+    header.alignment = alignment;
+    header.entry_size = sizeof(Chunk_Entry);
+    header.directory_crc = chunk_directory_crc(header, directory.entries.data());
+
+    out.patch(0, &header, sizeof(header));
+    out.patch(sizeof(header), directory.entries.data(), directory.entries.size() * sizeof(Chunk_Entry));
+    return filesize;
+}
+
+bool32 read_chunk_directory(FILE* fid, const char* magic, Chunk_File_Header& header, Chunk_Directory& directory) {
+    directory.entries.clear();
+
+    std::vector<uint8> block(directory_read_size);
+    utils::file_seek(fid, 0);
+    size_t num_read = fread(block.data(), 1, block.size(), fid);
+    if (num_read < sizeof(Chunk_File_Header))
+        return false;
+
+    memcpy(&header, block.data(), sizeof(Chunk_File_Header));
+    if (memcmp(header.magic, magic, 4) != 0)
+        return false;
+
+    uint32 entry_size = chunk_entry_size(header);
+    if (entry_size != sizeof(Chunk_Entry) && entry_size != sizeof(Chunk_Entry_32))
+        return false;
+
+    uint64 filesize = chunk_file_size(header);
+    uint64 directory_end = sizeof(Chunk_File_Header) + (uint64)header.num_chunks * entry_size;
+    if (directory_end > filesize)
+        return false;
+
+    std::vector<uint8> entries;
+    if (directory_end <= num_read) {
+        entries.assign(block.data() + sizeof(Chunk_File_Header), block.data() + directory_end);
+    } else {
+        // very large directory, read the rest of it
+        entries.resize(directory_end - sizeof(Chunk_File_Header));
+        utils::file_seek(fid, sizeof(Chunk_File_Header));
+        if (fread(entries.data(), 1, entries.size(), fid) != entries.size())
+            return false;
+    }
+
+    directory.entries.resize(header.num_chunks);
+    if (entry_size == sizeof(Chunk_Entry)) {
+        memcpy(directory.entries.data(), entries.data(), entries.size());
+    } else {
+        const Chunk_Entry_32* narrow = (const Chunk_Entry_32*)entries.data();
+        for (uint32 n = 0; n < header.num_chunks; n++) {
+            directory.entries[n] = widen_chunk_entry(narrow[n]);
+        }
+    }
+
+    if (!check_directory_crc(header, directory.entries.data()))
+        return false;
+
+    for (const Chunk_Entry& entry : directory.entries) {
+        if (entry.offset < directory_end || entry.offset > filesize || entry.size > filesize - entry.offset)
+            return false;
+    }
+
+    return true;
+}
+
+uint32 chunk_directory_crc(const Chunk_File_Header& header, const Chunk_Entry* entries) {
+    Chunk_File_Header unchecked = header;
+    unchecked.directory_crc = 0;
+    uint32 crc = crc32c(&unchecked, sizeof(unchecked));
+    return crc32c_update(crc, entries, (size_t)header.num_chunks * sizeof(Chunk_Entry));
+}
+
+bool32 has_chunk_checksums(const Chunk_File_Header& header) {
+    struct Checksum_Version {
+        const char* magic;
+        uint32 version;
+    };
+    const Checksum_Version first_checked[] = { { "MESH", 12 }, { "ANIM", 6 }, { "LEVL", 8 }, { "MATB", 2 } };
+    for (const Checksum_Version& format : first_checked) {
+        if (memcmp(header.magic, format.magic, 4) == 0)
+            return header.version >= format.version;
+    }
+    return false;
+}
+
+bool32 check_directory_crc(const Chunk_File_Header& header, const Chunk_Entry* entries) {
+    if (!has_chunk_checksums(header))
+        return true;
+    if (header.entry_size != sizeof(Chunk_Entry))
+        return false;
+    for (uint32 n = 0; n < header.num_chunks; n++) {
+        if (!(entries[n].flags & chunk_flag_checksum))
+            return false;
+    }
+    return chunk_directory_crc(header, entries) == header.directory_crc;
+}
+
+bool32 check_chunk_crc(const Chunk_Entry& entry, const uint8* stored) {
+    return !(entry.flags & chunk_flag_checksum) || crc32c(stored, entry.size) == entry.crc;
+}
+
+// marks entry as stored with the given encoding
+static bool32 set_encoded(Chunk_Entry& entry, uint32 encoding, size_t raw_size, const std::vector<uint8>& stored) {
+    entry.flags |= encoding;
+    entry.raw_size = raw_size;
+    entry.size = stored.size();
+    return true;
+}
+
+bool32 compress_chunk(Chunk_Entry& entry, const std::vector<uint8>& data, std::vector<uint8>& stored) {
+    if (!compress_blocks(data.data(), data.size(), stored))
+        return false;
+    return set_encoded(entry, chunk_flag_compressed, data.size(), stored);
+}
+
+bool32 encode_index_chunk(Chunk_Entry& entry, const std::vector<uint8>& data, std::vector<uint8>& stored) {
+    if (entry.stride != sizeof(uint32) || !encode_index_buffer((const uint32*)data.data(), entry.count, stored))
+        return false;
+    return set_encoded(entry, chunk_flag_index_codec, data.size(), stored);
+}
+
+bool32 encode_vertex_chunk(Chunk_Entry& entry, const std::vector<uint8>& data, std::vector<uint8>& stored) {
+    if (entry.stride == 0 || !encode_vertex_buffer(data.data(), entry.count, entry.stride, stored))
+        return false;
+    return set_encoded(entry, chunk_flag_vertex_codec, data.size(), stored);
+}
+
+bool32 decode_chunk(const Chunk_Entry& entry, const uint8* stored, void* dst, bool32 parallel) {
+    if (entry.flags & chunk_flag_compressed)
+        return decompress_blocks(stored, entry.size, dst, entry.raw_size, parallel);
+
+    if ((uint64)entry.count * entry.stride != entry.raw_size)
+        return false;
+    if (entry.flags & chunk_flag_index_codec)
+        return entry.stride == sizeof(uint32) && decode_index_buffer(stored, entry.size, (uint32*)dst, entry.count);
+    if (entry.flags & chunk_flag_vertex_codec)
+        return decode_vertex_buffer(stored, entry.size, dst, entry.count, entry.stride);
+
+    memcpy(dst, stored, entry.size);
+    return true;
+}
+
+bool32 read_chunk(FILE* fid, const Chunk_Entry& entry, std::vector<uint8>& data) {
+    if (entry.flags & chunk_flag_encoded) {
+        std::vector<uint8> stored;
+        Chunk_Entry stored_entry = entry;
+        stored_entry.flags &= ~chunk_flag_encoded;
+        if (!read_chunk(fid, stored_entry, stored))
+            return false;
+
+        data.resize(entry.raw_size);
+        return decode_chunk(entry, stored.data(), data.data(), true);
+    }
+
+    data.resize(entry.size);
+    if (entry.size == 0)
+        return true;
+
+    utils::file_seek(fid, entry.offset);
+    return fread(data.data(), 1, entry.size, fid) == entry.size && check_chunk_crc(entry, data.data());
+}
+
+void print_chunk_directory(const Chunk_Directory& directory) {
+    printf("%d Chunks\n", (int)directory.entries.size());
+    for (const Chunk_Entry& entry : directory.entries) {
+        char index_str[16] = "";
+        if (entry.index != chunk_index_none)
+            snprintf(index_str, sizeof(index_str), "[%d]", entry.index);
+
+        printf("  %.4s%-6s offset %8llu  %8llu bytes", entry.tag, index_str, (unsigned long long)entry.offset, (unsigned long long)entry.size);
+        if (entry.stride)
+            printf(" (%d x %d)", entry.count, entry.stride);
+        else
+            printf(" (%d records)", entry.count);
+        if (entry.flags & chunk_flag_optional)
+            printf(" optional");
+        if (entry.flags & chunk_flag_checksum)
+            printf(" crc %08x", entry.crc);
+        if (entry.flags & chunk_flag_encoded) {
+            const char* encoding = (entry.flags & chunk_flag_compressed) ? "compressed" :
+                                   (entry.flags & chunk_flag_index_codec) ? "index codec" : "vertex codec";
+            printf(" %s from %llu bytes (%.1f%%)", encoding, (unsigned long long)entry.raw_size, entry.raw_size ? 100.0 * entry.size / entry.raw_size : 0.0);
+        }
+        printf("\n");
+    }
+}
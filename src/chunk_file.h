@@ -0,0 +1,182 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdio>
+
+#include <laml/laml.hpp>
+
+struct File_Writer;
+
+/****************************************
+*
+*   CHUNKED FILE LAYOUT (.mesh, .anim, .level, .matb)
+*
+*   [Chunk_File_Header]
+*   [Chunk_Entry x num_chunks]           <- directory
+*   (padding) [chunk] (padding) [chunk] ...
+*   "END\0"
+*
+*   The directory lists every section of the file, so a reader only needs the header
+*   and directory (usually one small read) to find, or skip, any section. Every chunk
+*   starts at a multiple of header.alignment.
+*   Offsets and sizes are 64-bit (header.entry_size == sizeof(Chunk_Entry)). Older files have
+*   32-bit ones (Chunk_Entry_32, entry_size 0), read_chunk_directory widens those on load.
+*   Writers stream: the chunks are written one at a time after a placeholder directory,
+*   which is patched once every chunk's offset and size is known.
+*
+*   A chunk with chunk_flag_compressed is stored as compressed blocks (block_compression.h),
+*   one with chunk_flag_index_codec / chunk_flag_vertex_codec with a geometry codec
+*   (geometry_codec.h). entry.size is the stored size and entry.raw_size the size after
+*   decoding. Only bulk data (vertices, indices, animation tracks) is ever encoded, never
+*   the small descriptive chunks.
+*
+*   Names (mesh, material, bone, node) live in a string table chunk ("STRS" in every format):
+*   null-terminated strings, each stored once, referenced by byte offset. Every reference is
+*   paired with name_hash() of the string, so lookups by name compare integers and only
+*   touch the table to print or resolve collisions. Names are never truncated.
+*
+*   Checksums (mesh v12, anim v6, level v8): every chunk with chunk_flag_checksum stores the
+*   CRC32C (checksum.h) of its stored bytes in entry.crc, computed while it is written.
+*   header.directory_crc covers the header (with directory_crc = 0) and the directory, and is
+*   always checked for these versions: whether a file is checked depends on its magic and
+*   version only, never on the entry_size or flag bytes the checksum protects. Older files have
+*   neither and read unchecked.
+*
+* ************************************/
+const uint32 chunk_index_none = 0xFFFFFFFF; // index of chunks that belong to the whole file
+
+const uint32 chunk_flag_optional     = 0x01; // 1 - readers can skip it if they don't need/know the tag
+const uint32 chunk_flag_compressed   = 0x02; // 2 - stored as compressed blocks, see raw_size
+const uint32 chunk_flag_index_codec  = 0x04; // 4 - triangle list stored with the index codec
+const uint32 chunk_flag_vertex_codec = 0x08; // 8 - vertices stored with the vertex codec (uses count and stride)
+const uint32 chunk_flag_checksum     = 0x10; // 16 - crc holds the CRC32C of the stored bytes
+const uint32 chunk_flag_encoded = chunk_flag_compressed | chunk_flag_index_codec | chunk_flag_vertex_codec;
+
+struct Chunk_File_Header {
+    char   magic[4];         // "MESH", "ANIM", "LEVL", "MATB"
+    uint32 filesize;         // low 32 bits of the file size, see chunk_file_size()
+    uint32 version;
+    uint32 flag;
+    uint64 timestamp;
+    uint32 count;            // primitives (.mesh), bones (.anim), meshes (.level)
+    uint32 num_chunks;
+    uint32 alignment;        // power of two, 16 to 4096 (64 by default)
+    uint32 filesize_high;    // high 32 bits of the file size. was reserved (0)
+    uint32 entry_size;       // sizeof(Chunk_Entry), or 0 for the Chunk_Entry_32 directory of older files
+    uint32 directory_crc;    // CRC32C of the header and directory, see above. was reserved (0)
+};
+static_assert(sizeof(Chunk_File_Header) == 48, "Chunk_File_Header size changed");
+
+inline uint64 chunk_file_size(const Chunk_File_Header& header) {
+    return ((uint64)header.filesize_high << 32) | header.filesize;
+}
+
+struct Chunk_Entry {
+    char   tag[4];
+    uint32 index;            // primitive/bone the chunk belongs to, or chunk_index_none
+    uint64 offset;           // from the start of the file, multiple of header.alignment
+    uint64 size;             // in bytes, as stored in the file
+    uint64 raw_size;         // in bytes after decoding
+    uint32 count;            // number of elements
+    uint32 stride;           // bytes per element, 0 for variable-size records
+    uint32 flags;            // chunk_flag_*
+    uint32 crc;              // CRC32C of the size stored bytes, if flags has chunk_flag_checksum. was reserved (0)
+};
+static_assert(sizeof(Chunk_Entry) == 48, "Chunk_Entry size changed");
+
+// directory entry of files written before 64-bit offsets (mesh v6 - v10, anim v2 - v4, level v4 - v6)
+struct Chunk_Entry_32 {
+    char   tag[4];
+    uint32 index;
+    uint32 offset;
+    uint32 size;
+    uint32 count;
+    uint32 stride;
+    uint32 flags;
+    uint32 raw_size;         // was reserved (0) before compression was added
+};
+static_assert(sizeof(Chunk_Entry_32) == 32, "Chunk_Entry_32 size changed");
+
+Chunk_Entry widen_chunk_entry(const Chunk_Entry_32& entry);
+
+// bytes per directory entry of a file
+inline uint32 chunk_entry_size(const Chunk_File_Header& header) {
+    return header.entry_size ? header.entry_size : (uint32)sizeof(Chunk_Entry_32);
+}
+
+// size of the chunk's data once it is read (and decoded)
+inline uint64 chunk_raw_size(const Chunk_Entry& entry) {
+    return (entry.flags & chunk_flag_encoded) ? entry.raw_size : entry.size;
+}
+
+struct Chunk_Directory {
+    std::vector<Chunk_Entry> entries;
+
+    // fixed-size elements, size = count * stride
+    Chunk_Entry& add(const char* tag, uint32 index, uint32 count, uint32 stride, uint32 flags = 0);
+    // count variable-size records, size bytes in total
+    Chunk_Entry& add_records(const char* tag, uint32 index, uint32 count, uint64 size, uint32 flags = 0);
+
+    const Chunk_Entry* find(const char* tag, uint32 index = chunk_index_none) const;
+};
+
+// deduplicated null-terminated strings, written as one chunk
+struct String_Table {
+    std::vector<char> data;
+    std::unordered_map<std::string, uint32> offsets;
+
+    // returns the offset of string, adding it if it is not in the table yet
+    uint32 add(const std::string& string);
+    const char* get(uint32 offset) const { return offset < data.size() ? data.data() + offset : ""; }
+};
+
+// hash stored next to every name reference (64-bit FNV-1a of the bytes, no terminator)
+uint64 name_hash(const std::string& name);
+
+// Writing a chunked file, once every chunk has been added to the directory:
+//     begin_chunk_file(out, directory);
+//     for each chunk: begin_chunk(out, entry, alignment), write its entry.size bytes, end_chunk(out, entry)
+//     end_chunk_file(out, ...);
+// Only the chunk being written has to be in memory. An encoded chunk is encoded right before
+// it is written (compress_chunk etc. update entry.size).
+void begin_chunk_file(File_Writer& out, const Chunk_Directory& directory);
+// pads the file to the alignment and sets entry.offset. starts the checksum of the chunk
+void begin_chunk(File_Writer& out, Chunk_Entry& entry, uint32 alignment);
+// stores the checksum of everything written since begin_chunk in entry
+void end_chunk(File_Writer& out, Chunk_Entry& entry);
+// writes the END marker, then fills in the header and the final directory. returns the filesize
+uint64 end_chunk_file(File_Writer& out, const char* magic, uint32 version, uint32 flag, uint32 count,
+                      uint32 alignment, const Chunk_Directory& directory, uint64 timestamp);
+
+// Reads the header and the directory, without touching any chunk data. 32-bit directories are widened.
+// Returns false if the magic does not match, the directory is out of bounds or fails its checksum.
+bool32 read_chunk_directory(FILE* fid, const char* magic, Chunk_File_Header& header, Chunk_Directory& directory);
+
+// Compresses the data of entry. If that makes it smaller, entry is marked compressed and resized
+// and stored holds the bytes to write. Otherwise stored is left empty. Call before begin_chunk
+bool32 compress_chunk(Chunk_Entry& entry, const std::vector<uint8>& data, std::vector<uint8>& stored);
+// same, with the geometry codecs. the index codec needs a triangle list of uint32 indices
+bool32 encode_index_chunk(Chunk_Entry& entry, const std::vector<uint8>& data, std::vector<uint8>& stored);
+bool32 encode_vertex_chunk(Chunk_Entry& entry, const std::vector<uint8>& data, std::vector<uint8>& stored);
+
+// decodes the stored bytes of an encoded chunk into dst, which holds chunk_raw_size(entry) bytes.
+// with parallel set, compressed blocks are spread over the task system
+bool32 decode_chunk(const Chunk_Entry& entry, const uint8* stored, void* dst, bool32 parallel);
+
+// CRC32C of the header (with directory_crc = 0) followed by the header.num_chunks entries
+uint32 chunk_directory_crc(const Chunk_File_Header& header, const Chunk_Entry* entries);
+// true if files of this magic and version carry checksums (mesh v12, anim v6, level v8, matb v2 and later)
+bool32 has_chunk_checksums(const Chunk_File_Header& header);
+// true if the directory matches header.directory_crc, or the file's version has no checksums.
+// a version with checksums must also have a 64-bit directory with every chunk checksummed
+bool32 check_directory_crc(const Chunk_File_Header& header, const Chunk_Entry* entries);
+// true if stored (the entry.size bytes in the file) matches entry.crc, or the chunk has no checksum
+bool32 check_chunk_crc(const Chunk_Entry& entry, const uint8* stored);
+
+// reads a single chunk into data, decoding it if needed. fails if it does not match its checksum
+bool32 read_chunk(FILE* fid, const Chunk_Entry& entry, std::vector<uint8>& data);
+
+// prints the directory, one line per chunk
+void print_chunk_directory(const Chunk_Directory& directory);
@@ -0,0 +1,278 @@
+#include "mesh_converter.h"
+#include "chunk_file.h"
+#include "block_compression.h"
+#include "geometry_codec.h"
+#include "task_system.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <map>
+
+// each measurement is repeated until it took at least this long
+const double bench_min_seconds = 0.25;
+
+struct Bench_Payload {
+    std::string tag;
+    std::vector<uint8> data;
+    uint32 count = 0;
+    uint32 stride = 0;
+};
+
+struct Bench_Totals {
+    uint64 raw_size = 0;
+    uint64 stored_size = 0;
+    uint32 count = 0;
+};
+
+// every chunk of a chunked file (decompressed), or the whole file otherwise
+static bool32 load_bench_payloads(const std::string& filename, std::vector<Bench_Payload>& payloads) {
+    FILE* fid = fopen(filename.c_str(), "rb");
+    if (fid == nullptr) {
+        printf("[ERROR] Failed to open file [%s]\n", filename.c_str());
+        return false;
+    }
+
+    char magic[4] = { 0 };
+    fread(magic, 1, 4, fid);
+    uint32 version = 0;
+    fseek(fid, 8L, SEEK_SET);
+    fread(&version, sizeof(version), 1, fid);
+
+    bool32 chunked = (memcmp(magic, "MESH", 4) == 0 && version >= 6) ||
+                     (memcmp(magic, "ANIM", 4) == 0 && version >= 2) ||
+                     (memcmp(magic, "LEVL", 4) == 0 && version >= 4);
+
+    Chunk_File_Header header;
+    Chunk_Directory directory;
+    if (chunked && read_chunk_directory(fid, magic, header, directory)) {
+        for (const Chunk_Entry& entry : directory.entries) {
+            Bench_Payload payload;
+            payload.tag = std::string(entry.tag, 4);
+            payload.count = entry.count;
+            payload.stride = entry.stride;
+            if (!read_chunk(fid, entry, payload.data)) {
+                printf("[ERROR] Failed to read chunk %.4s of [%s]\n", entry.tag, filename.c_str());
+                fclose(fid);
+                return false;
+            }
+            payloads.push_back(std::move(payload));
+        }
+    } else {
+        Bench_Payload payload;
+        payload.tag = "file";
+        fseek(fid, 0L, SEEK_END);
+        payload.data.resize(ftell(fid));
+        fseek(fid, 0L, SEEK_SET);
+        fread(payload.data.data(), 1, payload.data.size(), fid);
+        payloads.push_back(std::move(payload));
+    }
+
+    fclose(fid);
+    return true;
+}
+
+// seconds per call of func, repeated until it ran for a while
+template<typename F>
+static double time_per_call(F func) {
+    using clock = std::chrono::steady_clock;
+    uint32 iterations = 0;
+    auto start = clock::now();
+    double elapsed = 0.0;
+    do {
+        func();
+        iterations++;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < bench_min_seconds);
+    return elapsed / iterations;
+}
+
+// the index codec may rotate triangles, so they are compared with their first vertex at the smallest index
+static bool32 same_triangles(const uint32* a, const uint32* b, size_t count) {
+    for (size_t t = 0; t < count; t += 3) {
+        bool32 match = false;
+        for (uint32 r = 0; r < 3 && !match; r++) {
+            match = a[t] == b[t + r] && a[t + 1] == b[t + (r + 1) % 3] && a[t + 2] == b[t + (r + 2) % 3];
+        }
+        if (!match)
+            return false;
+    }
+    return true;
+}
+
+enum class bench_codec { index, vertex };
+
+// ratio and decode speed of one geometry codec over the chunks it applies to
+static bool32 bench_geometry_codec(const std::vector<Bench_Payload>& payloads, bench_codec codec) {
+    std::vector<const Bench_Payload*> chunks;
+    for (const Bench_Payload& payload : payloads) {
+        bool32 is_index = (payload.tag == MESH_ARRAY_INDICES || payload.tag == MESH_ARRAY_SHADOW_INDICES);
+        bool32 is_vertex = (payload.tag == MESH_ARRAY_VERTICES || payload.tag == MESH_ARRAY_POSITIONS ||
+                            payload.tag == MESH_ARRAY_SHADING || payload.tag == MESH_ARRAY_SKIN ||
+                            payload.tag == MESH_ARRAY_SHADOW_VERTS);
+        if ((uint64)payload.count * payload.stride != payload.data.size() || payload.data.empty())
+            continue;
+        if (codec == bench_codec::index ? (is_index && payload.stride == sizeof(uint32) && payload.count % 3 == 0) : is_vertex)
+            chunks.push_back(&payload);
+    }
+
+    const char* name = (codec == bench_codec::index) ? "Index codec" : "Vertex codec";
+    if (chunks.empty()) {
+        printf("%s: no chunks to encode\n", name);
+        return true;
+    }
+
+    std::vector<std::vector<uint8>> encoded(chunks.size());
+    std::vector<std::vector<uint8>> decoded(chunks.size());
+    uint64 raw_size = 0, stored_size = 0, encoded_raw_size = 0, lz_size = 0;
+    std::vector<uint8> scratch;
+    for (uint32 n = 0; n < chunks.size(); n++) {
+        const Bench_Payload& chunk = *chunks[n];
+        bool32 ok = (codec == bench_codec::index) ?
+            encode_index_buffer((const uint32*)chunk.data.data(), chunk.count, encoded[n]) :
+            encode_vertex_buffer(chunk.data.data(), chunk.count, chunk.stride, encoded[n]);
+        raw_size += chunk.data.size();
+        stored_size += ok ? encoded[n].size() : chunk.data.size();
+        lz_size += compress_blocks(chunk.data.data(), chunk.data.size(), scratch) ? scratch.size() : chunk.data.size();
+        if (!ok)
+            continue;
+        encoded_raw_size += chunk.data.size();
+
+        // check the round trip before timing anything
+        decoded[n].resize(chunk.data.size());
+        bool32 decoded_ok = (codec == bench_codec::index) ?
+            decode_index_buffer(encoded[n].data(), encoded[n].size(), (uint32*)decoded[n].data(), chunk.count) &&
+                same_triangles((const uint32*)chunk.data.data(), (const uint32*)decoded[n].data(), chunk.count) :
+            decode_vertex_buffer(encoded[n].data(), encoded[n].size(), decoded[n].data(), chunk.count, chunk.stride) &&
+                decoded[n] == chunk.data;
+        if (!decoded_ok) {
+            printf("[ERROR] %s chunk %d (%s) did not survive the round trip\n", name, n, chunk.tag.c_str());
+            return false;
+        }
+    }
+
+    double decode_time = time_per_call([&]() {
+        for (uint32 n = 0; n < chunks.size(); n++) {
+            const Bench_Payload& chunk = *chunks[n];
+            if (encoded[n].empty())
+                continue;
+            if (codec == bench_codec::index)
+                decode_index_buffer(encoded[n].data(), encoded[n].size(), (uint32*)decoded[n].data(), chunk.count);
+            else
+                decode_vertex_buffer(encoded[n].data(), encoded[n].size(), decoded[n].data(), chunk.count, chunk.stride);
+        }
+    });
+
+    const double GB = 1024.0 * 1024.0 * 1024.0;
+    printf("%-13s %4d chunks  %12llu -> %12llu bytes  ratio %5.2f (block compression %5.2f)  decode, 1 thread: %6.3f GB/s\n",
+        name, (int)chunks.size(), (unsigned long long)raw_size, (unsigned long long)stored_size,
+        stored_size ? (double)raw_size / stored_size : 0.0, lz_size ? (double)raw_size / lz_size : 0.0,
+        encoded_raw_size / decode_time / GB);
+    return true;
+}
+
+bool bench_compression(const Options& opts) {
+    std::vector<std::string> filenames;
+    if (std::filesystem::is_directory(opts.input_filename)) {
+        for (const auto& file : std::filesystem::recursive_directory_iterator(opts.input_filename)) {
+            std::string ext = file.path().extension().string();
+            if (file.is_regular_file() && (ext == ".mesh" || ext == ".anim" || ext == ".level"))
+                filenames.push_back(file.path().string());
+        }
+    } else {
+        filenames.push_back(opts.input_filename);
+    }
+
+    if (filenames.empty()) {
+        printf("No .mesh, .anim or .level files in [%s]\n", opts.input_filename.c_str());
+        return false;
+    }
+
+    std::vector<Bench_Payload> payloads;
+    for (const std::string& filename : filenames) {
+        if (!load_bench_payloads(filename, payloads))
+            return false;
+    }
+    printf("Loaded %d chunks from %d files\n", (int)payloads.size(), (int)filenames.size());
+    printf("-----------------------------------------\n");
+
+    // compress everything once for the ratio
+    std::vector<std::vector<uint8>> stored(payloads.size());
+    std::map<std::string, Bench_Totals> per_tag;
+    Bench_Totals totals;
+    for (uint32 n = 0; n < payloads.size(); n++) {
+        const std::vector<uint8>& raw = payloads[n].data;
+        if (!compress_blocks(raw.data(), raw.size(), stored[n]))
+            stored[n].clear(); // would be stored raw
+
+        Bench_Totals& tag = per_tag[payloads[n].tag];
+        uint64 stored_size = stored[n].empty() ? raw.size() : stored[n].size();
+        tag.raw_size += raw.size();
+        tag.stored_size += stored_size;
+        tag.count++;
+        totals.raw_size += raw.size();
+        totals.stored_size += stored_size;
+        totals.count++;
+    }
+
+    printf("  tag   chunks     raw bytes  stored bytes  ratio\n");
+    for (const auto& it : per_tag) {
+        const Bench_Totals& tag = it.second;
+        printf("  %-5s %6d  %12llu  %12llu  %5.2f\n", it.first.c_str(), tag.count,
+            (unsigned long long)tag.raw_size, (unsigned long long)tag.stored_size,
+            tag.stored_size ? (double)tag.raw_size / tag.stored_size : 0.0);
+    }
+    printf("  %-5s %6d  %12llu  %12llu  %5.2f\n", "total", totals.count,
+        (unsigned long long)totals.raw_size, (unsigned long long)totals.stored_size,
+        totals.stored_size ? (double)totals.raw_size / totals.stored_size : 0.0);
+    printf("-----------------------------------------\n");
+
+    // check the round trip before timing anything
+    std::vector<std::vector<uint8>> decoded(payloads.size());
+    for (uint32 n = 0; n < payloads.size(); n++) {
+        decoded[n].resize(payloads[n].data.size());
+        if (stored[n].empty())
+            continue;
+        if (!decompress_blocks(stored[n].data(), stored[n].size(), decoded[n].data(), decoded[n].size(), false) ||
+            decoded[n] != payloads[n].data) {
+            printf("[ERROR] chunk %d (%s) did not survive the round trip\n", n, payloads[n].tag.c_str());
+            return false;
+        }
+    }
+
+    uint64 compressed_raw_size = 0; // only chunks that are actually compressed are decoded
+    for (uint32 n = 0; n < payloads.size(); n++) {
+        if (!stored[n].empty())
+            compressed_raw_size += payloads[n].data.size();
+    }
+
+    std::vector<uint8> scratch;
+    double compress_time = time_per_call([&]() {
+        for (uint32 n = 0; n < payloads.size(); n++) {
+            compress_blocks(payloads[n].data.data(), payloads[n].data.size(), scratch);
+        }
+    });
+
+    auto decode_all = [&](bool32 parallel) {
+        for (uint32 n = 0; n < payloads.size(); n++) {
+            if (!stored[n].empty())
+                decompress_blocks(stored[n].data(), stored[n].size(), decoded[n].data(), decoded[n].size(), parallel);
+        }
+    };
+    double decode_time = time_per_call([&]() { decode_all(false); });
+    double parallel_decode_time = time_per_call([&]() { decode_all(true); });
+
+    const double GB = 1024.0 * 1024.0 * 1024.0;
+    printf("Compress:            %8.3f GB/s\n", totals.raw_size / compress_time / GB);
+    printf("Decode, 1 thread:    %8.3f GB/s\n", compressed_raw_size / decode_time / GB);
+    printf("Decode, %2d threads:  %8.3f GB/s (the blocks of each chunk in parallel)\n", (int)task_system_threads(),
+        compressed_raw_size / parallel_decode_time / GB);
+    printf("-----------------------------------------\n");
+
+    if (!bench_geometry_codec(payloads, bench_codec::index) ||
+        !bench_geometry_codec(payloads, bench_codec::vertex))
+        return false;
+    printf("-----------------------------------------\n");
+
+    return true;
+}
@@ -0,0 +1,275 @@
+#include "conversion_cache.h"
+#include "mesh_converter.h"
+#include "checksum.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+// part of every key, bump it when what is cached (or how keys are built) changes
+const uint32 cache_version = 1;
+
+// files are read in pieces of this size to hash them
+const size_t hash_read_size = 8 * 1024 * 1024;
+
+bool32 open_cache(const std::string& folder, Conversion_Cache& cache) {
+    std::error_code ec;
+    std::filesystem::create_directories(folder, ec);
+    if (!std::filesystem::is_directory(folder, ec)) {
+        return false;
+    }
+    cache.folder = folder;
+    return true;
+}
+
+void trim_memory_cache(Conversion_Cache& cache, const std::unordered_set<uint64>& keys) {
+    std::lock_guard<std::mutex> lock(cache.memory_mutex);
+    for (auto it = cache.memory_outputs.begin(); it != cache.memory_outputs.end();) {
+        it = keys.count(it->first) ? std::next(it) : cache.memory_outputs.erase(it);
+    }
+    for (auto it = cache.memory_conversions.begin(); it != cache.memory_conversions.end();) {
+        it = keys.count(it->first) ? std::next(it) : cache.memory_conversions.erase(it);
+    }
+}
+
+void Cache_Key::add_bytes(const void* data, size_t size) {
+    hash = content_hash(data, size, hash);
+}
+
+void Cache_Key::add_string(const std::string& string) {
+    add((uint64)string.size());
+    add_bytes(string.data(), string.size());
+}
+
+uint64 cache_key_base(const Options& opts) {
+    Cache_Key key(cache_version);
+    key.add_string(TOOL_VERSION);
+    key.add(MESH_VERSION);
+    key.add(MAT_VERSION);
+    key.add(MAT_TEXT_VERSION);
+    key.add(ANIM_VERSION);
+    key.add(LEVEL_VERSION);
+
+    key.add(opts.flip_uvs_y);
+    key.add(opts.cleanup);
+    key.add(opts.shared_buffers);
+    key.add(opts.split_streams);
+    key.add(opts.alignment);
+    key.add(opts.compress);
+    key.add(opts.geometry_codec);
+    key.add(opts.frame_rate);
+    key.add(opts.batch_static);
+    key.add(opts.batch_cell_size);
+    key.add(opts.instance_format);
+    key.add(opts.material_output);
+    key.add(opts.pack_files);
+    key.add(opts.pack_compress);
+    key.add(opts.max_memory != 0); // the order of the outputs, in a .pack
+
+    // a fixed timestamp is part of the bytes. the current time is not, outputs keep the one
+    // they were first written with
+    bool32 deterministic = opts.timestamp != 0 || opts.timestamp_from_input;
+    key.add(deterministic ? output_timestamp(opts) : 0);
+    return key.hash;
+}
+
+bool32 hash_file(const std::string& filename, uint64& hash) {
+    FILE* fid = fopen(filename.c_str(), "rb");
+    if (fid == nullptr) {
+        return false;
+    }
+
+    std::vector<uint8> buffer(hash_read_size);
+    hash = 0;
+    bool32 failed = false;
+    for (;;) {
+        size_t n = fread(buffer.data(), 1, buffer.size(), fid);
+        hash = content_hash(buffer.data(), n, hash);
+        if (n < buffer.size()) {
+            failed = ferror(fid) != 0;
+            break;
+        }
+    }
+    fclose(fid);
+    return !failed;
+}
+
+static std::string entry_filename(const Conversion_Cache& cache, uint64 key, const char* ext) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx%s", (unsigned long long)key, ext);
+    return cache.folder + '/' + name;
+}
+
+// writes next to the entry and renames it into place, so no one reads half an entry
+static void store_entry(const std::string& filename, const void* data, size_t size) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%016llx.tmp", (unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::string temp_filename = filename + suffix;
+
+    FILE* fid = fopen(temp_filename.c_str(), "wb");
+    if (fid == nullptr) {
+        return;
+    }
+    bool32 written = fwrite(data, 1, size, fid) == size;
+    written = (fclose(fid) == 0) && written;
+
+    std::error_code ec;
+    if (written) {
+        std::filesystem::rename(temp_filename, filename, ec);
+    }
+    if (!written || ec) {
+        std::filesystem::remove(temp_filename, ec);
+    }
+}
+
+static bool32 output_in_memory(Conversion_Cache& cache, uint64 key, std::vector<uint8>* data) {
+    std::lock_guard<std::mutex> lock(cache.memory_mutex);
+    auto it = cache.memory_outputs.find(key);
+    if (it == cache.memory_outputs.end()) {
+        return false;
+    }
+    if (data) {
+        *data = it->second;
+    }
+    return true;
+}
+
+bool32 load_cached_output(Conversion_Cache& cache, uint64 key, std::vector<uint8>& data) {
+    if (cache.in_memory && output_in_memory(cache, key, &data)) {
+        return true;
+    }
+    if (cache.folder.empty()) {
+        return false;
+    }
+
+    FILE* fid = fopen(entry_filename(cache, key, ".out").c_str(), "rb");
+    if (fid == nullptr) {
+        return false;
+    }
+
+    uint64 size = utils::file_size(fid);
+    data.resize((size_t)size);
+    bool32 read = utils::read_at(fid, 0, data.data(), data.size());
+    fclose(fid);
+
+    if (read && cache.in_memory) {
+        std::lock_guard<std::mutex> lock(cache.memory_mutex);
+        cache.memory_outputs[key] = data;
+    }
+    return read;
+}
+
+void store_cached_output(Conversion_Cache& cache, uint64 key, const std::vector<uint8>& data) {
+    if (cache.in_memory) {
+        std::lock_guard<std::mutex> lock(cache.memory_mutex);
+        cache.memory_outputs[key] = data;
+    }
+    if (!cache.folder.empty()) {
+        store_entry(entry_filename(cache, key, ".out"), data.data(), data.size());
+    }
+}
+
+// text, one line each:
+//   meshconv cache <cache_version>
+//   dep <hash> <filename>
+//   out <key> <path>
+static bool32 read_cached_conversion(Conversion_Cache& cache, uint64 key, Cached_Conversion& conversion) {
+    if (cache.in_memory) {
+        std::lock_guard<std::mutex> lock(cache.memory_mutex);
+        auto it = cache.memory_conversions.find(key);
+        if (it != cache.memory_conversions.end()) {
+            conversion = it->second;
+            return true;
+        }
+    }
+    if (cache.folder.empty()) {
+        return false;
+    }
+
+    std::ifstream file(entry_filename(cache, key, ".in"));
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    char header[32];
+    snprintf(header, sizeof(header), "meshconv cache %u", cache_version);
+    if (!std::getline(file, line) || line != header) {
+        return false;
+    }
+
+    conversion = Cached_Conversion();
+    while (std::getline(file, line)) {
+        // "xxx <16 hex digits> <rest of the line>"
+        if (line.size() < 22 || line[3] != ' ' || line[20] != ' ') {
+            return false;
+        }
+        uint64 value = std::strtoull(line.substr(4, 16).c_str(), nullptr, 16);
+        std::string name = line.substr(21);
+        if (line.compare(0, 3, "dep") == 0) {
+            conversion.dependencies.push_back({ name, value });
+        } else if (line.compare(0, 3, "out") == 0) {
+            Cached_Output output;
+            output.path = name;
+            output.key = value;
+            conversion.outputs.push_back(output);
+        } else {
+            return false;
+        }
+    }
+
+    if (cache.in_memory) {
+        std::lock_guard<std::mutex> lock(cache.memory_mutex);
+        cache.memory_conversions[key] = conversion;
+    }
+    return true;
+}
+
+bool32 load_cached_conversion(Conversion_Cache& cache, uint64 key, Cached_Conversion& conversion) {
+    if (!read_cached_conversion(cache, key, conversion)) {
+        return false;
+    }
+
+    for (const Cached_Dependency& dep : conversion.dependencies) {
+        uint64 hash;
+        if (!hash_file(dep.filename, hash) || hash != dep.hash) {
+            return false;
+        }
+    }
+    for (const Cached_Output& output : conversion.outputs) {
+        if (cache.in_memory && output_in_memory(cache, output.key, nullptr)) {
+            continue;
+        }
+        std::error_code ec;
+        if (cache.folder.empty() || !std::filesystem::is_regular_file(entry_filename(cache, output.key, ".out"), ec)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void store_cached_conversion(Conversion_Cache& cache, uint64 key, const Cached_Conversion& conversion) {
+    if (cache.in_memory) {
+        std::lock_guard<std::mutex> lock(cache.memory_mutex);
+        cache.memory_conversions[key] = conversion;
+    }
+    if (cache.folder.empty()) {
+        return;
+    }
+
+    std::string text;
+    char line[64];
+    snprintf(line, sizeof(line), "meshconv cache %u\n", cache_version);
+    text += line;
+    for (const Cached_Dependency& dep : conversion.dependencies) {
+        snprintf(line, sizeof(line), "dep %016llx ", (unsigned long long)dep.hash);
+        text += line + dep.filename + '\n';
+    }
+    for (const Cached_Output& output : conversion.outputs) {
+        snprintf(line, sizeof(line), "out %016llx ", (unsigned long long)output.key);
+        text += line + output.path + '\n';
+    }
+    store_entry(entry_filename(cache, key, ".in"), text.data(), text.size());
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <laml/laml.hpp>
+
+struct Options;
+
+/****************************************
+*
+*   CONVERSION CACHE (-cache path/to/cache)
+*
+*   Outputs of earlier conversions, kept in a folder between runs so unchanged work is
+*   skipped. Every entry is a file named after its 64-bit key in hex:
+*
+*   <key>.out   the bytes of one output file. Its key hashes everything the file is written
+*               from (the extracted mesh, material or animation, and the options), so the
+*               unchanged meshes of a changed input are copied instead of encoded again.
+*               Outputs written from the whole scene (the .level) are keyed by their bytes.
+*   <key>.in    one whole conversion, keyed by the input's bytes and name, the mode and the
+*               options. Lists the other files the input read (.bin buffers, images) with
+*               their hashes, and every output as its path below the output folder plus the
+*               .out entry that holds it. While the input and those files are unchanged, the
+*               outputs are copied from the cache without loading the input at all.
+*
+*   Every key includes cache_key_base(): TOOL_VERSION, the format versions and the options
+*   that change what is written, so entries of other versions or options are never used.
+*   Entries are written to a temporary file and renamed, so conversions running in parallel
+*   (batch mode) can share a cache. Nothing is evicted, delete the folder to clear it.
+*
+*   Watch mode also keeps entries in memory (in_memory), so converting an input again only
+*   reads the files it changed. Without a folder the cache lives in memory only.
+*
+* ************************************/
+
+struct Cached_Dependency {
+    std::string filename;
+    uint64 hash;
+};
+struct Cached_Output {
+    std::string path;       // relative to the output folder, as in a .pack
+    uint64 key = 0;         // of the .out entry, 0 until it is stored
+};
+struct Cached_Conversion {
+    std::vector<Cached_Dependency> dependencies;
+    std::vector<Cached_Output> outputs;  // in the order they are written
+};
+
+struct Conversion_Cache {
+    std::string folder;     // empty = nothing is written to disk
+    bool32 in_memory = false;
+
+    // outputs copied from the cache and outputs written (and added to it), over all conversions
+    std::atomic<uint32> num_hits{0};
+    std::atomic<uint32> num_misses{0};
+
+    // with in_memory, every entry loaded or stored. see trim_memory_cache
+    std::mutex memory_mutex;
+    std::unordered_map<uint64, std::vector<uint8>> memory_outputs;
+    std::unordered_map<uint64, Cached_Conversion> memory_conversions;
+};
+
+// creates the folder if needed
+bool32 open_cache(const std::string& folder, Conversion_Cache& cache);
+// drops the entries kept in memory that are not in keys
+void trim_memory_cache(Conversion_Cache& cache, const std::unordered_set<uint64>& keys);
+
+// Builds a key out of the values added to it, in order. Only add types without padding.
+struct Cache_Key {
+    uint64 hash;
+
+    Cache_Key(uint64 seed) : hash(seed) {}
+
+    void add_bytes(const void* data, size_t size);
+    void add_string(const std::string& string);
+
+    template<typename T>
+    void add(const T& value) {
+        add_bytes(&value, sizeof(T));
+    }
+    template<typename T>
+    void add_array(const std::vector<T>& values) {
+        add((uint64)values.size());
+        add_bytes(values.data(), values.size() * sizeof(T));
+    }
+};
+
+// the versions and every option that changes the outputs, the seed of all other keys
+uint64 cache_key_base(const Options& opts);
+
+// content_hash() of a whole file. false if it can not be read
+bool32 hash_file(const std::string& filename, uint64& hash);
+
+// .out entries
+bool32 load_cached_output(Conversion_Cache& cache, uint64 key, std::vector<uint8>& data);
+void   store_cached_output(Conversion_Cache& cache, uint64 key, const std::vector<uint8>& data);
+
+// .in entries. false if there is no such entry, a dependency changed or an output is missing from the cache
+bool32 load_cached_conversion(Conversion_Cache& cache, uint64 key, Cached_Conversion& conversion);
+void   store_cached_conversion(Conversion_Cache& cache, uint64 key, const Cached_Conversion& conversion);
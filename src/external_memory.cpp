@@ -0,0 +1,76 @@
+#include "external_memory.h"
+#include "utils.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <thread>
+
+// tells the scratch files of one process apart
+static std::atomic<uint32> scratch_counter{0};
+
+bool32 Scratch_File::open() {
+    close();
+
+    std::error_code ec;
+    std::filesystem::path folder = std::filesystem::temp_directory_path(ec);
+    if (ec) {
+        folder = ".";
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "meshconv_%016llx_%u.tmp",
+        (unsigned long long)(std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                             (uint64)std::chrono::steady_clock::now().time_since_epoch().count()),
+        (uint32)scratch_counter++);
+    filename = (folder / name).string();
+
+    fid = fopen(filename.c_str(), "w+b");
+    size = 0;
+    failed = fid == nullptr;
+    dirty = false;
+    return fid != nullptr;
+}
+
+void Scratch_File::close() {
+    if (fid == nullptr) {
+        return;
+    }
+    fclose(fid);
+    fid = nullptr;
+    std::error_code ec;
+    std::filesystem::remove(filename, ec);
+}
+
+bool32 Scratch_File::reset() {
+    close();
+    return open();
+}
+
+void Scratch_File::append(const void* data, size_t num_bytes) {
+    if (num_bytes == 0) {
+        return;
+    }
+    // back to the end, in case a read moved the position. writes come in large blocks (Record_Writer)
+    if (fid == nullptr || !utils::file_seek(fid, size) || fwrite(data, 1, num_bytes, fid) != num_bytes) {
+        failed = true;
+    }
+    size += num_bytes;
+    dirty = true;
+}
+
+bool32 Scratch_File::read(uint64 offset, void* data, size_t num_bytes) {
+    if (fid == nullptr || offset + num_bytes > size) {
+        failed = true;
+        return false;
+    }
+    if (dirty) {
+        fflush(fid);
+        dirty = false;
+    }
+    if (!utils::read_at(fid, offset, data, num_bytes)) {
+        failed = true;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cstring>
+
+#include <laml/laml.hpp>
+
+/****************************************
+*
+*   EXTERNAL MEMORY
+*
+*   What the out-of-core mesh path (-max-memory, see Streamed_Mesh) keeps its data in when a
+*   primitive does not fit in memory. Each of these holds a fixed amount of memory, set when
+*   it is created, no matter how many records go through it:
+*
+*   Scratch_File    a file in the temporary folder, appended to and read anywhere, removed on close
+*   Record_Writer   appends records of one type to a scratch file, through a buffer
+*   Record_Reader   reads a range of them back in order, through a buffer
+*   sort_records    external merge sort: runs that fit in memory are sorted and written out,
+*                   then merged, as many at a time as there are read buffers in the budget
+*   Page_Cache      random access to an array that is not in memory, through a few pages of it,
+*                   the least recently used one is replaced
+*
+* ************************************/
+
+struct Scratch_File {
+    FILE* fid = nullptr;
+    std::string filename;
+    uint64 size = 0;         // bytes appended so far
+    bool32 failed = false;   // set if anything failed to write or read
+    bool32 dirty = false;    // appended to since the last read
+
+    Scratch_File() = default;
+    Scratch_File(const Scratch_File&) = delete;
+    Scratch_File& operator=(const Scratch_File&) = delete;
+    ~Scratch_File() { close(); }
+
+    bool32 open();
+    void close();
+    // closes it and opens a new, empty one
+    bool32 reset();
+
+    void append(const void* data, size_t num_bytes);
+    bool32 read(uint64 offset, void* data, size_t num_bytes);
+};
+
+template<typename T>
+struct Record_Writer {
+    Scratch_File& file;
+    std::vector<T> buffer;
+    uint64 count = 0; // records pushed
+
+    Record_Writer(Scratch_File& file, size_t buffer_bytes) : file(file) {
+        buffer.reserve(std::max<size_t>(1, buffer_bytes / sizeof(T)));
+    }
+    ~Record_Writer() { flush(); }
+
+    void push(const T& record) {
+        buffer.push_back(record);
+        count++;
+        if (buffer.size() == buffer.capacity())
+            flush();
+    }
+    void flush() {
+        file.append(buffer.data(), buffer.size() * sizeof(T));
+        buffer.clear();
+    }
+};
+
+template<typename T>
+struct Record_Reader {
+    Scratch_File& file;
+    uint64 offset;      // of the next record not in the buffer
+    uint64 remaining;   // records not read into the buffer yet
+    std::vector<T> buffer;
+    size_t next = 0;
+    size_t capacity;
+
+    // count records, starting at record first
+    Record_Reader(Scratch_File& file, uint64 first, uint64 count, size_t buffer_bytes)
+        : file(file), offset(first * sizeof(T)), remaining(count) {
+        capacity = std::max<size_t>(1, buffer_bytes / sizeof(T));
+    }
+
+    // the next record, nullptr at the end (or if the file can not be read)
+    const T* peek() {
+        if (next == buffer.size()) {
+            if (remaining == 0)
+                return nullptr;
+            size_t n = (size_t)std::min<uint64>(remaining, capacity);
+            buffer.resize(n);
+            if (!file.read(offset, buffer.data(), n * sizeof(T))) {
+                buffer.clear();
+                remaining = 0;
+                return nullptr;
+            }
+            offset += n * sizeof(T);
+            remaining -= n;
+            next = 0;
+        }
+        return &buffer[next];
+    }
+    void pop() { next++; }
+};
+
+// Sorts the count records at the start of in by less into out, which has to be empty. Holds
+// at most about memory bytes of records. in is used for the runs, and is left with garbage.
+// less has to be a strict total order (ties broken, by position for example), so the result
+// does not depend on how the records were split into runs
+template<typename T, typename Less>
+bool32 sort_records(Scratch_File& in, uint64 count, size_t memory, Less less, Scratch_File& out) {
+    size_t run_records = std::max<size_t>(1, memory / sizeof(T));
+    std::vector<T> run;
+
+    // sorted runs, into out if there is only one
+    Scratch_File runs;
+    Scratch_File* first_pass = (count <= run_records) ? &out : &runs;
+    if (first_pass == &runs && !runs.open())
+        return false;
+    std::vector<uint64> run_starts;
+    for (uint64 first = 0; first < count; first += run_records) {
+        size_t n = (size_t)std::min<uint64>(run_records, count - first);
+        run.resize(n);
+        if (!in.read(first * sizeof(T), run.data(), n * sizeof(T)))
+            return false;
+        std::sort(run.begin(), run.end(), less);
+        run_starts.push_back(first);
+        first_pass->append(run.data(), n * sizeof(T));
+    }
+    std::vector<T>().swap(run);
+    run_starts.push_back(count);
+    if (first_pass == &out)
+        return !out.failed;
+
+    // merged a few at a time, one read buffer for each and one for the output
+    size_t buffer_bytes = std::max<size_t>(64 * sizeof(T), memory / 17);
+    size_t fan_in = std::max<size_t>(3, memory / buffer_bytes) - 1;
+    Scratch_File* src = &runs;
+    Scratch_File* dst = &in;
+    while (run_starts.size() > 2) {
+        bool32 last_pass = run_starts.size() - 1 <= fan_in;
+        if (last_pass) {
+            dst = &out;
+        } else if (!dst->reset()) {
+            return false;
+        }
+
+        std::vector<uint64> merged_starts;
+        {
+            Record_Writer<T> writer(*dst, buffer_bytes);
+            for (size_t r = 0; r + 1 < run_starts.size(); r += fan_in) {
+                size_t end = std::min(r + fan_in, run_starts.size() - 1);
+                std::vector<Record_Reader<T>> readers;
+                readers.reserve(end - r);
+                for (size_t k = r; k < end; k++) {
+                    readers.emplace_back(*src, run_starts[k], run_starts[k + 1] - run_starts[k], buffer_bytes);
+                }
+
+                // the reader with the smallest record on top
+                auto greater = [&](size_t a, size_t b) { return less(*readers[b].peek(), *readers[a].peek()); };
+                std::vector<size_t> heap;
+                for (size_t k = 0; k < readers.size(); k++) {
+                    if (readers[k].peek()) heap.push_back(k);
+                }
+                std::make_heap(heap.begin(), heap.end(), greater);
+
+                merged_starts.push_back(writer.count);
+                while (!heap.empty()) {
+                    std::pop_heap(heap.begin(), heap.end(), greater);
+                    size_t k = heap.back();
+                    writer.push(*readers[k].peek());
+                    readers[k].pop();
+                    if (readers[k].peek()) {
+                        std::push_heap(heap.begin(), heap.end(), greater);
+                    } else {
+                        heap.pop_back();
+                    }
+                }
+            }
+            merged_starts.push_back(writer.count);
+        }
+        if (src->failed || dst->failed)
+            return false;
+        run_starts.swap(merged_starts);
+        std::swap(src, dst);
+    }
+    return !out.failed;
+}
+
+template<typename T>
+struct Page_Cache {
+    // fills out with count elements, starting at element first
+    typedef std::function<bool32(uint64 first, size_t count, T* out)> Load_Func;
+
+    struct Page {
+        uint64 number = ~0ull;
+        uint64 last_used = 0;
+        std::vector<T> elements;
+    };
+
+    Load_Func load;
+    uint64 count = 0;
+    size_t page_size = 1;   // elements per page
+    std::vector<Page> pages;
+    size_t last_page = 0;   // consecutive lookups mostly hit the same page
+    uint64 clock = 0;
+    bool32 failed = false;
+
+    // an array of count elements, held in at most about memory bytes
+    void init(uint64 num_elements, size_t memory, const Load_Func& load_func) {
+        load = load_func;
+        count = num_elements;
+        size_t num_pages = std::min<size_t>(64, std::max<size_t>(2, memory / (64 * 1024)));
+        page_size = std::max<size_t>(1, memory / num_pages / sizeof(T));
+        pages.assign(num_pages, Page());
+        last_page = 0;
+        clock = 0;
+        failed = false;
+    }
+
+    const T& get(uint64 index) {
+        uint64 number = index / page_size;
+        Page* page = &pages[last_page];
+        if (page->number != number) {
+            size_t found = pages.size();
+            size_t oldest = 0;
+            for (size_t n = 0; n < pages.size(); n++) {
+                if (pages[n].number == number) {
+                    found = n;
+                    break;
+                }
+                if (pages[n].last_used < pages[oldest].last_used)
+                    oldest = n;
+            }
+            if (found == pages.size()) {
+                found = oldest;
+                Page& replaced = pages[found];
+                uint64 first = number * page_size;
+                replaced.elements.resize((size_t)std::min<uint64>(page_size, count - first));
+                replaced.number = number;
+                if (!load(first, replaced.elements.size(), replaced.elements.data())) {
+                    // zeroed bytes, T() leaves laml vectors uninitialized
+                    memset((void*)replaced.elements.data(), 0, replaced.elements.size() * sizeof(T));
+                    failed = true;
+                }
+            }
+            last_page = found;
+            page = &pages[found];
+        }
+        page->last_used = ++clock;
+        return page->elements[(size_t)(index - number * page_size)];
+    }
+};
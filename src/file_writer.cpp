@@ -0,0 +1,135 @@
+#include "file_writer.h"
+#include "pack_file.h"
+#include "checksum.h"
+#include "utils.h"
+
+#include <cstring>
+#include <filesystem>
+
+// flush to the file once this much is staged
+const size_t staging_flush_size = 4 * 1024 * 1024;
+
+bool32 File_Writer::open(const std::string& name, bool32 skip) {
+    skip_unchanged = skip;
+    unchanged = false;
+    filename = name;
+    temp_filename = skip_unchanged ? name + ".tmp" : name;
+    errno_t err = fopen_s(&fid, temp_filename.c_str(), "wb");
+    if (fid == nullptr || err) {
+        fid = nullptr;
+        return false;
+    }
+
+    staging.clear();
+    staging.reserve(staging_flush_size);
+    flushed = 0;
+    failed = false;
+    checksum_active = false;
+    return true;
+}
+
+bool32 File_Writer::open(Pack_Writer* pack_writer, const std::string& path) {
+    fid = nullptr;
+    pack = pack_writer;
+    pack_path = path;
+    skip_unchanged = false;
+    unchanged = false;
+
+    staging.clear();
+    flushed = 0;
+    failed = false;
+    checksum_active = false;
+    return pack != nullptr;
+}
+
+bool32 File_Writer::close() {
+    if (pack != nullptr) {
+        bool32 added = pack->add(pack_path, staging.data(), staging.size());
+        pack = nullptr;
+        staging.clear();
+        return added;
+    }
+
+    if (fid == nullptr)
+        return false;
+
+    flush();
+    fclose(fid);
+    fid = nullptr;
+
+    if (skip_unchanged) {
+        skip_unchanged = false;
+        std::error_code ec;
+        if (failed) {
+            std::filesystem::remove(temp_filename, ec);
+        } else if (utils::files_equal(temp_filename, filename)) {
+            unchanged = true;
+            std::filesystem::remove(temp_filename, ec);
+        } else {
+            std::filesystem::rename(temp_filename, filename, ec);
+            if (ec)
+                failed = true;
+        }
+    }
+
+    return !failed;
+}
+
+void File_Writer::write_bytes(const void* data, size_t num_bytes) {
+    if (num_bytes == 0)
+        return;
+    if (checksum_active)
+        checksum = crc32c_update(checksum, data, num_bytes);
+    if (copy != nullptr)
+        copy->insert(copy->end(), (const uint8*)data, (const uint8*)data + num_bytes);
+
+    if (fid != nullptr && staging.size() + num_bytes > staging_flush_size) {
+        flush();
+
+        // big arrays go straight to the file in one call
+        if (num_bytes >= staging_flush_size) {
+            if (fwrite(data, 1, num_bytes, fid) != num_bytes)
+                failed = true;
+            flushed += num_bytes;
+            return;
+        }
+    }
+
+    const uint8* bytes = (const uint8*)data;
+    staging.insert(staging.end(), bytes, bytes + num_bytes);
+}
+
+void File_Writer::pad_to(size_t offset) {
+    const uint8 zeros[256] = { 0 };
+    while (size() < offset) {
+        size_t n = offset - size();
+        write_bytes(zeros, n < sizeof(zeros) ? n : sizeof(zeros));
+    }
+}
+
+void File_Writer::patch(size_t offset, const void* data, size_t num_bytes) {
+    if (copy != nullptr)
+        memcpy(copy->data() + offset, data, num_bytes);
+
+    if (offset >= flushed) {
+        // still in the staging buffer
+        memcpy(staging.data() + (offset - flushed), data, num_bytes);
+        return;
+    }
+
+    flush();
+    utils::file_seek(fid, offset);
+    if (fwrite(data, 1, num_bytes, fid) != num_bytes)
+        failed = true;
+    utils::file_seek(fid, flushed);
+}
+
+void File_Writer::flush() {
+    if (fid == nullptr || staging.empty())
+        return;
+
+    if (fwrite(staging.data(), 1, staging.size(), fid) != staging.size())
+        failed = true;
+    flushed += staging.size();
+    staging.clear();
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include <laml/laml.hpp>
+
+struct Pack_Writer;
+
+// Buffered binary file writer. Writes are appended to a staging buffer which is handed to
+// fwrite in large blocks, instead of one fwrite (and one stdio lock) per element.
+// size() replaces the manual FILESIZE bookkeeping, and patch() fills in header fields
+// (like the filesize) once the whole file has been written.
+// A writer that was never opened just collects everything in staging, which is used to
+// build chunks whose size is not known up front.
+// A writer opened on a pack entry also collects everything, and adds it to the pack on close.
+// Between begin_checksum() and end_checksum() every byte written is also run through CRC32C.
+// With copy set, everything written (and patched) is also kept there, for the conversion cache.
+// Opened with skip_unchanged, the file is written to filename.tmp (flushed as usual) and close()
+// only renames it over filename if that does not already hold exactly these bytes (unchanged is
+// set then, the .tmp is removed and the file is not touched).
+struct File_Writer {
+    FILE* fid = nullptr;
+    std::vector<uint8> staging;
+    size_t flushed = 0;     // bytes already handed to the file
+    bool32 failed = false;  // set if any write to the file failed
+
+    Pack_Writer* pack = nullptr;
+    std::string pack_path;
+
+    bool32 checksum_active = false;
+    uint32 checksum = 0;
+
+    std::vector<uint8>* copy = nullptr;
+
+    std::string filename;
+    std::string temp_filename;      // written instead of filename with skip_unchanged
+    bool32 skip_unchanged = false;
+    bool32 unchanged = false;
+
+    bool32 open(const std::string& filename, bool32 skip_unchanged = false);
+    bool32 open(Pack_Writer* pack, const std::string& path); // path of the entry inside the pack
+    bool32 close(); // flushes the staging buffer. returns false if anything failed to write
+
+    void write_bytes(const void* data, size_t num_bytes);
+
+    template<typename T>
+    void write(const T& value) {
+        write_bytes(&value, sizeof(T));
+    }
+    template<typename T>
+    void write_array(const T* data, size_t count) {
+        write_bytes(data, count * sizeof(T));
+    }
+
+    // writes zeros until the file is offset bytes long (no-op if it already is)
+    void pad_to(size_t offset);
+
+    // overwrite bytes that were already written, at an absolute offset in the file
+    void patch(size_t offset, const void* data, size_t num_bytes);
+
+    void begin_checksum() { checksum_active = true; checksum = 0; }
+    // returns the CRC32C of everything written since begin_checksum()
+    uint32 end_checksum() { checksum_active = false; return checksum; }
+
+    size_t size() const { return flushed + staging.size(); }
+    void flush();
+};
@@ -0,0 +1,541 @@
+#include "geometry_codec.h"
+
+#include <cstring>
+
+/****************************************
+ *
+ *   INDEX CODEC
+ *
+ ****************************************/
+const uint32 index_fifo_size   = 16;
+const uint32 edge_fifo_codes   = 15; // 0..14 in the high nibble, 15 = no shared edge
+const uint32 vertex_fifo_codes = 14; // 1..14 in a nibble, 0 = next vertex, 15 = explicit
+const uint32 vertex_code_next     = 0;
+const uint32 vertex_code_explicit = 15;
+
+struct Index_Edge {
+    uint32 a, b;
+};
+
+// state shared by the encoder and decoder, they must evolve it in exactly the same way
+struct Index_Codec_State {
+    Index_Edge edges[index_fifo_size];
+    uint32 vertices[index_fifo_size];
+    uint32 edge_pos = 0;
+    uint32 vertex_pos = 0;
+    uint32 next = 0;
+    uint32 last = 0;
+
+    Index_Codec_State() {
+        memset(edges, 0xFF, sizeof(edges));
+        memset(vertices, 0xFF, sizeof(vertices));
+    }
+
+    inline void push_edge(uint32 a, uint32 b) {
+        edges[edge_pos & (index_fifo_size - 1)] = { a, b };
+        edge_pos++;
+    }
+    inline void push_vertex(uint32 v) {
+        vertices[vertex_pos & (index_fifo_size - 1)] = v;
+        vertex_pos++;
+    }
+    inline const Index_Edge& edge(uint32 i) const {
+        return edges[(edge_pos - 1 - i) & (index_fifo_size - 1)];
+    }
+    inline uint32 vertex(uint32 i) const {
+        return vertices[(vertex_pos - 1 - i) & (index_fifo_size - 1)];
+    }
+};
+
+static inline void write_varint(std::vector<uint8>& out, uint32 v) {
+    while (v >= 0x80) {
+        out.push_back((uint8)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8)v);
+}
+
+static inline uint32 encode_index_vertex(Index_Codec_State& state, uint32 v, std::vector<uint8>& data) {
+    if (v == state.next) {
+        state.next++;
+        state.last = v;
+        state.push_vertex(v);
+        return vertex_code_next;
+    }
+
+    for (uint32 i = 0; i < vertex_fifo_codes; i++) {
+        if (state.vertex(i) == v)
+            return 1 + i;
+    }
+
+    int32 delta = (int32)(v - state.last);
+    write_varint(data, ((uint32)delta << 1) ^ (uint32)(delta >> 31));
+    state.last = v;
+    state.push_vertex(v);
+    return vertex_code_explicit;
+}
+
+bool32 encode_index_buffer(const uint32* indices, size_t count, std::vector<uint8>& out) {
+    out.clear();
+    if (count == 0 || count % 3 != 0)
+        return false;
+
+    Index_Codec_State state;
+    std::vector<uint8> codes;
+    std::vector<uint8> data;
+    codes.reserve(count / 3 + 16);
+
+    for (size_t t = 0; t < count; t += 3) {
+        uint32 tri[3] = { indices[t], indices[t + 1], indices[t + 2] };
+
+        // look for an edge shared with a recent triangle, in any rotation
+        uint32 edge_code = edge_fifo_codes;
+        uint32 rotation = 0;
+        for (uint32 i = 0; i < edge_fifo_codes && edge_code == edge_fifo_codes; i++) {
+            const Index_Edge& edge = state.edge(i);
+            for (uint32 r = 0; r < 3; r++) {
+                // the neighbour walked this edge the other way
+                if (edge.a == tri[(r + 1) % 3] && edge.b == tri[r]) {
+                    edge_code = i;
+                    rotation = r;
+                    break;
+                }
+            }
+        }
+
+        if (edge_code != edge_fifo_codes) {
+            uint32 x = tri[rotation], y = tri[(rotation + 1) % 3], z = tri[(rotation + 2) % 3];
+            uint32 cz = encode_index_vertex(state, z, data);
+            codes.push_back((uint8)((edge_code << 4) | cz));
+
+            state.push_edge(y, z);
+            state.push_edge(z, x);
+        } else {
+            uint32 x = tri[0], y = tri[1], z = tri[2];
+            uint32 cx = encode_index_vertex(state, x, data);
+            uint32 cy = encode_index_vertex(state, y, data);
+            uint32 cz = encode_index_vertex(state, z, data);
+            codes.push_back((uint8)((edge_fifo_codes << 4) | cz));
+            codes.push_back((uint8)((cx << 4) | cy));
+
+            state.push_edge(x, y);
+            state.push_edge(y, z);
+            state.push_edge(z, x);
+        }
+    }
+
+    uint32 code_size = codes.size();
+    out.resize(sizeof(uint32));
+    memcpy(out.data(), &code_size, sizeof(uint32));
+    out.insert(out.end(), codes.begin(), codes.end());
+    out.insert(out.end(), data.begin(), data.end());
+
+    if (out.size() >= count * sizeof(uint32)) {
+        out.clear();
+        return false;
+    }
+    return true;
+}
+
+// returns false if the data stream ran out
+static inline bool32 decode_index_vertex(Index_Codec_State& state, uint32 code, const uint8*& data, const uint8* data_end, uint32& v) {
+    if (code == vertex_code_next) {
+        v = state.next++;
+        state.last = v;
+        state.push_vertex(v);
+        return true;
+    }
+    if (code != vertex_code_explicit) {
+        v = state.vertex(code - 1);
+        return true;
+    }
+
+    uint32 zigzag = 0;
+    for (uint32 shift = 0; ; shift += 7) {
+        if (data >= data_end || shift > 28)
+            return false;
+        uint8 b = *data++;
+        zigzag |= (uint32)(b & 0x7F) << shift;
+        if (b < 0x80)
+            break;
+    }
+    v = state.last + ((zigzag >> 1) ^ (0u - (zigzag & 1)));
+    state.last = v;
+    state.push_vertex(v);
+    return true;
+}
+
+bool32 decode_index_buffer(const uint8* src, size_t src_size, uint32* out, size_t count) {
+    if (src_size < sizeof(uint32) || count % 3 != 0)
+        return false;
+
+    uint32 code_size;
+    memcpy(&code_size, src, sizeof(uint32));
+    if (code_size > src_size - sizeof(uint32))
+        return false;
+
+    const uint8* codes = src + sizeof(uint32);
+    const uint8* codes_end = codes + code_size;
+    const uint8* data = codes_end;
+    const uint8* data_end = src + src_size;
+
+    Index_Codec_State state;
+    for (size_t t = 0; t < count; t += 3) {
+        if (codes >= codes_end)
+            return false;
+        uint32 code = *codes++;
+        uint32 edge_code = code >> 4;
+
+        uint32 x, y, z;
+        if (edge_code != edge_fifo_codes) {
+            const Index_Edge& edge = state.edge(edge_code);
+            x = edge.b;
+            y = edge.a;
+            if (!decode_index_vertex(state, code & 15, data, data_end, z))
+                return false;
+
+            state.push_edge(y, z);
+            state.push_edge(z, x);
+        } else {
+            if (codes >= codes_end)
+                return false;
+            uint32 code_xy = *codes++;
+            if (!decode_index_vertex(state, code_xy >> 4, data, data_end, x) ||
+                !decode_index_vertex(state, code_xy & 15, data, data_end, y) ||
+                !decode_index_vertex(state, code & 15, data, data_end, z))
+                return false;
+
+            state.push_edge(x, y);
+            state.push_edge(y, z);
+            state.push_edge(z, x);
+        }
+
+        out[t] = x;
+        out[t + 1] = y;
+        out[t + 2] = z;
+    }
+
+    return codes == codes_end && data == data_end;
+}
+
+/****************************************
+ *
+ *   VERTEX CODEC
+ *
+ ****************************************/
+const uint32 vertex_group_size = 16;
+const uint32 vertex_block_bytes = 8192; // a block of one lane stays in L1 while decoding
+const uint32 vertex_block_max = 256;
+
+const uint32 group_mode_zero = 0;
+const uint32 group_mode_2bit = 1;
+const uint32 group_mode_4bit = 2;
+const uint32 group_mode_raw  = 3;
+
+static uint32 vertex_block_size(size_t stride) {
+    uint32 size = (uint32)(vertex_block_bytes / stride) & ~(vertex_group_size - 1);
+    if (size < vertex_group_size) size = vertex_group_size;
+    if (size > vertex_block_max) size = vertex_block_max;
+    return size;
+}
+
+static inline uint8 zigzag8(uint8 delta) {
+    return (uint8)((delta << 1) ^ (uint8)((int8)delta >> 7));
+}
+static inline uint8 unzigzag8(uint8 v) {
+    return (uint8)((v >> 1) ^ (uint8)(0 - (v & 1)));
+}
+
+// bytes needed for a group in the given mode
+static uint32 group_size(const uint8* deltas, uint32 mode) {
+    switch (mode) {
+        case group_mode_zero: {
+            for (uint32 i = 0; i < vertex_group_size; i++) {
+                if (deltas[i]) return 0xFFFF;
+            }
+            return 0;
+        }
+        case group_mode_2bit:
+        case group_mode_4bit: {
+            uint32 bits = (mode == group_mode_2bit) ? 2 : 4;
+            uint32 escape = (1u << bits) - 1;
+            uint32 size = vertex_group_size * bits / 8;
+            for (uint32 i = 0; i < vertex_group_size; i++) {
+                if (deltas[i] >= escape) size++;
+            }
+            return size;
+        }
+        default: return vertex_group_size;
+    }
+}
+
+static void write_group(std::vector<uint8>& out, const uint8* deltas, uint32 mode) {
+    if (mode == group_mode_zero)
+        return;
+    if (mode == group_mode_raw) {
+        out.insert(out.end(), deltas, deltas + vertex_group_size);
+        return;
+    }
+
+    uint32 bits = (mode == group_mode_2bit) ? 2 : 4;
+    uint32 escape = (1u << bits) - 1;
+    uint32 per_byte = 8 / bits;
+    for (uint32 i = 0; i < vertex_group_size; i += per_byte) {
+        uint8 packed = 0;
+        for (uint32 j = 0; j < per_byte; j++) {
+            uint8 v = deltas[i + j] < escape ? deltas[i + j] : escape;
+            packed |= v << (8 - bits * (j + 1));
+        }
+        out.push_back(packed);
+    }
+    for (uint32 i = 0; i < vertex_group_size; i++) {
+        if (deltas[i] >= escape)
+            out.push_back(deltas[i]);
+    }
+}
+
+bool32 encode_vertex_buffer(const void* vertices, size_t count, size_t stride, std::vector<uint8>& out) {
+    out.clear();
+    if (count == 0 || stride == 0)
+        return false;
+
+    const uint8* bytes = (const uint8*)vertices;
+    uint32 block_size = vertex_block_size(stride);
+    std::vector<uint8> last(stride, 0);
+    uint8 deltas[vertex_block_max];
+    uint8 modes[vertex_block_max / vertex_group_size];
+
+    for (size_t first = 0; first < count; first += block_size) {
+        uint32 num_verts = (count - first < block_size) ? (uint32)(count - first) : block_size;
+        uint32 num_groups = (num_verts + vertex_group_size - 1) / vertex_group_size;
+
+        for (size_t k = 0; k < stride; k++) {
+            uint8 prev = last[k];
+            for (uint32 i = 0; i < num_verts; i++) {
+                uint8 v = bytes[(first + i) * stride + k];
+                deltas[i] = zigzag8((uint8)(v - prev));
+                prev = v;
+            }
+            memset(deltas + num_verts, 0, num_groups * vertex_group_size - num_verts);
+            last[k] = prev;
+
+            // pick the smallest mode for every group, then write the 2-bit headers and the groups
+            for (uint32 g = 0; g < num_groups; g++) {
+                uint32 best_mode = group_mode_raw;
+                uint32 best_size = vertex_group_size;
+                for (uint32 mode = group_mode_zero; mode < group_mode_raw; mode++) {
+                    uint32 size = group_size(deltas + g * vertex_group_size, mode);
+                    if (size < best_size) {
+                        best_size = size;
+                        best_mode = mode;
+                    }
+                }
+                modes[g] = best_mode;
+            }
+            for (uint32 g = 0; g < num_groups; g += 4) {
+                uint8 header = 0;
+                for (uint32 j = 0; j < 4 && g + j < num_groups; j++) {
+                    header |= modes[g + j] << (2 * j);
+                }
+                out.push_back(header);
+            }
+            for (uint32 g = 0; g < num_groups; g++) {
+                write_group(out, deltas + g * vertex_group_size, modes[g]);
+            }
+        }
+    }
+
+    if (out.size() >= count * stride) {
+        out.clear();
+        return false;
+    }
+    return true;
+}
+
+static inline uint32 popcount32(uint32 v) {
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+// expands one byte of packed 2-bit or 4-bit values into one byte per value (first value first)
+struct Group_Expand_Tables {
+    uint32 expand2[256];
+    uint16 expand4[256];
+
+    Group_Expand_Tables() {
+        for (uint32 b = 0; b < 256; b++) {
+            uint8 values2[4] = { (uint8)(b >> 6), (uint8)((b >> 4) & 3), (uint8)((b >> 2) & 3), (uint8)(b & 3) };
+            uint8 values4[2] = { (uint8)(b >> 4), (uint8)(b & 15) };
+            memcpy(&expand2[b], values2, sizeof(values2));
+            memcpy(&expand4[b], values4, sizeof(values4));
+        }
+    }
+};
+static const Group_Expand_Tables expand_tables;
+
+// index of the lowest set bit of a non-zero value (de Bruijn multiply, no intrinsics)
+static inline uint32 lowest_bit(uint64 v) {
+    static const uint8 positions[64] = {
+         0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6
+    };
+    return positions[((v & (0 - v)) * 0x03F79D71B4CB0A89ull) >> 58];
+}
+
+// replaces the escaped values with the bytes that follow the packed values. escape_bits has a bit
+// set at first_bit - i * bits for every escaped value i, so it is walked from the last value back
+static inline void patch_escapes(uint8* deltas, uint64 escape_bits, uint32 first_bit, uint32 bits, const uint8* escapes, uint32 num_escapes) {
+    while (escape_bits) {
+        uint32 i = (first_bit - lowest_bit(escape_bits)) / bits;
+        deltas[i] = escapes[--num_escapes];
+        escape_bits &= escape_bits - 1;
+    }
+}
+
+// decodes one group of 16 zigzagged deltas. returns nullptr if the input ran out
+static inline const uint8* read_group(const uint8* p, const uint8* end, uint32 mode, uint8* deltas) {
+    switch (mode) {
+        case group_mode_zero: {
+            memset(deltas, 0, vertex_group_size);
+            return p;
+        }
+        case group_mode_2bit: {
+            if (end - p < 4) return nullptr;
+            uint32 bits = ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3];
+            uint32 escape_bits = bits & (bits >> 1) & 0x55555555;
+            uint32 num_escapes = popcount32(escape_bits);
+            if ((size_t)(end - p - 4) < num_escapes) return nullptr;
+
+            for (uint32 i = 0; i < 4; i++) {
+                memcpy(deltas + 4 * i, &expand_tables.expand2[p[i]], sizeof(uint32));
+            }
+            patch_escapes(deltas, escape_bits, 30, 2, p + 4, num_escapes);
+            return p + 4 + num_escapes;
+        }
+        case group_mode_4bit: {
+            if (end - p < 8) return nullptr;
+            uint64 bits = 0;
+            for (uint32 i = 0; i < 8; i++) {
+                memcpy(deltas + 2 * i, &expand_tables.expand4[p[i]], sizeof(uint16));
+                bits = (bits << 8) | p[i];
+            }
+            // a nibble is an escape when all 4 of its bits are set
+            uint64 escape_bits = bits & (bits >> 1);
+            escape_bits = escape_bits & (escape_bits >> 2) & 0x1111111111111111ull;
+            uint32 num_escapes = popcount32((uint32)escape_bits) + popcount32((uint32)(escape_bits >> 32));
+            if ((size_t)(end - p - 8) < num_escapes) return nullptr;
+
+            patch_escapes(deltas, escape_bits, 60, 4, p + 8, num_escapes);
+            return p + 8 + num_escapes;
+        }
+        default: {
+            if (end - p < (ptrdiff_t)vertex_group_size) return nullptr;
+            memcpy(deltas, p, vertex_group_size);
+            return p + vertex_group_size;
+        }
+    }
+}
+
+// undoes the zigzag delta of 8 lanes at once: prev + unzigzag8(delta) for every byte
+static inline uint64 apply_deltas8(uint64 prev, uint64 delta) {
+    const uint64 ones = 0x0101010101010101ull;
+    const uint64 high = 0x8080808080808080ull;
+    uint64 d = ((delta >> 1) & (ones * 0x7F)) ^ ((delta & ones) * 0xFF);
+    return ((prev & ~high) + (d & ~high)) ^ ((prev ^ d) & high);
+}
+
+// one step of the transpose: swaps the upper elements of a with the lower elements of b
+static inline void transpose_swap(uint64& a, uint64& b, uint32 shift, uint64 mask) {
+    uint64 t = ((a >> shift) ^ b) & mask;
+    b ^= t;
+    a ^= t << shift;
+}
+
+// transposes an 8x8 block of bytes: byte j of rows[r] ends up as byte r of rows[j].
+// unrolled by hand so the rows stay in registers
+static inline void transpose8x8(uint64 rows[8]) {
+    uint64 r0 = rows[0], r1 = rows[1], r2 = rows[2], r3 = rows[3];
+    uint64 r4 = rows[4], r5 = rows[5], r6 = rows[6], r7 = rows[7];
+
+    const uint64 m1 = 0x00FF00FF00FF00FFull, m2 = 0x0000FFFF0000FFFFull, m4 = 0x00000000FFFFFFFFull;
+    transpose_swap(r0, r1, 8, m1); transpose_swap(r2, r3, 8, m1); transpose_swap(r4, r5, 8, m1); transpose_swap(r6, r7, 8, m1);
+    transpose_swap(r0, r2, 16, m2); transpose_swap(r1, r3, 16, m2); transpose_swap(r4, r6, 16, m2); transpose_swap(r5, r7, 16, m2);
+    transpose_swap(r0, r4, 32, m4); transpose_swap(r1, r5, 32, m4); transpose_swap(r2, r6, 32, m4); transpose_swap(r3, r7, 32, m4);
+
+    rows[0] = r0; rows[1] = r1; rows[2] = r2; rows[3] = r3;
+    rows[4] = r4; rows[5] = r5; rows[6] = r6; rows[7] = r7;
+}
+
+bool32 decode_vertex_buffer(const uint8* src, size_t src_size, void* out, size_t count, size_t stride) {
+    if (stride == 0)
+        return false;
+
+    const uint8* p = src;
+    const uint8* end = src + src_size;
+    uint8* bytes = (uint8*)out;
+    uint32 block_size = vertex_block_size(stride);
+
+    // the lanes of a block are decoded as rows (one per vertex byte), then transposed back
+    // into vertices 8 lanes x 8 vertices at a time. rows are padded out to a multiple of 8
+    size_t num_rows = (stride + 7) & ~(size_t)7;
+    std::vector<uint8> lanes(num_rows * block_size, 0);
+    std::vector<uint8> last(num_rows, 0);
+
+    for (size_t first = 0; first < count; first += block_size) {
+        uint32 num_verts = (count - first < block_size) ? (uint32)(count - first) : block_size;
+        uint32 num_groups = (num_verts + vertex_group_size - 1) / vertex_group_size;
+        uint32 header_size = (num_groups + 3) / 4;
+        uint8* block = bytes + first * stride;
+
+        for (size_t k = 0; k < stride; k++) {
+            if ((size_t)(end - p) < header_size)
+                return false;
+            const uint8* header = p;
+            p += header_size;
+
+            uint8* row = lanes.data() + k * block_size;
+            for (uint32 g = 0; g < num_groups; g++) {
+                uint32 mode = (header[g / 4] >> (2 * (g % 4))) & 3;
+                p = read_group(p, end, mode, row + g * vertex_group_size);
+                if (p == nullptr)
+                    return false;
+            }
+        }
+
+        // lane groups go from last to first: a full 8-byte store of a partial group spills into the
+        // next vertex, whose first lanes are written afterwards. only the very end of out needs bytes
+        uint8* out_end = bytes + count * stride;
+        for (size_t k = (stride - 1) & ~(size_t)7; k < stride; k -= 8) {
+            size_t num_lanes = (stride - k < 8) ? stride - k : 8;
+            uint64 prev;
+            memcpy(&prev, last.data() + k, sizeof(uint64));
+
+            for (uint32 i = 0; i < num_verts; i += 8) {
+                uint64 rows[8];
+                for (uint32 r = 0; r < 8; r++) {
+                    memcpy(&rows[r], lanes.data() + (k + r) * block_size + i, sizeof(uint64));
+                }
+                transpose8x8(rows);
+
+                uint32 n = (num_verts - i < 8) ? num_verts - i : 8;
+                uint8* dst = block + (size_t)i * stride + k;
+                for (uint32 j = 0; j < n; j++, dst += stride) {
+                    prev = apply_deltas8(prev, rows[j]);
+                    if (num_lanes == 8 || out_end - dst >= (ptrdiff_t)sizeof(uint64)) {
+                        memcpy(dst, &prev, sizeof(uint64));
+                    } else {
+                        for (size_t b = 0; b < num_lanes; b++) {
+                            dst[b] = (uint8)(prev >> (8 * b));
+                        }
+                    }
+                }
+            }
+            memcpy(last.data() + k, &prev, sizeof(uint64));
+        }
+    }
+
+    return p == end;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include <laml/laml.hpp>
+
+/****************************************
+*
+*   GEOMETRY CODECS
+*
+*   Specialized encodings for index and vertex chunks, in the spirit of meshoptimizer.
+*   Both are byte oriented with no entropy coding, so decoding takes a few operations per
+*   byte (around 1 GB/s per core, on par with block decompression; see the bench mode).
+*
+*   Index codec (triangle lists):
+*     uint32 code_size
+*     uint8  codes[code_size]   <- one byte per triangle (two if it shares no edge)
+*     varint data[]             <- zigzag deltas of vertices that are neither new nor recent
+*     Each triangle either reuses an edge from a FIFO of the last 16 edges (4 bits) and codes
+*     its third vertex, or codes all three. A vertex is coded as 'next new vertex', an entry in
+*     a FIFO of recent vertices, or an explicit delta. Triangles may come out rotated (same
+*     winding, different first vertex).
+*
+*   Vertex codec (any stride):
+*     Vertices are handled in blocks. Inside a block every byte of the vertex (lane) is
+*     delta-encoded against the same byte of the previous vertex, zigzagged, and packed in
+*     groups of 16 with 0, 2, 4 or 8 bits each (2-bit mode per group, larger values escape
+*     to a full byte). Smooth attributes have small deltas in their high bytes.
+*
+* ************************************/
+
+// returns false if the indices are not a triangle list, or the encoding would not be smaller
+bool32 encode_index_buffer(const uint32* indices, size_t count, std::vector<uint8>& out);
+// count indices are written to out. returns false on corrupt input
+bool32 decode_index_buffer(const uint8* src, size_t src_size, uint32* out, size_t count);
+
+// returns false if the encoding would not be smaller
+bool32 encode_vertex_buffer(const void* vertices, size_t count, size_t stride, std::vector<uint8>& out);
+// count * stride bytes are written to out. returns false on corrupt input
+bool32 decode_vertex_buffer(const uint8* src, size_t src_size, void* out, size_t count, size_t stride);
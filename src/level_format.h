@@ -0,0 +1,39 @@
+#pragma once
+
+#include <laml/laml.hpp>
+#include "chunk_file.h"
+#include "material_format.h"
+
+/****************************************
+*
+*   LEVEL FILE LAYOUT (v4+)
+*
+*   A chunked file (see chunk_file.h) with header.count = number of mesh placements.
+*   INST and BTCH hold variable-size records (names), laid out as in the v3 blocks.
+*   From v5 each mesh name is followed by a uint64 hash of the mesh path relative to the
+*   level, e.g. pack_hash("render_meshes/crate.mesh"), which is also its key in a .pack.
+*   From v6 names are no longer inline (uint8 length, chars): each is a uint32 offset into
+*   the STRS string table followed by its uint64 name_hash() (see chunk_file.h).
+*   From v9 the optional MATS chunk embeds every material (material_format.h), with its
+*   names and texture paths in STRS.
+*   From v10 each instance table record has a uint32 transform format after num_instances,
+*   which can differ from the requested one at the start of INST (see pack_instance_transform).
+*
+* ************************************/
+// folders (or pack path prefixes) of the meshes a level refers to
+#define level_render_folder    "render_meshes"
+#define level_collision_folder "collision_meshes"
+
+#define LEVEL_CHUNK_INFO      "INFO" // Level_Info
+#define LEVEL_CHUNK_INSTANCES "INST" // uint32 num_tables, uint32 format, then one record per instance table
+#define LEVEL_CHUNK_BATCHES   "BTCH" // uint32 num_batches, then one record per static batch
+#define LEVEL_CHUNK_STRINGS   "STRS" // string table (chunk_file.h) (v6)
+#define LEVEL_CHUNK_MATERIALS MAT_CHUNK_MATERIALS // Material_Entry[num_materials] (v9)
+
+struct Level_Info {
+    uint32 num_meshes;
+    uint32 num_materials;
+    uint32 num_tables;
+    uint32 num_batches;
+};
+static_assert(sizeof(Level_Info) == 16, "Level_Info size changed");
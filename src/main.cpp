@@ -1,15 +1,25 @@
 #include "mesh_converter.h"
 #include "utils.h"
+#include "task_system.h"
+#include "conversion_cache.h"
 
 #include <filesystem>
 
 //printf("usage: mesh_conv [-v | --version] [-h] [-f input.gltf] [-o output/folder] [-fps 30]\n");
 const char* usage_string =
 "usage: meshconv [-v | --version] [-h | --help] <mode> input_filename [-o path/to/output] [-flip-uv] [-fps 30]\n"
+"       meshconv batch [inputs...] [-manifest list.txt] [-mode mesh|level|anim] [-verbose] [-queue-depth 2]\n"
+"       meshconv watch [inputs...] [-manifest list.txt] [-mode mesh|level|anim] [-verbose] [-debounce 200]\n"
+"       meshconv serve path/to/socket [-model-cache 512] [-j N]\n"
+"       meshconv request path/to/socket <mode> [arguments...]\n"
+"                [-o path/to/output] [options]\n"
+"                [-no-cleanup] [-shared-buffers] [-split-streams] [-align 64] [-batch] [-batch-cell 32] [-instance-format mat4|mat34|trs]\n"
+"                [-compress] [-geometry-codec] [-pack] [-pack-compress] [-material-format text|binary|both]\n"
+"                [-j N] [-cache path/to/cache] [-timestamp N|input] [-max-memory MB]\n"
 "\n"
 "modes:\n"
 "    mesh:  simply extracts meshes from the input and writes them to the output directory. Writes materials\n"
-"           to separate files in plain-text.\n"
+"           to separate files, in plain-text by default (see -material-format).\n"
 "\n"
 "    anim:  extracts all animations from the input and writes them to the output directory\n"
 "\n"
@@ -17,12 +27,94 @@ const char* usage_string =
 "           of meshes (both renderable and colliders), while writing those\n"
 "           .mesh files to separate folders.\n"
 "\n"
-"    disp: loads a .mesh or .level file and print the contents to the console\n"
+"    disp: loads a .mesh, .anim, .level, .matb or .pack file and print the contents to the console. Only the header,\n"
+"          chunk directory (table of contents) and the small descriptive chunks are read.\n"
 "\n"
 "    upgrade: loads a .mesh or .level file and upgrades it to the newest version (if possible)\n"
+"\n"
+"    bench: compresses every chunk of a .mesh, .anim or .level file (or of all of them in a folder) and\n"
+"           reports the compression ratio per chunk type and the compress/decode speed, then the same\n"
+"           for the geometry codecs on vertex and index chunks.\n"
+"\n"
+"    verify: checks the CRC32C checksums of a .mesh, .anim, .level or .matb file, or of all of them in a folder\n"
+"            (in parallel), and reports every corrupt chunk.\n"
+"\n"
+"    batch: converts many inputs in one process, on one thread pool, and prints a table of times and sizes.\n"
+"           inputs are files, patterns (* and ? in the filename, e.g. assets\\*.glb) or folders (every .gltf/.glb\n"
+"           below it), all converted with -mode (mesh by default). -manifest adds a file with one\n"
+"           '<mode> <input> [output_folder]' line per input. outputs go to -o\\<name>, or next to each input.\n"
+"           the log of an input is only printed if it fails, or with -verbose. options apply to every input.\n"
+"           inputs go through a load -> process -> write pipeline, with at most -queue-depth (default 2)\n"
+"           inputs waiting between two stages, and the busy time of every stage is reported.\n"
+"\n"
+"    watch: converts the inputs like batch, then keeps running and converts an input again whenever it or\n"
+"           a file it reads (.bin, images) changes, once nothing changed for -debounce ms (default 200).\n"
+"           outputs are kept in memory, so only the meshes, materials and animations that changed are\n"
+"           written again, and files that did not change are not touched. stop it with Ctrl+C.\n"
+"\n"
+"    serve: answers requests on a Unix domain socket. a request is one line holding a command line without\n"
+"           'meshconv' (any mode but serve and watch), the reply is its output and a last line\n"
+"           'meshconv exit <code>'. 'quit' stops the server. parsed inputs and the meshes, materials and\n"
+"           animations extracted from them are kept in memory (up to -model-cache MB, least recently used\n"
+"           first out), so converting an unchanged input again only writes the outputs. requests run\n"
+"           with the server's -j and can not give their own.\n"
+"\n"
+"    request: sends one request to a server and prints the reply, exiting with the request's exit code.\n"
+"\n"
+"options:\n"
+"    -no-cleanup:     skip removing degenerate, zero-area and duplicate triangles and fixing NaN/denormal\n"
+"                     vertex attributes.\n"
+"    -shared-buffers: write all primitives of a mesh into one shared vertex buffer and one shared\n"
+"                     index buffer, with a (first_index, index_count, base_vertex) range per primitive.\n"
+"    -split-streams:  store each primitive as separate position, shading and skin streams, plus a\n"
+"                     position-only welded index buffer for depth/shadow passes.\n"
+"    -align:          alignment (in bytes) of every vertex/index array in a .mesh file, so the file can be\n"
+"                     memory-mapped and uploaded without copies. power of two from 16 to 4096 (default 64).\n"
+"    -batch:          (level mode) pre-transform static, non-rigged meshes into world space and merge them\n"
+"                     into one batch mesh per material and spatial cell.\n"
+"    -batch-cell:     size of the spatial cells used by -batch (default 32).\n"
+"    -instance-format: (level mode) how instance transforms are packed: mat4 (default), mat34 or trs.\n"
+"    -compress:       compress the vertex, index and animation track chunks (LZ4 block format, in\n"
+"                     independent 64 KiB blocks that can be decoded in parallel).\n"
+"    -geometry-codec: encode index chunks (triangle lists) and vertex chunks with the geometry codecs,\n"
+"                     which shrink them more than -compress. with -compress too, chunks the codecs do\n"
+"                     not make smaller are compressed instead.\n"
+"    -pack:           (mesh/level mode) write every output file into a single 'output.pack' archive\n"
+"                     instead of a folder. entries are found by the hash of their path.\n"
+"    -pack-compress:  deflate the pack entries that get smaller by it. implies -pack.\n"
+"    -j:              number of threads (default: all hardware threads). the output is the same for any count.\n"
+"    -material-format: text (.matl, default), binary (.matb, a fixed-size record and a string table that\n"
+"                     need no parsing) or both. a .level always embeds its materials in binary.\n"
+"    -cache:          (mesh/level/anim/batch/watch) keep every output in this folder, keyed by a hash of what it\n"
+"                     was written from. an unchanged input is copied from the cache without loading it, and\n"
+"                     in a changed input only the meshes, materials and animations that changed are written.\n"
+"    -timestamp:      deterministic output: store N (seconds since 1970), or with 'input' the modification time\n"
+"                     of the input, in every file instead of the current time. files that already hold the\n"
+"                     same bytes are then not rewritten, and the number of files touched is reported.\n"
+"    -max-memory:     (mesh/level mode) bounded memory: extract and write the meshes a few at a time, with at\n"
+"                     most this many MB of them in flight, release the input's buffers as soon as no mesh\n"
+"                     still needs them and skip decoding images. not used with -batch. the buffers are read\n"
+"                     from their files instead of loaded, and a mesh larger than the budget on its own is\n"
+"                     written through temporary files (uncompressed, not with -pack or -cache).\n"
 "\n";
 
-int main(int argc, char** argv) {
+// how many outputs were actually written, with -timestamp
+static void print_touched(const Options& opt) {
+    if (opt.skip_unchanged) {
+        printf("Touched %d of %d files, %d were unchanged\n", (int)(opt.stats->num_files - opt.stats->num_unchanged),
+            (int)opt.stats->num_files.load(), (int)opt.stats->num_unchanged.load());
+    }
+}
+
+static void print_cache_stats(const Options& opt) {
+    if (opt.cache) {
+        printf("Cache: %d files copied from the cache, %d written and added to it\n",
+            (int)opt.cache->num_hits.load(), (int)opt.cache->num_misses.load());
+    }
+}
+
+// a whole command line, as given to main. serve mode runs one per request, with its model cache
+static int run_command(int argc, char** argv, Model_Cache* models) {
     //printf("-------------------------------------------------\n");
     //printf("%d args\n", argc);
     //for (int n = 0; n < argc; n++) {
@@ -44,6 +136,7 @@ int main(int argc, char** argv) {
     }
 
     Options opt = {};
+    opt.models = models;
 
     char* mode_str = argv[1];
     if (strcmp(mode_str, "mesh") == 0) {
@@ -64,22 +157,97 @@ int main(int argc, char** argv) {
     } else if (strcmp(mode_str, "upgrade") == 0) {
         // upgrade a files version
         opt.mode = UPGRADE_MODE;
+    } else if (strcmp(mode_str, "bench") == 0) {
+        // measure chunk compression
+        opt.mode = BENCH_MODE;
+    } else if (strcmp(mode_str, "verify") == 0) {
+        // check file checksums
+        opt.mode = VERIFY_MODE;
+    } else if (strcmp(mode_str, "batch") == 0) {
+        // convert many files in one go
+        opt.mode = BATCH_MODE;
+    } else if (strcmp(mode_str, "watch") == 0) {
+        // convert files again whenever they change
+        opt.mode = WATCH_MODE;
+    } else if (strcmp(mode_str, "serve") == 0) {
+        // answer requests on a socket
+        opt.mode = SERVE_MODE;
     } else {
         printf("Incorrect mode!\n");
         printf("%s\n", usage_string);
         return 0;
     }
 
-    if (argc < 3) {
-        printf("Error - No input filename given!\n");
-        return -1;
+    // options follow the input filename, or the inputs of batch and watch
+    int first_option = 3;
+    if (opt.mode == BATCH_MODE || opt.mode == WATCH_MODE) {
+        // the inputs are everything up to the first option
+        for (first_option = 2; first_option < argc && argv[first_option][0] != '-'; first_option++) {
+            opt.batch_inputs.push_back(std::string(argv[first_option]));
+        }
+        char* manifest = utils::getCmdOption(argv, argv + argc, "-manifest");
+        if (manifest) {
+            opt.manifest = std::string(manifest);
+        }
+        if (opt.batch_inputs.empty() && opt.manifest.empty()) {
+            printf("Error - No inputs given!\n");
+            return -1;
+        }
+
+        opt.batch_mode = SINGLE_MESH_MODE;
+        char* batch_mode_str = utils::getCmdOption(argv, argv + argc, "-mode");
+        if (batch_mode_str && !parse_convert_mode(batch_mode_str, opt.batch_mode)) {
+            printf("Unknown mode '%s', using mesh\n", batch_mode_str);
+        }
+        opt.verbose = utils::cmdOptionExists(argv, argv + argc, "-verbose");
+
+        opt.queue_depth = 0;
+        char* depth_str = utils::getCmdOption(argv, argv + argc, "-queue-depth");
+        if (depth_str) {
+            int depth = std::atoi(depth_str);
+            if (depth > 0)
+                opt.queue_depth = (uint32)depth;
+            else
+                printf("Invalid queue depth '%s', using 2\n", depth_str);
+        }
+
+        opt.debounce_ms = 200;
+        char* debounce_str = utils::getCmdOption(argv, argv + argc, "-debounce");
+        if (debounce_str) {
+            int debounce = std::atoi(debounce_str);
+            if (debounce >= 0 && (debounce > 0 || strcmp(debounce_str, "0") == 0))
+                opt.debounce_ms = (uint32)debounce;
+            else
+                printf("Invalid debounce '%s', using 200\n", debounce_str);
+        }
+    } else if (opt.mode == SERVE_MODE) {
+        if (argc < 3 || argv[2][0] == '-') {
+            printf("Error - No socket path given!\n");
+            return -1;
+        }
+        opt.socket_path = std::string(argv[2]);
+
+        opt.model_cache_size = 512ull << 20;
+        char* model_cache_str = utils::getCmdOption(argv, argv + argc, "-model-cache");
+        if (model_cache_str) {
+            int megabytes = std::atoi(model_cache_str);
+            if (megabytes > 0)
+                opt.model_cache_size = (uint64)megabytes << 20;
+            else
+                printf("Invalid model cache size '%s', using 512 MB\n", model_cache_str);
+        }
+    } else {
+        if (argc < 3) {
+            printf("Error - No input filename given!\n");
+            return -1;
+        }
+        opt.input_filename = std::string(argv[2]);
+        std::replace(opt.input_filename.begin(), opt.input_filename.end(), '/', '\\');
     }
-    opt.input_filename = std::string(argv[2]);
-    std::replace(opt.input_filename.begin(), opt.input_filename.end(), '/', '\\');
 
     // check if an output name is given
-    if (utils::cmdOptionExists(argv + 3, argv + argc, "-o")) {
-        char* out = utils::getCmdOption(argv + 3, argv + argc, "-o");
+    if (first_option < argc && utils::cmdOptionExists(argv + first_option, argv + argc, "-o")) {
+        char* out = utils::getCmdOption(argv + first_option, argv + argc, "-o");
         if (out) {
             opt.output_folder = std::string(out);
 
@@ -100,7 +268,7 @@ int main(int argc, char** argv) {
             return -1;
         }
     }
-    else {
+    else if (opt.mode != BATCH_MODE && opt.mode != WATCH_MODE && opt.mode != SERVE_MODE) {
         // no output filename given - use the input filename but change the extension
         std::string folder, filename, ext;
         utils::decompose_path(std::string(opt.input_filename), folder, filename, ext);
@@ -126,6 +294,110 @@ int main(int argc, char** argv) {
         opt.flip_uvs_y = false;
     }
 
+    if (utils::cmdOptionExists(argv, argv + argc, "-no-cleanup")) {
+        printf("  skipping mesh cleanup\n");
+        opt.cleanup = false;
+    } else {
+        opt.cleanup = true;
+    }
+
+    if (utils::cmdOptionExists(argv, argv + argc, "-shared-buffers")) {
+        printf("  writing shared vertex/index buffers\n");
+        opt.shared_buffers = true;
+    } else {
+        opt.shared_buffers = false;
+    }
+
+    if (utils::cmdOptionExists(argv, argv + argc, "-split-streams")) {
+        if (opt.shared_buffers) {
+            printf("  -split-streams can not be combined with -shared-buffers, ignoring it\n");
+            opt.split_streams = false;
+        } else {
+            printf("  writing split vertex streams\n");
+            opt.split_streams = true;
+        }
+    } else {
+        opt.split_streams = false;
+    }
+
+    opt.alignment = mesh_default_alignment;
+    char* align_str = utils::getCmdOption(argv, argv + argc, "-align");
+    if (align_str) {
+        uint32 align = (uint32)std::atoi(align_str);
+        if (align >= 16 && align <= mesh_max_alignment && (align & (align - 1)) == 0) {
+            printf("  aligning mesh arrays to %u bytes\n", align);
+            opt.alignment = align;
+        } else {
+            printf("Invalid alignment '%s' (must be a power of two from 16 to %u), using %u\n", align_str, mesh_max_alignment, mesh_default_alignment);
+        }
+    }
+
+    if (utils::cmdOptionExists(argv, argv + argc, "-compress")) {
+        printf("  compressing vertex, index and animation chunks\n");
+        opt.compress = true;
+    } else {
+        opt.compress = false;
+    }
+
+    if (utils::cmdOptionExists(argv, argv + argc, "-geometry-codec")) {
+        printf("  encoding vertex and index chunks with the geometry codecs\n");
+        opt.geometry_codec = true;
+    } else {
+        opt.geometry_codec = false;
+    }
+
+    if (utils::cmdOptionExists(argv, argv + argc, "-batch")) {
+        printf("  batching static meshes\n");
+        opt.batch_static = true;
+    } else {
+        opt.batch_static = false;
+    }
+
+    opt.batch_cell_size = 32.0f;
+    char* cell_str = utils::getCmdOption(argv, argv + argc, "-batch-cell");
+    if (cell_str) {
+        double cell = std::atof(cell_str);
+        if (cell > 0.0)
+            opt.batch_cell_size = cell;
+    }
+
+    opt.instance_format = transform_format::mat4;
+    char* inst_str = utils::getCmdOption(argv, argv + argc, "-instance-format");
+    if (inst_str) {
+        if (strcmp(inst_str, "mat34") == 0) {
+            opt.instance_format = transform_format::mat34;
+        } else if (strcmp(inst_str, "trs") == 0) {
+            opt.instance_format = transform_format::trs;
+        } else if (strcmp(inst_str, "mat4") != 0) {
+            printf("Unknown instance format '%s', using mat4\n", inst_str);
+        }
+    }
+
+    if (utils::cmdOptionExists(argv, argv + argc, "-pack-compress")) {
+        printf("  writing a compressed pack file\n");
+        opt.pack_files = true;
+        opt.pack_compress = true;
+    } else if (utils::cmdOptionExists(argv, argv + argc, "-pack")) {
+        printf("  writing a pack file\n");
+        opt.pack_files = true;
+        opt.pack_compress = false;
+    } else {
+        opt.pack_files = false;
+        opt.pack_compress = false;
+    }
+
+    opt.material_output = material_format::text;
+    char* mat_str = utils::getCmdOption(argv, argv + argc, "-material-format");
+    if (mat_str) {
+        if (strcmp(mat_str, "binary") == 0) {
+            opt.material_output = material_format::binary;
+        } else if (strcmp(mat_str, "both") == 0) {
+            opt.material_output = material_format::both;
+        } else if (strcmp(mat_str, "text") != 0) {
+            printf("Unknown material format '%s', using text\n", mat_str);
+        }
+    }
+
     opt.frame_rate = 30.0;
     char* fps_str = utils::getCmdOption(argv, argv + argc, "-fps");
     if (fps_str) {
@@ -134,8 +406,80 @@ int main(int argc, char** argv) {
             opt.frame_rate = fps;
     }
 
+    opt.num_threads = 0;
+    char* threads_str = utils::getCmdOption(argv, argv + argc, "-j");
+    if (threads_str) {
+        int num_threads = std::atoi(threads_str);
+        if (num_threads > 0)
+            opt.num_threads = (uint32)num_threads;
+        else
+            printf("Invalid thread count '%s', using all hardware threads\n", threads_str);
+    }
+    task_system_start(opt.num_threads);
+
+    opt.max_memory = 0;
+    char* memory_str = utils::getCmdOption(argv, argv + argc, "-max-memory");
+    if (memory_str) {
+        double megabytes = std::atof(memory_str);
+        if (megabytes > 0)
+            opt.max_memory = std::max<uint64>(1, (uint64)(megabytes * 1024.0 * 1024.0));
+        else
+            printf("Invalid memory budget '%s', converting without one\n", memory_str);
+    }
+
+    opt.timestamp = 0;
+    opt.timestamp_from_input = false;
+    char* timestamp_str = utils::getCmdOption(argv, argv + argc, "-timestamp");
+    if (timestamp_str) {
+        if (strcmp(timestamp_str, "input") == 0) {
+            opt.timestamp_from_input = true;
+        } else {
+            char* end = nullptr;
+            opt.timestamp = std::strtoull(timestamp_str, &end, 10);
+            if (end == timestamp_str || *end != '\0' || opt.timestamp == 0) {
+                printf("Invalid timestamp '%s', using the current time\n", timestamp_str);
+                opt.timestamp = 0;
+            }
+        }
+    }
+    opt.skip_unchanged = opt.timestamp != 0 || opt.timestamp_from_input;
+
+    Conversion_Cache cache;
+    char* cache_str = utils::getCmdOption(argv, argv + argc, "-cache");
+    if (cache_str) {
+        if (open_cache(cache_str, cache)) {
+            opt.cache_folder = cache_str;
+            opt.cache = &cache;
+        } else {
+            printf("Could not create the cache folder '%s', converting without a cache\n", cache_str);
+        }
+    }
+
     // print options
-    printf("  input_filename: %s\n", opt.input_filename.c_str());
+    if (opt.mode == BATCH_MODE || opt.mode == WATCH_MODE) {
+        printf("  inputs:         %d%s%s\n", (int)opt.batch_inputs.size(), opt.manifest.empty() ? "" : ", manifest ", opt.manifest.c_str());
+    } else if (opt.mode == SERVE_MODE) {
+        printf("  socket:         %s\n", opt.socket_path.c_str());
+        printf("  model cache:    %llu MB\n", (unsigned long long)(opt.model_cache_size >> 20));
+    } else {
+        printf("  input_filename: %s\n", opt.input_filename.c_str());
+    }
+    printf("  threads:        %d\n", task_system_threads());
+    if (opt.cache) {
+        printf("  cache:          %s\n", opt.cache_folder.c_str());
+    }
+    if (opt.max_memory) {
+        printf("  max memory:     %g MB\n", opt.max_memory / (1024.0 * 1024.0));
+    }
+    if (opt.timestamp_from_input) {
+        printf("  timestamp:      of the input\n");
+    } else if (opt.timestamp) {
+        printf("  timestamp:      %llu\n", (unsigned long long)opt.timestamp);
+    }
+
+    // counts the files of a single conversion, batch mode counts per input
+    Output_Stats stats;
+    opt.stats = &stats;
 
     if (opt.mode == DISPLAY_MODE) {
         // display contents of file
@@ -143,7 +487,31 @@ int main(int argc, char** argv) {
     } else if (opt.mode == UPGRADE_MODE) {
         // upgrade file
         upgrade_file(opt);
-    } else if (opt.mode == SINGLE_MESH_MODE) {
+    } else if (opt.mode == BENCH_MODE) {
+        bench_compression(opt);
+    } else if (opt.mode == VERIFY_MODE) {
+        // non-zero exit code, so scripts can stop on corrupt files
+        if (!verify_files(opt))
+            return 1;
+    } else if (opt.mode == BATCH_MODE) {
+        // non-zero exit code if any input failed
+        bool converted = convert_batch(opt);
+        print_cache_stats(opt);
+        if (!converted)
+            return 1;
+    } else if (opt.mode == WATCH_MODE) {
+        // only returns if there is nothing to watch
+        if (!convert_watch(opt))
+            return 1;
+    } else if (opt.mode == SERVE_MODE) {
+        opt.models = create_model_cache(opt.model_cache_size);
+        bool served = serve_requests(opt, [&opt](int request_argc, char** request_argv) {
+            return run_command(request_argc, request_argv, opt.models);
+        });
+        free_model_cache(opt.models);
+        if (!served)
+            return 1;
+    } else if (opt.mode == SINGLE_MESH_MODE || opt.mode == LEVEL_MODE) {
         printf("  output_folder:  %s\n", opt.output_folder.c_str());
 
         // Run the actual conversion
@@ -152,6 +520,8 @@ int main(int argc, char** argv) {
         } else {
             printf("Succesfully converted file!\n");
         }
+        print_touched(opt);
+        print_cache_stats(opt);
     } else if (opt.mode == ANIM_MODE) {
         printf("  output_folder:  %s\n", opt.output_folder.c_str());
 
@@ -162,6 +532,8 @@ int main(int argc, char** argv) {
         else {
             printf("Succesfully converted file!\n");
         }
+        print_touched(opt);
+        print_cache_stats(opt);
     }
 
     return 0;
@@ -253,4 +625,12 @@ int main(int argc, char** argv) {
 #endif
 
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) {
+    // a command line for a server (see serve_mode.cpp), run there instead
+    if (argc >= 2 && strcmp(argv[1], "request") == 0) {
+        return send_request(argc - 2, argv + 2);
+    }
+    return run_command(argc, argv, nullptr);
+}
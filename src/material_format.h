@@ -0,0 +1,39 @@
+#pragma once
+
+#include <laml/laml.hpp>
+#include "chunk_file.h"
+
+/****************************************
+*
+*   BINARY MATERIAL LAYOUT (.matb, Material Version 2)
+*
+*   A chunked file (see chunk_file.h) with magic "MATB" and header.count = number of
+*   materials (one per .matb file). MATS holds the fixed-size Material_Entry records and
+*   STRS the material names and texture paths they refer to, so loading a material is two
+*   reads and no parsing. header.flag is unused, the mat_flag_* bits are per entry.
+*   A .level (v9+) embeds every material of the level the same way, as an optional MATS
+*   chunk whose strings live in the level's STRS.
+*
+* ************************************/
+#define MAT_CHUNK_MATERIALS "MATS" // Material_Entry[count]
+#define MAT_CHUNK_STRINGS   "STRS" // string table (chunk_file.h)
+
+struct Material_Entry {
+    uint32 name;             // offset into the string table
+    uint32 flag;             // mat_flag_*
+    uint64 name_hash;        // name_hash() of the material name, matches Mesh_Prim_Entry::material_hash
+
+    real32 diffuse_factor[3];
+    real32 normal_scale;
+    real32 ambient_strength;
+    real32 metallic_factor;
+    real32 roughness_factor;
+    real32 emissive_factor[3];
+
+    // offsets into the string table, only valid if the matching mat_flag_has_* bit is set
+    uint32 diffuse_texture;
+    uint32 normal_texture;
+    uint32 amr_texture;
+    uint32 emissive_texture;
+};
+static_assert(sizeof(Material_Entry) == 72, "Material_Entry size changed");
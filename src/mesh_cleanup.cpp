@@ -0,0 +1,291 @@
+#include "mesh_cleanup.h"
+#include "task_system.h"
+
+#include <cmath>
+#include <cstring>
+#include <unordered_set>
+
+uint32 sanitize_floats(real32* data, size_t count) {
+    uint32 fixed = 0;
+    for (size_t n = 0; n < count; n++) {
+        int c = std::fpclassify(data[n]);
+        if (c == FP_NAN || c == FP_INFINITE || c == FP_SUBNORMAL) {
+            data[n] = 0.0f;
+            fixed++;
+        }
+    }
+    return fixed;
+}
+
+template<typename T>
+static uint32 sanitize_attribute(std::vector<T>& attribute) {
+    return sanitize_floats((real32*)attribute.data(), attribute.size() * (sizeof(T) / sizeof(real32)));
+}
+
+struct Tri_Key {
+    uint32 a, b, c;
+    bool operator==(const Tri_Key& other) const { return a == other.a && b == other.b && c == other.c; }
+};
+struct Tri_Key_Hash {
+    size_t operator()(const Tri_Key& k) const {
+        uint64 h = k.a;
+        h = h * 0x9E3779B97F4A7C15ull + k.b;
+        h = h * 0x9E3779B97F4A7C15ull + k.c;
+        return (size_t)(h ^ (h >> 29));
+    }
+};
+
+// true if the triangle is collinear (to within float precision) or has coincident corners
+static bool32 is_zero_area(const laml::Vec3& p0, const laml::Vec3& p1, const laml::Vec3& p2) {
+    laml::Vec3 e1 = p1 - p0;
+    laml::Vec3 e2 = p2 - p0;
+    laml::Vec3 c = laml::cross(e1, e2);
+
+    real32 area2 = laml::dot(c, c);
+    real32 scale2 = laml::dot(e1, e1) * laml::dot(e2, e2);
+    return area2 <= scale2 * 1e-12f;
+}
+
+uint32 sanitize_attributes(Mesh_Primitive& prim) {
+    uint32 fixed = 0;
+    fixed += sanitize_attribute(prim.positions);
+    fixed += sanitize_attribute(prim.normals);
+    fixed += sanitize_attribute(prim.texcoords);
+    fixed += sanitize_attribute(prim.tangents_4);
+    fixed += sanitize_attribute(prim.bone_weights);
+    return fixed;
+}
+
+void cleanup_primitive(Mesh_Primitive& prim, Cleanup_Stats& stats) {
+    stats = {};
+
+    stats.attributes_fixed += sanitize_attributes(prim);
+
+    uint32 num_verts = prim.positions.size();
+    std::vector<uint32> kept;
+    kept.reserve(prim.indices.size());
+
+    if (prim.prim_type == prim_type::triangles) {
+        std::unordered_set<Tri_Key, Tri_Key_Hash> seen;
+        for (size_t i = 0; i + 2 < prim.indices.size(); i += 3) {
+            uint32 a = prim.indices[i + 0];
+            uint32 b = prim.indices[i + 1];
+            uint32 c = prim.indices[i + 2];
+
+            if (a == b || b == c || a == c || a >= num_verts || b >= num_verts || c >= num_verts) {
+                stats.degenerate_removed++;
+                continue;
+            }
+            if (is_zero_area(prim.positions[a], prim.positions[b], prim.positions[c])) {
+                stats.zero_area_removed++;
+                continue;
+            }
+
+            // rotate so the smallest index comes first; keeps the winding, so
+            // back-to-back (double sided) triangles are not seen as duplicates
+            while (a > b || a > c) {
+                uint32 tmp = a; a = b; b = c; c = tmp;
+            }
+            if (!seen.insert({ a, b, c }).second) {
+                stats.duplicates_removed++;
+                continue;
+            }
+
+            kept.push_back(prim.indices[i + 0]);
+            kept.push_back(prim.indices[i + 1]);
+            kept.push_back(prim.indices[i + 2]);
+        }
+    } else if (prim.prim_type == prim_type::lines) {
+        std::unordered_set<uint64> seen;
+        for (size_t i = 0; i + 1 < prim.indices.size(); i += 2) {
+            uint32 a = prim.indices[i + 0];
+            uint32 b = prim.indices[i + 1];
+
+            if (a == b || a >= num_verts || b >= num_verts) {
+                stats.degenerate_removed++;
+                continue;
+            }
+
+            uint64 key = (a < b) ? (((uint64)a << 32) | b) : (((uint64)b << 32) | a);
+            if (!seen.insert(key).second) {
+                stats.duplicates_removed++;
+                continue;
+            }
+
+            kept.push_back(a);
+            kept.push_back(b);
+        }
+    } else {
+        return;
+    }
+
+    prim.indices.swap(kept);
+}
+
+void cleanup_meshes(std::vector<Mesh>& meshes) {
+    struct Prim_Ref {
+        uint32 mesh_idx;
+        uint32 prim_idx;
+    };
+    std::vector<Prim_Ref> prims;
+    for (uint32 m = 0; m < meshes.size(); m++) {
+        for (uint32 p = 0; p < meshes[m].primitives.size(); p++) {
+            prims.push_back({ m, p });
+        }
+    }
+
+    std::vector<Cleanup_Stats> stats(prims.size());
+    parallel_for(prims.size(), [&](uint32 n) {
+        cleanup_primitive(meshes[prims[n].mesh_idx].primitives[prims[n].prim_idx], stats[n]);
+    });
+
+    // log afterwards so the output order does not depend on the threads
+    uint32 total_removed = 0;
+    for (uint32 n = 0; n < prims.size(); n++) {
+        const Cleanup_Stats& s = stats[n];
+        uint32 removed = s.degenerate_removed + s.zero_area_removed + s.duplicates_removed;
+        total_removed += removed;
+
+        const Mesh& mesh = meshes[prims[n].mesh_idx];
+        log_printf("  '%s' prim %d: removed %d degenerate, %d zero-area, %d duplicate; fixed %d attributes\n",
+               mesh.mesh_name.c_str(), prims[n].prim_idx,
+               s.degenerate_removed, s.zero_area_removed, s.duplicates_removed, s.attributes_fixed);
+    }
+    log_printf("Cleaned %d primitives, removed %d elements.\n", (int)prims.size(), total_removed);
+}
+
+// an element (triangle or line segment) that is neither degenerate nor zero-area
+struct Element_Record {
+    uint32 index[3];    // as in the primitive, or rotated/ordered like the keys above (lines: the third is 0)
+    uint32 pad;
+    uint64 ordinal;     // which element of the primitive it is
+};
+
+bool32 cleanup_indices_out_of_core(prim_type type, uint64 num_indices, uint64 num_verts, const Index_Reader& read_indices,
+                                   Page_Cache<laml::Vec3>& positions, size_t memory, Scratch_File& kept, uint64& num_kept,
+                                   Cleanup_Stats& stats) {
+    uint32 per_element = (type == prim_type::triangles) ? 3 : 2;
+    uint64 num_elements = num_indices / per_element;
+    size_t buffer_bytes = std::max<size_t>(4096, memory / 16);
+
+    // degenerate and zero-area elements are dropped while the indices stream by. the others are
+    // written out twice: as they are, in order, and by their key, to be sorted
+    Scratch_File survivors, keys;
+    if (!survivors.open() || !keys.open()) {
+        return false;
+    }
+    uint64 num_survivors = 0;
+    {
+        Record_Writer<Element_Record> survivor_writer(survivors, buffer_bytes);
+        Record_Writer<Element_Record> key_writer(keys, buffer_bytes);
+        std::vector<uint32> indices(std::max<size_t>(1, buffer_bytes / sizeof(uint32) / per_element) * per_element);
+        for (uint64 first = 0; first < num_elements * per_element; first += indices.size()) {
+            size_t n = (size_t)std::min<uint64>(indices.size(), num_elements * per_element - first);
+            if (!read_indices(first, n, indices.data())) {
+                return false;
+            }
+
+            for (size_t i = 0; i < n; i += per_element) {
+                Element_Record element = {};
+                element.ordinal = (first + i) / per_element;
+                uint32 a = indices[i + 0];
+                uint32 b = indices[i + 1];
+                if (per_element == 3) {
+                    uint32 c = indices[i + 2];
+                    if (a == b || b == c || a == c || a >= num_verts || b >= num_verts || c >= num_verts) {
+                        stats.degenerate_removed++;
+                        continue;
+                    }
+                    // copies, a lookup can replace the page the one before it is in
+                    laml::Vec3 p0 = positions.get(a);
+                    laml::Vec3 p1 = positions.get(b);
+                    laml::Vec3 p2 = positions.get(c);
+                    if (is_zero_area(p0, p1, p2)) {
+                        stats.zero_area_removed++;
+                        continue;
+                    }
+                    element.index[0] = a; element.index[1] = b; element.index[2] = c;
+                    survivor_writer.push(element);
+
+                    while (a > b || a > c) {
+                        uint32 tmp = a; a = b; b = c; c = tmp;
+                    }
+                    element.index[0] = a; element.index[1] = b; element.index[2] = c;
+                    key_writer.push(element);
+                } else {
+                    if (a == b || a >= num_verts || b >= num_verts) {
+                        stats.degenerate_removed++;
+                        continue;
+                    }
+                    element.index[0] = a; element.index[1] = b;
+                    survivor_writer.push(element);
+
+                    element.index[0] = std::min(a, b); element.index[1] = std::max(a, b);
+                    key_writer.push(element);
+                }
+            }
+        }
+        num_survivors = survivor_writer.count;
+    }
+    if (positions.failed || survivors.failed || keys.failed) {
+        return false;
+    }
+
+    // sorted by key, every element but the first of its key is a duplicate
+    Scratch_File sorted_keys, duplicates, sorted_duplicates;
+    if (!sorted_keys.open() || !duplicates.open() || !sorted_duplicates.open()) {
+        return false;
+    }
+    auto key_less = [](const Element_Record& x, const Element_Record& y) {
+        for (uint32 k = 0; k < 3; k++) {
+            if (x.index[k] != y.index[k]) return x.index[k] < y.index[k];
+        }
+        return x.ordinal < y.ordinal;
+    };
+    if (!sort_records<Element_Record>(keys, num_survivors, memory, key_less, sorted_keys)) {
+        return false;
+    }
+    keys.close();
+
+    uint64 num_duplicates = 0;
+    {
+        Record_Reader<Element_Record> reader(sorted_keys, 0, num_survivors, buffer_bytes);
+        Record_Writer<uint64> writer(duplicates, buffer_bytes);
+        Element_Record previous = {};
+        bool32 first = true;
+        for (const Element_Record* element; (element = reader.peek()) != nullptr; reader.pop()) {
+            if (!first && memcmp(element->index, previous.index, sizeof(previous.index)) == 0) {
+                writer.push(element->ordinal);
+            }
+            previous = *element;
+            first = false;
+        }
+        num_duplicates = writer.count;
+    }
+    sorted_keys.close();
+    if (!sort_records<uint64>(duplicates, num_duplicates, memory, std::less<uint64>(), sorted_duplicates)) {
+        return false;
+    }
+    duplicates.close();
+    stats.duplicates_removed += (uint32)num_duplicates;
+
+    // the survivors in order, without the duplicates
+    num_kept = 0;
+    {
+        Record_Reader<Element_Record> survivor_reader(survivors, 0, num_survivors, buffer_bytes);
+        Record_Reader<uint64> duplicate_reader(sorted_duplicates, 0, num_duplicates, buffer_bytes);
+        Record_Writer<uint32> writer(kept, buffer_bytes);
+        for (const Element_Record* element; (element = survivor_reader.peek()) != nullptr; survivor_reader.pop()) {
+            const uint64* duplicate = duplicate_reader.peek();
+            if (duplicate && *duplicate == element->ordinal) {
+                duplicate_reader.pop();
+                continue;
+            }
+            for (uint32 k = 0; k < per_element; k++) {
+                writer.push(element->index[k]);
+            }
+        }
+        num_kept = writer.count;
+    }
+    return !survivors.failed && !sorted_duplicates.failed && !kept.failed;
+}
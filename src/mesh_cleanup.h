@@ -0,0 +1,37 @@
+#pragma once
+
+#include "mesh_converter.h"
+#include "external_memory.h"
+
+/****************************************
+*
+*   MESH CLEANUP
+*
+* ************************************/
+struct Cleanup_Stats {
+    uint32 degenerate_removed;  // repeated or out-of-range indices
+    uint32 zero_area_removed;   // distinct indices, but collinear/coincident positions
+    uint32 duplicates_removed;  // exact duplicate triangles (or line segments)
+    uint32 attributes_fixed;    // NaN/Inf/denormal components that were flushed to zero
+};
+
+// Removes degenerate, zero-area and duplicate triangles (and degenerate/duplicate line segments)
+// and flushes NaN/Inf/denormal vertex attributes to zero.
+void cleanup_primitive(Mesh_Primitive& prim, Cleanup_Stats& stats);
+
+// Runs cleanup_primitive on every primitive of every mesh in parallel, then logs the per-primitive counts.
+void cleanup_meshes(std::vector<Mesh>& meshes);
+
+// flushes NaN/Inf/denormal vertex attributes to zero, returns the number of components that changed
+uint32 sanitize_attributes(Mesh_Primitive& prim);
+uint32 sanitize_floats(real32* data, size_t count);
+
+// The index passes of cleanup_primitive, for a triangle or line primitive that does not fit in
+// memory (-max-memory). The indices are read in order through read_indices and the (sanitized)
+// positions looked up in a page cache. Duplicates are found by sorting the elements in scratch
+// files (external_memory.h), in about memory bytes. The indices kept are appended to kept, in
+// their order, and counted in stats (attributes_fixed is left to the caller)
+typedef std::function<bool32(uint64 first, size_t count, uint32* out)> Index_Reader;
+bool32 cleanup_indices_out_of_core(prim_type type, uint64 num_indices, uint64 num_verts, const Index_Reader& read_indices,
+                                   Page_Cache<laml::Vec3>& positions, size_t memory, Scratch_File& kept, uint64& num_kept,
+                                   Cleanup_Stats& stats);
@@ -1,4 +1,17 @@
 #include "mesh_converter.h"
+#include "static_batching.h"
+#include "mesh_cleanup.h"
+#include "file_writer.h"
+#include "chunk_file.h"
+#include "level_format.h"
+#include "anim_format.h"
+#include "material_format.h"
+#include "mesh_loader.h"
+#include "pack_file.h"
+#include "task_system.h"
+#include "conversion_cache.h"
+#include "checksum.h"
+#include "external_memory.h"
 
 // Define these only in *one* .cc file.
 #define TINYGLTF_IMPLEMENTATION
@@ -8,6 +21,11 @@
 #include "tinygltf/tiny_gltf.h"
 
 #include <unordered_set>
+#include <unordered_map>
+#include <cstdarg>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <time.h>       /* time_t, struct tm, difftime, time, mktime */
 
 // windows specific
@@ -33,6 +51,34 @@ const unsigned char* read_buffer_view(const tinygltf::Model& gltf_model, int buf
     return (buffer.data.data() + bufferView.byteOffset);
 }
 
+// -max-memory: where the bytes of a buffer are when it is left in its file instead of being
+// loaded (see read_gltf_json). accessors of such buffers are read from the file when extracted
+struct Buffer_File {
+    std::string filename;   // empty = in the model, like without -max-memory (data: uris)
+    uint64 offset = 0;      // of the buffer in the file: 0 for a .bin, the BIN chunk's for a .glb
+};
+
+// the buffer file of a buffer view, nullptr if it is in the model
+static const Buffer_File* buffer_view_file(const tinygltf::Model& gltf_model, const std::vector<Buffer_File>* files, int buffer_view_idx) {
+    if (files == nullptr) {
+        return nullptr;
+    }
+    int buffer = gltf_model.bufferViews[buffer_view_idx].buffer;
+    if (buffer < 0 || buffer >= (int)files->size() || (*files)[buffer].filename.empty()) {
+        return nullptr;
+    }
+    return &(*files)[buffer];
+}
+
+// bytes an accessor's elements cover in its buffer view
+static uint64 accessor_span(const tinygltf::Accessor& accessor, int stride) {
+    if (accessor.count == 0) {
+        return 0;
+    }
+    int element_size = tinygltf::GetNumComponentsInType(accessor.type) * tinygltf::GetComponentSizeInBytes(accessor.componentType);
+    return (uint64)(accessor.count - 1) * stride + element_size;
+}
+
 template<typename Component_Type>
 Component_Type read_component(int componentType, const uint8* cur_element) {
     switch (componentType) {
@@ -84,8 +130,37 @@ Component_Type read_component(int componentType, const uint8* cur_element) {
     return 0;
 }
 
+// converts count elements of an accessor, the first of them at raw_data, into out
+template<typename Element_Type, typename Component_Type>
+void convert_elements(const tinygltf::Accessor& accessor, int num_bytes_per_Element, const uint8* raw_data, size_t count, Element_Type* out) {
+    int num_components = tinygltf::GetNumComponentsInType(accessor.type);
+    int num_bytes_per_Component = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+
+    const uint8* cur_element = raw_data; // our current cursor
+    const uint8* cur_comp = cur_element;
+    for (size_t n = 0; n < count; n++) {
+        // for each type (SCALAR, VECn, MATn, etc..)
+        cur_element = raw_data + (n * num_bytes_per_Element);
+        Element_Type& element = out[n];
+
+        for (uint32 i = 0; i < num_components; i++) {
+            // if scalar, this just happens once per value of n.
+            // otherwise,this acts on each component of the output
+            // i.e. v.x, v.y, v.z for a VEC3
+
+            cur_comp = cur_element + (i * num_bytes_per_Component);
+
+            Component_Type comp = read_component<Component_Type>(accessor.componentType, cur_comp);
+            memcpy(((Component_Type*)(&element)) + (i), &comp, sizeof(Component_Type));
+        }
+    }
+}
+
+// files: with -max-memory, accessors of buffers left in their file are read from there, which
+// can fail (the file changed or went away). out is then left empty and false returned
 template<typename Element_Type, typename Component_Type>
-std::vector<Element_Type> extract_accessor(const tinygltf::Model& tinyModel, int accessor_idx, int level) {
+bool32 extract_accessor(const tinygltf::Model& tinyModel, int accessor_idx, int level, std::vector<Element_Type>& out,
+                        const std::vector<Buffer_File>* files = nullptr) {
     assert(accessor_idx >= 0);
 
     const tinygltf::Accessor& accessor = tinyModel.accessors[accessor_idx];
@@ -97,8 +172,6 @@ std::vector<Element_Type> extract_accessor(const tinygltf::Model& tinyModel, int
     //log_print(level, "accessor.componentType = %d\n", accessor.componentType);
     const tinygltf::BufferView bufferView = tinyModel.bufferViews[accessor.bufferView];
     accessor.byteOffset;
-    int num_components = tinygltf::GetNumComponentsInType(accessor.type);
-    int num_bytes_per_Component = tinygltf::GetComponentSizeInBytes(accessor.componentType);
     int num_bytes_per_Element = accessor.ByteStride(bufferView);
     //log_print(level, "num_components: %d\n", num_components);
     //log_print(level, "num_bytes_per_Component: %d\n", num_bytes_per_Component);
@@ -107,35 +180,108 @@ std::vector<Element_Type> extract_accessor(const tinygltf::Model& tinyModel, int
     //assert(num_components*num_bytes_per_Component == num_bytes_per_Element);
 
     const uint8* raw_data = read_buffer_view(tinyModel, accessor.bufferView); // ptr to start of byte stream for this accessor
-    const uint8* cur_element = raw_data; // our current cursor
-    const uint8* cur_comp = cur_element;
+    std::vector<uint8> file_data;
+    if (const Buffer_File* file = buffer_view_file(tinyModel, files, accessor.bufferView)) {
+        file_data.resize((size_t)accessor_span(accessor, num_bytes_per_Element));
+        FILE* fid = fopen(file->filename.c_str(), "rb");
+        bool32 read = fid != nullptr && utils::read_at(fid, file->offset + bufferView.byteOffset, file_data.data(), file_data.size());
+        if (fid) fclose(fid);
+        if (!read) {
+            level_print(level, "[ERROR] Failed to read accessor %d from '%s'\n", accessor_idx, file->filename.c_str());
+            out.clear();
+            return false;
+        }
+        raw_data = file_data.data();
+    }
 
-    std::vector<Element_Type> elements;
-    for (uint32 n = 0; n < accessor.count; n++) {
-        // for each type (SCALAR, VECn, MATn, etc..)
-        cur_element = raw_data + (n * num_bytes_per_Element);
-        Element_Type element;
+    out.resize(accessor.count);
+    convert_elements<Element_Type, Component_Type>(accessor, num_bytes_per_Element, raw_data, out.size(), out.data());
 
-        for (uint32 i = 0; i < num_components; i++) {
-            // if scalar, this just happens once per value of n.
-            // otherwise,this acts on each component of the output
-            // i.e. v.x, v.y, v.z for a VEC3
+    if (accessor.normalized) {}
 
-            cur_comp = cur_element + (i * num_bytes_per_Component);
+    return true;
+}
 
-            Component_Type comp = read_component<Component_Type>(accessor.componentType, cur_comp);
-            memcpy(((Component_Type*)(&element)) + (i), &comp, sizeof(Component_Type));
+// extract_accessor as a task of group, into out. failed is set if it fails
+template<typename Element_Type, typename Component_Type>
+void extract_accessor_task(Task_Group& group, const tinygltf::Model& tinyModel, int accessor_idx, int level, std::vector<Element_Type>& out,
+                           const std::vector<Buffer_File>* files, std::atomic<bool>& failed) {
+    group.run([&tinyModel, accessor_idx, level, &out, files, &failed]() {
+        if (!extract_accessor<Element_Type, Component_Type>(tinyModel, accessor_idx, level, out, files)) {
+            failed = true;
         }
+    });
+}
 
-        elements.push_back(element);
-    }
+// reads an accessor's elements a window at a time, from its buffer file or the model, for meshes
+// too large to extract whole (see Streamed_Mesh). like extract_accessor it ignores accessor.byteOffset
+struct Accessor_Stream {
+    const tinygltf::Accessor* accessor = nullptr;
+    uint64 count = 0;
+    int stride = 0;
+    int element_size = 0;
+    FILE* fid = nullptr;            // the buffer file, or
+    const uint8* data = nullptr;    // the buffer view in the model
+    uint64 offset = 0;              // of the buffer view in the file
+    std::vector<uint8> window;      // the bytes of the last read, from a file
+
+    Accessor_Stream() = default;
+    Accessor_Stream(const Accessor_Stream&) = delete;
+    Accessor_Stream& operator=(const Accessor_Stream&) = delete;
+    ~Accessor_Stream() { if (fid) fclose(fid); }
+
+    bool32 open(const tinygltf::Model& gltf_model, int accessor_idx, const std::vector<Buffer_File>* files) {
+        if (accessor_idx < 0 || accessor_idx >= (int)gltf_model.accessors.size()) {
+            return false;
+        }
+        accessor = &gltf_model.accessors[accessor_idx];
+        if (accessor->sparse.isSparse || accessor->bufferView < 0 || accessor->bufferView >= (int)gltf_model.bufferViews.size()) {
+            return false;
+        }
+        const tinygltf::BufferView& view = gltf_model.bufferViews[accessor->bufferView];
+        count = accessor->count;
+        stride = accessor->ByteStride(view);
+        element_size = tinygltf::GetNumComponentsInType(accessor->type) * tinygltf::GetComponentSizeInBytes(accessor->componentType);
+        if (stride <= 0 || element_size <= 0) {
+            return false;
+        }
 
-    if (accessor.normalized) {}
+        if (const Buffer_File* file = buffer_view_file(gltf_model, files, accessor->bufferView)) {
+            fid = fopen(file->filename.c_str(), "rb");
+            offset = file->offset + view.byteOffset;
+            return fid != nullptr;
+        }
+        data = read_buffer_view(gltf_model, accessor->bufferView);
+        return true;
+    }
 
-    return elements;
-}
+    // n elements, starting at element first, into out
+    template<typename Element_Type, typename Component_Type>
+    bool32 read(uint64 first, size_t n, Element_Type* out) {
+        if (first + n > count) {
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        const uint8* raw = data + first * stride;
+        if (fid != nullptr) {
+            window.resize((size_t)((n - 1) * stride + element_size));
+            if (!utils::read_at(fid, offset + first * stride, window.data(), window.size())) {
+                return false;
+            }
+            raw = window.data();
+        }
+        convert_elements<Element_Type, Component_Type>(*accessor, stride, raw, n, out);
+        return true;
+    }
+};
 
-void process_mesh(const tinygltf::Model& gltf_model, const tinygltf::Mesh& gltf_mesh, Mesh& mesh, bool has_skin, int level) {
+// files: see extract_accessor. without extract_vertices only the primitives' types and materials
+// are filled in, the arrays are left empty (out-of-core meshes, see Streamed_Mesh). false if an
+// accessor could not be read
+bool32 process_mesh(const tinygltf::Model& gltf_model, const tinygltf::Mesh& gltf_mesh, Mesh& mesh, bool has_skin, int level,
+                  const std::vector<Buffer_File>* files, bool32 extract_vertices) {
     int num_primitives = gltf_mesh.primitives.size();
     mesh.primitives.resize(num_primitives);
     mesh.is_rigged = has_skin;
@@ -157,11 +303,14 @@ void process_mesh(const tinygltf::Model& gltf_model, const tinygltf::Mesh& gltf_
     }
     mesh.is_collider = is_collider;
 
+    // the accessors are decoded in parallel, each into its own array of the primitive
+    Task_Group decode;
+    std::atomic<bool> failed(false);
     for (int n = 0; n < num_primitives; n++) {
         tinygltf::Primitive prim = gltf_mesh.primitives[n];
 
         if (!has_attribute(prim, "POSITION")) {
-            printf("[ERROR]  primitive is missing vertex positions!!!\n");
+            log_printf("[ERROR]  primitive is missing vertex positions!!!\n");
             assert(false);
         }
 
@@ -174,8 +323,10 @@ void process_mesh(const tinygltf::Model& gltf_model, const tinygltf::Mesh& gltf_
         }
         mesh.primitives[n].material_index = prim.material;
 
-        mesh.primitives[n].indices = extract_accessor<uint32, uint32>(gltf_model, prim.indices, level + 1);
-        mesh.primitives[n].positions = extract_accessor<laml::Vec3, real32>(gltf_model, prim.attributes["POSITION"], level + 1);
+        if (extract_vertices) {
+            extract_accessor_task<uint32, uint32>(decode, gltf_model, prim.indices, level + 1, mesh.primitives[n].indices, files, failed);
+            extract_accessor_task<laml::Vec3, real32>(decode, gltf_model, prim.attributes["POSITION"], level + 1, mesh.primitives[n].positions, files, failed);
+        }
 
         mesh.primitives[n].prim_type = prim_type::NONE;
         if (prim.mode == TINYGLTF_MODE_TRIANGLES) {
@@ -183,53 +334,59 @@ void process_mesh(const tinygltf::Model& gltf_model, const tinygltf::Mesh& gltf_
 
             // determine missing attributes
             if (!has_attribute(prim, "NORMAL")) {
-                printf("[WARNING]  primitive is missing normals\n");
+                log_printf("[WARNING]  primitive is missing normals\n");
                 assert(false);
             }
             if (!has_attribute(prim, "TANGENT")) {
-                printf("[WARNING]  primitive is missing tangents\n");
+                log_printf("[WARNING]  primitive is missing tangents\n");
                 assert(false);
             }
             if (!has_attribute(prim, "TEXCOORD_0")) {
-                printf("[WARNING]  primitive is missing uv-coords\n");
+                log_printf("[WARNING]  primitive is missing uv-coords\n");
                 assert(false);
             }
 
-            mesh.primitives[n].normals = extract_accessor<laml::Vec3, real32>(gltf_model, prim.attributes["NORMAL"], level + 1);
-            mesh.primitives[n].tangents_4 = extract_accessor<laml::Vec4, real32>(gltf_model, prim.attributes["TANGENT"], level + 1);
-            mesh.primitives[n].texcoords = extract_accessor<laml::Vec2, real32>(gltf_model, prim.attributes["TEXCOORD_0"], level + 1);
+            if (extract_vertices) {
+                extract_accessor_task<laml::Vec3, real32>(decode, gltf_model, prim.attributes["NORMAL"], level + 1, mesh.primitives[n].normals, files, failed);
+                extract_accessor_task<laml::Vec4, real32>(decode, gltf_model, prim.attributes["TANGENT"], level + 1, mesh.primitives[n].tangents_4, files, failed);
+                extract_accessor_task<laml::Vec2, real32>(decode, gltf_model, prim.attributes["TEXCOORD_0"], level + 1, mesh.primitives[n].texcoords, files, failed);
+            }
 
             // check for skinning data if skinned
             if (has_skin) {
                 // determine missing attributes
                 if (!has_attribute(prim, "JOINTS_0")) {
-                    printf("[WARNING]  primitive is missing bone indices!!!\n");
+                    log_printf("[WARNING]  primitive is missing bone indices!!!\n");
                     assert(false);
                 }
                 if (!has_attribute(prim, "WEIGHTS_0")) {
-                    printf("[ERROR]  primitive is missing bone weights!!!\n");
+                    log_printf("[ERROR]  primitive is missing bone weights!!!\n");
                     assert(false);
                 }
 
-                mesh.primitives[n].bone_weights = extract_accessor<laml::Vec4, real32>(gltf_model, prim.attributes["WEIGHTS_0"], level + 1);
-                mesh.primitives[n].bone_indices = extract_accessor<laml::Vector<int32, 4>, int32>(gltf_model, prim.attributes["JOINTS_0"], level + 1);
+                if (extract_vertices) {
+                    extract_accessor_task<laml::Vec4, real32>(decode, gltf_model, prim.attributes["WEIGHTS_0"], level + 1, mesh.primitives[n].bone_weights, files, failed);
+                    extract_accessor_task<laml::Vector<int32, 4>, int32>(decode, gltf_model, prim.attributes["JOINTS_0"], level + 1, mesh.primitives[n].bone_indices, files, failed);
+                }
             }
         } else if (prim.mode == TINYGLTF_MODE_LINE) {
             mesh.primitives[n].prim_type = prim_type::lines;
 
             // determine missing attributes
             if (!has_attribute(prim, "NORMAL")) {
-                printf("[WARNING]  primitive is missing normals\n");
+                log_printf("[WARNING]  primitive is missing normals\n");
             }
             if (!has_attribute(prim, "TANGENT")) {
-                printf("[WARNING]  primitive is missing tangents\n");
+                log_printf("[WARNING]  primitive is missing tangents\n");
             }
             if (!has_attribute(prim, "TEXCOORD_0")) {
-                printf("[WARNING]  primitive is missing uv-coords\n");
+                log_printf("[WARNING]  primitive is missing uv-coords\n");
             }
         }
         assert(mesh.primitives[n].prim_type != prim_type::NONE);
     }
+    decode.wait();
+    return !failed;
 }
 
 
@@ -286,8 +443,8 @@ std::string merge_ambient_and_metallic_roughness(const tinygltf::Model& gltf_mod
     }
 
     // otherwise: need to merge the two textures into 1
-    printf("[WARNING] Material contains different textures for Ambient and MetallicRoughness! Need to merge into a single AMR file.\n");
-    printf("[ERROR] Not supported right now...\n");
+    log_printf("[WARNING] Material contains different textures for Ambient and MetallicRoughness! Need to merge into a single AMR file.\n");
+    log_printf("[ERROR] Not supported right now...\n");
     has_texture = false;
     return std::string();
 }
@@ -311,12 +468,14 @@ void process_material(const tinygltf::Model& gltf_model, const tinygltf::Materia
 
     material.emissive_factor = utils::map_gltf_vec_to_vec3(gltf_mat.emissiveFactor);
     material.emissive_texture = get_gltf_texture_name(gltf_model, gltf_mat.emissiveTexture.index, material.emissive_has_texture);
+}
 
-    printf("Material: '%s'\n", gltf_mat.name.c_str());
-    if (material.diffuse_has_texture)  printf("  Diffuse Texture:  '%s'\n", material.diffuse_texture.c_str());
-    if (material.normal_has_texture)   printf("  Normal Texture:   '%s'\n", material.normal_texture.c_str());
-    if (material.amr_has_texture)      printf("  A/M/R Texture:    '%s'\n", material.amr_texture.c_str());
-    if (material.emissive_has_texture) printf("  Emissive Texture: '%s'\n", material.emissive_texture.c_str());
+void print_material(const Material& material) {
+    log_printf("Material: '%s'\n", material.name.c_str());
+    if (material.diffuse_has_texture)  log_printf("  Diffuse Texture:  '%s'\n", material.diffuse_texture.c_str());
+    if (material.normal_has_texture)   log_printf("  Normal Texture:   '%s'\n", material.normal_texture.c_str());
+    if (material.amr_has_texture)      log_printf("  A/M/R Texture:    '%s'\n", material.amr_texture.c_str());
+    if (material.emissive_has_texture) log_printf("  Emissive Texture: '%s'\n", material.emissive_texture.c_str());
 }
 
 
@@ -400,7 +559,9 @@ void traverse_bones(const tinygltf::Model& gltf_model,
     }
 }
 
-void extract_bind_pose(const tinygltf::Model& gltf_model, const tinygltf::Skin& gltf_skin, Mesh& mesh, int level) {
+// false if the inverse bind matrices could not be read, see extract_accessor
+bool32 extract_bind_pose(const tinygltf::Model& gltf_model, const tinygltf::Skin& gltf_skin, Mesh& mesh, int level,
+                         const std::vector<Buffer_File>* files = nullptr) {
     std::vector<Bone> bones;
     const tinygltf::Node& root_joint = gltf_model.nodes[gltf_skin.joints[0]];
     if (root_joint.name != "root") {
@@ -411,7 +572,10 @@ void extract_bind_pose(const tinygltf::Model& gltf_model, const tinygltf::Skin&
     uint32 num_joints = gltf_skin.joints.size();
     level_print(level+1, "Found %d/%d bones!\n", bones.size(), num_joints);
 
-    std::vector<laml::Mat4> inverseBindMatrices = extract_accessor<laml::Mat4, real32>(gltf_model, gltf_skin.inverseBindMatrices, 0);
+    std::vector<laml::Mat4> inverseBindMatrices;
+    if (!extract_accessor<laml::Mat4, real32>(gltf_model, gltf_skin.inverseBindMatrices, 0, inverseBindMatrices, files)) {
+        return false;
+    }
 
     for (uint32 n = 0; n < bones.size(); n++) {
         laml::Mat4 diff = bones[n].inv_model_matrix - inverseBindMatrices[n];
@@ -420,11 +584,57 @@ void extract_bind_pose(const tinygltf::Model& gltf_model, const tinygltf::Skin&
     }
 
     mesh.skeleton.bones = bones;
+    return true;
+}
+
+// a node with a mesh, found by traverse_nodes and processed by its own task afterwards
+struct Mesh_Node {
+    const tinygltf::Node* node;
+    laml::Mat4 world_transform;
+    int level;
+    Log_Buffer* log; // reserved in the traversal's output where the mesh was found
+
+    // with -max-memory, see stream_meshes
+    const std::vector<Buffer_File>* buffer_files = nullptr; // where the buffers the mesh reads are
+    bool32 out_of_core = false; // too large to extract, only the layout is, see Streamed_Mesh
+};
+
+// false if its buffers could not be read
+bool32 process_mesh_node(const tinygltf::Model& gltf_model, const Mesh_Node& mesh_node, Mesh& mesh) {
+    const tinygltf::Node& gltf_node = *mesh_node.node;
+    bool has_skin = gltf_node.skin >= 0;
+    int level = mesh_node.level;
+
+    level_print(level, "%s Mesh: '%s'\n", has_skin ? "Animated" : "Static", gltf_model.meshes[gltf_node.mesh].name.c_str());
+    //mesh.local_matrix = node_local_transform;
+    mesh.transform = mesh_node.world_transform;
+    mesh.name = gltf_node.name;
+    if (!process_mesh(gltf_model, gltf_model.meshes[gltf_node.mesh], mesh, has_skin, level, mesh_node.buffer_files, !mesh_node.out_of_core)) {
+        return false;
+    }
+
+    if (has_skin) {
+        level_print(level, "NOT SUPPORTED RIGHT NOW!!\n");
+
+        const tinygltf::Skin& gltf_skin = gltf_model.skins[gltf_node.skin];
+        level_print(level, "Skeleton: '%s' (%d bones)\n", gltf_skin.name.c_str(), gltf_skin.joints.size());
+
+        if (!extract_bind_pose(gltf_model, gltf_skin, mesh, level, mesh_node.buffer_files)) {
+            return false;
+        }
+        //process_anim_mesh(gltf_model, gltf_model.meshes[gltf_node.mesh], mesh, level + 1);
+        //Skeleton skeleton;
+        //process_skin(gltf_model, gltf_model.skins[gltf_node.skin], skeleton, level + 1);
+        //assign_skeleton(&mesh, &skeleton);
+    }
+    return true;
 }
 
+// walks the node tree, logging into log, and collects the mesh nodes in order
 void traverse_nodes(const tinygltf::Model& gltf_model, 
                     const tinygltf::Node& gltf_node, 
-                    std::vector<Mesh>& out_meshes, 
+                    std::vector<Mesh_Node>& out_nodes, 
+                    Ordered_Log& log,
                     laml::Mat4& parent_transform, 
                     int level) {
 
@@ -432,7 +642,6 @@ void traverse_nodes(const tinygltf::Model& gltf_model,
 
     bool has_camera = gltf_node.camera >= 0; // unused
     bool has_mesh = gltf_node.mesh >= 0;
-    bool has_skin = gltf_node.skin >= 0;
 
     laml::Mat4 node_local_transform = get_node_local_transform(gltf_node);
     laml::Mat4 node_world_transform = laml::mul(parent_transform, node_local_transform);
@@ -445,26 +654,12 @@ void traverse_nodes(const tinygltf::Model& gltf_model,
     //printf("\n");
 
     if (has_mesh) {
-        level_print(level + 1, "%s Mesh: '%s'\n", has_skin ? "Animated" : "Static", gltf_model.meshes[gltf_node.mesh].name.c_str());
-        Mesh mesh;
-        //mesh.local_matrix = node_local_transform;
-        mesh.transform = node_world_transform;
-        mesh.name = gltf_node.name;
-        process_mesh(gltf_model, gltf_model.meshes[gltf_node.mesh], mesh, has_skin, level + 1);
-
-        if (has_skin) {
-            level_print(level + 1, "NOT SUPPORTED RIGHT NOW!!\n");
-
-            const tinygltf::Skin& gltf_skin = gltf_model.skins[gltf_node.skin];
-            level_print(level + 1, "Skeleton: '%s' (%d bones)\n", gltf_skin.name.c_str(), gltf_skin.joints.size());
-
-            extract_bind_pose(gltf_model, gltf_skin, mesh, level+1);
-            //process_anim_mesh(gltf_model, gltf_model.meshes[gltf_node.mesh], mesh, level + 1);
-            //Skeleton skeleton;
-            //process_skin(gltf_model, gltf_model.skins[gltf_node.skin], skeleton, level + 1);
-            //assign_skeleton(&mesh, &skeleton);
-        }
-        out_meshes.push_back(mesh);
+        Mesh_Node mesh_node;
+        mesh_node.node = &gltf_node;
+        mesh_node.world_transform = node_world_transform;
+        mesh_node.level = level + 1;
+        mesh_node.log = &log.task();
+        out_nodes.push_back(mesh_node);
     }
 
     //if (node.children.size() > 0) { level_print(level, " %d Children: \n", node.children.size()); }
@@ -472,7 +667,7 @@ void traverse_nodes(const tinygltf::Model& gltf_model,
         // NOTE: this was passing in node_local_transform which doesnt make sense...
         //       could have been fine before since this path is separate than the path for skeletons
         //       need to confirm this is correct now.
-        traverse_nodes(gltf_model, gltf_model.nodes[gltf_node.children[n]], out_meshes, node_world_transform, level + 1);
+        traverse_nodes(gltf_model, gltf_model.nodes[gltf_node.children[n]], out_nodes, log, node_world_transform, level + 1);
     }
 }
 
@@ -485,160 +680,1345 @@ bool32 write_mesh_file(const Mesh& mesh,
 bool32 write_mat_file(const Material& mesh,
                       const std::string& root_folder,
                       const Options& opts);
+bool32 write_matb_file(const Material& mat,
+                       const std::string& root_folder,
+                       const Options& opts);
 bool32 write_level_file(const std::vector<Mesh>& meshes, 
                         const std::vector<Material>& materials, 
-                        const std::string& root_folder);
+                        const std::vector<Mesh_Batch>& batches,
+                        const std::string& root_folder,
+                        const Options& opts);
+static void reserve_output(const std::string& filename, const Options& opts);
+static bool32 open_output(File_Writer& out, const std::string& filename, const Options& opts);
+static bool32 close_output(File_Writer& out, const Options& opts);
+static std::string pack_entry_path(const std::string& filename, const Options& opts);
+struct Streamed_Mesh;
+static bool32 write_streamed_mesh_file(const Mesh& mesh, Streamed_Mesh& streamed,
+                                       const std::vector<Material>& materials,
+                                       const std::string& mesh_folder,
+                                       const Options& opts);
+
+// What was extracted from a model, for one set of the options extraction reads
+struct Extracted_Input {
+    uint64 key;
+    std::vector<Mesh> meshes;
+    std::vector<Material> materials;
+    std::vector<Animation> anims;
+};
+
+// a parsed input, and everything extracted from it so far
+struct Model_Cache_Entry {
+    std::string filename;
+    uint64 input_hash;
+    std::vector<Cached_Dependency> dependencies; // the .bin buffers and images it was parsed with
+    std::shared_ptr<tinygltf::Model> model;
+    std::vector<std::shared_ptr<const Extracted_Input>> extracted;
+    uint64 size = 0; // bytes of the buffers, images and extracted arrays, roughly what it holds on to
+};
+
+struct Model_Cache {
+    std::mutex mutex;
+    uint64 max_size;
+    uint64 size = 0;
+    std::list<std::shared_ptr<Model_Cache_Entry>> entries; // the most recently used first
+};
+
+// a conversion between its stages, see load_input
+struct Conversion_State {
+    std::shared_ptr<tinygltf::Model> gltf_model; // released once everything is extracted from it
+    std::string name;           // of the input file, without folder and extension
+
+    std::vector<Mesh> meshes;
+    std::vector<Material> materials;
+    std::vector<Animation> anims;
+
+    // with -cache
+    uint64 cache_key = 0;         // of the whole conversion, 0 = not cached
+    bool32 from_cache = false;    // unchanged, the outputs are copied from the cache
+    Cached_Conversion cached;     // dependencies, and the outputs when from_cache
+    std::deque<Cached_Output> outputs; // written so far, tasks fill in their own
+
+    // with Options::models
+    std::shared_ptr<Model_Cache_Entry> model_entry; // where the parsed model is kept
+
+    // with -max-memory, see stream_meshes
+    bool32 streaming = false;     // the meshes are extracted while they are written, the model is kept until then
+    std::vector<Buffer_File> buffer_files; // of every buffer of the model, see read_gltf_json
+};
+
+// -max-memory applies to mesh and level mode, but not with -batch (which needs every static mesh
+// at once) or a model cache (which keeps the whole model anyway)
+static bool32 streams_meshes(const Options& opts) {
+    return opts.max_memory != 0 && opts.mode != ANIM_MODE && !opts.batch_static && opts.models == nullptr;
+}
 
-bool convert_file(const Options& opts) {
-    printf("----------------Loading------------------\n");
-    printf("Loading file: '%s'\n", opts.input_filename.c_str());
+// images are only referred to by name, with -max-memory they are not decoded at all
+static bool skip_image_data(tinygltf::Image*, const int, std::string*, std::string*,
+                            int, int, const unsigned char*, int, void*) {
+    return true;
+}
+
+// a one byte buffer tinygltf loads instead of the real one
+static const char* placeholder_buffer_uri = "data:application/octet-stream;base64,AA==";
+
+// -max-memory: the json of a .gltf or .glb, with its buffers left in their files. Every buffer that
+// is not a data: uri becomes a placeholder for tinygltf, and files gets where its bytes are (the
+// .bin, or the .glb's BIN chunk), so nothing but the json is read here. Image buffer views are
+// pointed at the placeholder too, images are skipped anyway (skip_image_data)
+static bool32 read_gltf_json(const std::string& filename, bool32 binary, const std::string& root_folder,
+                             std::string& text, std::vector<std::string>& uris, std::vector<Buffer_File>& files) {
+    FILE* fid = fopen(filename.c_str(), "rb");
+    if (fid == nullptr) {
+        log_printf("Failed to open '%s'\n", filename.c_str());
+        return false;
+    }
+    uint64 file_size = utils::file_size(fid);
+
+    // .glb: header (magic, version, length), then the JSON chunk and the BIN chunk, each (length, type, data)
+    uint64 json_offset = 0;
+    uint64 json_size = file_size;
+    uint64 bin_offset = 0;
+    bool32 read = true;
+    if (binary) {
+        uint32 header[5] = {};
+        read = utils::read_at(fid, 0, header, sizeof(header)) && memcmp(header, "glTF", 4) == 0 && header[4] == 0x4E4F534A;
+        json_offset = sizeof(header);
+        json_size = header[3];
+        bin_offset = json_offset + ((json_size + 3) & ~3ull) + 2 * sizeof(uint32);
+    }
+    text.resize((size_t)json_size);
+    read = read && json_offset + json_size <= file_size && utils::read_at(fid, json_offset, &text[0], text.size());
+    fclose(fid);
+
+    nlohmann::json json = read ? nlohmann::json::parse(text, nullptr, false) : nlohmann::json();
+    if (!read || json.is_discarded() || !json.is_object()) {
+        log_printf("Failed to read the json of '%s'\n", filename.c_str());
+        return false;
+    }
+
+    auto buffers = json.find("buffers");
+    if (buffers != json.end() && buffers->is_array()) {
+        for (nlohmann::json& buffer : *buffers) {
+            std::string uri = buffer.value("uri", std::string());
+            uint64 size = buffer.value("byteLength", (uint64)0);
+            uris.push_back(uri);
+
+            Buffer_File file;
+            if (uri.compare(0, 5, "data:") == 0) {
+                files.push_back(file);
+                continue;
+            }
+            file.filename = uri.empty() ? filename : root_folder + uri;
+            file.offset = uri.empty() ? bin_offset : 0;
+
+            FILE* buffer_fid = fopen(file.filename.c_str(), "rb");
+            uint64 available = buffer_fid ? utils::file_size(buffer_fid) : 0;
+            if (buffer_fid) fclose(buffer_fid);
+            if (buffer_fid == nullptr || file.offset + size > available) {
+                log_printf("Buffer '%s' is missing or smaller than its byteLength (%llu bytes)\n", file.filename.c_str(), (unsigned long long)size);
+                return false;
+            }
+            files.push_back(file);
+
+            buffer["uri"] = placeholder_buffer_uri;
+            buffer["byteLength"] = 1;
+        }
+    }
+
+    auto images = json.find("images");
+    auto views = json.find("bufferViews");
+    if (images != json.end() && images->is_array() && views != json.end() && views->is_array()) {
+        for (const nlohmann::json& image : *images) {
+            int view = image.value("bufferView", -1);
+            if (view >= 0 && view < (int)views->size()) {
+                (*views)[(size_t)view]["byteOffset"] = 0;
+                (*views)[(size_t)view]["byteLength"] = 1;
+            }
+        }
+    }
+
+    text = json.dump();
+    return true;
+}
+
+Model_Cache* create_model_cache(uint64 max_size) {
+    Model_Cache* cache = new Model_Cache;
+    cache->max_size = max_size;
+    return cache;
+}
+
+void free_model_cache(Model_Cache* cache) {
+    delete cache;
+}
+
+uint32 model_cache_entries(Model_Cache* cache, uint64& size) {
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    size = cache->size;
+    return (uint32)cache->entries.size();
+}
+
+template<typename T>
+static uint64 array_size(const std::vector<T>& values) {
+    return values.size() * sizeof(T);
+}
+
+static uint64 model_size(const tinygltf::Model& model) {
+    uint64 size = 0;
+    for (const tinygltf::Buffer& buffer : model.buffers) {
+        size += array_size(buffer.data);
+    }
+    for (const tinygltf::Image& image : model.images) {
+        size += array_size(image.image);
+    }
+    return size;
+}
+
+static uint64 extracted_size(const Extracted_Input& extracted) {
+    uint64 size = 0;
+    for (const Mesh& mesh : extracted.meshes) {
+        for (const Mesh_Primitive& prim : mesh.primitives) {
+            size += array_size(prim.indices) + array_size(prim.positions) + array_size(prim.normals) +
+                array_size(prim.texcoords) + array_size(prim.tangents_4) + array_size(prim.bone_weights) +
+                array_size(prim.bone_indices);
+        }
+    }
+    for (const Animation& anim : extracted.anims) {
+        for (const BoneAnim& bone : anim.bones) {
+            size += array_size(bone.translation) + array_size(bone.rotation) + array_size(bone.scale);
+        }
+    }
+    return size;
+}
+
+// drops the least recently used entries until the cache fits, but always keeps the newest.
+// entries still used by a conversion stay alive until it is done with them
+static void trim_model_cache(Model_Cache& cache) {
+    while (cache.size > cache.max_size && cache.entries.size() > 1) {
+        cache.size -= cache.entries.back()->size;
+        cache.entries.pop_back();
+    }
+}
+
+// the entry of this input parsed from the same bytes (and the same .bin buffers and images),
+// made the most recently used. the older entry of a changed input is dropped
+static std::shared_ptr<Model_Cache_Entry> find_model(Model_Cache& cache, const std::string& filename, uint64 input_hash) {
+    std::shared_ptr<Model_Cache_Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto it = std::find_if(cache.entries.begin(), cache.entries.end(),
+            [&](const std::shared_ptr<Model_Cache_Entry>& e) { return e->filename == filename; });
+        if (it == cache.entries.end()) {
+            return nullptr;
+        }
+        entry = *it;
+        cache.entries.erase(it);
+        if (entry->input_hash == input_hash) {
+            cache.entries.push_front(entry);
+        } else {
+            cache.size -= entry->size;
+            return nullptr;
+        }
+    }
+
+    for (const Cached_Dependency& dep : entry->dependencies) {
+        uint64 hash;
+        if (!hash_file(dep.filename, hash) || hash != dep.hash) {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            auto it = std::find(cache.entries.begin(), cache.entries.end(), entry);
+            if (it != cache.entries.end()) {
+                cache.entries.erase(it);
+                cache.size -= entry->size;
+            }
+            return nullptr;
+        }
+    }
+    return entry;
+}
+
+static void add_model(Model_Cache& cache, const std::shared_ptr<Model_Cache_Entry>& entry) {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    entry->size = model_size(*entry->model);
+    cache.entries.push_front(entry);
+    cache.size += entry->size;
+    trim_model_cache(cache);
+}
+
+static void add_extracted(Model_Cache& cache, Model_Cache_Entry& entry, const std::shared_ptr<const Extracted_Input>& extracted) {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    uint64 size = extracted_size(*extracted);
+    entry.extracted.push_back(extracted);
+    entry.size += size;
+    if (std::find_if(cache.entries.begin(), cache.entries.end(),
+                     [&](const std::shared_ptr<Model_Cache_Entry>& e) { return e.get() == &entry; }) != cache.entries.end()) {
+        cache.size += size;
+        trim_model_cache(cache);
+    }
+}
+
+// everything extraction reads besides the model
+static uint64 extract_key(const Options& opts) {
+    Cache_Key key(opts.mode == ANIM_MODE);
+    key.add(opts.cleanup);
+    key.add(opts.frame_rate);
+    return key.hash;
+}
+
+// looks the input up in the cache, keyed by its bytes, name, mode and the options
+static void find_cached_conversion(const Options& opts, Conversion_State& state) {
+    uint64 input_hash;
+    if (!hash_file(opts.input_filename, input_hash)) {
+        return; // fails to load below
+    }
+    Cache_Key key(cache_key_base(opts));
+    key.add(input_hash);
+    key.add_string(state.name);
+    key.add(opts.mode);
+    state.cache_key = key.hash;
+
+    if (load_cached_conversion(*opts.cache, state.cache_key, state.cached)) {
+        state.from_cache = true;
+    }
+}
+
+// the other files the input read, so a changed buffer or image is a different conversion
+static bool32 find_dependencies(const tinygltf::Model& gltf_model, const std::string& root_folder, Cached_Conversion& cached) {
+    std::vector<std::string> uris;
+    for (const tinygltf::Buffer& buffer : gltf_model.buffers) {
+        uris.push_back(buffer.uri);
+    }
+    for (const tinygltf::Image& image : gltf_model.images) {
+        uris.push_back(image.uri);
+    }
+
+    for (const std::string& uri : uris) {
+        if (uri.empty() || uri.compare(0, 5, "data:") == 0) {
+            continue; // inside the input
+        }
+        Cached_Dependency dep;
+        dep.filename = root_folder + uri;
+        if (!hash_file(dep.filename, dep.hash)) {
+            return false;
+        }
+        cached.dependencies.push_back(dep);
+    }
+    return true;
+}
 
-    tinygltf::Model gltf_model;
+Conversion_State* load_input(const Options& opts) {
+    log_printf("----------------Loading------------------\n");
+    log_printf("Loading file: '%s'\n", opts.input_filename.c_str());
+
+    Conversion_State* state = new Conversion_State;
     tinygltf::TinyGLTF gltf_loader;
     std::string err;
     std::string warn;
         
     std::string rf, fn, ext;
     utils::decompose_path(opts.input_filename, rf, fn, ext);
-    printf("filename: %s\n", fn.c_str());
+    state->name = fn;
+    log_printf("filename: %s\n", fn.c_str());
+
+    if (opts.cache != nullptr) {
+        find_cached_conversion(opts, *state);
+        if (state->from_cache) {
+            log_printf("Unchanged since it was converted last, %d files are in the cache.\n", (int)state->cached.outputs.size());
+            return state;
+        }
+    }
+
+    uint64 input_hash = 0;
+    if (opts.models != nullptr && hash_file(opts.input_filename, input_hash)) {
+        state->model_entry = find_model(*opts.models, opts.input_filename, input_hash);
+        if (state->model_entry) {
+            log_printf("Unchanged since it was parsed last, using the model kept in memory.\n");
+            state->gltf_model = state->model_entry->model;
+            if (state->cache_key != 0) {
+                state->cached.dependencies = state->model_entry->dependencies;
+            }
+            return state;
+        }
+    }
+
+    state->gltf_model = std::make_shared<tinygltf::Model>();
+    tinygltf::Model& gltf_model = *state->gltf_model;
+    if (streams_meshes(opts)) {
+        gltf_loader.SetImageLoader(skip_image_data, nullptr);
+    }
     bool ret = false;
-    if (ext == ".glb") {
+    if (streams_meshes(opts) && (ext == ".glb" || ext == ".gltf")) {
+        // only the json, buffers are read from their files while the meshes are extracted
+        std::string json;
+        std::vector<std::string> uris;
+        if (read_gltf_json(opts.input_filename, ext == ".glb", rf, json, uris, state->buffer_files)) {
+            ret = gltf_loader.LoadASCIIFromString(&gltf_model, &err, &warn, json.c_str(), (unsigned int)json.size(), rf);
+        }
+        for (uint32 n = 0; ret && n < gltf_model.buffers.size() && n < uris.size(); n++) {
+            gltf_model.buffers[n].uri = uris[n];
+            if (!state->buffer_files[n].filename.empty()) {
+                std::vector<unsigned char>().swap(gltf_model.buffers[n].data);
+            }
+        }
+    } else if (ext == ".glb") {
         ret = gltf_loader.LoadBinaryFromFile(&gltf_model, &err, &warn, opts.input_filename);
     } else if (ext == ".gltf") {
         ret = gltf_loader.LoadASCIIFromFile(&gltf_model, &err, &warn, opts.input_filename);
     } else {
-        printf("Unknown file extension: [%s]\n", ext.c_str());
+        log_printf("Unknown file extension: [%s]\n", ext.c_str());
     }
 
     if (!warn.empty()) {
-        printf("Warn: %s\n", warn.c_str());
+        log_printf("Warn: %s\n", warn.c_str());
     }
 
     if (!err.empty()) {
-        printf("Err: %s\n", err.c_str());
+        log_printf("Err: %s\n", err.c_str());
     }
 
     if (!ret) {
-        printf("Failed to parse glTF\n");
-        return false;
+        log_printf("Failed to parse glTF\n");
+        delete state;
+        return nullptr;
     }
 
-    printf("%s file parsed.\n", ext.c_str());
-    bool32 success = true;
+    log_printf("%s file parsed.\n", ext.c_str());
 
-    // Extract all meshes from the file
-    std::vector<Mesh> extracted_meshes;
+    if (state->cache_key != 0 && !find_dependencies(gltf_model, rf, state->cached)) {
+        state->cache_key = 0;
+    }
+
+    // kept for the next conversion of the same input
+    Cached_Conversion dependencies;
+    if (opts.models != nullptr && input_hash != 0 && find_dependencies(gltf_model, rf, dependencies)) {
+        state->model_entry = std::make_shared<Model_Cache_Entry>();
+        state->model_entry->filename = opts.input_filename;
+        state->model_entry->input_hash = input_hash;
+        state->model_entry->dependencies = dependencies.dependencies;
+        state->model_entry->model = state->gltf_model;
+        add_model(*opts.models, state->model_entry);
+    }
+    return state;
+}
+
+// every material of the file
+static void extract_materials(Conversion_State& state) {
+    const tinygltf::Model& gltf_model = *state.gltf_model;
+    std::vector<Material>& extracted_materials = state.materials;
+
+    // Extract all materials from the file, in parallel. logged afterwards, in order
+    extracted_materials.resize(gltf_model.materials.size());
+    parallel_for(extracted_materials.size(), [&](uint32 mat_idx) {
+        process_material(gltf_model, gltf_model.materials[mat_idx], extracted_materials[mat_idx]);
+    });
+    for (const Material& mat : extracted_materials) {
+        print_material(mat);
+    }
+    log_printf("Extracted %d materials.\n", (int)extracted_materials.size());
+    log_printf("-----------------------------------------\n");
+}
+
+// meshes and materials of the first scene. false if a mesh could not be extracted
+static bool32 extract_scene(const Options& opts, Conversion_State& state) {
+    const tinygltf::Model& gltf_model = *state.gltf_model;
+    std::vector<Mesh>& extracted_meshes = state.meshes;
+
+    // Extract all meshes from the file. The node tree is walked first, then every mesh node
+    // is processed by its own task. Each task logs into the place the walk reserved for it,
+    // so the output reads the same as a serial run
     for (int scene_idx = 0; scene_idx < gltf_model.scenes.size(); scene_idx++) {
         if (scene_idx > 0) {
-            printf("[WARNING] Ignoring all scenes but the first!\n");
+            log_printf("[WARNING] Ignoring all scenes but the first!\n");
             break;
         }
         const tinygltf::Scene& scene = gltf_model.scenes[scene_idx];
-        printf("Scene: %s\n", scene.name.c_str());
+        log_printf("Scene: %s\n", scene.name.c_str());
 
-        // loop through all the top-level nodes
-        for (int n = 0; n < scene.nodes.size(); n++) {
-            int node_idx = scene.nodes[n];
-            const tinygltf::Node& node = gltf_model.nodes[node_idx];
-            traverse_nodes(gltf_model, node, extracted_meshes, laml::Mat4(1.0f), 1);
+        {
+            Ordered_Log log;
+            std::vector<Mesh_Node> mesh_nodes;
+
+            // loop through all the top-level nodes
+            for (int n = 0; n < scene.nodes.size(); n++) {
+                int node_idx = scene.nodes[n];
+                const tinygltf::Node& node = gltf_model.nodes[node_idx];
+                traverse_nodes(gltf_model, node, mesh_nodes, log, laml::Mat4(1.0f), 1);
+            }
+
+            extracted_meshes.resize(mesh_nodes.size());
+            Task_Group extract;
+            std::atomic<bool> failed(false);
+            for (uint32 n = 0; n < mesh_nodes.size(); n++) {
+                extract.run([&gltf_model, &mesh_nodes, &extracted_meshes, &failed, n]() {
+                    Log_Scope scope(mesh_nodes[n].log);
+                    if (!process_mesh_node(gltf_model, mesh_nodes[n], extracted_meshes[n])) {
+                        failed = true;
+                    }
+                });
+            }
+            extract.wait();
+            if (failed) {
+                log_printf("[ERROR] Failed to extract the meshes\n");
+                return false;
+            }
         }
-        printf("Extracted %d meshes.\n", (int)extracted_meshes.size());
+        log_printf("Extracted %d meshes.\n", (int)extracted_meshes.size());
     }
-    printf("-----------------------------------------\n");
+    log_printf("-----------------------------------------\n");
+
+    // Remove degenerate/duplicate geometry before anything else touches it
+    if (opts.cleanup) {
+        log_printf("Cleaning up meshes...\n");
+        cleanup_meshes(extracted_meshes);
+        log_printf("-----------------------------------------\n");
+    }
+
+    extract_materials(state);
+    return true;
+}
 
-    // Extract all materials from the file
-    std::vector<Material> extracted_materials;
-    for (int mat_idx = 0; mat_idx < gltf_model.materials.size(); mat_idx++) {
-        const tinygltf::Material& gltf_mat = gltf_model.materials[mat_idx];
+static std::string format_string(const char* format, ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    return buffer;
+}
 
-        Material new_mat;
-        process_material(gltf_model, gltf_mat, new_mat);
-        extracted_materials.push_back(new_mat);
+// Cache keys of the outputs: everything their writer reads, on top of cache_key_base()
+static void add_skeleton(Cache_Key& key, const Skeleton& skeleton) {
+    key.add((uint64)skeleton.bones.size());
+    for (const Bone& bone : skeleton.bones) {
+        key.add(bone.parent_idx);
+        key.add(bone.local_matrix);
+        key.add(bone.inv_model_matrix);
+        key.add_string(bone.name);
+        key.add(bone.node_idx);
+        key.add(bone.bone_idx);
     }
-    printf("Extracted %d materials.\n", (int)extracted_materials.size());
-    printf("-----------------------------------------\n");
+}
 
-    // Write each render mesh to its own file
-    printf("Writing mesh files...\n");
-    _mkdir(opts.output_folder.c_str());
-    std::string mesh_folder = opts.output_folder;
-    if (opts.mode == LEVEL_MODE) {
-        mesh_folder = mesh_folder + '\\' + "render_meshes";
+static uint64 mesh_cache_key(const Mesh& mesh, const std::vector<Material>& materials, const Options& opts) {
+    Cache_Key key(cache_key_base(opts));
+    key.add_string(".mesh");
+    key.add(mesh.transform);
+    key.add(mesh.is_rigged);
+    key.add(mesh.is_collider);
+    key.add_string(mesh.mesh_name);
+    key.add_string(mesh.name);
+    key.add((uint64)mesh.primitives.size());
+    for (const Mesh_Primitive& prim : mesh.primitives) {
+        key.add(prim.material_index);
+        key.add_string(prim.material_index >= 0 && (size_t)prim.material_index < materials.size() ? materials[prim.material_index].name : "");
+        key.add_string(prim.default_mat_name);
+        key.add(prim.prim_type);
+        key.add_array(prim.indices);
+        key.add_array(prim.positions);
+        key.add_array(prim.normals);
+        key.add_array(prim.texcoords);
+        key.add_array(prim.tangents_4);
+        key.add_array(prim.bone_weights);
+        key.add_array(prim.bone_indices);
     }
-    _mkdir(mesh_folder.c_str());
-    std::unordered_set<std::string> written_meshes; // to catch duplicates
-    for (int n = 0; n < extracted_meshes.size(); n++) {
-        const Mesh& mesh = extracted_meshes[n];
+    add_skeleton(key, mesh.skeleton);
+    return key.hash;
+}
 
-        if (mesh.is_collider) continue;
+static uint64 material_cache_key(const Material& mat, const char* ext, const Options& opts) {
+    Cache_Key key(cache_key_base(opts));
+    key.add_string(ext);
+    key.add_string(mat.name);
+    key.add(mat.double_sided);
+    key.add(mat.diffuse_factor);
+    key.add_string(mat.diffuse_texture);
+    key.add(mat.diffuse_has_texture);
+    key.add(mat.normal_scale);
+    key.add_string(mat.normal_texture);
+    key.add(mat.normal_has_texture);
+    key.add(mat.ambient_strength);
+    key.add(mat.metallic_factor);
+    key.add(mat.roughness_factor);
+    key.add_string(mat.amr_texture);
+    key.add(mat.amr_has_texture);
+    key.add(mat.emissive_factor);
+    key.add_string(mat.emissive_texture);
+    key.add(mat.emissive_has_texture);
+    return key.hash;
+}
 
-        if (written_meshes.find(mesh.mesh_name) == written_meshes.end()) {
-            printf("  Writing mesh %2d: '%s.mesh' [v%d]...", 1 + (int)written_meshes.size(), mesh.mesh_name.c_str(), MESH_VERSION);
-            if (write_mesh_file(mesh, extracted_materials, mesh_folder, opts)) {
-                printf("done!\n");
-            } else {
-                printf("failed!\n");
-                success = false;
-            }
-            written_meshes.insert(mesh.mesh_name);
-        }
+static uint64 anim_cache_key(const Animation& anim, const Options& opts) {
+    Cache_Key key(cache_key_base(opts));
+    key.add_string(".anim");
+    add_skeleton(key, anim.skeleton);
+    key.add_string(anim.name);
+    key.add((uint64)anim.bones.size());
+    for (const BoneAnim& bone : anim.bones) {
+        key.add(bone.bone_idx);
+        key.add_array(bone.translation);
+        key.add_array(bone.rotation);
+        key.add_array(bone.scale);
     }
-    printf("Wrote %d files.\n", (int)written_meshes.size());
-    printf("-----------------------------------------\n");
+    key.add(anim.frame_rate);
+    key.add(anim.length);
+    key.add(anim.flag);
+    return key.hash;
+}
 
-    // Write materials
-    for (int n = 0; n < extracted_materials.size(); n++) {
-        const Material& mat = extracted_materials[n];
+// writes data as filename, the same way a writer would (into the pack, counted in the stats)
+static bool32 copy_output(const std::string& filename, const std::vector<uint8>& data, const Options& opts) {
+    File_Writer out;
+    if (!open_output(out, filename, opts)) {
+        log_printf("Failed to open output file '%s'...\n", filename.c_str());
+        return false;
+    }
+    out.write_bytes(data.data(), data.size());
+    return close_output(out, opts);
+}
 
-        printf("  Writing material %2d: '%s.matl' [v%d]...", 1 + (int)extracted_materials.size(), mat.name.c_str(), MAT_VERSION);
-        if (write_mat_file(mat, mesh_folder, opts)) {
-            printf("done!\n");
-        } else {
-            printf("failed!\n");
-            success = false;
+// The cache side of writing one output. Without a cache this just calls write. With one, an
+// output whose key is in the cache is copied from there (from_cache is set), anything else
+// is written and added to the cache. key() is only called with a cache, nullptr = no key,
+// the output is then only cached by its bytes, for the record of the whole conversion.
+// output is the record's entry for this file, its key is set once it is in the cache
+static bool32 write_output(const std::string& filename, const std::function<uint64()>& key, Cached_Output& output,
+                           const Options& opts, const std::function<bool32(const Options&)>& write, bool32& from_cache) {
+    from_cache = false;
+    if (opts.cache == nullptr) {
+        return write(opts);
+    }
+
+    uint64 output_key = key ? key() : 0;
+    std::vector<uint8> data;
+    if (output_key != 0 && load_cached_output(*opts.cache, output_key, data)) {
+        if (!copy_output(filename, data, opts)) {
+            return false;
         }
+        opts.cache->num_hits++;
+        output.key = output_key;
+        from_cache = true;
+        return true;
     }
-    printf("Wrote %d files.\n", (int)written_meshes.size());
-    printf("-----------------------------------------\n");
 
-    // Write collision meshes to files
-    printf("Writing collider files...\n");
-    std::string collision_folder = opts.output_folder;
-    if (opts.mode == LEVEL_MODE) {
-        collision_folder = collision_folder + '\\' + "collision_meshes";
+    // written with a copy of every byte kept in data
+    Options capture_opts = opts;
+    capture_opts.capture = &data;
+    if (!write(capture_opts)) {
+        return false;
+    }
+    if (output_key == 0) {
+        output_key = content_hash(data.data(), data.size());
     }
-    _mkdir(collision_folder.c_str());
-    written_meshes.clear(); // to catch duplicates
-    for (int n = 0; n < extracted_meshes.size(); n++) {
-        const Mesh& mesh = extracted_meshes[n];
+    store_cached_output(*opts.cache, output_key, data);
+    opts.cache->num_misses++;
+    output.key = output_key;
+    return true;
+}
 
-        if (!mesh.is_collider) continue;
+// the record entry of an output, in the order the outputs are submitted
+static Cached_Output& record_output(Conversion_State& state, const std::string& filename, const Options& opts) {
+    Cached_Output& output = state.outputs.emplace_back();
+    output.path = pack_entry_path(filename, opts);
+    return output;
+}
 
-        if (written_meshes.find(mesh.mesh_name) == written_meshes.end()) {
-            printf("  Writing mesh %2d: '%s.mesh' [v%d]...", 1 + (int)written_meshes.size(), mesh.mesh_name.c_str(), MESH_VERSION);
-            if (write_mesh_file(mesh, extracted_materials, collision_folder, opts)) {
-                printf("done!\n");
-            } else {
-                printf("failed!\n");
-                success = false;
+// every output of an unchanged conversion, copied from the cache in the order they were written
+static bool restore_outputs(const Options& opts, const Conversion_State& state) {
+    log_printf("Copying files from the cache...\n");
+    if (opts.pack == nullptr) {
+        _mkdir(opts.output_folder.c_str());
+    }
+
+    bool32 success = true;
+    std::vector<uint8> data;
+    for (const Cached_Output& output : state.cached.outputs) {
+        std::string filename = opts.output_folder + '\\' + output.path;
+        if (opts.pack == nullptr) {
+            for (size_t slash = output.path.find('\\'); slash != std::string::npos; slash = output.path.find('\\', slash + 1)) {
+                _mkdir((opts.output_folder + '\\' + output.path.substr(0, slash)).c_str());
             }
-            written_meshes.insert(mesh.mesh_name);
         }
-    }
-    printf("Wrote %d files.\n", (int)written_meshes.size());
-    printf("-----------------------------------------\n");
 
-    // Write mesh paths to level file
-    if (opts.mode == LEVEL_MODE) {
-        printf("Writing level file: '%s' [v%d]...", fn.c_str(), LEVEL_VERSION);
-        if (write_level_file(extracted_meshes, extracted_materials, opts.output_folder + '\\' + fn)) {
-            printf("done!\n");
+        log_printf("  Copying '%s'...", output.path.c_str());
+        if (load_cached_output(*opts.cache, output.key, data) && copy_output(filename, data, opts)) {
+            opts.cache->num_hits++;
+            log_printf("done!\n");
+        } else {
+            log_printf("failed!\n");
+            success = false;
         }
-        else {
-            printf("failed!\n");
-            bool32 success = false;
+    }
+    log_printf("Copied %d files.\n", (int)state.cached.outputs.size());
+    log_printf("-----------------------------------------\n");
+    return success;
+}
+
+// write_scene's way of writing one output: (filename, log header, cache key, write)
+typedef std::function<void(const std::string&, const std::string&, std::function<uint64()>,
+                           std::function<bool32(const Options&)>)> Write_Task;
+
+// the buffers a mesh node reads: its primitives' accessors and its skin's inverse bind matrices
+static void mesh_node_buffers(const tinygltf::Model& gltf_model, const tinygltf::Node& node, std::vector<int>& buffers) {
+    std::vector<int> accessors;
+    for (const tinygltf::Primitive& prim : gltf_model.meshes[node.mesh].primitives) {
+        for (const auto& attribute : prim.attributes) {
+            accessors.push_back(attribute.second);
         }
-        printf("-----------------------------------------\n");
+        accessors.push_back(prim.indices);
+    }
+    if (node.skin >= 0) {
+        accessors.push_back(gltf_model.skins[node.skin].inverseBindMatrices);
+    }
+
+    for (int accessor : accessors) {
+        if (accessor < 0 || accessor >= (int)gltf_model.accessors.size()) continue;
+        int view = gltf_model.accessors[accessor].bufferView;
+        if (view < 0 || view >= (int)gltf_model.bufferViews.size()) continue;
+        int buffer = gltf_model.bufferViews[view].buffer;
+        if (std::find(buffers.begin(), buffers.end(), buffer) == buffers.end()) {
+            buffers.push_back(buffer);
+        }
+    }
+}
+
+// roughly what extracting and writing a mesh node holds on to: its vertex and index arrays as
+// extracted (see Mesh_Primitive), and about as much again while a file is encoded from them
+static uint64 mesh_node_memory(const tinygltf::Model& gltf_model, const tinygltf::Node& node) {
+    uint64 vertex_size = 2 * sizeof(laml::Vec3) + sizeof(laml::Vec2) + sizeof(laml::Vec4);
+    if (node.skin >= 0) {
+        vertex_size += sizeof(laml::Vec4) + sizeof(laml::Vector<int32, 4>);
+    }
+
+    uint64 size = 0;
+    for (const tinygltf::Primitive& prim : gltf_model.meshes[node.mesh].primitives) {
+        auto position = prim.attributes.find("POSITION");
+        uint64 num_verts = 0;
+        if (position != prim.attributes.end() && position->second < (int)gltf_model.accessors.size()) {
+            num_verts = gltf_model.accessors[position->second].count;
+        }
+        uint64 num_indices = num_verts;
+        if (prim.indices >= 0 && prim.indices < (int)gltf_model.accessors.size()) {
+            num_indices = gltf_model.accessors[prim.indices].count;
+        }
+        size += num_verts * vertex_size + num_indices * sizeof(uint32);
+    }
+    return 2 * size;
+}
+
+// grows bounds to take in p. has_bounds is false for the first point
+static void add_to_bounds(Mesh_Bounds& bounds, bool32& has_bounds, const laml::Vec3& p) {
+    for (uint32 k = 0; k < 3; k++) {
+        if (!has_bounds || p[k] < bounds.min[k]) bounds.min[k] = p[k];
+        if (!has_bounds || p[k] > bounds.max[k]) bounds.max[k] = p[k];
+    }
+    has_bounds = true;
+}
+
+// one primitive of a Streamed_Mesh
+struct Streamed_Prim {
+    prim_type type;
+    bool32 has_skin = false;
+    Accessor_Stream indices, positions, normals, tangents, texcoords, weights, joints;
+    uint64 num_verts = 0;
+    uint64 num_indices = 0;         // as written, after -cleanup
+
+    // -cleanup: the indices kept (uint32), the accessor's are written otherwise
+    bool32 cleaned = false;
+    Scratch_File kept;
+
+    // -split-streams: the weld of weld_positions
+    uint64 num_shadow_verts = 0;
+    Scratch_File shadow_verts;      // the source vertex of each welded vertex (uint32), ascending
+    Scratch_File shadow_remap;      // the welded vertex of each vertex (uint32)
+};
+
+// -max-memory: a mesh too large to extract. Its Mesh only has the layout (process_mesh without
+// extract_vertices), the vertices and indices are read from the buffers a window at a time, by
+// the passes of prepare_streamed_mesh and again while the file is written (write_streamed_mesh_file).
+// What does not fit in memory goes through scratch files (external_memory.h)
+struct Streamed_Mesh {
+    std::deque<Streamed_Prim> prims;
+    Mesh_Bounds bounds = {};
+    size_t memory = 0;          // each pass holds about this much
+    size_t window_verts = 0;    // vertices read at a time
+};
+
+// vertices [first, first + count) of a streamed primitive, into window's arrays, which the vertex
+// writers then take as a primitive of count vertices. without shading only the positions and skin
+// are read. on failure the window is zeroed, so the file still gets the sizes it was laid out with
+static bool32 read_vertex_window(Streamed_Prim& sp, uint64 first, size_t count, bool32 shading, bool32 sanitize,
+                                 Mesh_Primitive& window, uint32* fixed = nullptr) {
+    window.prim_type = sp.type;
+    window.positions.resize(count);
+    bool32 read = sp.positions.read<laml::Vec3, real32>(first, count, window.positions.data());
+    if (sp.type == prim_type::triangles && shading) {
+        window.normals.resize(count);
+        window.tangents_4.resize(count);
+        window.texcoords.resize(count);
+        read = read && sp.normals.read<laml::Vec3, real32>(first, count, window.normals.data());
+        read = read && sp.tangents.read<laml::Vec4, real32>(first, count, window.tangents_4.data());
+        read = read && sp.texcoords.read<laml::Vec2, real32>(first, count, window.texcoords.data());
+    } else {
+        window.normals.clear();
+        window.tangents_4.clear();
+        window.texcoords.clear();
+    }
+    if (sp.has_skin) {
+        window.bone_weights.resize(count);
+        window.bone_indices.resize(count);
+        read = read && sp.weights.read<laml::Vec4, real32>(first, count, window.bone_weights.data());
+        read = read && sp.joints.read<laml::Vector<int32, 4>, int32>(first, count, window.bone_indices.data());
+    }
+
+    if (!read) {
+        std::fill(window.positions.begin(), window.positions.end(), laml::Vec3(0.0f));
+        std::fill(window.normals.begin(), window.normals.end(), laml::Vec3(0.0f));
+        std::fill(window.tangents_4.begin(), window.tangents_4.end(), laml::Vec4(0.0f));
+        std::fill(window.texcoords.begin(), window.texcoords.end(), laml::Vec2(0.0f));
+        std::fill(window.bone_weights.begin(), window.bone_weights.end(), laml::Vec4(0.0f));
+        std::fill(window.bone_indices.begin(), window.bone_indices.end(), laml::Vector<int32, 4>(0));
+        return false;
+    }
+    if (sanitize) {
+        uint32 n = sanitize_attributes(window);
+        if (fixed) *fixed += n;
+    }
+    return true;
+}
+
+// indices [first, first + count) as written: the ones -cleanup kept, or the accessor's
+static bool32 read_streamed_indices(Streamed_Prim& sp, uint64 first, size_t count, uint32* out) {
+    bool32 read = sp.cleaned ? sp.kept.read(first * sizeof(uint32), out, count * sizeof(uint32))
+                             : sp.indices.read<uint32, uint32>(first, count, out);
+    if (!read) {
+        std::fill(out, out + count, 0u);
+    }
+    return read;
+}
+
+// weld_positions for a streamed primitive. Vertices are sorted by their weld key, every group
+// is represented by its first vertex, and welded vertices are numbered in the order of those,
+// which is the order weld_positions finds them in. shadow_remap gets the welded vertex of every
+// vertex, by sorting the (vertex, welded vertex) pairs back into vertex order
+static bool32 weld_streamed_prim(Streamed_Prim& sp, const Streamed_Mesh& streamed, const Options& opts) {
+    struct Weld_Record {
+        uint32 bits[11];
+        uint32 vertex;
+    };
+    auto weld_less = [](const Weld_Record& a, const Weld_Record& b) {
+        int c = memcmp(a.bits, b.bits, sizeof(a.bits));
+        return c != 0 ? c < 0 : a.vertex < b.vertex;
+    };
+    size_t buffer_bytes = std::max<size_t>(4096, streamed.memory / 16);
+
+    Scratch_File records, sorted, pairs, sorted_pairs, ranks, sorted_ranks;
+    if (!records.open() || !sorted.open() || !pairs.open() || !sorted_pairs.open() || !ranks.open() ||
+        !sorted_ranks.open() || !sp.shadow_verts.open() || !sp.shadow_remap.open()) {
+        return false;
+    }
+
+    {
+        Record_Writer<Weld_Record> writer(records, buffer_bytes);
+        Mesh_Primitive window;
+        for (uint64 first = 0; first < sp.num_verts; first += streamed.window_verts) {
+            size_t count = (size_t)std::min<uint64>(streamed.window_verts, sp.num_verts - first);
+            if (!read_vertex_window(sp, first, count, false, opts.cleanup, window)) {
+                return false;
+            }
+            for (size_t i = 0; i < count; i++) {
+                Weld_Record record = {};
+                laml::Vec3 p = window.positions[i];
+                for (uint32 k = 0; k < 3; k++) {
+                    if (p[k] == 0.0f) p[k] = 0.0f; // -0 and +0 weld together
+                }
+                memcpy(&record.bits[0], &p.x, 3*sizeof(real32));
+                if (sp.has_skin) {
+                    memcpy(&record.bits[3], &window.bone_indices[i].x, 4*sizeof(int32));
+                    memcpy(&record.bits[7], &window.bone_weights[i].x, 4*sizeof(real32));
+                }
+                record.vertex = (uint32)(first + i);
+                writer.push(record);
+            }
+        }
+    }
+    if (!sort_records<Weld_Record>(records, sp.num_verts, streamed.memory, weld_less, sorted)) {
+        return false;
+    }
+    records.close();
+
+    // (first vertex of the group << 32 | vertex), sorted so the groups come in first-vertex order
+    {
+        Record_Reader<Weld_Record> reader(sorted, 0, sp.num_verts, buffer_bytes);
+        Record_Writer<uint64> writer(pairs, buffer_bytes);
+        Weld_Record group = {};
+        bool32 first = true;
+        for (const Weld_Record* record; (record = reader.peek()) != nullptr; reader.pop()) {
+            if (first || memcmp(record->bits, group.bits, sizeof(group.bits)) != 0) {
+                group = *record;
+                first = false;
+            }
+            writer.push(((uint64)group.vertex << 32) | record->vertex);
+        }
+    }
+    sorted.close();
+    if (!sort_records<uint64>(pairs, sp.num_verts, streamed.memory, std::less<uint64>(), sorted_pairs)) {
+        return false;
+    }
+    pairs.close();
+
+    // the welded vertices, and (vertex << 32 | welded vertex) sorted back into vertex order
+    {
+        Record_Reader<uint64> reader(sorted_pairs, 0, sp.num_verts, buffer_bytes);
+        Record_Writer<uint32> verts(sp.shadow_verts, buffer_bytes);
+        Record_Writer<uint64> writer(ranks, buffer_bytes);
+        uint64 rank = 0;
+        uint32 group = 0;
+        for (const uint64* pair; (pair = reader.peek()) != nullptr; reader.pop()) {
+            uint32 rep = (uint32)(*pair >> 32);
+            if (verts.count == 0 || rep != group) {
+                group = rep;
+                rank = verts.count;
+                verts.push(rep);
+            }
+            writer.push(((*pair & 0xFFFFFFFFull) << 32) | rank);
+        }
+        sp.num_shadow_verts = verts.count;
+    }
+    sorted_pairs.close();
+    if (!sort_records<uint64>(ranks, sp.num_verts, streamed.memory, std::less<uint64>(), sorted_ranks)) {
+        return false;
+    }
+    ranks.close();
+
+    {
+        Record_Reader<uint64> reader(sorted_ranks, 0, sp.num_verts, buffer_bytes);
+        Record_Writer<uint32> writer(sp.shadow_remap, buffer_bytes);
+        for (const uint64* rank; (rank = reader.peek()) != nullptr; reader.pop()) {
+            writer.push((uint32)*rank);
+        }
+    }
+    return !sorted_ranks.failed && !sp.shadow_verts.failed && !sp.shadow_remap.failed;
+}
+
+// opens the accessors of a streamed mesh and runs what write_mesh_file would do in memory
+// before writing: bounds, -cleanup (logged like cleanup_meshes) and the -split-streams weld
+static bool32 prepare_streamed_mesh(const tinygltf::Model& gltf_model, const Mesh_Node& mesh_node, const Mesh& mesh,
+                                    Streamed_Mesh& streamed, const Options& opts) {
+    const tinygltf::Mesh& gltf_mesh = gltf_model.meshes[mesh_node.node->mesh];
+    const std::vector<Buffer_File>* files = mesh_node.buffer_files;
+
+    uint64 vertex_size = 2 * sizeof(laml::Vec3) + sizeof(laml::Vec2) + 2 * sizeof(laml::Vec4) + sizeof(laml::Vector<int32, 4>);
+    streamed.memory = (size_t)std::min<uint64>(opts.max_memory, SIZE_MAX / 4);
+    streamed.window_verts = (size_t)std::max<uint64>(1024, streamed.memory / 8 / vertex_size);
+
+    if (opts.compress || opts.geometry_codec) {
+        log_printf("[WARNING] '%s' does not fit in -max-memory, its arrays are written without -compress/-geometry-codec\n",
+            mesh.mesh_name.c_str());
+    }
+
+    bool32 has_bounds = false;
+    std::vector<Cleanup_Stats> stats(mesh.primitives.size());
+    for (uint32 n = 0; n < mesh.primitives.size(); n++) {
+        const tinygltf::Primitive& gltf_prim = gltf_mesh.primitives[n];
+        auto attribute = [&](const char* name) {
+            auto it = gltf_prim.attributes.find(name);
+            return it == gltf_prim.attributes.end() ? -1 : it->second;
+        };
+
+        Streamed_Prim& sp = streamed.prims.emplace_back();
+        sp.type = mesh.primitives[n].prim_type;
+        sp.has_skin = mesh.is_rigged && sp.type == prim_type::triangles;
+        bool32 opened = sp.indices.open(gltf_model, gltf_prim.indices, files) &&
+                        sp.positions.open(gltf_model, attribute("POSITION"), files);
+        sp.num_verts = sp.positions.count;
+        sp.num_indices = sp.indices.count;
+        if (sp.type == prim_type::triangles) {
+            opened = opened && sp.normals.open(gltf_model, attribute("NORMAL"), files) && sp.normals.count >= sp.num_verts &&
+                               sp.tangents.open(gltf_model, attribute("TANGENT"), files) && sp.tangents.count >= sp.num_verts &&
+                               sp.texcoords.open(gltf_model, attribute("TEXCOORD_0"), files) && sp.texcoords.count >= sp.num_verts;
+        }
+        if (sp.has_skin) {
+            opened = opened && sp.weights.open(gltf_model, attribute("WEIGHTS_0"), files) && sp.weights.count >= sp.num_verts &&
+                               sp.joints.open(gltf_model, attribute("JOINTS_0"), files) && sp.joints.count >= sp.num_verts;
+        }
+        if (!opened) {
+            log_printf("[ERROR] '%s' prim %d: can not read its accessors from the buffers\n", mesh.mesh_name.c_str(), n);
+            return false;
+        }
+        if (sp.num_verts > 0xFFFFFFFFull || sp.num_indices > 0xFFFFFFFFull) {
+            log_printf("[ERROR] '%s' prim %d: more than 2^32 vertices or indices do not fit in a .mesh\n", mesh.mesh_name.c_str(), n);
+            return false;
+        }
+
+        // bounds, and the attributes -cleanup fixes (it fixes them again as they are written)
+        Mesh_Primitive window;
+        for (uint64 first = 0; first < sp.num_verts; first += streamed.window_verts) {
+            size_t count = (size_t)std::min<uint64>(streamed.window_verts, sp.num_verts - first);
+            if (!read_vertex_window(sp, first, count, true, opts.cleanup, window, &stats[n].attributes_fixed)) {
+                log_printf("[ERROR] '%s' prim %d: failed to read its vertices\n", mesh.mesh_name.c_str(), n);
+                return false;
+            }
+            for (const laml::Vec3& p : window.positions) {
+                add_to_bounds(streamed.bounds, has_bounds, p);
+            }
+        }
+
+        if (opts.cleanup && (sp.type == prim_type::triangles || sp.type == prim_type::lines)) {
+            Page_Cache<laml::Vec3> positions;
+            positions.init(sp.num_verts, streamed.memory / 4, [&sp](uint64 first, size_t count, laml::Vec3* out) {
+                if (!sp.positions.read<laml::Vec3, real32>(first, count, out)) {
+                    return (bool32)false;
+                }
+                sanitize_floats(&out[0].x, count * 3);
+                return (bool32)true;
+            });
+            Index_Reader read_indices = [&sp](uint64 first, size_t count, uint32* out) {
+                return sp.indices.read<uint32, uint32>(first, count, out);
+            };
+            uint64 num_kept = 0;
+            if (!sp.kept.open() || !cleanup_indices_out_of_core(sp.type, sp.num_indices, sp.num_verts, read_indices, positions,
+                                                                streamed.memory / 2, sp.kept, num_kept, stats[n])) {
+                log_printf("[ERROR] '%s' prim %d: cleanup failed, out of scratch space?\n", mesh.mesh_name.c_str(), n);
+                return false;
+            }
+            sp.cleaned = true;
+            sp.num_indices = num_kept;
+        }
+
+        if (opts.split_streams && !opts.shared_buffers && !weld_streamed_prim(sp, streamed, opts)) {
+            log_printf("[ERROR] '%s' prim %d: welding the shadow vertices failed, out of scratch space?\n", mesh.mesh_name.c_str(), n);
+            return false;
+        }
+    }
+
+    if (opts.cleanup) {
+        uint32 total_removed = 0;
+        for (uint32 n = 0; n < stats.size(); n++) {
+            const Cleanup_Stats& s = stats[n];
+            total_removed += s.degenerate_removed + s.zero_area_removed + s.duplicates_removed;
+            log_printf("  '%s' prim %d: removed %d degenerate, %d zero-area, %d duplicate; fixed %d attributes\n",
+                   mesh.mesh_name.c_str(), n, s.degenerate_removed, s.zero_area_removed, s.duplicates_removed, s.attributes_fixed);
+        }
+        log_printf("Cleaned %d primitives, removed %d elements.\n", (int)stats.size(), total_removed);
+    }
+    return true;
+}
+
+// -max-memory: the meshes of the first scene are extracted, cleaned up and written a few at a
+// time, in node order, with at most opts.max_memory bytes (by mesh_node_memory) in flight. Once
+// written, a mesh keeps only what the .level needs (names, transform, collider flag) and every
+// buffer of the model no mesh still has to read is released. A mesh larger than opts.max_memory
+// on its own is streamed instead (Streamed_Mesh), unless its file has to be held in memory
+// anyway (-pack, -cache)
+static bool32 stream_meshes(const Options& opts, Conversion_State& state, const std::string& mesh_folder,
+                          const std::string& collision_folder, const Write_Task& write_task,
+                          Task_Group& writes, Ordered_Log& log) {
+    tinygltf::Model& gltf_model = *state.gltf_model;
+
+    std::vector<Mesh_Node> mesh_nodes;
+    for (int scene_idx = 0; scene_idx < gltf_model.scenes.size(); scene_idx++) {
+        if (scene_idx > 0) {
+            log_printf("[WARNING] Ignoring all scenes but the first!\n");
+            break;
+        }
+        const tinygltf::Scene& scene = gltf_model.scenes[scene_idx];
+        log_printf("Scene: %s\n", scene.name.c_str());
+
+        // the mesh logs it reserves are left empty, meshes log where they are extracted
+        Ordered_Log walk;
+        for (int n = 0; n < scene.nodes.size(); n++) {
+            traverse_nodes(gltf_model, gltf_model.nodes[scene.nodes[n]], mesh_nodes, walk, laml::Mat4(1.0f), 1);
+        }
+    }
+    log_printf("-----------------------------------------\n");
+
+    // how many mesh nodes still have to read each buffer. the others (animations) are not needed at all
+    std::vector<uint32> buffer_users(gltf_model.buffers.size(), 0);
+    std::vector<std::vector<int>> node_buffers(mesh_nodes.size());
+    std::vector<uint64> node_memory(mesh_nodes.size());
+    for (uint32 n = 0; n < mesh_nodes.size(); n++) {
+        mesh_node_buffers(gltf_model, *mesh_nodes[n].node, node_buffers[n]);
+        for (int buffer : node_buffers[n]) {
+            if (buffer >= 0 && buffer < (int)buffer_users.size()) buffer_users[buffer]++;
+        }
+        node_memory[n] = mesh_node_memory(gltf_model, *mesh_nodes[n].node);
+
+        mesh_nodes[n].buffer_files = &state.buffer_files;
+        if (node_memory[n] > opts.max_memory && opts.pack == nullptr && opts.cache == nullptr) {
+            mesh_nodes[n].out_of_core = true;
+            node_memory[n] = opts.max_memory;
+        }
+    }
+    uint64 released = 0;
+    auto release_buffer = [&](int buffer) {
+        released += gltf_model.buffers[buffer].data.size();
+        std::vector<unsigned char>().swap(gltf_model.buffers[buffer].data);
+    };
+    for (uint32 b = 0; b < buffer_users.size(); b++) {
+        if (buffer_users[b] == 0) release_buffer(b);
+    }
+
+    log_printf("Extracting and writing %d meshes, at most %g MB at a time...\n", (int)mesh_nodes.size(),
+        opts.max_memory / (1024.0 * 1024.0));
+    std::unordered_set<std::string> written_meshes;    // to catch duplicates
+    std::unordered_set<std::string> written_colliders;
+    uint32 num_steps = 0;
+    uint64 peak = 0;
+    bool32 success = true;
+    for (uint32 begin = 0; begin < mesh_nodes.size(); num_steps++) {
+        // as many as fit, but at least one. an out-of-core mesh is always alone in its step,
+        // the step ends before and after it
+        uint32 end = begin;
+        uint64 in_flight = 0;
+        if (mesh_nodes[begin].out_of_core) {
+            in_flight += node_memory[end++];
+        } else {
+            while (end < mesh_nodes.size() && !mesh_nodes[end].out_of_core &&
+                   (end == begin || in_flight + node_memory[end] <= opts.max_memory)) {
+                in_flight += node_memory[end++];
+            }
+        }
+        peak = std::max(peak, in_flight);
+
+        std::vector<Mesh> meshes(end - begin);
+        for (uint32 n = begin; n < end; n++) {
+            mesh_nodes[n].log = &log.task();
+        }
+        // a mesh whose buffers can not be read fails the conversion, and is not written
+        std::vector<uint8> extracted(end - begin, 0);
+        parallel_for(end - begin, [&](uint32 n) {
+            Log_Scope scope(mesh_nodes[begin + n].log);
+            extracted[n] = process_mesh_node(gltf_model, mesh_nodes[begin + n], meshes[n]) ? 1 : 0;
+        });
+        for (uint32 n = 0; n < meshes.size(); n++) {
+            if (!extracted[n]) {
+                success = false;
+                meshes[n].primitives.clear();
+            }
+        }
+
+        // out-of-core meshes are alone in their step, see above
+        Streamed_Mesh streamed;
+        bool32 out_of_core = mesh_nodes[begin].out_of_core;
+        assert((!out_of_core || end == begin + 1) && "Out-of-core mesh shares its step!");
+        if (out_of_core) {
+            Log_Scope scope(mesh_nodes[begin].log);
+            log_printf("  does not fit in %g MB, streaming it through scratch files\n", opts.max_memory / (1024.0 * 1024.0));
+            if (extracted[0] && !prepare_streamed_mesh(gltf_model, mesh_nodes[begin], meshes[0], streamed, opts)) {
+                success = false;
+                streamed.prims.clear();
+            }
+        } else if (opts.cleanup) {
+            cleanup_meshes(meshes);
+        }
+
+        for (uint32 n = 0; n < meshes.size(); n++) {
+            const Mesh& mesh = meshes[n];
+            if (!extracted[n]) {
+                continue;
+            }
+            std::unordered_set<std::string>& written = mesh.is_collider ? written_colliders : written_meshes;
+            if (!written.insert(mesh.mesh_name).second) {
+                continue;
+            }
+            const std::string& folder = mesh.is_collider ? collision_folder : mesh_folder;
+            std::string header = format_string("  Writing %s %2d: '%s.mesh' [v%d]...", mesh.is_collider ? "collider" : "mesh",
+                (int)written.size(), mesh.mesh_name.c_str(), MESH_VERSION);
+            if (out_of_core) {
+                if (streamed.prims.size() != mesh.primitives.size()) {
+                    continue; // failed to prepare
+                }
+                write_task(folder + '\\' + mesh.mesh_name + ".mesh", header, nullptr,
+                    [&, n, folder](const Options& write_opts) {
+                        return write_streamed_mesh_file(meshes[n], streamed, state.materials, folder, write_opts);
+                    });
+                continue;
+            }
+            write_task(folder + '\\' + mesh.mesh_name + ".mesh", header,
+                [&, n]() { return mesh_cache_key(meshes[n], state.materials, opts); },
+                [&, n, folder](const Options& write_opts) {
+                    return write_mesh_file(meshes[n], state.materials, folder, write_opts);
+                });
+        }
+        writes.wait();
+        log.flush();
+
+        for (Mesh& mesh : meshes) {
+            std::vector<Mesh_Primitive>().swap(mesh.primitives);
+            state.meshes.push_back(std::move(mesh));
+        }
+        for (uint32 n = begin; n < end; n++) {
+            for (int buffer : node_buffers[n]) {
+                if (buffer >= 0 && buffer < (int)buffer_users.size() && --buffer_users[buffer] == 0) release_buffer(buffer);
+            }
+        }
+        begin = end;
+    }
+    log_printf("Wrote %d meshes and %d colliders in %d steps, %.1f MB in flight at most, released %.1f MB of buffers.\n",
+        (int)written_meshes.size(), (int)written_colliders.size(), (int)num_steps, peak / (1024.0 * 1024.0),
+        released / (1024.0 * 1024.0));
+    log_printf("-----------------------------------------\n");
+    return success;
+}
+
+// every output file, for extract_scene's meshes and materials
+static bool write_scene(const Options& opts, Conversion_State& state) {
+    if (state.from_cache) {
+        return restore_outputs(opts, state);
+    }
+
+    const std::string& fn = state.name;
+    const std::vector<Mesh>& extracted_meshes = state.meshes;
+    const std::vector<Material>& extracted_materials = state.materials;
+    bool32 success = true;
+
+    // Every file below is written by its own task. What gets written (only the first mesh of
+    // each name) and the numbering are decided here, in order, before the tasks run. Each task
+    // logs into its own place in the output, and with a pack its entry keeps its place too.
+    // With a cache, key() is the output's cache key (see write_output)
+    Ordered_Log log;
+    Task_Group writes;
+    std::atomic<bool> write_failed(false);
+    Write_Task write_task = [&](const std::string& filename, const std::string& header,
+                                std::function<uint64()> key, std::function<bool32(const Options&)> write) {
+        reserve_output(filename, opts);
+        Cached_Output& output = record_output(state, filename, opts);
+        Log_Buffer& buffer = log.task();
+        writes.run([&opts, &buffer, &write_failed, &output, filename, header, key, write]() {
+            Log_Scope scope(buffer);
+            log_printf("%s", header.c_str());
+            bool32 from_cache;
+            if (write_output(filename, key, output, opts, write, from_cache)) {
+                log_printf(from_cache ? "cached!\n" : "done!\n");
+            } else {
+                log_printf("failed!\n");
+                write_failed = true;
+            }
+        });
+    };
+
+    std::string mesh_folder = opts.output_folder;
+    std::string collision_folder = opts.output_folder;
+    if (opts.mode == LEVEL_MODE) {
+        mesh_folder = mesh_folder + '\\' + level_render_folder;
+        collision_folder = collision_folder + '\\' + level_collision_folder;
+    }
+    if (opts.pack == nullptr) {
+        _mkdir(opts.output_folder.c_str());
+        _mkdir(mesh_folder.c_str());
+        _mkdir(collision_folder.c_str());
+    }
+
+    // Write each render mesh to its own file. with -max-memory render meshes and colliders are
+    // extracted and written together instead, a few at a time
+    std::unordered_set<std::string> written_meshes; // to catch duplicates
+    if (state.streaming) {
+        if (!stream_meshes(opts, state, mesh_folder, collision_folder, write_task, writes, log)) {
+            write_failed = true;
+        }
+    } else {
+        log_printf("Writing mesh files...\n");
+        for (int n = 0; n < extracted_meshes.size(); n++) {
+            const Mesh& mesh = extracted_meshes[n];
+
+            if (mesh.is_collider) continue;
+
+            if (written_meshes.insert(mesh.mesh_name).second) {
+                int num = (int)written_meshes.size();
+                write_task(mesh_folder + '\\' + mesh.mesh_name + ".mesh",
+                    format_string("  Writing mesh %2d: '%s.mesh' [v%d]...", num, mesh.mesh_name.c_str(), MESH_VERSION),
+                    [&, n]() { return mesh_cache_key(extracted_meshes[n], extracted_materials, opts); },
+                    [&, n](const Options& write_opts) {
+                        return write_mesh_file(extracted_meshes[n], extracted_materials, mesh_folder, write_opts);
+                    });
+            }
+        }
+        log_printf("Wrote %d files.\n", (int)written_meshes.size());
+        log_printf("-----------------------------------------\n");
+    }
+
+    // Merge static level geometry into world-space batches (while the meshes above are written)
+    std::vector<Mesh_Batch> batches;
+    if (opts.mode == LEVEL_MODE && opts.batch_static) {
+        log_printf("Batching static meshes...\n");
+        batch_static_meshes(extracted_meshes, extracted_materials, opts, batches);
+
+        for (int n = 0; n < batches.size(); n++) {
+            const Mesh& mesh = batches[n].mesh;
+            write_task(mesh_folder + '\\' + mesh.mesh_name + ".mesh",
+                format_string("  Writing batch %2d: '%s.mesh' [v%d]...", 1 + n, mesh.mesh_name.c_str(), MESH_VERSION),
+                [&, n]() { return mesh_cache_key(batches[n].mesh, extracted_materials, opts); },
+                [&, n](const Options& write_opts) {
+                    return write_mesh_file(batches[n].mesh, extracted_materials, mesh_folder, write_opts);
+                });
+        }
+        log_printf("Wrote %d files.\n", (int)batches.size());
+        log_printf("-----------------------------------------\n");
+    }
+
+    // Write materials
+    bool32 write_text_mats = (opts.material_output != material_format::binary);
+    bool32 write_binary_mats = (opts.material_output != material_format::text);
+    for (int n = 0; n < extracted_materials.size(); n++) {
+        const Material& mat = extracted_materials[n];
+
+        if (write_text_mats) {
+            write_task(mesh_folder + '\\' + mat.name + ".matl",
+                format_string("  Writing material %2d: '%s.matl' [v%d]...", 1 + n, mat.name.c_str(), MAT_TEXT_VERSION),
+                [&, n]() { return material_cache_key(extracted_materials[n], ".matl", opts); },
+                [&, n](const Options& write_opts) {
+                    return write_mat_file(extracted_materials[n], mesh_folder, write_opts);
+                });
+        }
+        if (write_binary_mats) {
+            write_task(mesh_folder + '\\' + mat.name + ".matb",
+                format_string("  Writing material %2d: '%s.matb' [v%d]...", 1 + n, mat.name.c_str(), MAT_VERSION),
+                [&, n]() { return material_cache_key(extracted_materials[n], ".matb", opts); },
+                [&, n](const Options& write_opts) {
+                    return write_matb_file(extracted_materials[n], mesh_folder, write_opts);
+                });
+        }
+    }
+    log_printf("Wrote %d files.\n", (int)written_meshes.size());
+    log_printf("-----------------------------------------\n");
+
+    // Write collision meshes to files
+    std::unordered_set<std::string> written_colliders; // to catch duplicates
+    if (!state.streaming) {
+        log_printf("Writing collider files...\n");
+        for (int n = 0; n < extracted_meshes.size(); n++) {
+            const Mesh& mesh = extracted_meshes[n];
+
+            if (!mesh.is_collider) continue;
+
+            if (written_colliders.insert(mesh.mesh_name).second) {
+                int num = (int)written_colliders.size();
+                write_task(collision_folder + '\\' + mesh.mesh_name + ".mesh",
+                    format_string("  Writing mesh %2d: '%s.mesh' [v%d]...", num, mesh.mesh_name.c_str(), MESH_VERSION),
+                    [&, n]() { return mesh_cache_key(extracted_meshes[n], extracted_materials, opts); },
+                    [&, n](const Options& write_opts) {
+                        return write_mesh_file(extracted_meshes[n], extracted_materials, collision_folder, write_opts);
+                    });
+            }
+        }
+        log_printf("Wrote %d files.\n", (int)written_colliders.size());
+        log_printf("-----------------------------------------\n");
+    }
+
+    // Write mesh paths to level file
+    if (opts.mode == LEVEL_MODE) {
+        // written from everything above, only cached as part of the whole conversion
+        write_task(opts.output_folder + '\\' + fn + ".level",
+            format_string("Writing level file: '%s' [v%d]...", fn.c_str(), LEVEL_VERSION),
+            nullptr,
+            [&](const Options& write_opts) {
+                return write_level_file(extracted_meshes, extracted_materials, batches, opts.output_folder + '\\' + fn, write_opts);
+            });
+        log_printf("-----------------------------------------\n");
+    }
+
+    writes.wait();
+    log.flush();
+    if (write_failed) {
+        success = false;
     }
 
     //printf("Checking transforms...\n");
@@ -666,146 +2046,661 @@ bool convert_file(const Options& opts) {
     return success;
 }
 
-size_t write_string(FILE* fid, const std::string& string) {
-    uint8 len = string.length();
-    size_t written = fwrite(&len, sizeof(uint8), 1, fid) * sizeof(uint8);
-    written += fwrite(string.data(), sizeof(char), len, fid) * sizeof(char);
-    return written;
+// write_scene, into a pack with -pack
+static bool write_scene_files(const Options& opts, Conversion_State& state) {
+    if (!opts.pack_files) {
+        return write_scene(opts, state);
+    }
+
+    // everything goes into one archive next to where the output folder would be
+    std::string pack_filename = opts.output_folder + ".pack";
+    Pack_Writer pack;
+    pack.timestamp = output_timestamp(opts);
+    pack.skip_unchanged = opts.skip_unchanged;
+    if (!pack.open(pack_filename, opts.alignment ? opts.alignment : mesh_default_alignment, opts.pack_compress)) {
+        log_printf("Failed to open output file '%s'...\n", pack_filename.c_str());
+        return false;
+    }
+
+    Options pack_opts = opts;
+    pack_opts.pack = &pack;
+    bool success = write_scene(pack_opts, state);
+
+    uint32 num_compressed = 0;
+    uint64 raw_size = 0;
+    for (const Pack_Entry& entry : pack.entries) {
+        if (entry.compression != pack_compression_none) num_compressed++;
+        raw_size += entry.raw_size;
+    }
+    log_printf("Writing pack file: '%s'...", pack_filename.c_str());
+    if (pack.close()) {
+        log_printf(" [%d entries, %d compressed, %llu bytes (%llu uncompressed)] %s\n",
+            (int)pack.entries.size(), num_compressed, (unsigned long long)pack.size, (unsigned long long)raw_size,
+            pack.unchanged ? "unchanged!" : "done!");
+        // nothing in it was touched
+        if (pack.unchanged && opts.stats != nullptr) {
+            opts.stats->num_unchanged += (uint32)pack.entries.size();
+        }
+    } else {
+        log_printf("failed!\n");
+        success = false;
+    }
+    log_printf("-----------------------------------------\n");
+
+    return success;
 }
 
-bool32 write_mesh_file(const Mesh& mesh, 
-    const std::vector<Material>& materials, 
-    const std::string& mesh_folder, 
-    const Options& opts) {
+// normal, tangent, bitangent, uv
+void write_vertex_shading(File_Writer& out, const Mesh_Primitive& prim, uint32 i, const Options& opts) {
+    out.write_array(&prim.normals[i].x, 3);
 
-    std::string filename = mesh_folder + '\\' + mesh.mesh_name + ".mesh";
+    laml::Vec3 tangent = laml::Vec3(prim.tangents_4[i].x, prim.tangents_4[i].y, prim.tangents_4[i].z);
+    laml::Vec3 bitangent = laml::cross(prim.normals[i], tangent) * prim.tangents_4[i].w;
+    out.write_array(&tangent.x, 3);
+    out.write_array(&bitangent.x, 3);
 
-    // Open and check for valid file
-    FILE* fid = nullptr;
-    errno_t err = fopen_s(&fid, filename.c_str(), "wb");
-    if (fid == nullptr || err) {
-        printf("Failed to open output file '%s'...\n", filename.c_str());
-        return false;
+    // flip y uv-coord
+    real32 y;
+    if (opts.flip_uvs_y) {
+        y = 1.0f - prim.texcoords[i].y;
+    }
+    else {
+        y = prim.texcoords[i].y;
     }
+    out.write(prim.texcoords[i].x);
+    out.write(y);
+    //out.write_array(&vert.tex.x, 2);
+}
 
-    uint16 num_prims = mesh.primitives.size();
-    std::vector<uint32> mat_ids;
-    mat_ids.resize(num_prims);
-    for (int n = 0; n < num_prims; n++) {
-        mat_ids[n] = mesh.primitives[n].material_index;
+// bone indices, bone weights
+void write_vertex_skin(File_Writer& out, const Mesh_Primitive& prim, uint32 i) {
+    out.write_array(&prim.bone_indices[i].x, 4);
+    out.write_array(&prim.bone_weights[i].x, 4);
+}
+
+// writes all vertices of a primitive. When pad_lines is set, line primitives are written
+// with the full triangle vertex layout (zeroed attributes) so every vertex has the same stride.
+void write_prim_vertices(File_Writer& out, const Mesh_Primitive& prim, bool32 is_rigged, bool32 pad_lines, const Options& opts) {
+    uint32 num_verts = prim.positions.size();
+    bool32 has_attributes = (prim.prim_type == prim_type::triangles);
+
+    for (uint32 i = 0; i < num_verts; i++) {
+        out.write_array(&prim.positions[i].x, 3);
+
+        if (has_attributes) {
+            write_vertex_shading(out, prim, i, opts);
+
+            // only write bone data if rigged
+            if (is_rigged) {
+                write_vertex_skin(out, prim, i);
+            }
+        } else if (pad_lines) {
+            const real32 zeros[19] = { 0 };
+            uint32 pad_floats = is_rigged ? 19 : 11;
+            out.write_array(zeros, pad_floats);
+        }
     }
+}
 
-    // construct options flag
+// Welds vertices that share a position (and skinning, if rigged), ignoring uv/normal seams.
+// out_verts holds the source vertex of each welded vertex, out_indices the remapped index buffer.
+void weld_positions(const Mesh_Primitive& prim, bool32 is_rigged, std::vector<uint32>& out_verts, std::vector<uint32>& out_indices) {
+    struct Weld_Key {
+        uint32 bits[11];
+        bool operator==(const Weld_Key& other) const { return memcmp(bits, other.bits, sizeof(bits)) == 0; }
+    };
+    struct Weld_Key_Hash {
+        size_t operator()(const Weld_Key& k) const {
+            uint64 h = 14695981039346656037ull;
+            for (uint32 n = 0; n < 11; n++) {
+                h = (h ^ k.bits[n]) * 1099511628211ull;
+            }
+            return (size_t)h;
+        }
+    };
+
+    bool32 has_skin = is_rigged && (prim.prim_type == prim_type::triangles);
+    uint32 num_verts = prim.positions.size();
+
+    std::unordered_map<Weld_Key, uint32, Weld_Key_Hash> lookup;
+    std::vector<uint32> remap(num_verts);
+    out_verts.clear();
+    for (uint32 i = 0; i < num_verts; i++) {
+        Weld_Key key = {};
+        laml::Vec3 p = prim.positions[i];
+        for (uint32 k = 0; k < 3; k++) {
+            if (p[k] == 0.0f) p[k] = 0.0f; // -0 and +0 weld together
+        }
+        memcpy(&key.bits[0], &p.x, 3*sizeof(real32));
+        if (has_skin) {
+            memcpy(&key.bits[3], &prim.bone_indices[i].x, 4*sizeof(int32));
+            memcpy(&key.bits[7], &prim.bone_weights[i].x, 4*sizeof(real32));
+        }
+
+        auto it = lookup.find(key);
+        if (it == lookup.end()) {
+            it = lookup.insert(std::make_pair(key, (uint32)out_verts.size())).first;
+            out_verts.push_back(i);
+        }
+        remap[i] = it->second;
+    }
+
+    out_indices.resize(prim.indices.size());
+    for (size_t n = 0; n < prim.indices.size(); n++) {
+        out_indices[n] = remap[prim.indices[n]];
+    }
+}
+
+// split-streams layout: the welded, position-only vertex/index buffer used for depth and shadow passes
+struct Shadow_Weld {
+    std::vector<uint32> verts;   // source vertex of each welded vertex
+    std::vector<uint32> indices;
+};
+
+// vertex and index arrays, which are encoded with -compress / -geometry-codec. descriptors, names and bones never are
+static bool32 is_mesh_bulk_chunk(const char* tag) {
+    const char* bulk_tags[] = { MESH_ARRAY_INDICES, MESH_ARRAY_VERTICES, MESH_ARRAY_POSITIONS, MESH_ARRAY_SHADING,
+                                MESH_ARRAY_SKIN, MESH_ARRAY_SHADOW_VERTS, MESH_ARRAY_SHADOW_INDICES };
+    for (const char* bulk : bulk_tags) {
+        if (memcmp(tag, bulk, 4) == 0)
+            return true;
+    }
+    return false;
+}
+
+// where filename goes in a pack: its path relative to the output folder
+static std::string pack_entry_path(const std::string& filename, const Options& opts) {
+    std::string path = filename;
+    std::string root = opts.output_folder + '\\';
+    if (path.compare(0, root.size(), root) == 0) {
+        path = path.substr(root.size());
+    }
+    return path;
+}
+
+// opens filename, or the matching entry when writing a pack
+static bool32 open_output(File_Writer& out, const std::string& filename, const Options& opts) {
+    if (opts.capture != nullptr) {
+        opts.capture->clear();
+        out.copy = opts.capture;
+    }
+    if (opts.pack == nullptr) {
+        return out.open(filename, opts.skip_unchanged);
+    }
+    return out.open(opts.pack, pack_entry_path(filename, opts));
+}
+
+// closes out, and counts it in opts.stats
+static bool32 close_output(File_Writer& out, const Options& opts) {
+    if (opts.stats != nullptr) {
+        opts.stats->num_files++;
+        opts.stats->num_bytes += out.size();
+    }
+    bool32 closed = out.close();
+    if (closed && out.unchanged && opts.stats != nullptr) {
+        opts.stats->num_unchanged++;
+    }
+    return closed;
+}
+
+uint64 output_timestamp(const Options& opts) {
+    if (opts.timestamp_from_input) {
+        return utils::file_time(opts.input_filename);
+    }
+    return opts.timestamp ? opts.timestamp : (uint64)time(NULL);
+}
+
+static void reserve_output(const std::string& filename, const Options& opts) {
+    if (opts.pack != nullptr) {
+        opts.pack->reserve(pack_entry_path(filename, opts));
+    }
+}
+
+// the header flag of a .mesh
+static uint32 mesh_file_flag(const Mesh& mesh, const Options& opts) {
     uint32 flag = 0;
         
     if (mesh.is_rigged)
         flag |= mesh_flag_is_rigged;
+    if (opts.shared_buffers)
+        flag |= mesh_flag_shared_buffers;
+    else if (opts.split_streams)
+        flag |= mesh_flag_split_streams;
+    return flag;
+}
 
-    uint64 timestamp = (uint64)time(NULL);
+// the descriptor of primitive n, but for the layout fields (first_index, base_vertex, num_shadow_verts)
+static Mesh_Prim_Entry mesh_prim_entry(const Mesh_Primitive& prim, uint32 n, uint32 num_verts, uint32 num_inds,
+                                       const std::vector<Material>& materials, String_Table& strings) {
+    const Material& mat = materials[prim.material_index];
+
+    Mesh_Prim_Entry entry = {};
+    entry.prim_type = (uint32)prim.prim_type;
+    entry.mat_idx = n;  //prim.material_index;
+    entry.material_name = strings.add(mat.name);
+    entry.material_hash = name_hash(mat.name);
+    entry.num_verts = num_verts;
+    entry.num_inds = num_inds;
+    return entry;
+}
 
-    // Write to file
-    uint32 filesize_write = 0;
-    size_t FILESIZE = 0; // will get updated later
-    FILESIZE += fwrite("MESH", 1, 4, fid);
-    FILESIZE += fwrite(&filesize_write, sizeof(uint32), 1, fid) * sizeof(uint32);
-    FILESIZE += fwrite(&MESH_VERSION, sizeof(uint32), 1, fid) * sizeof(uint32);
-    FILESIZE += fwrite(&flag, sizeof(uint32), 1, fid) * sizeof(uint32);
-    FILESIZE += fwrite(&timestamp, sizeof(uint64), 1, fid) * sizeof(uint64);
-    FILESIZE += fwrite(&num_prims, sizeof(uint16), 1, fid) * sizeof(uint16);
-    FILESIZE += fwrite("\0\0\0\0\0\0", 1, 6, fid);
-
-    // write vertex data
-    for (int n = 0; n < num_prims; n++) {
-        const Mesh_Primitive& prim = mesh.primitives[n];
-        const Material& mat = materials[mat_ids[n]];
+// the BONE records of a rigged mesh
+static void mesh_bone_entries(const Mesh& mesh, String_Table& strings, std::vector<Mesh_Bone_Entry>& bones) {
+    if (mesh.is_rigged) {
+        // same skeleton for all prims?
+        const Skeleton& skeleton = mesh.skeleton;
+        bones.resize(skeleton.bones.size());
+        for (uint32 b = 0; b < bones.size(); b++) {
+            const Bone& bone = skeleton.bones[b];
+            bones[b].bone_idx = bone.bone_idx;
+            bones[b].parent_idx = bone.parent_idx;
+            bones[b].debug_length = 1.0f;
+            bones[b].name = strings.add(bone.name);
+            bones[b].name_hash = name_hash(bone.name);
+            memcpy(bones[b].local_matrix, &bone.local_matrix.c_11, 16*sizeof(real32));
+            memcpy(bones[b].inv_model_matrix, &bone.inv_model_matrix.c_11, 16*sizeof(real32));
+        }
+    }
+}
 
-        uint32 num_verts = prim.positions.size();
-        uint32 num_inds = prim.indices.size();
-        uint32 mat_idx = n;  //prim.material_index;
-        uint32 prim_type = (uint32)prim.prim_type;
+// the chunks of a .mesh with these primitives. with shared buffers, base_vertex and first_index
+// are the totals, the sizes of the shared arrays
+static void mesh_chunk_directory(Chunk_Directory& directory, const std::vector<Mesh_Prim_Entry>& prims, uint32 flag, bool32 is_rigged,
+                                 uint32 base_vertex, uint32 first_index, uint32 num_bones, uint32 strings_size) {
+    uint32 num_prims = prims.size();
+    const uint32 vertex_stride = mesh_position_stride + mesh_shading_stride + (is_rigged ? mesh_skin_stride : 0);
+
+    directory.add(MESH_ARRAY_PRIMS, chunk_index_none, num_prims, sizeof(Mesh_Prim_Entry));
+    directory.add(MESH_ARRAY_STRINGS, chunk_index_none, strings_size, 1);
+    directory.add(MESH_ARRAY_BOUNDS, chunk_index_none, 1, sizeof(Mesh_Bounds), chunk_flag_optional);
+    if (flag & mesh_flag_shared_buffers) {
+        // lines are padded out to the full vertex size so the stride is constant.
+        // indices stay relative to the primitive, base_vertex is applied at draw time.
+        directory.add(MESH_ARRAY_VERTICES, chunk_index_none, base_vertex, vertex_stride);
+        directory.add(MESH_ARRAY_INDICES, chunk_index_none, first_index, sizeof(uint32));
+    } else {
+        for (uint32 n = 0; n < num_prims; n++) {
+            const Mesh_Prim_Entry& prim = prims[n];
+            bool32 has_attributes = (prim.prim_type == (uint32)prim_type::triangles);
+
+            directory.add(MESH_ARRAY_INDICES, n, prim.num_inds, sizeof(uint32));
+            if (flag & mesh_flag_split_streams) {
+                directory.add(MESH_ARRAY_POSITIONS, n, prim.num_verts, mesh_position_stride);
+                if (has_attributes) {
+                    directory.add(MESH_ARRAY_SHADING, n, prim.num_verts, mesh_shading_stride);
+                    if (is_rigged)
+                        directory.add(MESH_ARRAY_SKIN, n, prim.num_verts, mesh_skin_stride);
+                }
+                uint32 shadow_stride = mesh_position_stride + ((is_rigged && has_attributes) ? mesh_skin_stride : 0);
+                directory.add(MESH_ARRAY_SHADOW_VERTS, n, prim.num_shadow_verts, shadow_stride, chunk_flag_optional);
+                directory.add(MESH_ARRAY_SHADOW_INDICES, n, prim.num_inds, sizeof(uint32), chunk_flag_optional);
+            } else {
+                directory.add(MESH_ARRAY_VERTICES, n, prim.num_verts, has_attributes ? vertex_stride : mesh_position_stride);
+            }
+        }
+    }
+    if (is_rigged) {
+        directory.add(MESH_ARRAY_BONES, chunk_index_none, num_bones, sizeof(Mesh_Bone_Entry));
+    }
+}
 
-        FILESIZE += fwrite("PRIM", 1, 4, fid);
-        FILESIZE += fwrite(&num_verts, sizeof(uint32), 1, fid) * sizeof(uint32);
-        FILESIZE += fwrite(&num_inds,  sizeof(uint32), 1, fid) * sizeof(uint32);
-        FILESIZE += fwrite(&mat_idx,   sizeof(uint32), 1, fid) * sizeof(uint32);
-        FILESIZE += fwrite(&prim_type, sizeof(uint32), 1, fid) * sizeof(uint32);
+bool32 write_mesh_file(const Mesh& mesh, 
+    const std::vector<Material>& materials, 
+    const std::string& mesh_folder, 
+    const Options& opts) {
 
-        // write material name
-        FILESIZE += write_string(fid, mat.name);
+    std::string filename = mesh_folder + '\\' + mesh.mesh_name + ".mesh";
 
-        // write indices
-        for (int i = 0; i < num_inds; i++) {
-            FILESIZE += fwrite(&prim.indices[i], sizeof(uint32), 1, fid) * sizeof(uint32);
-        }
+    // Open and check for valid file
+    File_Writer out;
+    if (!open_output(out, filename, opts)) {
+        log_printf("Failed to open output file '%s'...\n", filename.c_str());
+        return false;
+    }
 
-        // write vertices
-        for (int i = 0; i < num_verts; i++) {
-            FILESIZE += fwrite(&prim.positions[i].x, sizeof(real32), 3, fid) * sizeof(real32);
+    uint32 num_prims = mesh.primitives.size();
+    uint32 alignment = opts.alignment ? opts.alignment : mesh_default_alignment;
 
-            if (prim_type == (uint32)prim_type::triangles) {
-                FILESIZE += fwrite(&prim.normals[i].x, sizeof(real32), 3, fid) * sizeof(real32);
+    // construct options flag
+    uint32 flag = mesh_file_flag(mesh, opts);
+
+    // primitive descriptors and names
+    String_Table strings;
+    std::vector<Mesh_Prim_Entry> prims(num_prims);
+    std::vector<Shadow_Weld> welds;
+    if (flag & mesh_flag_split_streams)
+        welds.resize(num_prims);
+
+    uint32 first_index = 0;
+    uint32 base_vertex = 0;
+    for (uint32 n = 0; n < num_prims; n++) {
+        const Mesh_Primitive& prim = mesh.primitives[n];
 
-                laml::Vec3 tangent = laml::Vec3(prim.tangents_4[i].x, prim.tangents_4[i].y, prim.tangents_4[i].z);
-                laml::Vec3 bitangent = laml::cross(prim.normals[i], tangent) * prim.tangents_4[i].w;
-                FILESIZE += fwrite(&tangent.x, sizeof(real32), 3, fid) * sizeof(real32);
-                FILESIZE += fwrite(&bitangent.x, sizeof(real32), 3, fid) * sizeof(real32);
+        Mesh_Prim_Entry& entry = prims[n];
+        entry = mesh_prim_entry(prim, n, prim.positions.size(), prim.indices.size(), materials, strings);
+
+        if (flag & mesh_flag_shared_buffers) {
+            entry.first_index = first_index;
+            entry.base_vertex = base_vertex;
+            first_index += entry.num_inds;
+            base_vertex += entry.num_verts;
+        } else if (flag & mesh_flag_split_streams) {
+            weld_positions(prim, mesh.is_rigged, welds[n].verts, welds[n].indices);
+            entry.num_shadow_verts = welds[n].verts.size();
+        }
+    }
 
-                // flip y uv-coord
-                real32 y;
-                if (opts.flip_uvs_y) {
-                    y = 1.0f - prim.texcoords[i].y;
-                }
-                else {
-                    y = prim.texcoords[i].y;
-                }
-                FILESIZE += fwrite(&prim.texcoords[i].x, sizeof(real32), 1, fid) * sizeof(real32);
-                FILESIZE += fwrite(&y, sizeof(real32), 1, fid) * sizeof(real32);
-                //FILESIZE += fwrite(&vert.tex.x,       sizeof(real32), 2, fid) * sizeof(real32);
+    std::vector<Mesh_Bone_Entry> bones;
+    mesh_bone_entries(mesh, strings, bones);
 
-                // only write bone data if rigged
-                if (mesh.is_rigged) {
-                    FILESIZE += fwrite(&prim.bone_indices[i].x, sizeof(int32), 4, fid) * sizeof(int32);
-                    FILESIZE += fwrite(&prim.bone_weights[i].x, sizeof(real32), 4, fid) * sizeof(real32);
+    Mesh_Bounds bounds = {};
+    bool32 has_bounds = false;
+    for (const Mesh_Primitive& prim : mesh.primitives) {
+        for (const laml::Vec3& p : prim.positions) {
+            add_to_bounds(bounds, has_bounds, p);
+        }
+    }
+
+    // chunk directory
+    Chunk_Directory directory;
+    mesh_chunk_directory(directory, prims, flag, mesh.is_rigged, base_vertex, first_index, bones.size(), strings.data.size());
+
+    // writes the (uncompressed) data of one chunk
+    auto write_chunk_data = [&](File_Writer& w, const Chunk_Entry& entry) {
+        if (memcmp(entry.tag, MESH_ARRAY_PRIMS, 4) == 0) {
+            w.write_array(prims.data(), prims.size());
+        } else if (memcmp(entry.tag, MESH_ARRAY_STRINGS, 4) == 0) {
+            w.write_array(strings.data.data(), strings.data.size());
+        } else if (memcmp(entry.tag, MESH_ARRAY_BOUNDS, 4) == 0) {
+            w.write(bounds);
+        } else if (memcmp(entry.tag, MESH_ARRAY_BONES, 4) == 0) {
+            w.write_array(bones.data(), bones.size());
+        } else if (entry.index == chunk_index_none) {
+            for (uint32 p = 0; p < num_prims; p++) {
+                const Mesh_Primitive& prim = mesh.primitives[p];
+                if (memcmp(entry.tag, MESH_ARRAY_VERTICES, 4) == 0)
+                    write_prim_vertices(w, prim, mesh.is_rigged, true, opts);
+                else
+                    w.write_array(prim.indices.data(), prim.indices.size());
+            }
+        } else {
+            const Mesh_Primitive& prim = mesh.primitives[entry.index];
+            uint32 num_verts = prim.positions.size();
+
+            if (memcmp(entry.tag, MESH_ARRAY_INDICES, 4) == 0) {
+                w.write_array(prim.indices.data(), prim.indices.size());
+            } else if (memcmp(entry.tag, MESH_ARRAY_VERTICES, 4) == 0) {
+                write_prim_vertices(w, prim, mesh.is_rigged, false, opts);
+            } else if (memcmp(entry.tag, MESH_ARRAY_POSITIONS, 4) == 0) {
+                for (uint32 i = 0; i < num_verts; i++)
+                    w.write_array(&prim.positions[i].x, 3);
+            } else if (memcmp(entry.tag, MESH_ARRAY_SHADING, 4) == 0) {
+                for (uint32 i = 0; i < num_verts; i++)
+                    write_vertex_shading(w, prim, i, opts);
+            } else if (memcmp(entry.tag, MESH_ARRAY_SKIN, 4) == 0) {
+                for (uint32 i = 0; i < num_verts; i++)
+                    write_vertex_skin(w, prim, i);
+            } else if (memcmp(entry.tag, MESH_ARRAY_SHADOW_VERTS, 4) == 0) {
+                const Shadow_Weld& weld = welds[entry.index];
+                for (uint32 v : weld.verts) {
+                    w.write_array(&prim.positions[v].x, 3);
+                    if (entry.stride > mesh_position_stride)
+                        write_vertex_skin(w, prim, v);
                 }
+            } else if (memcmp(entry.tag, MESH_ARRAY_SHADOW_INDICES, 4) == 0) {
+                w.write_array(welds[entry.index].indices.data(), welds[entry.index].indices.size());
             }
         }
+    };
+
+    // index arrays of triangle lists can use the index codec, lines can not
+    auto is_triangle_list = [&](const Chunk_Entry& entry) {
+        if (entry.index != chunk_index_none)
+            return prims[entry.index].prim_type == (uint32)prim_type::triangles;
+        for (const Mesh_Prim_Entry& prim : prims) {
+            if (prim.prim_type != (uint32)prim_type::triangles)
+                return false;
+        }
+        return true;
+    };
+
+    // Write to file. chunks are streamed one at a time, only the one being encoded is held in memory.
+    // a geometry codec is tried first for bulk arrays, block compression is the fallback
+    begin_chunk_file(out, directory);
+    for (Chunk_Entry& entry : directory.entries) {
+        std::vector<uint8> stored;
+        if ((opts.compress || opts.geometry_codec) && is_mesh_bulk_chunk(entry.tag)) {
+            File_Writer raw;
+            write_chunk_data(raw, entry);
+
+            bool32 encoded = false;
+            if (opts.geometry_codec) {
+                bool32 is_index_chunk = (memcmp(entry.tag, MESH_ARRAY_INDICES, 4) == 0) ||
+                                        (memcmp(entry.tag, MESH_ARRAY_SHADOW_INDICES, 4) == 0);
+                if (is_index_chunk)
+                    encoded = is_triangle_list(entry) && encode_index_chunk(entry, raw.staging, stored);
+                else
+                    encoded = encode_vertex_chunk(entry, raw.staging, stored);
+            }
+            if (!encoded && opts.compress)
+                compress_chunk(entry, raw.staging, stored);
+        }
+
+        begin_chunk(out, entry, alignment);
+        if (entry.flags & chunk_flag_encoded)
+            out.write_bytes(stored.data(), stored.size());
+        else
+            write_chunk_data(out, entry);
+        end_chunk(out, entry);
     }
+    uint64 filesize = end_chunk_file(out, "MESH", MESH_VERSION, flag, num_prims, alignment, directory, output_timestamp(opts));
 
-    // Write the skeleton if mesh is rigged
-    // same skeleton for all prims?
-    if (mesh.is_rigged) {
-        const Skeleton& skeleton = mesh.skeleton;
-        uint32 num_bones = skeleton.bones.size();
+    log_printf(" [%llu bytes] ", (unsigned long long)filesize);
 
-        FILESIZE += fwrite("SKEL", 1, 4, fid);
-        FILESIZE += fwrite(&num_bones, sizeof(uint32), 1, fid) * sizeof(uint32);
+    return close_output(out, opts);
+}
 
-        real32 debug_length = 1.0f;
-        for (uint32 bone_idx = 0; bone_idx < num_bones; bone_idx++) {
-            const Bone& bone = skeleton.bones[bone_idx];
+// write_mesh_file for a Streamed_Mesh, prepared by prepare_streamed_mesh. Every chunk is written
+// a window at a time, through the same vertex writers, so the bytes are the same as
+// write_mesh_file's. The arrays are always stored raw, and the file is written straight to disk
+// (never held to compare with the one there, see -skip-unchanged)
+static bool32 write_streamed_mesh_file(const Mesh& mesh, Streamed_Mesh& streamed,
+                                       const std::vector<Material>& materials,
+                                       const std::string& mesh_folder,
+                                       const Options& opts) {
+    std::string filename = mesh_folder + '\\' + mesh.mesh_name + ".mesh";
 
-            FILESIZE += fwrite(&bone.bone_idx, sizeof(uint32), 1, fid) * sizeof(uint32);
-            FILESIZE += fwrite(&bone.parent_idx, sizeof(int32), 1, fid) * sizeof(int32);
-            FILESIZE += fwrite(&debug_length, sizeof(real32), 1, fid) * sizeof(real32);
-            FILESIZE += fwrite(&bone.local_matrix.c_11, sizeof(real32), 16, fid) * sizeof(real32);
-            FILESIZE += fwrite(&bone.inv_model_matrix.c_11, sizeof(real32), 16, fid) * sizeof(real32);
+    Options write_opts = opts;
+    write_opts.skip_unchanged = false;
+    File_Writer out;
+    if (!open_output(out, filename, write_opts)) {
+        log_printf("Failed to open output file '%s'...\n", filename.c_str());
+        return false;
+    }
+
+    uint32 num_prims = mesh.primitives.size();
+    uint32 alignment = opts.alignment ? opts.alignment : mesh_default_alignment;
+    uint32 flag = mesh_file_flag(mesh, opts);
+
+    String_Table strings;
+    std::vector<Mesh_Prim_Entry> prims(num_prims);
+    uint32 first_index = 0;
+    uint32 base_vertex = 0;
+    for (uint32 n = 0; n < num_prims; n++) {
+        const Streamed_Prim& sp = streamed.prims[n];
+
+        Mesh_Prim_Entry& entry = prims[n];
+        entry = mesh_prim_entry(mesh.primitives[n], n, (uint32)sp.num_verts, (uint32)sp.num_indices, materials, strings);
+
+        if (flag & mesh_flag_shared_buffers) {
+            entry.first_index = first_index;
+            entry.base_vertex = base_vertex;
+            first_index += entry.num_inds;
+            base_vertex += entry.num_verts;
+        } else if (flag & mesh_flag_split_streams) {
+            entry.num_shadow_verts = (uint32)sp.num_shadow_verts;
+        }
+    }
 
-            FILESIZE += write_string(fid, bone.name);
+    std::vector<Mesh_Bone_Entry> bones;
+    mesh_bone_entries(mesh, strings, bones);
+
+    Chunk_Directory directory;
+    mesh_chunk_directory(directory, prims, flag, mesh.is_rigged, base_vertex, first_index, bones.size(), strings.data.size());
+
+    bool32 failed = false;
+    Mesh_Primitive window;
+    std::vector<uint32> indices;
+    size_t buffer_bytes = std::max<size_t>(4096, streamed.memory / 16);
+
+    // every vertex of a primitive, a window at a time
+    auto for_vertex_windows = [&](Streamed_Prim& sp, bool32 shading, const std::function<void(uint64 first)>& write) {
+        for (uint64 first = 0; first < sp.num_verts; first += streamed.window_verts) {
+            size_t count = (size_t)std::min<uint64>(streamed.window_verts, sp.num_verts - first);
+            failed |= !read_vertex_window(sp, first, count, shading, opts.cleanup, window);
+            write(first);
+        }
+    };
+    auto write_indices = [&](File_Writer& w, Streamed_Prim& sp) {
+        indices.resize(std::max<size_t>(1, buffer_bytes / sizeof(uint32)));
+        for (uint64 first = 0; first < sp.num_indices; first += indices.size()) {
+            size_t count = (size_t)std::min<uint64>(indices.size(), sp.num_indices - first);
+            failed |= !read_streamed_indices(sp, first, count, indices.data());
+            w.write_array(indices.data(), count);
         }
+    };
+
+    // like write_mesh_file's, but reading as it goes
+    auto write_chunk_data = [&](File_Writer& w, const Chunk_Entry& entry) {
+        if (memcmp(entry.tag, MESH_ARRAY_PRIMS, 4) == 0) {
+            w.write_array(prims.data(), prims.size());
+        } else if (memcmp(entry.tag, MESH_ARRAY_STRINGS, 4) == 0) {
+            w.write_array(strings.data.data(), strings.data.size());
+        } else if (memcmp(entry.tag, MESH_ARRAY_BOUNDS, 4) == 0) {
+            w.write(streamed.bounds);
+        } else if (memcmp(entry.tag, MESH_ARRAY_BONES, 4) == 0) {
+            w.write_array(bones.data(), bones.size());
+        } else if (entry.index == chunk_index_none) {
+            for (Streamed_Prim& sp : streamed.prims) {
+                if (memcmp(entry.tag, MESH_ARRAY_VERTICES, 4) == 0)
+                    for_vertex_windows(sp, true, [&](uint64) { write_prim_vertices(w, window, mesh.is_rigged, true, opts); });
+                else
+                    write_indices(w, sp);
+            }
+        } else {
+            Streamed_Prim& sp = streamed.prims[entry.index];
+
+            if (memcmp(entry.tag, MESH_ARRAY_INDICES, 4) == 0) {
+                write_indices(w, sp);
+            } else if (memcmp(entry.tag, MESH_ARRAY_VERTICES, 4) == 0) {
+                for_vertex_windows(sp, true, [&](uint64) { write_prim_vertices(w, window, mesh.is_rigged, false, opts); });
+            } else if (memcmp(entry.tag, MESH_ARRAY_POSITIONS, 4) == 0) {
+                for_vertex_windows(sp, false, [&](uint64) {
+                    for (uint32 i = 0; i < window.positions.size(); i++)
+                        w.write_array(&window.positions[i].x, 3);
+                });
+            } else if (memcmp(entry.tag, MESH_ARRAY_SHADING, 4) == 0) {
+                for_vertex_windows(sp, true, [&](uint64) {
+                    for (uint32 i = 0; i < window.positions.size(); i++)
+                        write_vertex_shading(w, window, i, opts);
+                });
+            } else if (memcmp(entry.tag, MESH_ARRAY_SKIN, 4) == 0) {
+                for_vertex_windows(sp, false, [&](uint64) {
+                    for (uint32 i = 0; i < window.positions.size(); i++)
+                        write_vertex_skin(w, window, i);
+                });
+            } else if (memcmp(entry.tag, MESH_ARRAY_SHADOW_VERTS, 4) == 0) {
+                // the welded vertices are ascending, so one pass over the vertices finds them all
+                Record_Reader<uint32> verts(sp.shadow_verts, 0, sp.num_shadow_verts, buffer_bytes);
+                for_vertex_windows(sp, false, [&](uint64 first) {
+                    for (const uint32* v; (v = verts.peek()) != nullptr && *v < first + window.positions.size(); verts.pop()) {
+                        uint32 i = (uint32)(*v - first);
+                        w.write_array(&window.positions[i].x, 3);
+                        if (entry.stride > mesh_position_stride)
+                            write_vertex_skin(w, window, i);
+                    }
+                });
+                failed |= sp.shadow_verts.failed;
+            } else if (memcmp(entry.tag, MESH_ARRAY_SHADOW_INDICES, 4) == 0) {
+                Page_Cache<uint32> remap;
+                remap.init(sp.num_verts, streamed.memory / 4, [&sp](uint64 first, size_t count, uint32* out) {
+                    return sp.shadow_remap.read(first * sizeof(uint32), out, count * sizeof(uint32));
+                });
+                indices.resize(std::max<size_t>(1, buffer_bytes / sizeof(uint32)));
+                for (uint64 first = 0; first < sp.num_indices; first += indices.size()) {
+                    size_t count = (size_t)std::min<uint64>(indices.size(), sp.num_indices - first);
+                    failed |= !read_streamed_indices(sp, first, count, indices.data());
+                    for (size_t i = 0; i < count; i++) {
+                        // out of range without -cleanup, welded to the first vertex
+                        indices[i] = indices[i] < sp.num_verts ? remap.get(indices[i]) : 0;
+                    }
+                    w.write_array(indices.data(), count);
+                }
+                failed |= remap.failed;
+            }
+        }
+    };
+
+    begin_chunk_file(out, directory);
+    for (Chunk_Entry& entry : directory.entries) {
+        begin_chunk(out, entry, alignment);
+        write_chunk_data(out, entry);
+        end_chunk(out, entry);
+    }
+    uint64 filesize = end_chunk_file(out, "MESH", MESH_VERSION, flag, num_prims, alignment, directory, output_timestamp(opts));
+
+    log_printf(" [%llu bytes] ", (unsigned long long)filesize);
+
+    bool32 closed = close_output(out, write_opts);
+    if (failed) {
+        log_printf("[ERROR] reading the buffers failed, the file is incomplete ");
+        return false;
     }
+    return closed;
+}
 
-    FILESIZE += fwrite("END", 1, 3, fid);
-    FILESIZE += (fputc(0, fid) == 0);
+// printf into the writer, for the plain-text formats
+static void write_text(File_Writer& out, const char* format, ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
 
-    fseek(fid, 4, SEEK_SET);
-    filesize_write = static_cast<uint32>(FILESIZE);
-    fwrite(&filesize_write, sizeof(uint32), 1, fid);
-        
-    printf(" [%i bytes] ", filesize_write);
+    if (len > 0) {
+        out.write_bytes(buffer, len < (int)sizeof(buffer) ? len : sizeof(buffer) - 1);
+    }
+}
 
-    fclose(fid);
+static uint32 material_flag(const Material& mat) {
+    uint32 mat_flag = 0;
+    if (mat.double_sided)         mat_flag |= mat_flag_double_sided;
+    if (mat.diffuse_has_texture)  mat_flag |= mat_flag_has_diffuse;
+    if (mat.normal_has_texture)   mat_flag |= mat_flag_has_normal;
+    if (mat.amr_has_texture)      mat_flag |= mat_flag_has_amr;
+    if (mat.emissive_has_texture) mat_flag |= mat_flag_has_emissive;
+    return mat_flag;
+}
 
-    return true;
+// the binary record of a material, as written to a .matb or embedded in a .level
+static Material_Entry material_entry(const Material& mat, String_Table& strings) {
+    Material_Entry entry = {};
+    entry.name = strings.add(mat.name);
+    entry.flag = material_flag(mat);
+    entry.name_hash = name_hash(mat.name);
+
+    memcpy(entry.diffuse_factor, &mat.diffuse_factor.x, 3*sizeof(real32));
+    entry.normal_scale = mat.normal_scale;
+    entry.ambient_strength = mat.ambient_strength;
+    entry.metallic_factor = mat.metallic_factor;
+    entry.roughness_factor = mat.roughness_factor;
+    memcpy(entry.emissive_factor, &mat.emissive_factor.x, 3*sizeof(real32));
+
+    if (mat.diffuse_has_texture)  entry.diffuse_texture = strings.add(mat.diffuse_texture);
+    if (mat.normal_has_texture)   entry.normal_texture = strings.add(mat.normal_texture);
+    if (mat.amr_has_texture)      entry.amr_texture = strings.add(mat.amr_texture);
+    if (mat.emissive_has_texture) entry.emissive_texture = strings.add(mat.emissive_texture);
+    return entry;
 }
 
 bool32 write_mat_file(const Material& mat,
@@ -815,124 +2710,328 @@ bool32 write_mat_file(const Material& mat,
     std::string filename = root_folder + '\\' + mat.name + ".matl";
 
     // Open and check for valid file
-    FILE* fid = nullptr;
-    errno_t err = fopen_s(&fid, filename.c_str(), "wb");
-    if (fid == nullptr || err) {
-        printf("Failed to open output file '%s'...\n", filename.c_str());
+    File_Writer out;
+    if (!open_output(out, filename, opts)) {
+        log_printf("Failed to open output file '%s'...\n", filename.c_str());
         return false;
     }
 
     // construct options flag
-    uint32 mat_flag = 0;
-    if (mat.double_sided)         mat_flag |= 0x01;
-    if (mat.diffuse_has_texture)  mat_flag |= 0x02;
-    if (mat.normal_has_texture)   mat_flag |= 0x04;
-    if (mat.amr_has_texture)      mat_flag |= 0x08;
-    if (mat.emissive_has_texture) mat_flag |= 0x10;
+    uint32 mat_flag = material_flag(mat);
 
-    uint64 timestamp = (uint64)time(NULL);
+    uint64 timestamp = output_timestamp(opts);
 
     // Write to file as plain-text
-    fprintf(fid, "MATL\n");
-    fprintf(fid, "Version: %u\n", MAT_VERSION);
-    fprintf(fid, "Timestamp: %llu\n", timestamp);
-    fprintf(fid, "Flag: %u // ( ", mat_flag);
-    if (mat.double_sided)         fprintf(fid, "double_sided ");
-    if (mat.diffuse_has_texture)  fprintf(fid, "diffuse ");
-    if (mat.normal_has_texture)   fprintf(fid, "normal ");
-    if (mat.amr_has_texture)      fprintf(fid, "amr ");
-    if (mat.emissive_has_texture) fprintf(fid, "emissive ");
-    fprintf(fid, ")\n\n");
-
-    fprintf(fid, "Diffuse:\n");
-    fprintf(fid, "    Factor:  [%f, %f, %f]\n", mat.diffuse_factor.x, mat.diffuse_factor.y, mat.diffuse_factor.z);
-    if (mat.diffuse_has_texture) fprintf(fid, "    Texture: %s\n", mat.diffuse_texture.c_str());
-    fprintf(fid, "\n");
-
-    fprintf(fid, "Normal:\n");
-    fprintf(fid, "    Scale:   %f\n", mat.normal_scale);
-    if (mat.normal_has_texture) fprintf(fid, "    Texture: %s\n", mat.normal_texture.c_str());
-    fprintf(fid, "\n");
-
-    fprintf(fid, "Combined:\n");
-    fprintf(fid, "    Ambient:   %f\n",   mat.ambient_strength);
-    fprintf(fid, "    Metallic:  %f\n",  mat.metallic_factor);
-    fprintf(fid, "    Roughness: %f\n", mat.roughness_factor);
-    if (mat.amr_has_texture) fprintf(fid, "    Texture: %s\n", mat.amr_texture.c_str());
-    fprintf(fid, "\n");
-
-    fprintf(fid, "Emissive:\n");
-    fprintf(fid, "    Factor:  [%f, %f, %f]\n", mat.emissive_factor.x, mat.emissive_factor.y, mat.emissive_factor.z);
-    if (mat.emissive_has_texture) fprintf(fid, "    Texture: %s\n", mat.emissive_texture.c_str());
-    fprintf(fid, "\n");
+    write_text(out, "MATL\n");
+    write_text(out, "Version: %u\n", MAT_TEXT_VERSION);
+    write_text(out, "Timestamp: %llu\n", (unsigned long long)timestamp);
+    write_text(out, "Flag: %u // ( ", mat_flag);
+    if (mat.double_sided)         write_text(out, "double_sided ");
+    if (mat.diffuse_has_texture)  write_text(out, "diffuse ");
+    if (mat.normal_has_texture)   write_text(out, "normal ");
+    if (mat.amr_has_texture)      write_text(out, "amr ");
+    if (mat.emissive_has_texture) write_text(out, "emissive ");
+    write_text(out, ")\n\n");
+
+    write_text(out, "Diffuse:\n");
+    write_text(out, "    Factor:  [%f, %f, %f]\n", mat.diffuse_factor.x, mat.diffuse_factor.y, mat.diffuse_factor.z);
+    if (mat.diffuse_has_texture) write_text(out, "    Texture: %s\n", mat.diffuse_texture.c_str());
+    write_text(out, "\n");
+
+    write_text(out, "Normal:\n");
+    write_text(out, "    Scale:   %f\n", mat.normal_scale);
+    if (mat.normal_has_texture) write_text(out, "    Texture: %s\n", mat.normal_texture.c_str());
+    write_text(out, "\n");
+
+    write_text(out, "Combined:\n");
+    write_text(out, "    Ambient:   %f\n",   mat.ambient_strength);
+    write_text(out, "    Metallic:  %f\n",  mat.metallic_factor);
+    write_text(out, "    Roughness: %f\n", mat.roughness_factor);
+    if (mat.amr_has_texture) write_text(out, "    Texture: %s\n", mat.amr_texture.c_str());
+    write_text(out, "\n");
+
+    write_text(out, "Emissive:\n");
+    write_text(out, "    Factor:  [%f, %f, %f]\n", mat.emissive_factor.x, mat.emissive_factor.y, mat.emissive_factor.z);
+    if (mat.emissive_has_texture) write_text(out, "    Texture: %s\n", mat.emissive_texture.c_str());
+    write_text(out, "\n");
+
+    return close_output(out, opts);
+}
 
-    fclose(fid);
+bool32 write_matb_file(const Material& mat,
+                       const std::string& root_folder,
+                       const Options& opts) {
+
+    std::string filename = root_folder + '\\' + mat.name + ".matb";
+
+    // Open and check for valid file
+    File_Writer out;
+    if (!open_output(out, filename, opts)) {
+        log_printf("Failed to open output file '%s'...\n", filename.c_str());
+        return false;
+    }
+
+    String_Table strings;
+    Material_Entry entry = material_entry(mat, strings);
+
+    uint32 alignment = opts.alignment ? opts.alignment : mesh_default_alignment;
+    Chunk_Directory directory;
+    directory.add(MAT_CHUNK_MATERIALS, chunk_index_none, 1, sizeof(Material_Entry));
+    directory.add(MAT_CHUNK_STRINGS, chunk_index_none, strings.data.size(), 1);
+
+    // Write to file
+    begin_chunk_file(out, directory);
+    begin_chunk(out, directory.entries[0], alignment);
+    out.write(entry);
+    end_chunk(out, directory.entries[0]);
+    begin_chunk(out, directory.entries[1], alignment);
+    out.write_array(strings.data.data(), strings.data.size());
+    end_chunk(out, directory.entries[1]);
+    end_chunk_file(out, "MATB", MAT_VERSION, 0, 1, alignment, directory, output_timestamp(opts));
+
+    return close_output(out, opts);
+}
+
+// the level refers to meshes by the hash of their path relative to the level (the pack entry, if packed)
+static uint64 level_mesh_hash(const std::string& mesh_name, bool32 is_collider) {
+    std::string folder = is_collider ? level_collision_folder : level_render_folder;
+    return pack_hash(folder + '/' + mesh_name + ".mesh");
+}
+
+// packs a transform into the instance table format, returns the number of floats written to out
+uint32 pack_instance_transform(const laml::Mat4& transform, transform_format format, real32* out) {
+    switch (format) {
+        case transform_format::mat34: {
+            for (uint32 row = 0; row < 3; row++) {
+                for (uint32 col = 0; col < 4; col++) {
+                    out[row*4 + col] = transform[col][row];
+                }
+            }
+            return 12;
+        } break;
+        case transform_format::trs: {
+            laml::Mat3 rot_mat;
+            laml::Vec3 trans, scale;
+            laml::transform::decompose(transform, rot_mat, trans, scale);
+
+            // a mirrored transform leaves a reflection in rot_mat, which no quaternion stands for.
+            // flipping one scale axis (and its column) moves the reflection into the scale
+            laml::Vec3 x_axis(transform[0][0], transform[0][1], transform[0][2]);
+            laml::Vec3 y_axis(transform[1][0], transform[1][1], transform[1][2]);
+            laml::Vec3 z_axis(transform[2][0], transform[2][1], transform[2][2]);
+            if (laml::dot(laml::cross(x_axis, y_axis), z_axis) < 0.0f) {
+                scale.x = -scale.x;
+                for (uint32 row = 0; row < 3; row++) {
+                    rot_mat[0][row] = -rot_mat[0][row];
+                }
+            }
+            laml::Quat rot_quat = laml::transform::quat_from_mat(rot_mat);
+
+            out[0] = trans.x;    out[1] = trans.y;    out[2] = trans.z;
+            out[3] = rot_quat.x; out[4] = rot_quat.y; out[5] = rot_quat.z; out[6] = rot_quat.w;
+            out[7] = scale.x;    out[8] = scale.y;    out[9] = scale.z;
+            return 10;
+        } break;
+        default: {
+            memcpy(out, &transform.c_11, 16*sizeof(real32));
+            return 16;
+        } break;
+    }
+}
+
+// the row-major 3x4 matrix a packed trs transform stands for (same layout as mat34)
+static void unpack_trs_transform(const real32* trs, real32* out) {
+    real32 x = trs[3], y = trs[4], z = trs[5], w = trs[6];
+    real32 rot[3][3] = {
+        { 1 - 2*(y*y + z*z), 2*(x*y - z*w),     2*(x*z + y*w)     },
+        { 2*(x*y + z*w),     1 - 2*(x*x + z*z), 2*(y*z - x*w)     },
+        { 2*(x*z - y*w),     2*(y*z + x*w),     1 - 2*(x*x + y*y) },
+    };
+    for (uint32 row = 0; row < 3; row++) {
+        for (uint32 col = 0; col < 3; col++) {
+            out[row*4 + col] = rot[row][col] * trs[7 + col];
+        }
+        out[row*4 + 3] = trs[row];
+    }
+}
 
+// trs can't hold shear (or non-uniform scale under a rotated parent). true if packing the
+// transform as trs gives it back within a tolerance relative to its largest element
+static bool32 trs_round_trips(const laml::Mat4& transform) {
+    real32 trs[10], expected[12], unpacked[12];
+    pack_instance_transform(transform, transform_format::trs, trs);
+    pack_instance_transform(transform, transform_format::mat34, expected);
+    unpack_trs_transform(trs, unpacked);
+
+    real32 largest = 1.0f;
+    for (uint32 n = 0; n < 12; n++) {
+        largest = std::max(largest, std::abs(expected[n]));
+    }
+    for (uint32 n = 0; n < 12; n++) {
+        if (!(std::abs(unpacked[n] - expected[n]) <= 1e-4f * largest))
+            return false;
+    }
     return true;
 }
 
-bool32 write_level_file(const std::vector<Mesh>& meshes, const std::vector<Material>& materials, const std::string& root_folder) {
+bool32 write_level_file(const std::vector<Mesh>& meshes, 
+                        const std::vector<Material>& materials, 
+                        const std::vector<Mesh_Batch>& batches,
+                        const std::string& root_folder,
+                        const Options& opts) {
     std::string filename = root_folder + ".level";
 
     // Open and check for valid file
-    FILE* fid = nullptr;
-    errno_t err = fopen_s(&fid, filename.c_str(), "wb");
-    if (fid == nullptr || err) {
-        //std::cout << "Failed to open output file '" << filename << "'..." << std::endl;
+    File_Writer out;
+    if (!open_output(out, filename, opts)) {
+        log_printf("Failed to open output file '%s'...\n", filename.c_str());
         return false;
     }
 
-    uint16 num_meshes = meshes.size();
-    uint16 num_materials = materials.size();
+    uint32 num_meshes = meshes.size();
+    uint32 num_materials = materials.size();
 
     // construct options flag
     uint32 flag = 0;
 
+    // Group placements by mesh into instance tables, in order of first appearance
+    struct Instance_Table {
+        const Mesh* mesh;
+        std::vector<uint32> entries;
+    };
+    std::vector<Instance_Table> tables;
+    std::unordered_map<std::string, uint32> table_lookup; // colliders and render meshes get separate tables
+    for (uint32 n = 0; n < num_meshes; n++) {
+        const Mesh& mesh = meshes[n];
 
-    uint64 timestamp = (uint64)time(NULL);
+        std::string key = (mesh.is_collider ? "c:" : "r:") + mesh.mesh_name;
+        auto it = table_lookup.find(key);
+        if (it == table_lookup.end()) {
+            it = table_lookup.insert(std::make_pair(key, (uint32)tables.size())).first;
 
-    // Write to file
-    uint32 filesize_write = 0;
-    size_t FILESIZE = 0; // will get updated later
-    FILESIZE += fwrite("LEVL", 1, 4, fid);
-    FILESIZE += fwrite(&filesize_write, sizeof(uint32), 1, fid) * sizeof(uint32);
-    FILESIZE += fwrite(&LEVEL_VERSION, sizeof(uint32), 1, fid) * sizeof(uint32);
-    FILESIZE += fwrite(&flag, sizeof(uint32), 1, fid) * sizeof(uint32);
-    FILESIZE += fwrite(&timestamp, sizeof(uint64), 1, fid) * sizeof(uint64);
-    FILESIZE += fwrite(&num_meshes,    sizeof(uint16), 1, fid) * sizeof(uint16);
-    FILESIZE += fwrite(&num_materials, sizeof(uint16), 1, fid) * sizeof(uint16);
-    uint32 PADDING = 0;
-    FILESIZE += fwrite(&PADDING, sizeof(uint32), 1, fid) * sizeof(uint32);
-
-    for (int n = 0; n < num_meshes; n++) {
-        const Mesh& mesh = meshes[n];
+            Instance_Table new_table;
+            new_table.mesh = &mesh;
+            tables.push_back(new_table);
+        }
+        tables[it->second].entries.push_back(n);
+    }
+
+    // the instance and batch chunks are variable-size records, so they are built in memory first.
+    // names go to the string table, records hold their offset and hash
+    String_Table strings;
+    auto write_name = [&strings](File_Writer& w, const std::string& name) {
+        w.write(strings.add(name));
+        w.write(name_hash(name));
+    };
+
+    File_Writer inst;
+    uint32 num_tables = tables.size();
+    uint32 format = (uint32)opts.instance_format;
+    inst.write(num_tables);
+    inst.write(format);
+    for (uint32 t = 0; t < num_tables; t++) {
+        const Instance_Table& table = tables[t];
+        uint32 num_instances = table.entries.size();
+
+        // a table whose transforms don't survive trs is written as mat3x4 instead
+        transform_format table_format = opts.instance_format;
+        if (table_format == transform_format::trs) {
+            for (uint32 i = 0; i < num_instances; i++) {
+                if (!trs_round_trips(meshes[table.entries[i]].transform)) {
+                    log_printf(" %32s: '%s' has a transform trs can't represent, the table is written as mat3x4\n",
+                        table.mesh->mesh_name.c_str(), meshes[table.entries[i]].name.c_str());
+                    table_format = transform_format::mat34;
+                    break;
+                }
+            }
+        }
+
+        write_name(inst, table.mesh->mesh_name);
+        inst.write(level_mesh_hash(table.mesh->mesh_name, table.mesh->is_collider));
+        inst.write(table.mesh->is_collider);
+        inst.write(num_instances);
+        inst.write((uint32)table_format);
+
+        // packed transforms, ready to be used as an instance buffer
+        for (uint32 i = 0; i < num_instances; i++) {
+            real32 packed[16];
+            uint32 num_floats = pack_instance_transform(meshes[table.entries[i]].transform, table_format, packed);
+            inst.write_array(packed, num_floats);
+        }
 
-        FILESIZE += fwrite(&mesh.transform.c_11, sizeof(real32), 16, fid) * sizeof(real32);
-        FILESIZE += fwrite(&mesh.is_collider, sizeof(bool32), 1, fid) * sizeof(bool32);
-        FILESIZE += write_string(fid, mesh.name);
-        FILESIZE += write_string(fid, mesh.mesh_name);
+        inst.write_array(table.entries.data(), num_instances);
+        for (uint32 i = 0; i < num_instances; i++) {
+            write_name(inst, meshes[table.entries[i]].name);
+        }
 
-        printf(" %32s -> '%s'\n", mesh.name.c_str(), mesh.mesh_name.c_str());
+        log_printf(" %32s x%d %s\n", table.mesh->mesh_name.c_str(), num_instances, table.mesh->is_collider ? "(collider)" : "");
     }
 
-    FILESIZE += fwrite("END", 1, 3, fid);
-    FILESIZE += (fputc(0, fid) == 0);
+    // static batches, and which entries they replace
+    File_Writer btch;
+    uint32 num_batches = batches.size();
+    btch.write(num_batches);
+    for (uint32 n = 0; n < num_batches; n++) {
+        const Mesh_Batch& batch = batches[n];
+        uint32 num_replaced = batch.replaced_entries.size();
+
+        write_name(btch, batch.mesh.mesh_name);
+        btch.write(level_mesh_hash(batch.mesh.mesh_name, false));
+        btch.write(num_replaced);
+        btch.write_array(batch.replaced_entries.data(), num_replaced);
+    }
 
-    fseek(fid, 4, SEEK_SET);
-    filesize_write = static_cast<uint32>(FILESIZE);
-    fwrite(&filesize_write, sizeof(uint32), 1, fid);
-        
-    printf(" [%i bytes] ", filesize_write);
+    // every material, so the level does not need a file read per material
+    std::vector<Material_Entry> mats(num_materials);
+    for (uint32 n = 0; n < num_materials; n++) {
+        mats[n] = material_entry(materials[n], strings);
+    }
 
-    fclose(fid);
+    Level_Info info = {};
+    info.num_meshes = num_meshes;
+    info.num_materials = num_materials;
+    info.num_tables = num_tables;
+    info.num_batches = num_batches;
 
-    return true;
+    uint32 alignment = opts.alignment ? opts.alignment : mesh_default_alignment;
+    Chunk_Directory directory;
+    directory.add(LEVEL_CHUNK_INFO, chunk_index_none, 1, sizeof(Level_Info));
+    directory.add_records(LEVEL_CHUNK_INSTANCES, chunk_index_none, num_tables, inst.size());
+    directory.add_records(LEVEL_CHUNK_BATCHES, chunk_index_none, num_batches, btch.size(), chunk_flag_optional);
+    directory.add(LEVEL_CHUNK_STRINGS, chunk_index_none, strings.data.size(), 1);
+    directory.add(LEVEL_CHUNK_MATERIALS, chunk_index_none, num_materials, sizeof(Material_Entry), chunk_flag_optional);
+
+    // Write to file
+    begin_chunk_file(out, directory);
+    begin_chunk(out, directory.entries[0], alignment);
+    out.write(info);
+    end_chunk(out, directory.entries[0]);
+    begin_chunk(out, directory.entries[1], alignment);
+    out.write_bytes(inst.staging.data(), inst.staging.size());
+    end_chunk(out, directory.entries[1]);
+    begin_chunk(out, directory.entries[2], alignment);
+    out.write_bytes(btch.staging.data(), btch.staging.size());
+    end_chunk(out, directory.entries[2]);
+    begin_chunk(out, directory.entries[3], alignment);
+    out.write_array(strings.data.data(), strings.data.size());
+    end_chunk(out, directory.entries[3]);
+    begin_chunk(out, directory.entries[4], alignment);
+    out.write_array(mats.data(), mats.size());
+    end_chunk(out, directory.entries[4]);
+    uint64 filesize = end_chunk_file(out, "LEVL", LEVEL_VERSION, flag, num_meshes, alignment, directory, output_timestamp(opts));
+
+    log_printf(" [%llu bytes] ", (unsigned long long)filesize);
+
+    return close_output(out, opts);
 }
 
 
 // print contents of file
 void display_mesh_file(const Options& opts);
 void display_level_file(const Options& opts);
+void display_anim_file(const Options& opts);
+void display_pack_file(const Options& opts);
+void display_material_file(const Options& opts);
 bool display_contents(const Options& opts) {
     printf("----------------Loading------------------\n");
     printf("Loading file: '%s'\n", opts.input_filename.c_str());
@@ -945,6 +3044,12 @@ bool display_contents(const Options& opts) {
         display_mesh_file(opts);
     } else if (ext == ".level") {
         display_level_file(opts);
+    } else if (ext == ".anim") {
+        display_anim_file(opts);
+    } else if (ext == ".pack") {
+        display_pack_file(opts);
+    } else if (ext == ".matb") {
+        display_material_file(opts);
     } else {
         printf("Unknown file extension: [%s]\n", ext.c_str());
     }
@@ -957,6 +3062,9 @@ bool display_contents(const Options& opts) {
 
 void print_color(float* color, char* fmt, ...);
 
+// files before v6 are read sequentially
+void display_mesh_file_v5(const Options& opts);
+
 void display_mesh_file(const Options& opts) {
     FILE* fid = fopen(opts.input_filename.c_str(), "rb");
     if (fid == nullptr) {
@@ -964,6 +3072,141 @@ void display_mesh_file(const Options& opts) {
         return;
     }
 
+    // only the header, the directory and the small descriptive chunks are read. vertex data is never touched.
+    Chunk_File_Header header;
+    Chunk_Directory directory;
+    std::vector<uint8> prim_data, string_data, bounds_data, bone_data;
+    const Chunk_Entry* prims_chunk;
+    const Chunk_Entry* strings_chunk;
+    const Chunk_Entry* bounds_chunk;
+    const Chunk_Entry* bones_chunk;
+    auto get_string = [&](uint32 offset) -> const char* {
+        return offset < string_data.size() ? (const char*)string_data.data() + offset : "";
+    };
+
+    uint32 file_version = 0;
+    fseek(fid, 8L, SEEK_SET);
+    read_single(file_version);
+    if (file_version < 6) {
+        fclose(fid);
+        display_mesh_file_v5(opts);
+        return;
+    }
+
+    if (!read_chunk_directory(fid, "MESH", header, directory)) {
+        printf("[ERROR] ill-formed .mesh file (v%d)\n", MESH_VERSION);
+        goto exit;
+    }
+
+    if (utils::file_size(fid) != chunk_file_size(header)) {
+        printf("[ERROR] File is %llu bytes, file says its %llu bytes...\n",
+            (unsigned long long)utils::file_size(fid), (unsigned long long)chunk_file_size(header));
+        goto exit;
+    }
+
+    {
+        uint32 flag = header.flag;
+
+        uint64 timestamp = header.timestamp;
+        struct tm* time_info;
+        char timeString[32] = { 0 };
+        time_info = localtime((time_t*)(&timestamp));
+        strftime(timeString, sizeof(timeString), "%c", time_info);
+
+        printf("Filesize: %llu bytes\n", (unsigned long long)chunk_file_size(header));
+        printf("Mesh version: %d\n", header.version);
+        printf("Flag = %d (", flag);
+        if (flag & mesh_flag_is_rigged)   printf("is_rigged ");
+        if (flag & mesh_flag_is_collider) printf("is_collider ");
+        if (flag & mesh_flag_shared_buffers) printf("shared_buffers ");
+        if (flag & mesh_flag_split_streams) printf("split_streams ");
+        printf(")\n");
+        printf("Alignment: %d bytes\n", header.alignment);
+        printf("File generated on: %s\n", timeString);
+        printf("-----------------------------------------\n");
+        print_chunk_directory(directory);
+        printf("-----------------------------------------\n");
+
+        prims_chunk = directory.find(MESH_ARRAY_PRIMS);
+        strings_chunk = directory.find(MESH_ARRAY_STRINGS);
+        bounds_chunk = directory.find(MESH_ARRAY_BOUNDS);
+        bones_chunk = directory.find(MESH_ARRAY_BONES);
+        // records before v10 are a prefix of the current ones, without the name hashes
+        uint32 prim_stride = header.version >= 10 ? sizeof(Mesh_Prim_Entry) : mesh_prim_entry_v6_size;
+        uint32 bone_stride = header.version >= 10 ? sizeof(Mesh_Bone_Entry) : mesh_bone_entry_v6_size;
+        if (prims_chunk == nullptr || prims_chunk->count != header.count || prims_chunk->stride != prim_stride) {
+            printf("[ERROR] ill-formed .mesh file (v%d)\n", MESH_VERSION);
+            goto exit;
+        }
+        read_chunk(fid, *prims_chunk, prim_data);
+        if (strings_chunk)
+            read_chunk(fid, *strings_chunk, string_data);
+
+        if (bounds_chunk && bounds_chunk->size == sizeof(Mesh_Bounds)) {
+            read_chunk(fid, *bounds_chunk, bounds_data);
+            const Mesh_Bounds* bounds = (const Mesh_Bounds*)bounds_data.data();
+            printf("Bounds: [%.2f %.2f %.2f] - [%.2f %.2f %.2f]\n",
+                bounds->min[0], bounds->min[1], bounds->min[2], bounds->max[0], bounds->max[1], bounds->max[2]);
+        }
+
+        printf("%d Primitives\n", header.count);
+        for (uint32 n = 0; n < header.count; n++) {
+            Mesh_Prim_Entry prim = {};
+            memcpy(&prim, prim_data.data() + (size_t)n * prim_stride, prim_stride);
+
+            printf("  Primitive %d:\n", n);
+            printf("    %d vertices\n", prim.num_verts);
+            printf("    %d indices\n", prim.num_inds);
+            if (header.version >= 10)
+                printf("    Material %d (%s, hash %016llx)\n", prim.mat_idx, get_string(prim.material_name), (unsigned long long)prim.material_hash);
+            else
+                printf("    Material %d (%s)\n", prim.mat_idx, get_string(prim.material_name));
+            printf("    Type: %s\n", prim.prim_type == (uint32)prim_type::triangles ? "TRIANGLES" : "LINES");
+            if (flag & mesh_flag_shared_buffers)
+                printf("    Range: first_index %d, base_vertex %d\n", prim.first_index, prim.base_vertex);
+            if (flag & mesh_flag_split_streams)
+                printf("    Shadow: %d welded vertices, %d indices\n", prim.num_shadow_verts, prim.num_inds);
+
+            if (n < (header.count - 1))
+                printf("\n");
+        }
+
+        if (bones_chunk && bones_chunk->stride == bone_stride) {
+            read_chunk(fid, *bones_chunk, bone_data);
+
+            printf("-----------------------------------------\n");
+            printf("Skeleton\n");
+            printf("%d bones\n", bones_chunk->count);
+            for (uint32 n = 0; n < bones_chunk->count; n++) {
+                Mesh_Bone_Entry bone = {};
+                memcpy(&bone, bone_data.data() + (size_t)n * bone_stride, bone_stride);
+
+                printf("  %2d %2d %-20s ", bone.bone_idx, bone.parent_idx, get_string(bone.name));
+                if (header.version >= 10)
+                    printf("%016llx ", (unsigned long long)bone.name_hash);
+                printf("[");
+                for (uint32 i = 0; i < 16; i++) {
+                    printf("%5.2f ", bone.local_matrix[i]);
+                }
+                printf("]\n");
+            }
+        }
+
+        printf("-----------------------------------------\n");
+    }
+
+exit:
+    fclose(fid);
+    return;
+}
+
+void display_mesh_file_v5(const Options& opts) {
+    FILE* fid = fopen(opts.input_filename.c_str(), "rb");
+    if (fid == nullptr) {
+        printf("[ERROR] Failed to open file [%s]\n", opts.input_filename.c_str());
+        return;
+    }
+
     std::vector<std::string> mat_names;
 
     fseek(fid, 0L, SEEK_END);
@@ -975,7 +3218,7 @@ void display_mesh_file(const Options& opts) {
     read_multi(MAGIC, 4);
     //printf("MAGIC = [%s]\n", MAGIC);
     if (strcmp(MAGIC, "MESH")) {
-        printf("[ERROR] ill-formed .mesh file (v%d)\n", MESH_VERSION);
+        printf("[ERROR] ill-formed .mesh file (v%d)\n", 5);
         goto exit;
     }
 
@@ -1017,118 +3260,19 @@ void display_mesh_file(const Options& opts) {
     printf("Flag = %d (", flag);
     if (flag & mesh_flag_is_rigged)   printf("is_rigged ");
     if (flag & mesh_flag_is_collider) printf("is_collider ");
+    if (flag & mesh_flag_shared_buffers) printf("shared_buffers ");
+    if (flag & mesh_flag_split_streams) printf("split_streams ");
     printf(")\n", flag);
     printf("File generated on: %s\n", timeString);
     printf("-----------------------------------------\n");
 
-    // read materials
-    printf("%d Materials\n", num_prims);
-    for (int n = 0; n < num_prims; n++) {
-        read_multi(MAGIC, 4);
-
-        if (strcmp(MAGIC, "MATL")) {
-            printf("  [ERROR] ill-formed .mesh file (v%d)\n", MESH_VERSION);
-            goto exit;
-        }
-
-        uint32 mat_flag;
-        read_single(mat_flag);
-
-        real32 DiffuseFactor[3];
-        read_multi(DiffuseFactor, 3);
-
-        real32 NormalScale;
-        read_single(NormalScale);
-
-        real32 AmbientStrength;
-        read_single(AmbientStrength);
-
-        real32 MetallicFactor;
-        read_single(MetallicFactor);
-
-        real32 RoughnessFactor;
-        read_single(RoughnessFactor);
-
-        real32 EmissiveFactor[3];
-        read_multi(EmissiveFactor, 3);
-
-        char mat_name[1024] = { 0 };
-        char d_name[1024] = { 0 };
-        char n_name[1024] = { 0 };
-        char a_name[1024] = { 0 };
-        char e_name[1024] = { 0 };
-
-
-        uint8 name_len;
-        read_single(name_len);
-        read_multi(mat_name, name_len);
-        mat_names[n] = std::string(mat_name);
-
-        // load optional textures
-        if (mat_flag & 0x02) {
-            read_single(name_len);
-            read_multi(d_name, name_len);
-        }
-        if (mat_flag & 0x04) {
-            read_single(name_len);
-            read_multi(n_name, name_len);
-        }
-        if (mat_flag & 0x08) {
-            read_single(name_len);
-            read_multi(a_name, name_len);
-        }
-        if (mat_flag & 0x10) {
-            read_single(name_len);
-            read_multi(e_name, name_len);
-        }
-
-        // print out data
-        printf("  Material %d: %s\n", n, mat_name);
-        printf("    Flag = %d (", mat_flag);
-        if (mat_flag & 0x02) printf("has_diffuse ");
-        if (mat_flag & 0x04) printf("has_normal ");
-        if (mat_flag & 0x08) printf("has_amr ");
-        if (mat_flag & 0x10) printf("has_emissive ");
-        printf(")\n");
-
-        printf("    Diffuse:   ");
-        print_color(DiffuseFactor, "[%.2f %.2f %.2f]", DiffuseFactor[0], DiffuseFactor[1], DiffuseFactor[2]);
-        if (mat_flag & 0x02) printf(" - '%s'", d_name);
-        printf("\n");
-
-        printf("    Normal:          %.2f", NormalScale);
-        if (mat_flag & 0x04) printf("       - '%s'", n_name);
-        printf("\n");
-
-        printf("    Ambient:         %.2f", AmbientStrength);
-        if (mat_flag & 0x08) printf("       - '%s'", a_name);
-        printf("\n");
-
-        printf("    Metallic:        %.2f", MetallicFactor);
-        if (mat_flag & 0x08) printf("       - '%s'", a_name);
-        printf("\n");
-
-        printf("    Roughness:       %.2f", RoughnessFactor);
-        if (mat_flag & 0x08) printf("       - '%s'", a_name);
-        printf("\n");
-
-        printf("    Emissive:  ");
-        print_color(EmissiveFactor, "[%.2f %.2f %.2f]", EmissiveFactor[0], EmissiveFactor[1], EmissiveFactor[2]);
-        if (mat_flag & 0x10) printf(" - '%s'", e_name);
-        printf("\n");
-
-        if (n < (num_prims-1))
-            printf("\n");
-    }
-
     // read primitives
-    printf("-----------------------------------------\n");
     printf("%d Primitives\n", num_prims);
     for (int n = 0; n < num_prims; n++) {
         read_multi(MAGIC, 4);
 
         if (strcmp(MAGIC, "PRIM")) {
-            printf("  [ERROR] ill-formed .mesh file (v%d)\n", MESH_VERSION);
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 5);
             goto exit;
         }
 
@@ -1141,22 +3285,76 @@ void display_mesh_file(const Options& opts) {
         uint32 prim_type;
         read_single(prim_type);
 
-
-        fseek(fid, sizeof(uint32)*num_indices, SEEK_CUR);
-        uint32 attribute_size = (flag & mesh_flag_is_rigged) ? 22 : 14;
-        if (prim_type == (uint32)prim_type::lines)
-            attribute_size = 3;
-        fseek(fid, attribute_size*sizeof(real32)*num_verts, SEEK_CUR);
+        uint8 name_len;
+        char mat_name[256] = { 0 };
+        read_single(name_len);
+        read_multi(mat_name, name_len);
+        mat_names[n] = std::string(mat_name);
 
         printf("  Primitive %d:\n", n);
         printf("    %d vertices\n", num_verts);
         printf("    %d indices\n", num_indices);
-        printf("    Material %d (%s)\n", mat_idx, mat_names[mat_idx].c_str());
+        printf("    Material %d (%s)\n", mat_idx, mat_names[n].c_str());
         printf("    Type: %s\n", prim_type == (uint32)prim_type::triangles ? "TRIANGLES" : "LINES");
+
+        if (flag & mesh_flag_shared_buffers) {
+            uint32 first_index, base_vertex;
+            read_single(first_index);
+            read_single(base_vertex);
+            printf("    Range: first_index %d, base_vertex %d\n", first_index, base_vertex);
+        } else if (flag & mesh_flag_split_streams) {
+            // indices, then position/shading/skin streams (same total size as interleaved)
+            fseek(fid, sizeof(uint32)*num_indices, SEEK_CUR);
+            uint32 attribute_size = (flag & mesh_flag_is_rigged) ? 22 : 14;
+            if (prim_type == (uint32)prim_type::lines)
+                attribute_size = 3;
+            fseek(fid, attribute_size*sizeof(real32)*num_verts, SEEK_CUR);
+
+            uint32 num_shadow_verts, num_shadow_inds;
+            read_single(num_shadow_verts);
+            read_single(num_shadow_inds);
+            uint32 shadow_size = ((flag & mesh_flag_is_rigged) && prim_type == (uint32)prim_type::triangles) ? 11 : 3;
+            fseek(fid, shadow_size*sizeof(real32)*num_shadow_verts + sizeof(uint32)*num_shadow_inds, SEEK_CUR);
+            printf("    Shadow: %d welded vertices, %d indices\n", num_shadow_verts, num_shadow_inds);
+        } else {
+            fseek(fid, sizeof(uint32)*num_indices, SEEK_CUR);
+            uint32 attribute_size = (flag & mesh_flag_is_rigged) ? 22 : 14;
+            if (prim_type == (uint32)prim_type::lines)
+                attribute_size = 3;
+            fseek(fid, attribute_size*sizeof(real32)*num_verts, SEEK_CUR);
+        }
+
         if (n < (num_prims - 1))
             printf("\n");
     }
 
+    // read shared buffers
+    if (flag & mesh_flag_shared_buffers) {
+        printf("-----------------------------------------\n");
+
+        read_multi(MAGIC, 4);
+        if (strcmp(MAGIC, "VBUF")) {
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 5);
+            goto exit;
+        }
+        uint32 total_verts;
+        read_single(total_verts);
+        uint32 attribute_size = (flag & mesh_flag_is_rigged) ? 22 : 14;
+        fseek(fid, attribute_size*sizeof(real32)*total_verts, SEEK_CUR);
+
+        read_multi(MAGIC, 4);
+        if (strcmp(MAGIC, "IBUF")) {
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 5);
+            goto exit;
+        }
+        uint32 total_inds;
+        read_single(total_inds);
+        fseek(fid, sizeof(uint32)*total_inds, SEEK_CUR);
+
+        printf("Shared vertex buffer: %d vertices (%d bytes)\n", total_verts, attribute_size*(uint32)sizeof(real32)*total_verts);
+        printf("Shared index buffer:  %d indices (%d bytes)\n", total_inds, (uint32)sizeof(uint32)*total_inds);
+    }
+
     // read skeleton
     if (flag & mesh_flag_is_rigged) {
         printf("-----------------------------------------\n");
@@ -1164,7 +3362,7 @@ void display_mesh_file(const Options& opts) {
 
         read_multi(MAGIC, 4);
         if (strcmp(MAGIC, "SKEL")) {
-            printf("  [ERROR] ill-formed .mesh file (v%d)\n", MESH_VERSION);
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 5);
             goto exit;
         }
 
@@ -1205,17 +3403,194 @@ void display_mesh_file(const Options& opts) {
     read_multi(MAGIC, 4);
 
     if (strcmp(MAGIC, "END")) {
-        printf("[ERROR] ill-formed .mesh file (v%d)\n", MESH_VERSION);
+        printf("[ERROR] ill-formed .mesh file (v%d)\n", 5);
+        goto exit;
+    }
+
+    printf("-----------------------------------------\n");
+
+exit:
+    fclose(fid);
+    return;
+}
+// names are inline (uint8 length, chars) before v6, and a string table offset plus name hash from v6
+static std::string read_level_name(FILE* fid, uint32 version, const std::vector<uint8>& strings) {
+    if (version >= 6) {
+        uint32 offset;
+        uint64 hash;
+        read_single(offset);
+        read_single(hash);
+        return offset < strings.size() ? (const char*)strings.data() + offset : "";
+    }
+
+    char name[256] = { 0 };
+    uint8 name_len;
+    read_single(name_len);
+    read_multi(name, name_len);
+    return name;
+}
+
+// INST block (v3) / chunk (v4+)
+static void display_level_instances(FILE* fid, uint32 num_meshes, uint32 version, const std::vector<uint8>& strings) {
+    uint32 num_tables, format;
+    read_single(num_tables);
+    read_single(format);
+
+    const char* format_names[] = { "mat4", "mat3x4", "trs" };
+    printf("%d Meshes in %d instance tables (%s transforms)\n", num_meshes, num_tables, format < 3 ? format_names[format] : "unknown");
+    for (uint32 t = 0; t < num_tables; t++) {
+        std::string mesh_name = read_level_name(fid, version, strings);
+
+        uint64 mesh_hash = 0;
+        if (version >= 5)
+            read_single(mesh_hash);
+
+        bool32 is_collider;
+        read_single(is_collider);
+
+        uint32 num_instances;
+        read_single(num_instances);
+
+        // from v10 each table has its own format, a trs table can fall back to mat3x4
+        uint32 table_format = format;
+        if (version >= 10)
+            read_single(table_format);
+
+        uint32 floats_per_instance = 16;
+        if (table_format == (uint32)transform_format::mat34) floats_per_instance = 12;
+        if (table_format == (uint32)transform_format::trs)   floats_per_instance = 10;
+
+        std::vector<real32> transforms(num_instances * floats_per_instance);
+        read_multi(transforms.data(), transforms.size());
+        std::vector<uint32> entries(num_instances);
+        read_multi(entries.data(), num_instances);
+
+        printf("  Table %d - %s (%s) x%d", t, mesh_name.c_str(), is_collider ? "collider" : "renderable", num_instances);
+        if (version >= 5)
+            printf(" [%016llx]", (unsigned long long)mesh_hash);
+        if (table_format != format)
+            printf(" (%s)", table_format < 3 ? format_names[table_format] : "unknown");
+        printf("\n");
+        for (uint32 i = 0; i < num_instances; i++) {
+            std::string name = read_level_name(fid, version, strings);
+
+            printf("    [%d] %s [", entries[i], name.c_str());
+            for (uint32 f = 0; f < floats_per_instance; f++) {
+                printf(f ? " %.2f" : "%.2f", transforms[i*floats_per_instance + f]);
+            }
+            printf("]\n");
+        }
+    }
+}
+
+// BTCH block (v2, v3) / chunk (v4+)
+static void display_level_batches(FILE* fid, uint32 version, const std::vector<uint8>& strings) {
+    uint32 num_batches;
+    read_single(num_batches);
+
+    printf("%d Static Batches\n", num_batches);
+    for (uint32 n = 0; n < num_batches; n++) {
+        std::string mesh_name = read_level_name(fid, version, strings);
+
+        uint64 mesh_hash = 0;
+        if (version >= 5)
+            read_single(mesh_hash);
+
+        uint32 num_replaced;
+        read_single(num_replaced);
+        std::vector<uint32> replaced(num_replaced);
+        read_multi(replaced.data(), num_replaced);
+
+        printf("  Batch %d - %s", n, mesh_name.c_str());
+        if (version >= 5)
+            printf(" [%016llx]", (unsigned long long)mesh_hash);
+        printf("\n");
+        printf("    replaces %d entries [", num_replaced);
+        for (uint32 i = 0; i < num_replaced; i++) {
+            printf(i ? " %d" : "%d", replaced[i]);
+        }
+        printf("]\n");
+    }
+}
+
+// Material_Entry records of a .matb or a level's MATS chunk
+static void display_materials(const std::vector<uint8>& mat_data, const std::vector<uint8>& strings) {
+    auto get_string = [&](uint32 offset) -> const char* {
+        return offset < strings.size() ? (const char*)strings.data() + offset : "";
+    };
+
+    uint32 num_materials = mat_data.size() / sizeof(Material_Entry);
+    printf("%d Materials\n", num_materials);
+    for (uint32 n = 0; n < num_materials; n++) {
+        Material_Entry mat;
+        memcpy(&mat, mat_data.data() + n*sizeof(Material_Entry), sizeof(Material_Entry));
+
+        printf("  Material %d - %s [%016llx]%s\n", n, get_string(mat.name), (unsigned long long)mat.name_hash,
+            (mat.flag & mat_flag_double_sided) ? " (double sided)" : "");
+        printf("    Diffuse:   [%.2f %.2f %.2f]", mat.diffuse_factor[0], mat.diffuse_factor[1], mat.diffuse_factor[2]);
+        if (mat.flag & mat_flag_has_diffuse) printf(" '%s'", get_string(mat.diffuse_texture));
+        printf("\n");
+        printf("    Normal:    %.2f", mat.normal_scale);
+        if (mat.flag & mat_flag_has_normal) printf(" '%s'", get_string(mat.normal_texture));
+        printf("\n");
+        printf("    A/M/R:     %.2f %.2f %.2f", mat.ambient_strength, mat.metallic_factor, mat.roughness_factor);
+        if (mat.flag & mat_flag_has_amr) printf(" '%s'", get_string(mat.amr_texture));
+        printf("\n");
+        printf("    Emissive:  [%.2f %.2f %.2f]", mat.emissive_factor[0], mat.emissive_factor[1], mat.emissive_factor[2]);
+        if (mat.flag & mat_flag_has_emissive) printf(" '%s'", get_string(mat.emissive_texture));
+        printf("\n");
+    }
+}
+
+void display_material_file(const Options& opts) {
+    FILE* fid = fopen(opts.input_filename.c_str(), "rb");
+    if (fid == nullptr) {
+        printf("[ERROR] Failed to open file [%s]\n", opts.input_filename.c_str());
+        return;
+    }
+
+    Chunk_File_Header header;
+    Chunk_Directory directory;
+    std::vector<uint8> mat_data, string_data;
+    const Chunk_Entry* mats_chunk;
+    const Chunk_Entry* strings_chunk;
+
+    if (!read_chunk_directory(fid, "MATB", header, directory)) {
+        printf("[ERROR] ill-formed .matb file (v%d)\n", MAT_VERSION);
+        goto exit;
+    }
+
+    mats_chunk = directory.find(MAT_CHUNK_MATERIALS);
+    strings_chunk = directory.find(MAT_CHUNK_STRINGS);
+    if (mats_chunk == nullptr || mats_chunk->stride != sizeof(Material_Entry) ||
+        !read_chunk(fid, *mats_chunk, mat_data) || (strings_chunk && !read_chunk(fid, *strings_chunk, string_data))) {
+        printf("[ERROR] ill-formed .matb file (v%d)\n", MAT_VERSION);
         goto exit;
     }
 
-    printf("-----------------------------------------\n");
-
+    {
+        uint64 timestamp = header.timestamp;
+        struct tm* time_info;
+        char timeString[32] = { 0 };
+        time_info = localtime((time_t*)(&timestamp));
+        strftime(timeString, sizeof(timeString), "%c", time_info);
+
+        printf("Filesize: %llu bytes\n", (unsigned long long)chunk_file_size(header));
+        printf("Material version: %d\n", header.version);
+        printf("File generated on: %s\n", timeString);
+        printf("-----------------------------------------\n");
+        print_chunk_directory(directory);
+        printf("-----------------------------------------\n");
+        display_materials(mat_data, string_data);
+        printf("-----------------------------------------\n");
+    }
+
 exit:
     fclose(fid);
     return;
 }
-void display_level_file(const Options& opts) {
+
+static void display_level_file_v3(const Options& opts) {
     FILE* fid = fopen(opts.input_filename.c_str(), "rb");
     if (fid == nullptr) {
         printf("[ERROR] Failed to open file [%s]\n", opts.input_filename.c_str());
@@ -1269,34 +3644,56 @@ void display_level_file(const Options& opts) {
     printf("File generated on: %s\n", timeString);
     printf("-----------------------------------------\n");
 
-    printf("%d Meshes\n", num_meshes);
-    for (int n = 0; n < num_meshes; n++) {
-        real32 Transform[16];
-        read_multi(Transform, 16);
+    if (file_version < 3) {
+        printf("%d Meshes\n", num_meshes);
+        for (int n = 0; n < num_meshes; n++) {
+            real32 Transform[16];
+            read_multi(Transform, 16);
 
-        bool32 is_collider;
-        read_single(is_collider);
+            bool32 is_collider;
+            read_single(is_collider);
 
-        char name[1024] = { 0 };
-        char mesh_name[1024] = { 0 };
-        uint8 name_len;
+            char name[1024] = { 0 };
+            char mesh_name[1024] = { 0 };
+            uint8 name_len;
 
-        read_single(name_len);
-        read_multi(name, name_len);
+            read_single(name_len);
+            read_multi(name, name_len);
 
-        read_single(name_len);
-        read_multi(mesh_name, name_len);
+            read_single(name_len);
+            read_multi(mesh_name, name_len);
+
+            // print
+            printf("  Mesh %d - %s\n", n, is_collider ? "collider" : "renderable");
+            printf("    %s | %s\n", name, mesh_name);
+            printf("    Transform [%.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f]\n",
+                Transform[0], Transform[1], Transform[2], Transform[3],
+                Transform[4], Transform[5], Transform[6], Transform[7],
+                Transform[8], Transform[9], Transform[10], Transform[11],
+                Transform[12], Transform[13], Transform[14], Transform[15]);
+        }
+        printf("-----------------------------------------\n");
+    } else {
+        read_multi(MAGIC, 4);
+        if (strcmp(MAGIC, "INST")) {
+            printf("[ERROR] ill-formed .level file\n");
+            goto exit;
+        }
 
-        // print
-        printf("  Mesh %d - %s\n", n, is_collider ? "collider" : "renderable");
-        printf("    %s | %s\n", name, mesh_name);
-        printf("    Transform [%.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f %.2f]\n",
-            Transform[0], Transform[1], Transform[2], Transform[3],
-            Transform[4], Transform[5], Transform[6], Transform[7],
-            Transform[8], Transform[9], Transform[10], Transform[11],
-            Transform[12], Transform[13], Transform[14], Transform[15]);
+        display_level_instances(fid, num_meshes, file_version, {});
+        printf("-----------------------------------------\n");
+    }
+
+    if (file_version >= 2) {
+        read_multi(MAGIC, 4);
+        if (strcmp(MAGIC, "BTCH")) {
+            printf("[ERROR] ill-formed .level file\n");
+            goto exit;
+        }
+
+        display_level_batches(fid, file_version, {});
+        printf("-----------------------------------------\n");
     }
-    printf("-----------------------------------------\n");
 
     read_multi(MAGIC, 4);
     if (strcmp(MAGIC, "END")) {
@@ -1309,6 +3706,215 @@ exit:
     return;
 }
 
+void display_level_file(const Options& opts) {
+    FILE* fid = fopen(opts.input_filename.c_str(), "rb");
+    if (fid == nullptr) {
+        printf("[ERROR] Failed to open file [%s]\n", opts.input_filename.c_str());
+        return;
+    }
+
+    // only the header, the directory and the chunks that are printed are read
+    Chunk_File_Header header;
+    Chunk_Directory directory;
+    std::vector<uint8> info_data, string_data, mat_data;
+    const Chunk_Entry* info_chunk;
+    const Chunk_Entry* inst_chunk;
+    const Chunk_Entry* btch_chunk;
+    const Chunk_Entry* strings_chunk;
+    const Chunk_Entry* mats_chunk;
+
+    uint32 file_version = 0;
+    fseek(fid, 8L, SEEK_SET);
+    read_single(file_version);
+    if (file_version < 4) {
+        fclose(fid);
+        display_level_file_v3(opts);
+        return;
+    }
+
+    if (!read_chunk_directory(fid, "LEVL", header, directory)) {
+        printf("[ERROR] ill-formed .level file\n");
+        goto exit;
+    }
+
+    {
+        uint64 timestamp = header.timestamp;
+        struct tm* time_info;
+        char timeString[32] = { 0 };
+        time_info = localtime((time_t*)(&timestamp));
+        strftime(timeString, sizeof(timeString), "%c", time_info);
+
+        printf("Filesize: %llu bytes\n", (unsigned long long)chunk_file_size(header));
+        printf("Level version: %d\n", header.version);
+        printf("Flag = %d\n", header.flag);
+        printf("File generated on: %s\n", timeString);
+        printf("-----------------------------------------\n");
+        print_chunk_directory(directory);
+        printf("-----------------------------------------\n");
+
+        info_chunk = directory.find(LEVEL_CHUNK_INFO);
+        if (info_chunk && info_chunk->size == sizeof(Level_Info)) {
+            read_chunk(fid, *info_chunk, info_data);
+            const Level_Info* info = (const Level_Info*)info_data.data();
+            printf("%d Meshes, %d Materials, %d Instance tables, %d Static batches\n",
+                info->num_meshes, info->num_materials, info->num_tables, info->num_batches);
+            printf("-----------------------------------------\n");
+        }
+
+        strings_chunk = directory.find(LEVEL_CHUNK_STRINGS);
+        if (strings_chunk)
+            read_chunk(fid, *strings_chunk, string_data);
+
+        inst_chunk = directory.find(LEVEL_CHUNK_INSTANCES);
+        if (inst_chunk) {
+            utils::file_seek(fid, inst_chunk->offset);
+            display_level_instances(fid, header.count, header.version, string_data);
+            printf("-----------------------------------------\n");
+        }
+
+        btch_chunk = directory.find(LEVEL_CHUNK_BATCHES);
+        if (btch_chunk) {
+            utils::file_seek(fid, btch_chunk->offset);
+            display_level_batches(fid, header.version, string_data);
+            printf("-----------------------------------------\n");
+        }
+
+        mats_chunk = directory.find(LEVEL_CHUNK_MATERIALS);
+        if (mats_chunk && mats_chunk->stride == sizeof(Material_Entry) && read_chunk(fid, *mats_chunk, mat_data)) {
+            display_materials(mat_data, string_data);
+            printf("-----------------------------------------\n");
+        }
+    }
+
+exit:
+    fclose(fid);
+    return;
+}
+
+void display_pack_file(const Options& opts) {
+    // only the header and the table of contents are read
+    Pack_Reader pack;
+    if (!open_pack(opts.input_filename, pack)) {
+        printf("[ERROR] Failed to open file [%s], or it is not a valid .pack file\n", opts.input_filename.c_str());
+        return;
+    }
+
+    uint64 timestamp = pack.header.timestamp;
+    struct tm* time_info;
+    char timeString[32] = { 0 };
+    time_info = localtime((time_t*)(&timestamp));
+    strftime(timeString, sizeof(timeString), "%c", time_info);
+
+    printf("Filesize: %llu bytes\n", (unsigned long long)pack.header.filesize);
+    printf("Pack version: %d\n", pack.header.version);
+    printf("Alignment: %d\n", pack.header.alignment);
+    printf("File generated on: %s\n", timeString);
+    printf("-----------------------------------------\n");
+
+    const char* compression_names[] = { "", "deflate" };
+    printf("%d Entries\n", pack.header.num_entries);
+    for (const Pack_Entry& entry : pack.entries) {
+        printf("  %016llx offset %10llu  %8d bytes", (unsigned long long)entry.hash, (unsigned long long)entry.offset, entry.size);
+        if (entry.compression != pack_compression_none) {
+            printf(" (%s, %d raw)", entry.compression < 2 ? compression_names[entry.compression] : "unknown", entry.raw_size);
+        }
+        printf("  %s\n", pack.name(entry));
+    }
+    printf("-----------------------------------------\n");
+
+    close_pack(pack);
+}
+
+void display_anim_file(const Options& opts) {
+    FILE* fid = fopen(opts.input_filename.c_str(), "rb");
+    if (fid == nullptr) {
+        printf("[ERROR] Failed to open file [%s]\n", opts.input_filename.c_str());
+        return;
+    }
+
+    // only the header, the directory, INFO and SKEL are read. bone tracks are skipped.
+    Chunk_File_Header header;
+    Chunk_Directory directory;
+    std::vector<uint8> info_data, skel_data, string_data;
+    const Chunk_Entry* info_chunk;
+    const Chunk_Entry* skel_chunk;
+    const Chunk_Entry* strings_chunk;
+    uint32 info_size, bone_stride;
+    auto get_string = [&](uint32 offset) -> const char* {
+        return offset < string_data.size() ? (const char*)string_data.data() + offset : "";
+    };
+
+    if (!read_chunk_directory(fid, "ANIM", header, directory) || header.version < 2) {
+        printf("[ERROR] ill-formed .anim file (v%d)\n", ANIM_VERSION);
+        goto exit;
+    }
+
+    {
+        uint64 timestamp = header.timestamp;
+        struct tm* time_info;
+        char timeString[32] = { 0 };
+        time_info = localtime((time_t*)(&timestamp));
+        strftime(timeString, sizeof(timeString), "%c", time_info);
+
+        printf("Filesize: %llu bytes\n", (unsigned long long)chunk_file_size(header));
+        printf("Anim version: %d\n", header.version);
+        printf("Flag = %d (", header.flag);
+        if (header.flag & anim_flag_is_sampled) printf("is_sampled ");
+        printf(")\n");
+        printf("File generated on: %s\n", timeString);
+        printf("-----------------------------------------\n");
+        print_chunk_directory(directory);
+        printf("-----------------------------------------\n");
+
+        // INFO before v4 is a prefix of the current one, without the name. SKEL before v5 has 16-bit indices
+        info_size = header.version >= 4 ? sizeof(Anim_Info) : anim_info_v2_size;
+        bone_stride = header.version >= 5 ? sizeof(Anim_Bone_Entry) :
+                      header.version >= 4 ? sizeof(Anim_Bone_Entry_16) : anim_bone_entry_v2_size;
+        strings_chunk = directory.find(ANIM_CHUNK_STRINGS);
+        if (strings_chunk)
+            read_chunk(fid, *strings_chunk, string_data);
+
+        info_chunk = directory.find(ANIM_CHUNK_INFO);
+        if (info_chunk && info_chunk->size == info_size) {
+            read_chunk(fid, *info_chunk, info_data);
+            Anim_Info info = {};
+            memcpy(&info, info_data.data(), info_size);
+            if (header.version >= 4)
+                printf("Animation: %s (hash %016llx)\n", get_string(info.name), (unsigned long long)info.name_hash);
+            printf("%d samples at %.2f fps (%.3f sec)\n", info.num_samples, info.frame_rate, info.length);
+        }
+
+        skel_chunk = directory.find(ANIM_CHUNK_SKELETON);
+        if (skel_chunk && skel_chunk->stride == bone_stride) {
+            read_chunk(fid, *skel_chunk, skel_data);
+
+            printf("%d bones\n", skel_chunk->count);
+            for (uint32 n = 0; n < skel_chunk->count; n++) {
+                Anim_Bone_Entry bone = {};
+                if (header.version >= 5) {
+                    memcpy(&bone, skel_data.data() + (size_t)n * bone_stride, bone_stride);
+                } else {
+                    Anim_Bone_Entry_16 narrow = {};
+                    memcpy(&narrow, skel_data.data() + (size_t)n * bone_stride, bone_stride);
+                    bone.bone_idx = narrow.bone_idx;
+                    bone.parent_idx = narrow.parent_idx;
+                    bone.name = narrow.name;
+                    bone.name_hash = narrow.name_hash;
+                }
+                if (header.version >= 4)
+                    printf("  %2d %2d %-20s %016llx\n", bone.bone_idx, bone.parent_idx, get_string(bone.name), (unsigned long long)bone.name_hash);
+                else
+                    printf("  %2d %2d\n", bone.bone_idx, bone.parent_idx);
+            }
+        }
+        printf("-----------------------------------------\n");
+    }
+
+exit:
+    fclose(fid);
+    return;
+}
+
 void print_color(float* color, char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
@@ -1858,89 +4464,304 @@ void read_mesh_v4(FILE* fid, Mesh& mesh, std::vector<Material>& materials) {
         Mesh_Primitive& prim = mesh.primitives[n];
 
         read_multi(MAGIC, 4);
-
+
+        if (strcmp(MAGIC, "PRIM")) {
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 4);
+            return;
+        }
+
+        uint32 num_verts;
+        read_single(num_verts);
+        prim.positions.resize(num_verts);
+        prim.normals.resize(num_verts);
+        prim.tangents_4.resize(num_verts);
+        prim.texcoords.resize(num_verts);
+
+        if (mesh.is_rigged) {
+            prim.bone_indices.resize(num_verts);
+            prim.bone_weights.resize(num_verts);
+        }
+
+        uint32 num_indices;
+        read_single(num_indices);
+        prim.indices.resize(num_indices);
+
+        uint32 mat_idx;
+        read_single(mat_idx);
+        prim.material_index = mat_idx;
+
+        prim_type type; // = prim_type::triangles; // v3 only supported triangles!
+        read_single(type);
+        prim.prim_type = type;
+
+        fread(prim.indices.data(), sizeof(uint32), num_indices, fid);
+        //fseek(fid, sizeof(uint32) * num_indices, SEEK_CUR);
+
+        for (uint32 i = 0; i < num_verts; i++) {
+            fread(&prim.positions[i], sizeof(real32), 3, fid);
+            fread(&prim.normals[i], sizeof(real32), 3, fid);
+
+            laml::Vec3 tangent, bitangent, normal;
+            fread(&tangent, sizeof(real32), 3, fid);
+            fread(&bitangent, sizeof(real32), 3, fid);
+            normal = laml::cross(tangent, bitangent);
+            if (laml::abs(laml::dot(normal, prim.normals[i])) < laml::eps<real32>) {
+                prim.tangents_4[i] = laml::Vec4(tangent.x, tangent.y, tangent.z, 1.0f);
+            }
+            else {
+                prim.tangents_4[i] = laml::Vec4(tangent.x, tangent.y, tangent.z, -1.0f);
+            }
+
+            fread(&prim.texcoords[i], sizeof(real32), 2, fid);
+
+            if (mesh.is_rigged) {
+                fread(&prim.bone_indices[i], sizeof(int32), 4, fid);
+                fread(&prim.bone_weights[i], sizeof(real32), 4, fid);
+            }
+        }
+    }
+
+    // read skeleton if rigged
+    if (mesh.is_rigged) {
+        /*
+        // Check if theres a skeleton
+        if (is_skinned) {
+            struct SKELETON_T {
+                char Magic[4];
+                uint32 num_bones;
+
+                struct BONE_t {
+                    uint32 bone_idx;
+                    int32  parent_idx;
+                    float  debug_length;
+                    float  local_matrix[16];
+                    float  inv_model_matrix[16];
+                    STRING_t bone_name<read=ReadAString>;
+                } bones[num_bones]<optimize=false,read=ReadABone>;
+            } Skeleton<bgcolor=cWhite>;
+        }
+        */
+        Skeleton& skel = mesh.skeleton;
+
+        read_multi(MAGIC, 4);
+
+        if (strcmp(MAGIC, "SKEL")) {
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 4);
+            return;
+        }
+
+        uint32 num_bones;
+        fread(&num_bones, sizeof(uint32), 1, fid);
+        skel.bones.resize(num_bones);
+
+        char bone_name[1024] = { 0 };
+
+        for (uint32 b = 0; b < num_bones; b++) {
+            real32 debug_length;
+            fread(&skel.bones[b].bone_idx, sizeof(uint32), 1, fid);
+            fread(&skel.bones[b].parent_idx, sizeof(int32), 1, fid);
+            fread(&debug_length, sizeof(real32), 1, fid);
+            fread(&skel.bones[b].local_matrix, sizeof(real32), 16, fid);
+            fread(&skel.bones[b].inv_model_matrix, sizeof(real32), 16, fid);
+
+            uint8 name_len;
+            read_single(name_len);
+            read_multi(bone_name, name_len);
+            skel.bones[b].name = std::string(bone_name);
+        }
+    }
+
+    read_multi(MAGIC, 4);
+
+    if (strcmp(MAGIC, "END")) {
+        printf("[ERROR] ill-formed .mesh file (v%d)\n", 4);
+        return;
+    }
+}
+// normal, tangent, bitangent, uv -> normal, tangent_4, uv
+static void read_vertex_shading_v5(FILE* fid, Mesh_Primitive& prim, uint32 i) {
+    laml::Vec3 tangent, bitangent;
+    fread(&prim.normals[i], sizeof(real32), 3, fid);
+    fread(&tangent, sizeof(real32), 3, fid);
+    fread(&bitangent, sizeof(real32), 3, fid);
+    fread(&prim.texcoords[i], sizeof(real32), 2, fid);
+
+    real32 handedness = laml::dot(laml::cross(prim.normals[i], tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+    prim.tangents_4[i] = laml::Vec4(tangent.x, tangent.y, tangent.z, handedness);
+}
+static void read_vertex_skin_v5(FILE* fid, Mesh_Primitive& prim, uint32 i) {
+    fread(&prim.bone_indices[i], sizeof(int32), 4, fid);
+    fread(&prim.bone_weights[i], sizeof(real32), 4, fid);
+}
+static void resize_prim_v5(Mesh_Primitive& prim, bool32 is_rigged, uint32 num_verts, uint32 num_indices) {
+    prim.positions.resize(num_verts);
+    prim.indices.resize(num_indices);
+    if (prim.prim_type != prim_type::triangles)
+        return;
+
+    prim.normals.resize(num_verts);
+    prim.tangents_4.resize(num_verts);
+    prim.texcoords.resize(num_verts);
+    if (is_rigged) {
+        prim.bone_indices.resize(num_verts);
+        prim.bone_weights.resize(num_verts);
+    }
+}
+// v5 only stores material names, so materials only get their name filled in
+void read_mesh_v5(FILE* fid, Mesh& mesh, std::vector<Material>& materials) {
+    fseek(fid, 0L, SEEK_END);
+    size_t real_filesize = ftell(fid);
+
+    fseek(fid, 0L, SEEK_SET);
+
+    char MAGIC[5] = { 0 };
+    read_multi(MAGIC, 4);
+    if (strcmp(MAGIC, "MESH")) {
+        printf("[ERROR] ill-formed .mesh file (v%d)\n", 5);
+        return;
+    }
+
+    uint32 filesize;
+    read_single(filesize);
+    if ((uint32)real_filesize != filesize) {
+        printf("[ERROR] File is %zd bytes, file says its %d bytes...\n", real_filesize, filesize);
+        return;
+    }
+
+    uint32 file_version;
+    read_single(file_version);
+
+    uint32 flag;
+    read_single(flag);
+    mesh.is_collider = flag & mesh_flag_is_collider;
+    mesh.is_rigged = flag & mesh_flag_is_rigged;
+
+    uint64 timestamp;
+    read_single(timestamp);
+
+    uint16 num_prims;
+    read_single(num_prims);
+    if (num_prims > 1000) { //  just in case
+        printf("[ERROR] header not read properly.\n");
+        return;
+    }
+
+    uint16 PADDING[3];
+    read_multi(PADDING, 3);
+
+    mesh.primitives.resize(num_prims);
+    materials.resize(num_prims);
+
+    // read primitives
+    std::vector<uint32> base_vertices(num_prims);
+    for (int n = 0; n < num_prims; n++) {
+        Mesh_Primitive& prim = mesh.primitives[n];
+
+        read_multi(MAGIC, 4);
         if (strcmp(MAGIC, "PRIM")) {
-            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 4);
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 5);
             return;
         }
 
-        uint32 num_verts;
+        uint32 num_verts, num_indices, mat_idx;
         read_single(num_verts);
-        prim.positions.resize(num_verts);
-        prim.normals.resize(num_verts);
-        prim.tangents_4.resize(num_verts);
-        prim.texcoords.resize(num_verts);
-
-        if (mesh.is_rigged) {
-            prim.bone_indices.resize(num_verts);
-            prim.bone_weights.resize(num_verts);
-        }
-
-        uint32 num_indices;
         read_single(num_indices);
-        prim.indices.resize(num_indices);
-
-        uint32 mat_idx;
         read_single(mat_idx);
-        prim.material_index = mat_idx;
+        read_single(prim.prim_type);
+        prim.material_index = n;
 
-        prim_type type; // = prim_type::triangles; // v3 only supported triangles!
-        read_single(type);
-        prim.prim_type = type;
+        uint8 name_len;
+        char mat_name[256] = { 0 };
+        read_single(name_len);
+        read_multi(mat_name, name_len);
+        materials[n].name = std::string(mat_name);
+
+        resize_prim_v5(prim, mesh.is_rigged, num_verts, num_indices);
+        bool32 has_attributes = (prim.prim_type == prim_type::triangles);
+
+        if (flag & mesh_flag_shared_buffers) {
+            // data follows in VBUF/IBUF
+            uint32 first_index;
+            read_single(first_index);
+            read_single(base_vertices[n]);
+            continue;
+        }
 
         fread(prim.indices.data(), sizeof(uint32), num_indices, fid);
-        //fseek(fid, sizeof(uint32) * num_indices, SEEK_CUR);
+
+        if (flag & mesh_flag_split_streams) {
+            fread(prim.positions.data(), sizeof(real32), 3 * num_verts, fid);
+            if (has_attributes) {
+                for (uint32 i = 0; i < num_verts; i++)
+                    read_vertex_shading_v5(fid, prim, i);
+                if (mesh.is_rigged) {
+                    for (uint32 i = 0; i < num_verts; i++)
+                        read_vertex_skin_v5(fid, prim, i);
+                }
+            }
+
+            // the welded shadow buffer is rebuilt by the writer
+            uint32 num_shadow_verts, num_shadow_inds;
+            read_single(num_shadow_verts);
+            read_single(num_shadow_inds);
+            uint32 shadow_size = (mesh.is_rigged && has_attributes) ? 11 : 3;
+            fseek(fid, shadow_size*sizeof(real32)*num_shadow_verts + sizeof(uint32)*num_shadow_inds, SEEK_CUR);
+            continue;
+        }
 
         for (uint32 i = 0; i < num_verts; i++) {
             fread(&prim.positions[i], sizeof(real32), 3, fid);
-            fread(&prim.normals[i], sizeof(real32), 3, fid);
-
-            laml::Vec3 tangent, bitangent, normal;
-            fread(&tangent, sizeof(real32), 3, fid);
-            fread(&bitangent, sizeof(real32), 3, fid);
-            normal = laml::cross(tangent, bitangent);
-            if (laml::abs(laml::dot(normal, prim.normals[i])) < laml::eps<real32>) {
-                prim.tangents_4[i] = laml::Vec4(tangent.x, tangent.y, tangent.z, 1.0f);
-            }
-            else {
-                prim.tangents_4[i] = laml::Vec4(tangent.x, tangent.y, tangent.z, -1.0f);
+            if (has_attributes) {
+                read_vertex_shading_v5(fid, prim, i);
+                if (mesh.is_rigged)
+                    read_vertex_skin_v5(fid, prim, i);
             }
+        }
+    }
 
-            fread(&prim.texcoords[i], sizeof(real32), 2, fid);
-
-            if (mesh.is_rigged) {
-                fread(&prim.bone_indices[i], sizeof(int32), 4, fid);
-                fread(&prim.bone_weights[i], sizeof(real32), 4, fid);
+    if (flag & mesh_flag_shared_buffers) {
+        read_multi(MAGIC, 4);
+        if (strcmp(MAGIC, "VBUF")) {
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 5);
+            return;
+        }
+        uint32 total_verts;
+        read_single(total_verts);
+        for (int n = 0; n < num_prims; n++) {
+            Mesh_Primitive& prim = mesh.primitives[n];
+            for (uint32 i = 0; i < prim.positions.size(); i++) {
+                fread(&prim.positions[i], sizeof(real32), 3, fid);
+                if (prim.prim_type == prim_type::triangles) {
+                    read_vertex_shading_v5(fid, prim, i);
+                    if (mesh.is_rigged)
+                        read_vertex_skin_v5(fid, prim, i);
+                } else {
+                    // lines are padded to the full vertex size
+                    fseek(fid, (mesh.is_rigged ? 19 : 11) * sizeof(real32), SEEK_CUR);
+                }
             }
         }
+
+        read_multi(MAGIC, 4);
+        if (strcmp(MAGIC, "IBUF")) {
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 5);
+            return;
+        }
+        uint32 total_inds;
+        read_single(total_inds);
+        for (int n = 0; n < num_prims; n++) {
+            Mesh_Primitive& prim = mesh.primitives[n];
+            fread(prim.indices.data(), sizeof(uint32), prim.indices.size(), fid);
+        }
     }
 
     // read skeleton if rigged
     if (mesh.is_rigged) {
-        /*
-        // Check if theres a skeleton
-        if (is_skinned) {
-            struct SKELETON_T {
-                char Magic[4];
-                uint32 num_bones;
-
-                struct BONE_t {
-                    uint32 bone_idx;
-                    int32  parent_idx;
-                    float  debug_length;
-                    float  local_matrix[16];
-                    float  inv_model_matrix[16];
-                    STRING_t bone_name<read=ReadAString>;
-                } bones[num_bones]<optimize=false,read=ReadABone>;
-            } Skeleton<bgcolor=cWhite>;
-        }
-        */
         Skeleton& skel = mesh.skeleton;
 
         read_multi(MAGIC, 4);
-
         if (strcmp(MAGIC, "SKEL")) {
-            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 4);
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 5);
             return;
         }
 
@@ -1948,8 +4769,6 @@ void read_mesh_v4(FILE* fid, Mesh& mesh, std::vector<Material>& materials) {
         fread(&num_bones, sizeof(uint32), 1, fid);
         skel.bones.resize(num_bones);
 
-        char bone_name[1024] = { 0 };
-
         for (uint32 b = 0; b < num_bones; b++) {
             real32 debug_length;
             fread(&skel.bones[b].bone_idx, sizeof(uint32), 1, fid);
@@ -1959,6 +4778,7 @@ void read_mesh_v4(FILE* fid, Mesh& mesh, std::vector<Material>& materials) {
             fread(&skel.bones[b].inv_model_matrix, sizeof(real32), 16, fid);
 
             uint8 name_len;
+            char bone_name[256] = { 0 };
             read_single(name_len);
             read_multi(bone_name, name_len);
             skel.bones[b].name = std::string(bone_name);
@@ -1966,12 +4786,138 @@ void read_mesh_v4(FILE* fid, Mesh& mesh, std::vector<Material>& materials) {
     }
 
     read_multi(MAGIC, 4);
-
     if (strcmp(MAGIC, "END")) {
-        printf("[ERROR] ill-formed .mesh file (v%d)\n", 4);
+        printf("[ERROR] ill-formed .mesh file (v%d)\n", 5);
         return;
     }
 }
+// v6+ files are read through the reference loader. materials only get their name filled in
+bool32 read_mesh_v6(const std::string& filename, Mesh& mesh, std::vector<Material>& materials) {
+    Mapped_File file;
+    Mesh_View view;
+    if (!map_file(filename, file) || !open_mesh_view(file.data, file.size, view)) {
+        printf("[ERROR] ill-formed .mesh file (v%d)\n", 6);
+        unmap_file(file);
+        return false;
+    }
+
+    uint32 flag = view.header->flag;
+    mesh.is_collider = flag & mesh_flag_is_collider;
+    mesh.is_rigged = flag & mesh_flag_is_rigged;
+
+    uint32 num_prims = view.header->count;
+    mesh.primitives.resize(num_prims);
+    materials.resize(num_prims);
+
+    // compressed arrays are decompressed once, the rest is used straight from the mapping
+    std::vector<std::vector<uint8>> decompressed(view.header->num_chunks);
+    bool32 corrupt = false;
+    auto array_data = [&](const Chunk_Entry* entry) -> const void* {
+        if (!view.is_compressed(entry))
+            return view.array_data(entry);
+
+        std::vector<uint8>& data = decompressed[entry - view.chunks];
+        if (data.empty()) {
+            data.resize(entry->raw_size);
+            if (!read_mesh_array(view, entry, data.data()))
+                corrupt = true;
+        }
+        return data.data();
+    };
+
+    const Chunk_Entry* shared_verts = view.find_array(MESH_ARRAY_VERTICES);
+    const Chunk_Entry* shared_inds = view.find_array(MESH_ARRAY_INDICES);
+
+    for (uint32 n = 0; n < num_prims; n++) {
+        const Mesh_Prim_Entry entry = view.prim(n);
+        Mesh_Primitive& prim = mesh.primitives[n];
+
+        prim.material_index = n;
+        prim.prim_type = (prim_type)entry.prim_type;
+        materials[n].name = view.string(entry.material_name);
+        resize_prim_v5(prim, mesh.is_rigged, entry.num_verts, entry.num_inds);
+        bool32 has_attributes = (prim.prim_type == prim_type::triangles);
+
+        // a chunk, the first element of this primitive in it, and its stride
+        const Chunk_Entry* inds = view.find_array(MESH_ARRAY_INDICES, n);
+        const Chunk_Entry* verts = view.find_array(MESH_ARRAY_VERTICES, n);
+        const Chunk_Entry* positions = view.find_array(MESH_ARRAY_POSITIONS, n);
+        const Chunk_Entry* shading = view.find_array(MESH_ARRAY_SHADING, n);
+        const Chunk_Entry* skin = view.find_array(MESH_ARRAY_SKIN, n);
+        uint32 first_index = 0, base_vertex = 0;
+        if (flag & mesh_flag_shared_buffers) {
+            inds = shared_inds;
+            verts = shared_verts;
+            first_index = entry.first_index;
+            base_vertex = entry.base_vertex;
+        }
+        // open_mesh_view checked that the records fit the arrays, the interleaved layout is checked here
+        uint32 vertex_stride = mesh_position_stride + mesh_shading_stride + (mesh.is_rigged ? mesh_skin_stride : 0);
+        if (inds == nullptr || (verts == nullptr && positions == nullptr) ||
+            (verts && has_attributes && verts->stride < vertex_stride)) {
+            printf("  [ERROR] ill-formed .mesh file (v%d)\n", 6);
+            unmap_file(file);
+            return false;
+        }
+
+        memcpy(prim.indices.data(), (const uint32*)array_data(inds) + first_index, entry.num_inds * sizeof(uint32));
+
+        for (uint32 i = 0; i < entry.num_verts; i++) {
+            const real32* pos;
+            const real32* shd = nullptr;
+            const real32* skn = nullptr;
+            if (verts) {
+                // interleaved: position, shading, skin
+                pos = (const real32*)((const uint8*)array_data(verts) + (size_t)(base_vertex + i) * verts->stride);
+                if (has_attributes) {
+                    shd = pos + 3;
+                    skn = mesh.is_rigged ? shd + 11 : nullptr;
+                }
+            } else {
+                pos = (const real32*)array_data(positions) + 3*i;
+                if (has_attributes && shading)
+                    shd = (const real32*)array_data(shading) + 11*i;
+                if (has_attributes && skin)
+                    skn = (const real32*)array_data(skin) + 8*i;
+            }
+
+            memcpy(&prim.positions[i].x, pos, 3*sizeof(real32));
+            if (shd) {
+                laml::Vec3 tangent(shd[3], shd[4], shd[5]);
+                laml::Vec3 bitangent(shd[6], shd[7], shd[8]);
+                memcpy(&prim.normals[i].x, shd, 3*sizeof(real32));
+                memcpy(&prim.texcoords[i].x, shd + 9, 2*sizeof(real32));
+
+                real32 handedness = laml::dot(laml::cross(prim.normals[i], tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+                prim.tangents_4[i] = laml::Vec4(tangent.x, tangent.y, tangent.z, handedness);
+            }
+            if (skn) {
+                memcpy(&prim.bone_indices[i].x, skn, 4*sizeof(int32));
+                memcpy(&prim.bone_weights[i].x, skn + 4, 4*sizeof(real32));
+            }
+        }
+    }
+
+    if (view.bones) {
+        Skeleton& skel = mesh.skeleton;
+        skel.bones.resize(view.num_bones);
+        for (uint32 b = 0; b < view.num_bones; b++) {
+            const Mesh_Bone_Entry entry = view.bone(b);
+            skel.bones[b].bone_idx = entry.bone_idx;
+            skel.bones[b].parent_idx = entry.parent_idx;
+            skel.bones[b].name = view.string(entry.name);
+            memcpy(&skel.bones[b].local_matrix.c_11, entry.local_matrix, 16*sizeof(real32));
+            memcpy(&skel.bones[b].inv_model_matrix.c_11, entry.inv_model_matrix, 16*sizeof(real32));
+        }
+    }
+
+    unmap_file(file);
+    if (corrupt) {
+        printf("  [ERROR] corrupt compressed array in .mesh file\n");
+        return false;
+    }
+    return true;
+}
 void upgrade_mesh_file(const Options& opts) {
     Mesh mesh;
     std::vector<Material> materials;
@@ -2044,12 +4990,62 @@ void upgrade_mesh_file(const Options& opts) {
             read_mesh_v4(fid, mesh, materials);
             printf("done!\n");
         } break;
+        case 5: {
+            printf("Copying file %s to %s_v5\n", opts.input_filename.c_str(), opts.input_filename.c_str());
+            CopyFile(opts.input_filename.c_str(), (opts.input_filename + "_v5").c_str(), false);
+            printf("Reading file as v5 mesh...");
+            read_mesh_v5(fid, mesh, materials);
+            printf("done!\n");
+        } break;
+        case 6: {
+            printf("Copying file %s to %s_v6\n", opts.input_filename.c_str(), opts.input_filename.c_str());
+            CopyFile(opts.input_filename.c_str(), (opts.input_filename + "_v6").c_str(), false);
+            printf("Reading file as v6 mesh...");
+            read_mesh_v6(opts.input_filename, mesh, materials);
+            printf("done!\n");
+        } break;
+        case 7: {
+            printf("Copying file %s to %s_v7\n", opts.input_filename.c_str(), opts.input_filename.c_str());
+            CopyFile(opts.input_filename.c_str(), (opts.input_filename + "_v7").c_str(), false);
+            printf("Reading file as v7 mesh...");
+            read_mesh_v6(opts.input_filename, mesh, materials);
+            printf("done!\n");
+        } break;
+        case 8: {
+            printf("Copying file %s to %s_v8\n", opts.input_filename.c_str(), opts.input_filename.c_str());
+            CopyFile(opts.input_filename.c_str(), (opts.input_filename + "_v8").c_str(), false);
+            printf("Reading file as v8 mesh...");
+            read_mesh_v6(opts.input_filename, mesh, materials);
+            printf("done!\n");
+        } break;
+        case 9: {
+            printf("Copying file %s to %s_v9\n", opts.input_filename.c_str(), opts.input_filename.c_str());
+            CopyFile(opts.input_filename.c_str(), (opts.input_filename + "_v9").c_str(), false);
+            printf("Reading file as v9 mesh...");
+            read_mesh_v6(opts.input_filename, mesh, materials);
+            printf("done!\n");
+        } break;
+        case 10: {
+            printf("Copying file %s to %s_v10\n", opts.input_filename.c_str(), opts.input_filename.c_str());
+            CopyFile(opts.input_filename.c_str(), (opts.input_filename + "_v10").c_str(), false);
+            printf("Reading file as v10 mesh...");
+            read_mesh_v6(opts.input_filename, mesh, materials);
+            printf("done!\n");
+        } break;
+        case 11: {
+            printf("Copying file %s to %s_v11\n", opts.input_filename.c_str(), opts.input_filename.c_str());
+            CopyFile(opts.input_filename.c_str(), (opts.input_filename + "_v11").c_str(), false);
+            printf("Reading file as v11 mesh...");
+            read_mesh_v6(opts.input_filename, mesh, materials);
+            printf("done!\n");
+        } break;
     }
     fclose(fid);
 
     printf("Writing new v%d file...", MESH_VERSION);
     write_mesh_file(mesh, materials, ".", opts);
-    for (uint32 n = 0; n < materials.size(); n++) {
+    // v5+ files only name their materials, the .matl files already exist
+    for (uint32 n = 0; file_version < 5 && n < materials.size(); n++) {
         const Material& mat = materials[n];
         printf("  Writing Material: %s\n", mat.name.c_str());
         write_mat_file(mat, ".", opts);
@@ -2073,47 +5069,11 @@ void upgrade_level_file(const Options& opts) {
 void   process_animation(const tinygltf::Model& gltf_model, const tinygltf::Animation& gltf_anim, Animation& anim, const Options& opts);
 bool32 write_anim_file(const Animation& anim, const std::string& out_folder, const Options& opts);
 
-bool extract_anims(const Options& opts) {
-    printf("----------------Loading------------------\n");
-    printf("Loading file: '%s'\n", opts.input_filename.c_str());
-
-    tinygltf::Model gltf_model;
-    tinygltf::TinyGLTF gltf_loader;
-    std::string err;
-    std::string warn;
-
-    std::string rf, fn, ext;
-    utils::decompose_path(opts.input_filename, rf, fn, ext);
-    printf("filename: %s\n", fn.c_str());
-    bool ret = false;
-    if (ext == ".glb") {
-        ret = gltf_loader.LoadBinaryFromFile(&gltf_model, &err, &warn, opts.input_filename);
-    }
-    else if (ext == ".gltf") {
-        ret = gltf_loader.LoadASCIIFromFile(&gltf_model, &err, &warn, opts.input_filename);
-    }
-    else {
-        printf("Unknown file extension: [%s]\n", ext.c_str());
-    }
-
-    if (!warn.empty()) {
-        printf("Warn: %s\n", warn.c_str());
-    }
-
-    if (!err.empty()) {
-        printf("Err: %s\n", err.c_str());
-    }
-
-    if (!ret) {
-        printf("Failed to parse glTF\n");
-        return false;
-    }
-
-    printf("%s file parsed.\n", ext.c_str());
-    bool32 success = true;
+static void extract_animations(const Options& opts, Conversion_State& state) {
+    const tinygltf::Model& gltf_model = *state.gltf_model;
+    std::vector<Animation>& extracted_anims = state.anims;
 
     // Extract all meshes from the file
-    std::vector<Animation> extracted_anims;
     for (int anim_idx = 0; anim_idx < gltf_model.animations.size(); anim_idx++) {
         const tinygltf::Animation& gltf_anim = gltf_model.animations[anim_idx];
 
@@ -2121,32 +5081,154 @@ bool extract_anims(const Options& opts) {
         process_animation(gltf_model, gltf_anim, anim, opts);
         extracted_anims.push_back(anim);
 
-        printf("Animation: %s\n", anim.name.c_str());
+        log_printf("Animation: %s\n", anim.name.c_str());
     }
-    printf("-----------------------------------------\n");
+    log_printf("-----------------------------------------\n");
+}
+
+static bool write_animations(const Options& opts, Conversion_State& state) {
+    if (state.from_cache) {
+        return restore_outputs(opts, state);
+    }
+
+    const std::vector<Animation>& extracted_anims = state.anims;
+    bool32 success = true;
 
     // Write each render mesh to its own file
-    printf("Writing anim files...\n");
+    log_printf("Writing anim files...\n");
     _mkdir(opts.output_folder.c_str());
     std::string out_folder = opts.output_folder;
     _mkdir(out_folder.c_str());
     for (int n = 0; n < extracted_anims.size(); n++) {
         const Animation& anim = extracted_anims[n];
+        std::string filename = out_folder + '\\' + anim.name + ".anim";
 
-        printf("  Writing anim %2d: '%s.anim' [v%d]...", 1 + n, anim.name.c_str(), ANIM_VERSION);
-        if (write_anim_file(anim, out_folder, opts)) {
-            printf("done!\n");
+        log_printf("  Writing anim %2d: '%s.anim' [v%d]...", 1 + n, anim.name.c_str(), ANIM_VERSION);
+        bool32 from_cache;
+        if (write_output(filename, [&]() { return anim_cache_key(anim, opts); }, record_output(state, filename, opts), opts,
+                         [&](const Options& write_opts) { return write_anim_file(anim, out_folder, write_opts); }, from_cache)) {
+            log_printf(from_cache ? "cached!\n" : "done!\n");
         }
         else {
-            printf("failed!\n");
+            log_printf("failed!\n");
             success = false;
         }
     }
-    printf("-----------------------------------------\n");
+    log_printf("-----------------------------------------\n");
+
+    return success;
+}
 
+bool process_input(const Options& opts, Conversion_State* state) {
+    if (state->from_cache) {
+        return true;
+    }
+
+    if (streams_meshes(opts)) {
+        // only the materials for now, the model is kept until the meshes are written
+        state->streaming = true;
+        log_printf("-----------------------------------------\n");
+        extract_materials(*state);
+        return true;
+    }
+
+    // extracted from the same model with the same options before
+    uint64 key = extract_key(opts);
+    std::shared_ptr<const Extracted_Input> extracted;
+    if (state->model_entry) {
+        std::lock_guard<std::mutex> lock(opts.models->mutex);
+        for (const auto& e : state->model_entry->extracted) {
+            if (e->key == key) extracted = e;
+        }
+    }
+    if (extracted) {
+        log_printf("Extracted before, using the %d meshes, %d materials and %d animations kept in memory.\n",
+            (int)extracted->meshes.size(), (int)extracted->materials.size(), (int)extracted->anims.size());
+        log_printf("-----------------------------------------\n");
+        state->meshes = extracted->meshes;
+        state->materials = extracted->materials;
+        state->anims = extracted->anims;
+    } else {
+        if (opts.mode == ANIM_MODE) {
+            extract_animations(opts, *state);
+        } else if (!extract_scene(opts, *state)) {
+            return false;
+        }
+
+        if (state->model_entry) {
+            auto copy = std::make_shared<Extracted_Input>();
+            copy->key = key;
+            copy->meshes = state->meshes;
+            copy->materials = state->materials;
+            copy->anims = state->anims;
+            add_extracted(*opts.models, *state->model_entry, copy);
+        }
+    }
+
+    // everything needed is extracted, and the model can be much bigger than that
+    // (unless it is kept in Options::models)
+    state->gltf_model.reset();
+    state->model_entry.reset();
+    return true;
+}
+
+bool write_outputs(const Options& opts, Conversion_State* state) {
+    bool success;
+    if (opts.mode == ANIM_MODE) {
+        success = write_animations(opts, *state);
+    } else {
+        success = write_scene_files(opts, *state);
+    }
+
+    // everything is in the cache now, so next time the whole conversion can come from it
+    if (success && opts.cache != nullptr && state->cache_key != 0 && !state->from_cache) {
+        state->cached.outputs.assign(state->outputs.begin(), state->outputs.end());
+        store_cached_conversion(*opts.cache, state->cache_key, state->cached);
+    }
+    return success;
+}
+
+void free_conversion(Conversion_State* state) {
+    delete state;
+}
+
+void conversion_files(const Conversion_State* state, std::vector<std::string>& dependencies, std::vector<uint64>& cache_keys) {
+    for (const Cached_Dependency& dep : state->cached.dependencies) {
+        dependencies.push_back(dep.filename);
+    }
+    if (state->cache_key != 0) {
+        cache_keys.push_back(state->cache_key);
+    }
+    if (state->from_cache) {
+        for (const Cached_Output& output : state->cached.outputs) {
+            cache_keys.push_back(output.key);
+        }
+    } else {
+        for (const Cached_Output& output : state->outputs) {
+            cache_keys.push_back(output.key);
+        }
+    }
+}
+
+// the stages one after another. batch mode pipelines them over its inputs instead
+static bool convert_input(const Options& opts) {
+    Conversion_State* state = load_input(opts);
+    if (state == nullptr) {
+        return false;
+    }
+    bool success = process_input(opts, state) && write_outputs(opts, state);
+    free_conversion(state);
     return success;
 }
 
+bool convert_file(const Options& opts) {
+    return convert_input(opts);
+}
+
+bool extract_anims(const Options& opts) {
+    return convert_input(opts);
+}
+
 const tinygltf::Node& find_parent(const tinygltf::Model& gltf_model, const tinygltf::Node& node, int node_idx) {
     int num_nodes = gltf_model.nodes.size();
     for (int n = 0; n < num_nodes; n++) {
@@ -2162,7 +5244,7 @@ const tinygltf::Node& find_parent(const tinygltf::Model& gltf_model, const tinyg
         }
     }
 
-    printf("[WARNING]: Could not find a parent node!\n");
+    log_printf("[WARNING]: Could not find a parent node!\n");
     return node;
 }
 int find_bone_idx(const Skeleton& skeleton, int node_idx) {
@@ -2198,14 +5280,14 @@ void process_animation(const tinygltf::Model& gltf_model, const tinygltf::Animat
     }
     //if (root_node.name != "root" || mesh_node->skin == -1 || mesh_node->mesh == -1) {
     if (mesh_node->skin == -1 || mesh_node->mesh == -1) {
-        printf("Could not find skeleton!\n");
+        log_printf("Could not find skeleton!\n");
         return;
     }
 
     // get skeleton bind pose
     const tinygltf::Skin& gltf_skin = gltf_model.skins[mesh_node->skin];
     Mesh mesh;
-    extract_bind_pose(gltf_model, gltf_skin, mesh, 0);
+    extract_bind_pose(gltf_model, gltf_skin, mesh, 0); // the buffers are loaded in anim mode
 
     // create skeleton animation data
     anim.bones.resize(mesh.skeleton.bones.size());
@@ -2214,46 +5296,54 @@ void process_animation(const tinygltf::Model& gltf_model, const tinygltf::Animat
         anim.bones[n].bone_idx = n;
     }
 
-    printf(" Sampling at %.2f fps\n", anim.frame_rate);
+    log_printf(" Sampling at %.2f fps\n", anim.frame_rate);
+    std::vector<int> channel_bones(num_channels);
     for (uint32 n = 0; n < num_channels; n++) {
-        const tinygltf::AnimationChannel& chan = gltf_anim.channels[n];
-
-        const tinygltf::AnimationSampler& sampler = gltf_anim.samplers[chan.sampler];
-
-        int node_idx  = chan.target_node;
-        int bone_idx = find_bone_idx(mesh.skeleton, node_idx);
-        if (bone_idx < 0) {
-            printf("[ERROR] Could not match bone to channel!\n");
+        channel_bones[n] = find_bone_idx(mesh.skeleton, gltf_anim.channels[n].target_node);
+        if (channel_bones[n] < 0) {
+            log_printf("[ERROR] Could not match bone to channel!\n");
             return;
         }
-        const tinygltf::Node& node = gltf_model.nodes[node_idx];
+    }
 
-        BoneAnim& bone = anim.bones[bone_idx];
+    // every channel is sampled in parallel. a channel only writes its own track of its bone
+    parallel_for(num_channels, [&](uint32 n) {
+        const tinygltf::AnimationChannel& chan = gltf_anim.channels[n];
+        const tinygltf::AnimationSampler& sampler = gltf_anim.samplers[chan.sampler];
+        BoneAnim& bone = anim.bones[channel_bones[n]];
 
         if (chan.target_path == "translation") {
-            printf("    Translation channel:\n");
             bone.translation = sample_anim_channel<laml::Vec3>(gltf_model, chan, sampler, anim.frame_rate, false,
                 [](const laml::Vec3& v1, const laml::Vec3& v2, real32 f) { return laml::lerp(v1, v2, f); });
         }
         else if (chan.target_path == "rotation") {
-            printf("    Rotation channel:\n");
             bone.rotation = sample_anim_channel<laml::Quat>(gltf_model, chan, sampler, anim.frame_rate, true,
                 [](const laml::Quat& q1, const laml::Quat& q2, real32 f) { return laml::slerp(q1, q2, f); });
         }
         else if (chan.target_path == "scale") {
-            printf("    Scale channel:\n");
             bone.scale = sample_anim_channel<laml::Vec3>(gltf_model, chan, sampler, anim.frame_rate, false,
                 [](const laml::Vec3& v1, const laml::Vec3& v2, real32 f) { return laml::lerp(v1, v2, f); });
         }
+    });
 
-        printf("  [%2d:%2d] '%s': %s\n", node_idx, bone_idx, node.name.c_str(), chan.target_path.c_str());
+    for (uint32 n = 0; n < num_channels; n++) {
+        const tinygltf::AnimationChannel& chan = gltf_anim.channels[n];
+        const tinygltf::Node& node = gltf_model.nodes[chan.target_node];
+
+        if (chan.target_path == "translation")
+            log_printf("    Translation channel:\n");
+        else if (chan.target_path == "rotation")
+            log_printf("    Rotation channel:\n");
+        else if (chan.target_path == "scale")
+            log_printf("    Scale channel:\n");
+        log_printf("  [%2d:%2d] '%s': %s\n", chan.target_node, channel_bones[n], node.name.c_str(), chan.target_path.c_str());
     }
 
     anim.skeleton = mesh.skeleton;
     anim.length = anim.bones[0].translation.size() / anim.frame_rate;
 
-    printf("framerate: %.3f fps\n", anim.frame_rate);
-    printf("length:    %.3f sec\n", anim.length);
+    log_printf("framerate: %.3f fps\n", anim.frame_rate);
+    log_printf("length:    %.3f sec\n", anim.length);
 }
 
 template<typename T>
@@ -2266,8 +5356,11 @@ std::vector<T> sample_anim_channel(const tinygltf::Model& tinymodel,
     const tinygltf::Accessor& input_acc = tinymodel.accessors[sampler.input];
     const tinygltf::Accessor& output_acc = tinymodel.accessors[sampler.output];
 
-    std::vector<real32> frame_times  = extract_accessor<real32, real32>(tinymodel, sampler.input, 0);
-    std::vector<T>   frame_values = extract_accessor<T, real32>(tinymodel, sampler.output, 0);
+    // anim mode always loads the buffers, these can not fail
+    std::vector<real32> frame_times;
+    std::vector<T>   frame_values;
+    extract_accessor<real32, real32>(tinymodel, sampler.input, 0, frame_times);
+    extract_accessor<T, real32>(tinymodel, sampler.output, 0, frame_values);
 
     //printf("  time: [");
     //for (uint32 n = 0; n < frame_times.size(); n++) {
@@ -2362,79 +5455,100 @@ std::vector<T> sample_anim_channel(const tinygltf::Model& tinymodel,
 
 bool32 write_anim_file(const Animation& anim, const std::string& out_folder, const Options& opts) {
     if (anim.bones.size() == 0) {
-        printf("[WARNING] 0 bones in '%s'\n", anim.name.c_str());
+        log_printf("[WARNING] 0 bones in '%s'\n", anim.name.c_str());
         return false;
     }
     std::string filename = out_folder + '\\' + anim.name+ ".anim";
 
     // Open and check for valid file
-    FILE* fid = nullptr;
-    errno_t err = fopen_s(&fid, filename.c_str(), "wb");
-    if (fid == nullptr || err) {
-        printf("Failed to open output file '%s'...\n", filename.c_str());
+    File_Writer out;
+    if (!open_output(out, filename, opts)) {
+        log_printf("Failed to open output file '%s'...\n", filename.c_str());
         return false;
     }
 
-    uint16 num_bones = anim.skeleton.bones.size();
-    uint16 num_samples = anim.bones[0].translation.size();
-    real32 frame_rate = anim.frame_rate;
+    uint32 num_bones = anim.skeleton.bones.size();
+    uint32 num_samples = anim.bones[0].translation.size();
 
     // construct options flag
     uint32 flag = 0;
     flag |= anim_flag_is_sampled;
 
-    uint64 timestamp = (uint64)time(NULL);
+    String_Table strings;
+    Anim_Info info = {};
+    info.num_samples = num_samples;
+    info.frame_rate = anim.frame_rate;
+    info.length = anim.length;
+    info.name = strings.add(anim.name);
+    info.name_hash = name_hash(anim.name);
 
-    // Write to file
-    uint32 filesize_write = 0;
-    size_t FILESIZE = 0; // will get updated later
-    FILESIZE += fwrite("ANIM", 1, 4, fid);
-    FILESIZE += fwrite(&filesize_write, sizeof(uint32), 1, fid) * sizeof(uint32);
-    FILESIZE += fwrite(&ANIM_VERSION,   sizeof(uint32), 1, fid) * sizeof(uint32);
-    FILESIZE += fwrite(&flag,           sizeof(uint32), 1, fid) * sizeof(uint32);
-    FILESIZE += fwrite(&timestamp,      sizeof(uint64), 1, fid) * sizeof(uint64);
-    FILESIZE += fwrite(&num_bones,      sizeof(uint16), 1, fid) * sizeof(uint16);
-    FILESIZE += fwrite(&num_samples,    sizeof(uint16), 1, fid) * sizeof(uint16);
-    FILESIZE += fwrite(&frame_rate,     sizeof(real32), 1, fid) * sizeof(real32);
-
-    // Write the skeleton heirarchy
+    // the skeleton heirarchy
     const Skeleton& skeleton = anim.skeleton;
-    FILESIZE += fwrite("SKEL", 1, 4, fid);
-    FILESIZE += fwrite(&num_bones, sizeof(uint16), 1, fid) * sizeof(uint16);
-
+    std::vector<Anim_Bone_Entry> bones(num_bones);
     for (uint32 bone_idx = 0; bone_idx < num_bones; bone_idx++) {
         const Bone& bone = skeleton.bones[bone_idx];
-
-        FILESIZE += fwrite(&bone.bone_idx, sizeof(uint16), 1, fid) * sizeof(uint16);
-        FILESIZE += fwrite(&bone.parent_idx, sizeof(int16), 1, fid) * sizeof(int16);
+        bones[bone_idx].bone_idx = bone.bone_idx;
+        bones[bone_idx].parent_idx = bone.parent_idx;
+        bones[bone_idx].name = strings.add(bone.name);
+        bones[bone_idx].name_hash = name_hash(bone.name);
     }
 
-    // Write sampled animation frames
-    for (uint32 bone_idx = 0; bone_idx < num_bones; bone_idx++) {
-        const BoneAnim& bone = anim.bones[bone_idx];
+    uint32 alignment = opts.alignment ? opts.alignment : mesh_default_alignment;
+    Chunk_Directory directory;
+    directory.add(ANIM_CHUNK_INFO, chunk_index_none, 1, sizeof(Anim_Info));
+    directory.add(ANIM_CHUNK_SKELETON, chunk_index_none, num_bones, sizeof(Anim_Bone_Entry));
+    directory.add(ANIM_CHUNK_STRINGS, chunk_index_none, strings.data.size(), 1);
 
-        FILESIZE += fwrite("BONE", 1, 4, fid);
+    // sampled animation frames, one chunk per bone track
+    for (uint32 bone_idx = 0; bone_idx < num_bones; bone_idx++) {
+        directory.add(ANIM_CHUNK_BONE, bone_idx, num_samples, anim_sample_size);
+    }
+    auto write_track = [&](File_Writer& w, const BoneAnim& bone) {
         for (uint32 n = 0; n < num_samples; n++) {
-            FILESIZE += fwrite(&bone.translation[n].x, sizeof(real32), 3, fid) * sizeof(real32);
+            w.write_array(&bone.translation[n].x, 3);
         }
         for (uint32 n = 0; n < num_samples; n++) {
-            FILESIZE += fwrite(&bone.rotation[n].x, sizeof(real32), 4, fid) * sizeof(real32);
+            w.write_array(&bone.rotation[n].x, 4);
         }
         for (uint32 n = 0; n < num_samples; n++) {
-            FILESIZE += fwrite(&bone.scale[n].x, sizeof(real32), 3, fid) * sizeof(real32);
+            w.write_array(&bone.scale[n].x, 3);
         }
-    }
+    };
 
-    FILESIZE += fwrite("END", 1, 3, fid);
-    FILESIZE += (fputc(0, fid) == 0);
+    // Write to file. tracks are streamed, only the one being compressed is held in memory
+    begin_chunk_file(out, directory);
 
-    fseek(fid, 4, SEEK_SET);
-    filesize_write = static_cast<uint32>(FILESIZE);
-    fwrite(&filesize_write, sizeof(uint32), 1, fid);
+    begin_chunk(out, directory.entries[0], alignment);
+    out.write(info);
+    end_chunk(out, directory.entries[0]);
 
-    printf(" [%i bytes] ", filesize_write);
+    begin_chunk(out, directory.entries[1], alignment);
+    out.write_array(bones.data(), bones.size());
+    end_chunk(out, directory.entries[1]);
 
-    fclose(fid);
+    begin_chunk(out, directory.entries[2], alignment);
+    out.write_array(strings.data.data(), strings.data.size());
+    end_chunk(out, directory.entries[2]);
 
-    return true;
+    for (uint32 bone_idx = 0; bone_idx < num_bones; bone_idx++) {
+        Chunk_Entry& entry = directory.entries[3 + bone_idx];
+        std::vector<uint8> stored;
+        if (opts.compress) {
+            File_Writer track;
+            write_track(track, anim.bones[bone_idx]);
+            compress_chunk(entry, track.staging, stored);
+        }
+
+        begin_chunk(out, entry, alignment);
+        if (entry.flags & chunk_flag_compressed)
+            out.write_bytes(stored.data(), stored.size());
+        else
+            write_track(out, anim.bones[bone_idx]);
+        end_chunk(out, entry);
+    }
+    uint64 filesize = end_chunk_file(out, "ANIM", ANIM_VERSION, flag, num_bones, alignment, directory, output_timestamp(opts));
+
+    log_printf(" [%llu bytes] ", (unsigned long long)filesize);
+
+    return close_output(out, opts);
 }
\ No newline at end of file
@@ -1,8 +1,15 @@
 #pragma once
 
 #include <cassert>
+#include <atomic>
+#include <functional>
 #include <laml/laml.hpp>
 #include "utils.h"
+#include "mesh_format.h"
+
+struct Pack_Writer;
+struct Conversion_Cache;
+struct Model_Cache;
 
 enum OperationModeType {
     HELP_MODE,
@@ -11,6 +18,30 @@ enum OperationModeType {
     LEVEL_MODE,
     DISPLAY_MODE,
     UPGRADE_MODE,
+    BENCH_MODE,
+    VERIFY_MODE,
+    BATCH_MODE,
+    WATCH_MODE,
+    SERVE_MODE,
+};
+
+enum class transform_format : uint32 {
+    mat4  = 0, // 16 floats, column-major
+    mat34 = 1, // 12 floats, the top 3 rows in row-major order
+    trs   = 2, // 10 floats, translation (xyz), rotation (xyzw), scale (xyz)
+};
+
+enum class material_format : uint32 {
+    text   = 0, // .matl, plain-text
+    binary = 1, // .matb, see material_format.h
+    both   = 2,
+};
+
+// what a conversion wrote, counted when Options::stats is set
+struct Output_Stats {
+    std::atomic<uint32> num_files{0};
+    std::atomic<uint64> num_bytes{0};
+    std::atomic<uint32> num_unchanged{0}; // of num_files, already on disk with the same bytes and not touched
 };
 
 struct Options {
@@ -20,7 +51,55 @@ struct Options {
     std::string output_folder;
 
     bool flip_uvs_y;
+    bool cleanup;
+    bool shared_buffers;
+    bool split_streams;
+    uint32 alignment;
+    bool compress;
+    bool geometry_codec;
     float frame_rate;
+
+    bool batch_static;
+    float batch_cell_size;
+
+    transform_format instance_format;
+    material_format material_output;
+
+    uint32 num_threads; // -j, 0 = all hardware threads
+
+    bool pack_files;
+    bool pack_compress;
+    Pack_Writer* pack; // set while converting into a pack, outputs become entries of it
+    Output_Stats* stats; // every file written is counted in it, if set
+
+    // deterministic output: the same input and options give the same bytes, so files that did
+    // not change are not rewritten (and hot-reload or downstream caches are not triggered)
+    uint64 timestamp;            // -timestamp N: stored in every output instead of the current time, 0 = current time
+    bool timestamp_from_input;   // -timestamp input: the modification time of the input instead
+    bool skip_unchanged;         // set with -timestamp: files that already hold the same bytes are left alone
+
+    std::string cache_folder;     // -cache: outputs are kept there between runs (conversion_cache.h)
+    Conversion_Cache* cache;      // set with -cache
+    std::vector<uint8>* capture;  // set while an output is written for the cache, gets a copy of its bytes
+
+    Model_Cache* models;          // serve mode: parsed inputs and what was extracted from them are kept in it
+
+    // -max-memory MB: bounded memory (mesh and level mode). meshes are extracted and written a few
+    // at a time, at most this many bytes of them in flight, and the buffers of the input are
+    // released as soon as no mesh still needs them. 0 = everything is extracted, then written
+    uint64 max_memory;
+
+    // batch mode
+    std::vector<std::string> batch_inputs; // files, glob patterns (* and ? in the filename) and folders
+    OperationModeType batch_mode;          // -mode: how batch_inputs are converted (mesh, level or anim)
+    std::string manifest;                  // -manifest: a list of '<mode> <input> [output_folder]' lines
+    bool verbose;                          // print the log of every input, not only of failed ones
+    uint32 queue_depth;                    // -queue-depth: inputs waiting between two pipeline stages, 0 = 2
+    uint32 debounce_ms;                    // -debounce: watch mode converts once nothing changed for this long
+
+    // serve mode
+    std::string socket_path;               // the Unix domain socket requests come in on
+    uint64 model_cache_size;               // -model-cache: bytes of parsed inputs kept in memory
 };
 
 #define TOOL_VERSION "v0.2.0"
@@ -31,14 +110,93 @@ struct Options {
  * Mesh Version 5:
  *      -Remove material definition from mesh file. Now contains a 'default_material_name' field. This can be empty,
  *       and in use the mesh needs to be paired with a material separatly. Needs to pair with a Material Version 1.
+ *      -Optional 'shared buffers' layout (mesh_flag_shared_buffers): all primitives share one vertex buffer (VBUF)
+ *       and one index buffer (IBUF), and each PRIM block only carries its (first_index, index_count, base_vertex) range.
+ *      -Optional 'split streams' layout (mesh_flag_split_streams): each PRIM stores its vertices as a position stream,
+ *       a shading stream (normal/tangent/bitangent/uv) and a skin stream, followed by a position-only welded
+ *       vertex/index buffer for depth and shadow passes. Not combined with shared buffers.
+ * Mesh Version 6:
+ *      -Memory-mappable layout (see mesh_format.h). The header is followed by an offset table with one entry
+ *       (tag, primitive, offset, size, count, stride) per array, and every array starts at a multiple of the
+ *       alignment stored in the header (64 bytes by default, up to 4 KiB). Primitive descriptors, bones and
+ *       names are fixed-size records / a string array, so a loader only has to map the file and fix up pointers.
+ *       The shared-buffers and split-streams layouts become different sets of arrays in the table.
+ * Mesh Version 7:
+ *      -The offset table is now the common chunk directory (chunk_file.h): the entry's reserved word holds chunk
+ *       flags, and the header field that held num_prims is the generic 'count'. v6 files read as-is.
+ *      -Added a BNDS chunk with the bounds of the whole mesh, so it can be read without touching vertex data.
+ * Mesh Version 8:
+ *      -Vertex and index chunks can be compressed (chunk_flag_compressed, block_compression.h). The directory
+ *       entry's last word is now the uncompressed size. Uncompressed chunks are unchanged and can still be mapped.
+ * Mesh Version 9:
+ *      -Index chunks of triangle lists can use the index codec (chunk_flag_index_codec) and vertex chunks the
+ *       vertex codec (chunk_flag_vertex_codec), see geometry_codec.h. Decoded the same way as compressed chunks.
+ * Mesh Version 10:
+ *      -The STRS chunk is a deduplicated string table. Mesh_Prim_Entry gained the hash of its material name and
+ *       Mesh_Bone_Entry the hash of its bone name (name_hash(), 64-bit FNV-1a), so names can be matched without
+ *       string compares. v6 - v9 records are a prefix of the new ones and still read.
+ * Mesh Version 11:
+ *      -64-bit chunk offsets and sizes (Chunk_Entry grew to 48 bytes) and a 64-bit filesize (the header's
+ *       filesize_high), so meshes past 4 GiB are written correctly. Older 32-bit directories are widened on read.
+ * Mesh Version 12:
+ *      -CRC32C checksums (checksum.h): every chunk stores the checksum of its stored bytes in the directory entry's
+ *       last word (chunk_flag_checksum), and the header's last word covers the header and directory. The layout
+ *       is unchanged, v11 files read as-is (unchecked).
+ */
+/* Anim Version 2:
+ *      -Chunked layout (chunk_file.h, anim_format.h): INFO (samples, frame rate, length), SKEL, and one BONE
+ *       chunk per bone track, all listed in the directory after the header.
+ * Anim Version 3:
+ *      -BONE chunks can be compressed, same as mesh v8.
+ * Anim Version 4:
+ *      -Added a STRS string table. INFO names the animation and every SKEL entry its bone, each by string
+ *       offset plus name hash, same as mesh v10. The BONE chunks move after STRS in the directory.
+ * Anim Version 5:
+ *      -64-bit chunk offsets and sizes, same as mesh v11. SKEL entries store 32-bit bone and parent indices.
+ * Anim Version 6:
+ *      -CRC32C checksums per chunk and for the directory, same as mesh v12.
+ */
+/* Level Version 2:
+ *      -Added a BTCH block after the mesh list. Each batch names a pre-transformed, world-space .mesh
+ *       and lists the indices of the mesh entries it replaces.
+ * Level Version 3:
+ *      -Replaced the per-entry mesh list with instance tables (INST). Each table holds one mesh reference and
+ *       a packed array of transforms (mat4, mat3x4 or TRS) that can be uploaded directly as an instance buffer,
+ *       followed by the entry index and node name of each instance. BTCH entry indices refer to these.
+ * Level Version 4:
+ *      -Chunked layout (chunk_file.h, level_format.h): INFO (counts), then the INST and BTCH blocks as chunks,
+ *       all listed in the directory after the header.
+ * Level Version 5:
+ *      -Each instance table and batch stores a 64-bit hash of its mesh path after the name, so meshes can be
+ *       looked up in a .pack (pack_file.h) without building paths.
+ * Level Version 6:
+ *      -Names moved to a STRS string table. Each name in INST and BTCH is a uint32 offset and a uint64
+ *       name hash instead of an inline uint8 length and chars, so long names are no longer truncated.
+ * Level Version 7:
+ *      -64-bit chunk offsets and sizes, same as mesh v11.
+ * Level Version 8:
+ *      -CRC32C checksums per chunk and for the directory, same as mesh v12.
+ * Level Version 9:
+ *      -Added an optional MATS chunk with every material of the level as Material_Entry records (material_format.h),
+ *       their names and texture paths in STRS, so a level loads all of its materials with one read.
+ * Level Version 10:
+ *      -Each instance table stores its own transform format after num_instances. The format at the start of INST
+ *       is the one requested; a trs table whose transforms don't round-trip through TRS (shear) is mat3x4.
+ */
+/* Material Version 2:
+ *      -Binary .matb files (material_format.h): a chunked file with one fixed-size Material_Entry and a string
+ *       table for the names and texture paths. The plain-text .matl stays at version 1 (MAT_TEXT_VERSION).
  */
-const uint32 MESH_VERSION  = 5;
-const uint32 MAT_VERSION   = 1;
-const uint32 ANIM_VERSION  = 1;
-const uint32 LEVEL_VERSION = 1;
+const uint32 MESH_VERSION  = 12;
+const uint32 MAT_VERSION   = 2;
+const uint32 MAT_TEXT_VERSION = 1;
+const uint32 ANIM_VERSION  = 6;
+const uint32 LEVEL_VERSION = 10;
 
 const uint32 mesh_flag_is_rigged   = 0x01; // 1
 const uint32 mesh_flag_is_collider = 0x02; // 2
+const uint32 mesh_flag_shared_buffers = 0x04; // 4
+const uint32 mesh_flag_split_streams  = 0x08; // 8
 
 const uint32 anim_flag_is_sampled  = 0x01; // 1
 
@@ -50,8 +208,54 @@ const uint32 mat_flag_has_emissive = 0x10; // 16
 
 bool convert_file(const Options& opts);
 bool extract_anims(const Options& opts);
+// the timestamp stored in the outputs of a conversion, see Options::timestamp
+uint64 output_timestamp(const Options& opts);
+
+// The stages convert_file and extract_anims run one after another: load (reading and parsing
+// the input), process (extraction) and write (encoding and writing the outputs). Batch mode
+// runs them as a pipeline instead, with a different input in each stage.
+struct Conversion_State;
+Conversion_State* load_input(const Options& opts); // nullptr if the input can not be loaded
+bool process_input(const Options& opts, Conversion_State* state);
+bool write_outputs(const Options& opts, Conversion_State* state);
+void free_conversion(Conversion_State* state);
+// Parsed inputs (tinygltf models) and the meshes, materials and animations extracted from them,
+// kept between conversions by serve mode. An input is reused while its bytes and the .bin
+// buffers and images it read are unchanged. The least recently used inputs are dropped once
+// the buffers, images and extracted arrays add up to more than max_size bytes.
+Model_Cache* create_model_cache(uint64 max_size);
+void free_model_cache(Model_Cache* cache);
+// number of inputs kept, and their size
+uint32 model_cache_entries(Model_Cache* cache, uint64& size);
+
+// with -cache, after write_outputs: the files the input read besides itself (.bin buffers,
+// images) and the cache entries of the conversion and its outputs
+void conversion_files(const Conversion_State* state, std::vector<std::string>& dependencies, std::vector<uint64>& cache_keys);
 bool display_contents(const Options& opts);
 bool upgrade_file(const Options& opts);
+bool bench_compression(const Options& opts);
+bool verify_files(const Options& opts);
+bool convert_batch(const Options& opts);
+// batch mode's inputs, converted again whenever they change. runs until the process is stopped
+bool convert_watch(const Options& opts);
+// Serve mode: runs the command line of every request on socket_path with run (main's, with the
+// model cache), and sends its output back. Runs until a 'quit' request, false if it can not start
+bool serve_requests(const Options& opts, const std::function<int(int argc, char** argv)>& run);
+// sends the command line in argv[1..] to the server on the socket argv[0], prints the reply and
+// returns the command's exit code
+int send_request(int argc, char** argv);
+// "mesh", "level" or "anim"
+bool32 parse_convert_mode(const std::string& name, OperationModeType& mode);
+
+// an input of batch or watch mode, and where it is written to
+struct Convert_Input {
+    OperationModeType mode;
+    std::string filename;
+    std::string output_folder;
+};
+// batch_inputs (files, patterns and folders) and the manifest, as single input files.
+// false (after printing why) if there are none, the manifest is bad or two share an output folder
+bool32 find_convert_inputs(const Options& opts, std::vector<Convert_Input>& inputs);
 
 
 /****************************************
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <laml/laml.hpp>
+#include "chunk_file.h"
+
+/****************************************
+*
+*   MESH FILE LAYOUT (v6+)
+*
+*   A chunked file (see chunk_file.h) with header.count = number of primitives.
+*   Every vertex/index array is its own chunk, so it starts at a multiple of
+*   header.alignment and the file can be memory-mapped and the arrays handed
+*   straight to the graphics API. All structs here are written to the file as-is.
+*   v10 appended a name hash to Mesh_Prim_Entry and Mesh_Bone_Entry. Older files use the
+*   shorter records (the chunk stride tells which), the leading fields are the same.
+*
+* ************************************/
+const uint32 mesh_default_alignment = 64;
+const uint32 mesh_max_alignment     = 4096;
+
+// vertex strides. interleaved VERT vertices are position, shading (if triangles), skin (if rigged)
+const uint32 mesh_position_stride = 3 * sizeof(real32);
+const uint32 mesh_shading_stride  = 11 * sizeof(real32); // normal, tangent, bitangent, uv
+const uint32 mesh_skin_stride     = 4 * sizeof(int32) + 4 * sizeof(real32);
+
+// chunk tags                                                                                  chunk index
+#define MESH_ARRAY_PRIMS          "PRMS" // Mesh_Prim_Entry[num_prims]                         (none)
+#define MESH_ARRAY_STRINGS        "STRS" // string table (chunk_file.h), deduplicated in v10  (none)
+#define MESH_ARRAY_BOUNDS         "BNDS" // Mesh_Bounds of the whole mesh (v7)                 (none)
+#define MESH_ARRAY_INDICES        "INDS" // uint32 indices                                     (prim, or none if shared)
+#define MESH_ARRAY_VERTICES       "VERT" // interleaved vertices                               (prim, or none if shared)
+#define MESH_ARRAY_POSITIONS      "VPOS" // split streams: vec3 position                       (prim)
+#define MESH_ARRAY_SHADING        "VSHD" // split streams: normal, tangent, bitangent, uv      (prim)
+#define MESH_ARRAY_SKIN           "VSKN" // split streams: ivec4 bone indices, vec4 weights    (prim)
+#define MESH_ARRAY_SHADOW_VERTS   "SHVT" // split streams: welded position (+ skin if rigged)  (prim)
+#define MESH_ARRAY_SHADOW_INDICES "SHIX" // split streams: uint32 indices into SHVT           (prim)
+#define MESH_ARRAY_BONES          "BONE" // Mesh_Bone_Entry[num_bones]                         (none)
+
+struct Mesh_Prim_Entry {
+    uint32 prim_type;
+    uint32 mat_idx;
+    uint32 material_name;    // offset into the string array
+    uint32 num_verts;
+    uint32 num_inds;
+    uint32 first_index;      // shared buffers: start of this primitive in the shared index array
+    uint32 base_vertex;      // shared buffers: start of this primitive in the shared vertex array
+    uint32 num_shadow_verts; // split streams: number of welded shadow vertices
+    uint64 material_hash;    // name_hash() of the material name (v10)
+};
+static_assert(sizeof(Mesh_Prim_Entry) == 40, "Mesh_Prim_Entry size changed");
+const uint32 mesh_prim_entry_v6_size = 32; // v6 - v9, without material_hash
+
+struct Mesh_Bounds {
+    real32 min[3];
+    real32 max[3];
+};
+static_assert(sizeof(Mesh_Bounds) == 24, "Mesh_Bounds size changed");
+
+struct Mesh_Bone_Entry {
+    uint32 bone_idx;
+    int32  parent_idx;
+    real32 debug_length;
+    uint32 name;             // offset into the string array
+    real32 local_matrix[16];
+    real32 inv_model_matrix[16];
+    uint64 name_hash;        // name_hash() of the bone name (v10)
+};
+static_assert(sizeof(Mesh_Bone_Entry) == 152, "Mesh_Bone_Entry size changed");
+const uint32 mesh_bone_entry_v6_size = 144; // v6 - v9, without name_hash
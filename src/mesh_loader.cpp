@@ -0,0 +1,267 @@
+#include "mesh_loader.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool32 map_file(const std::string& filename, Mapped_File& file) {
+    file = {};
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+        CloseHandle(handle);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(handle);
+        return false;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(handle);
+        return false;
+    }
+
+    file.data = (const uint8*)data;
+    file.size = (size_t)size.QuadPart;
+    file.file_handle = handle;
+    file.mapping_handle = mapping;
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if (data == MAP_FAILED)
+        return false;
+
+    file.data = (const uint8*)data;
+    file.size = (size_t)st.st_size;
+#endif
+
+    return true;
+}
+
+void unmap_file(Mapped_File& file) {
+    if (file.data == nullptr)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle((HANDLE)file.mapping_handle);
+    CloseHandle((HANDLE)file.file_handle);
+#else
+    munmap((void*)file.data, file.size);
+#endif
+
+    file = {};
+}
+
+const Chunk_Entry* Mesh_View::find_array(const char* tag, uint32 prim_idx) const {
+    for (uint32 n = 0; n < header->num_chunks; n++) {
+        if (chunks[n].index == prim_idx && memcmp(chunks[n].tag, tag, 4) == 0)
+            return &chunks[n];
+    }
+    return nullptr;
+}
+
+Mesh_Prim_Entry Mesh_View::prim(uint32 prim_idx) const {
+    Mesh_Prim_Entry entry = {};
+    memcpy(&entry, prims + (size_t)prim_idx * prim_stride, prim_stride);
+    if (prim_stride < sizeof(Mesh_Prim_Entry))
+        entry.material_hash = name_hash(string(entry.material_name));
+    return entry;
+}
+
+Mesh_Bone_Entry Mesh_View::bone(uint32 bone_idx) const {
+    Mesh_Bone_Entry entry = {};
+    memcpy(&entry, bones + (size_t)bone_idx * bone_stride, bone_stride);
+    if (bone_stride < sizeof(Mesh_Bone_Entry))
+        entry.name_hash = name_hash(string(entry.name));
+    return entry;
+}
+
+int32 Mesh_View::find_bone(const std::string& name) const {
+    uint64 hash = name_hash(name);
+    for (uint32 b = 0; b < num_bones; b++) {
+        Mesh_Bone_Entry entry = bone(b);
+        if (entry.name_hash == hash && name == string(entry.name))
+            return (int32)b;
+    }
+    return -1;
+}
+
+// every primitive record has to fit in the arrays it points into: [first_index, first_index + num_inds)
+// and [base_vertex, base_vertex + num_verts) in the shared arrays, the first num_inds / num_verts /
+// num_shadow_verts elements of its own. vertex arrays need the strides readers assume
+static bool32 prims_fit_arrays(const Mesh_View& view) {
+    const Chunk_Entry* shared_inds = view.find_array(MESH_ARRAY_INDICES);
+    const Chunk_Entry* shared_verts = view.find_array(MESH_ARRAY_VERTICES);
+    if (shared_verts && shared_verts->stride != mesh_position_stride && shared_verts->stride < (mesh_position_stride + mesh_shading_stride))
+        return false;
+
+    for (uint32 n = 0; n < view.header->count; n++) {
+        Mesh_Prim_Entry prim = view.prim(n);
+
+        const Chunk_Entry* inds = view.find_array(MESH_ARRAY_INDICES, n);
+        if (inds ? prim.num_inds > inds->count
+                 : !shared_inds || (uint64)prim.first_index + prim.num_inds > shared_inds->count)
+            return false;
+
+        const Chunk_Entry* verts = view.find_array(MESH_ARRAY_VERTICES, n);
+        const Chunk_Entry* positions = view.find_array(MESH_ARRAY_POSITIONS, n);
+        if (verts) {
+            if (prim.num_verts > verts->count || (verts->stride != mesh_position_stride && verts->stride < (mesh_position_stride + mesh_shading_stride)))
+                return false;
+        } else if (positions) {
+            if (prim.num_verts > positions->count || positions->stride != mesh_position_stride)
+                return false;
+        } else if (!shared_verts || (uint64)prim.base_vertex + prim.num_verts > shared_verts->count) {
+            return false;
+        }
+
+        const Chunk_Entry* shading = view.find_array(MESH_ARRAY_SHADING, n);
+        const Chunk_Entry* skin = view.find_array(MESH_ARRAY_SKIN, n);
+        const Chunk_Entry* shadow_verts = view.find_array(MESH_ARRAY_SHADOW_VERTS, n);
+        const Chunk_Entry* shadow_inds = view.find_array(MESH_ARRAY_SHADOW_INDICES, n);
+        if (shading && (prim.num_verts > shading->count || shading->stride != mesh_shading_stride))
+            return false;
+        if (skin && (prim.num_verts > skin->count || skin->stride != mesh_skin_stride))
+            return false;
+        if (shadow_verts && (prim.num_shadow_verts > shadow_verts->count || shadow_verts->stride < mesh_position_stride))
+            return false;
+        if (shadow_inds && prim.num_inds > shadow_inds->count)
+            return false;
+    }
+    return true;
+}
+
+bool32 open_mesh_view(const uint8* data, size_t size, Mesh_View& view) {
+    view = {};
+    if (data == nullptr || size < sizeof(Chunk_File_Header))
+        return false;
+
+    const Chunk_File_Header* header = (const Chunk_File_Header*)data;
+    if (memcmp(header->magic, "MESH", 4) != 0 || header->version < 6 || chunk_file_size(*header) != size)
+        return false;
+
+    uint32 alignment = header->alignment;
+    if (alignment == 0 || alignment > mesh_max_alignment || (alignment & (alignment - 1)) != 0)
+        return false;
+
+    uint32 entry_size = chunk_entry_size(*header);
+    if (entry_size != sizeof(Chunk_Entry) && entry_size != sizeof(Chunk_Entry_32))
+        return false;
+    uint64 directory_end = sizeof(Chunk_File_Header) + (uint64)header->num_chunks * entry_size;
+    if (directory_end > size)
+        return false;
+
+    // the directory is used in place, unless it has to be widened
+    const Chunk_Entry* chunks = (const Chunk_Entry*)(data + sizeof(Chunk_File_Header));
+    if (entry_size != sizeof(Chunk_Entry)) {
+        const Chunk_Entry_32* narrow = (const Chunk_Entry_32*)(data + sizeof(Chunk_File_Header));
+        view.wide_chunks.resize(header->num_chunks);
+        for (uint32 n = 0; n < header->num_chunks; n++) {
+            view.wide_chunks[n] = widen_chunk_entry(narrow[n]);
+        }
+        chunks = view.wide_chunks.data();
+    }
+    if (!check_directory_crc(*header, chunks))
+        return false;
+
+    for (uint32 n = 0; n < header->num_chunks; n++) {
+        const Chunk_Entry& entry = chunks[n];
+        if (entry.offset % alignment != 0 || entry.offset < directory_end)
+            return false;
+        if (entry.offset > size || entry.size > size - entry.offset)
+            return false;
+        if ((uint64)entry.count * entry.stride != chunk_raw_size(entry))
+            return false;
+        if (entry.index != chunk_index_none && entry.index >= header->count)
+            return false;
+    }
+
+    view.base = data;
+    view.size = size;
+    view.header = header;
+    view.chunks = chunks;
+
+    // descriptive arrays are used in place, so they can not be compressed
+    for (const char* tag : { MESH_ARRAY_PRIMS, MESH_ARRAY_STRINGS, MESH_ARRAY_BOUNDS, MESH_ARRAY_BONES }) {
+        const Chunk_Entry* entry = view.find_array(tag);
+        if (entry && view.is_compressed(entry))
+            return false;
+    }
+
+    // records before v10 are shorter, but start with the same fields
+    uint32 prim_stride = header->version >= 10 ? sizeof(Mesh_Prim_Entry) : mesh_prim_entry_v6_size;
+    uint32 bone_stride = header->version >= 10 ? sizeof(Mesh_Bone_Entry) : mesh_bone_entry_v6_size;
+
+    const Chunk_Entry* prims = view.find_array(MESH_ARRAY_PRIMS);
+    if (prims == nullptr || prims->count != header->count || prims->stride != prim_stride)
+        return false;
+    view.prims = (const uint8*)view.array_data(prims);
+    view.prim_stride = prim_stride;
+
+    const Chunk_Entry* strings = view.find_array(MESH_ARRAY_STRINGS);
+    if (strings) {
+        // every string must be terminated inside the array
+        if (strings->size > 0 && data[strings->offset + strings->size - 1] != '\0')
+            return false;
+        view.strings = (const char*)view.array_data(strings);
+        view.strings_size = (uint32)strings->size;
+    }
+
+    const Chunk_Entry* bounds = view.find_array(MESH_ARRAY_BOUNDS);
+    if (bounds && bounds->size == sizeof(Mesh_Bounds)) {
+        view.bounds = (const Mesh_Bounds*)view.array_data(bounds);
+    }
+
+    const Chunk_Entry* bones = view.find_array(MESH_ARRAY_BONES);
+    if (bones) {
+        if (bones->stride != bone_stride)
+            return false;
+        view.bones = (const uint8*)view.array_data(bones);
+        view.bone_stride = bone_stride;
+        view.num_bones = bones->count;
+    }
+
+    if (!prims_fit_arrays(view))
+        return false;
+
+    return true;
+}
+
+bool32 read_mesh_array(const Mesh_View& view, const Chunk_Entry* entry, void* dst) {
+    if (!view.is_compressed(entry)) {
+        memcpy(dst, view.array_data(entry), entry->size);
+        return true;
+    }
+
+    return decode_chunk(*entry, (const uint8*)view.array_data(entry), dst, true);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "mesh_format.h"
+
+/****************************************
+*
+*   REFERENCE MESH LOADER
+*
+*   Shows how an engine is expected to load a .mesh file (v6+): map it, validate the
+*   header and chunk directory once, then hand out pointers into the mapping. Nothing
+*   is copied or parsed per-vertex.
+*   Compressed or codec-encoded arrays (v8+, written with -compress / -geometry-codec) can not
+*   be used in place, they are decoded with read_mesh_array into memory the caller owns
+*   (e.g. an upload buffer).
+*
+*       Mapped_File file;
+*       Mesh_View view;
+*       if (map_file("thing.mesh", file) && open_mesh_view(file.data, file.size, view)) {
+*           const Chunk_Entry* verts = view.find_array(MESH_ARRAY_VERTICES, 0);
+*           upload(view.array_data(verts), verts->size);
+*       }
+*       unmap_file(file);
+*
+* ************************************/
+struct Mapped_File {
+    const uint8* data = nullptr;
+    size_t size = 0;
+
+    void* file_handle = nullptr;    // windows only
+    void* mapping_handle = nullptr; // windows only
+};
+
+// maps a whole file read-only. returns false if it could not be opened or mapped
+bool32 map_file(const std::string& filename, Mapped_File& file);
+void unmap_file(Mapped_File& file);
+
+struct Mesh_View {
+    const uint8* base = nullptr;
+    size_t size = 0;
+
+    const Chunk_File_Header* header = nullptr;
+    const Chunk_Entry* chunks = nullptr;       // in the mapping, or wide_chunks for 32-bit directories
+    std::vector<Chunk_Entry> wide_chunks;      // files before 64-bit offsets only (don't copy the view)
+    const uint8*       prims = nullptr;       // header->count records of prim_stride bytes
+    uint32             prim_stride = 0;
+    const Mesh_Bounds* bounds = nullptr;      // v7+
+    const uint8*       bones = nullptr;       // num_bones records of bone_stride bytes
+    uint32             bone_stride = 0;
+    uint32 num_bones = 0;
+    const char* strings = nullptr;
+    uint32 strings_size = 0;
+
+    // records are copied out, so files older than v10 read the same (missing hashes are computed)
+    Mesh_Prim_Entry prim(uint32 prim_idx) const;
+    Mesh_Bone_Entry bone(uint32 bone_idx) const;
+    // compares name hashes, and only checks the string on a match. returns -1 if there is no such bone
+    int32 find_bone(const std::string& name) const;
+
+    // returns nullptr if the mesh has no such array
+    const Chunk_Entry* find_array(const char* tag, uint32 prim_idx = chunk_index_none) const;
+    // only valid for arrays that are not compressed
+    const void* array_data(const Chunk_Entry* entry) const { return base + entry->offset; }
+    bool32 is_compressed(const Chunk_Entry* entry) const { return (entry->flags & chunk_flag_encoded) != 0; }
+    const char* string(uint32 offset) const { return offset < strings_size ? strings + offset : ""; }
+};
+
+// Checks the header and chunk directory (version, bounds, alignment, strides, directory checksum) and points
+// the view at the arrays. Chunk checksums are not checked here, since that touches every byte of the file;
+// call check_chunk_crc(*entry, base + entry->offset) on the arrays that need it.
+// The view only borrows data, it must stay valid (mapped) while the view is used.
+bool32 open_mesh_view(const uint8* data, size_t size, Mesh_View& view);
+
+// Copies, or decodes, an array into dst, which must hold chunk_raw_size(*entry) bytes.
+// Decompression of large compressed arrays is spread over the task system (task_system.h).
+bool32 read_mesh_array(const Mesh_View& view, const Chunk_Entry* entry, void* dst);
@@ -0,0 +1,299 @@
+#include "pack_file.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+
+#include "tinygltf/stb_image.h"
+
+// both live in the stb implementations compiled into mesh_converter.cpp.
+// stb_image_write does not declare its zlib compressor in the header part.
+extern "C" unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+
+const int pack_deflate_quality = 8;
+
+uint64 pack_hash(const std::string& path) {
+    std::string normalized = path;
+    std::replace(normalized.begin(), normalized.end(), '\\', '/');
+    return utils::hash_string(normalized);
+}
+
+bool32 Pack_Writer::open(const std::string& name, uint32 align, bool32 compress_entries) {
+    filename = name;
+    temp_filename = skip_unchanged ? filename + ".tmp" : filename;
+    unchanged = false;
+    errno_t err = fopen_s(&fid, temp_filename.c_str(), "wb");
+    if (fid == nullptr || err) {
+        fid = nullptr;
+        return false;
+    }
+
+    alignment = align;
+    compress = compress_entries;
+    failed = false;
+    entries.clear();
+    names.clear();
+    lookup.clear();
+    reserved.clear();
+    next_reserved = 0;
+    waiting.clear();
+
+    // the header is filled in by close()
+    Pack_Header header = {};
+    size = sizeof(Pack_Header);
+    if (fwrite(&header, sizeof(header), 1, fid) != 1)
+        failed = true;
+
+    return true;
+}
+
+static void pad_pack(Pack_Writer& pack, uint64 offset) {
+    const uint8 zeros[4096] = { 0 };
+    while (pack.size < offset) {
+        size_t n = (size_t)std::min<uint64>(offset - pack.size, sizeof(zeros));
+        if (fwrite(zeros, 1, n, pack.fid) != n)
+            pack.failed = true;
+        pack.size += n;
+    }
+}
+
+// appends one entry to the file. called with the mutex held
+static bool32 store_entry(Pack_Writer& pack, const std::string& path, const void* stored, uint32 stored_size, uint32 raw_size, uint32 compression) {
+    Pack_Entry entry = {};
+    entry.hash = pack_hash(path);
+    auto existing = pack.lookup.find(entry.hash);
+    if (existing != pack.lookup.end()) {
+        log_printf("[ERROR] '%s' is already in the pack (or its hash collides with '%s')\n", path.c_str(), pack.names.data() + pack.entries[existing->second].name);
+        return false;
+    }
+    entry.size = stored_size;
+    entry.raw_size = raw_size;
+    entry.compression = compression;
+
+    pad_pack(pack, (pack.size + pack.alignment - 1) & ~(uint64)(pack.alignment - 1));
+    entry.offset = pack.size;
+    if (entry.size > 0 && fwrite(stored, 1, entry.size, pack.fid) != entry.size)
+        pack.failed = true;
+    pack.size += entry.size;
+
+    std::string name = path;
+    std::replace(name.begin(), name.end(), '\\', '/');
+    entry.name = pack.names.size();
+    pack.names.insert(pack.names.end(), name.begin(), name.end());
+    pack.names.push_back('\0');
+
+    pack.lookup[entry.hash] = pack.entries.size();
+    pack.entries.push_back(entry);
+    return !pack.failed;
+}
+
+// stores the waiting entries whose turn it is now
+static void store_waiting(Pack_Writer& pack) {
+    for (auto it = pack.waiting.begin(); it != pack.waiting.end() && it->first == pack.next_reserved; it = pack.waiting.erase(it)) {
+        const Pack_Waiting_Entry& entry = it->second;
+        store_entry(pack, entry.path, entry.data.data(), entry.data.size(), entry.raw_size, entry.compression);
+        pack.next_reserved++;
+    }
+}
+
+void Pack_Writer::reserve(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64 hash = pack_hash(path);
+    if (reserved.find(hash) == reserved.end()) { // a second add of the same path fails in add()
+        uint32 position = reserved.size();
+        reserved[hash] = position;
+    }
+}
+
+bool32 Pack_Writer::add(const std::string& path, const void* data, size_t num_bytes) {
+    if (fid == nullptr)
+        return false;
+
+    // entry sizes are 32-bit. very large meshes and animations have to be written as loose files
+    if (num_bytes > 0xFFFFFFFFull) {
+        log_printf("[ERROR] '%s' is too large for a .pack entry (%llu bytes, the limit is 4 GiB)\n", path.c_str(), (unsigned long long)num_bytes);
+        return false;
+    }
+
+    // compressed before taking the lock, so entries from several threads compress in parallel
+    const void* stored = data;
+    unsigned char* compressed = nullptr;
+    uint32 stored_size = num_bytes;
+    uint32 compression = pack_compression_none;
+    if (compress && num_bytes > 0 && num_bytes < 0x7FFFFFFF) { // stb's deflate takes an int size
+        int compressed_size = 0;
+        compressed = stbi_zlib_compress((unsigned char*)data, (int)num_bytes, &compressed_size, pack_deflate_quality);
+        if (compressed && (size_t)compressed_size < num_bytes) {
+            stored = compressed;
+            stored_size = compressed_size;
+            compression = pack_compression_deflate;
+        }
+    }
+
+    bool32 added = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto slot = reserved.find(pack_hash(path));
+        if (slot != reserved.end() && slot->second > next_reserved) {
+            // not its turn yet, keep a copy until the entries reserved before it are stored
+            if (waiting.find(slot->second) != waiting.end()) {
+                log_printf("[ERROR] '%s' is already in the pack (or its hash collides with '%s')\n", path.c_str(), waiting[slot->second].path.c_str());
+                added = false;
+            } else {
+                Pack_Waiting_Entry& entry = waiting[slot->second];
+                entry.path = path;
+                entry.data.assign((const uint8*)stored, (const uint8*)stored + stored_size);
+                entry.raw_size = num_bytes;
+                entry.compression = compression;
+            }
+        } else {
+            added = store_entry(*this, path, stored, stored_size, num_bytes, compression);
+            if (slot != reserved.end() && slot->second == next_reserved) {
+                next_reserved++;
+                store_waiting(*this);
+            }
+        }
+    }
+    free(compressed);
+
+    return added;
+}
+
+bool32 Pack_Writer::close() {
+    if (fid == nullptr)
+        return false;
+
+    while (!waiting.empty()) {
+        next_reserved = waiting.begin()->first;
+        store_waiting(*this);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Pack_Entry& a, const Pack_Entry& b) {
+        return a.hash < b.hash;
+    });
+
+    Pack_Header header = {};
+    memcpy(header.magic, "PACK", 4);
+    header.version = PACK_VERSION;
+    header.alignment = alignment;
+    header.timestamp = timestamp ? timestamp : (uint64)time(NULL);
+    header.num_entries = entries.size();
+    header.names_size = names.size();
+
+    // table of contents and names are read together, in one go
+    pad_pack(*this, (size + alignment - 1) & ~(uint64)(alignment - 1));
+    header.toc_offset = size;
+    header.names_offset = size + entries.size() * sizeof(Pack_Entry);
+    header.filesize = header.names_offset + names.size();
+
+    if (!entries.empty() && fwrite(entries.data(), sizeof(Pack_Entry), entries.size(), fid) != entries.size())
+        failed = true;
+    if (!names.empty() && fwrite(names.data(), 1, names.size(), fid) != names.size())
+        failed = true;
+    size = header.filesize;
+
+    fseek(fid, 0L, SEEK_SET);
+    if (fwrite(&header, sizeof(header), 1, fid) != 1)
+        failed = true;
+
+    fclose(fid);
+    fid = nullptr;
+
+    if (skip_unchanged) {
+        std::error_code ec;
+        if (failed) {
+            std::filesystem::remove(temp_filename, ec);
+        } else if (utils::files_equal(temp_filename, filename)) {
+            unchanged = true;
+            std::filesystem::remove(temp_filename, ec);
+        } else {
+            std::filesystem::rename(temp_filename, filename, ec);
+            if (ec)
+                failed = true;
+        }
+    }
+
+    return !failed;
+}
+
+const Pack_Entry* Pack_Reader::find(uint64 hash) const {
+    auto it = std::lower_bound(entries.begin(), entries.end(), hash, [](const Pack_Entry& entry, uint64 h) {
+        return entry.hash < h;
+    });
+    if (it == entries.end() || it->hash != hash)
+        return nullptr;
+    return &(*it);
+}
+
+bool32 open_pack(const std::string& filename, Pack_Reader& pack) {
+    pack.fid = fopen(filename.c_str(), "rb");
+    if (pack.fid == nullptr)
+        return false;
+
+    if (!utils::read_at(pack.fid, 0, &pack.header, sizeof(Pack_Header)) || memcmp(pack.header.magic, "PACK", 4) != 0) {
+        close_pack(pack);
+        return false;
+    }
+
+    const Pack_Header& header = pack.header;
+    uint64 toc_size = (uint64)header.num_entries * sizeof(Pack_Entry);
+    if (header.toc_offset < sizeof(Pack_Header) || header.names_offset != header.toc_offset + toc_size ||
+        header.names_offset + header.names_size > header.filesize) {
+        close_pack(pack);
+        return false;
+    }
+
+    std::vector<uint8> block(toc_size + header.names_size);
+    if (!block.empty() && !utils::read_at(pack.fid, header.toc_offset, block.data(), block.size())) {
+        close_pack(pack);
+        return false;
+    }
+    pack.entries.resize(header.num_entries);
+    if (toc_size > 0)
+        memcpy(pack.entries.data(), block.data(), toc_size);
+    pack.names.assign(block.begin() + toc_size, block.end());
+
+    for (const Pack_Entry& entry : pack.entries) {
+        if (entry.offset + entry.size > header.toc_offset) {
+            close_pack(pack);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void close_pack(Pack_Reader& pack) {
+    if (pack.fid)
+        fclose(pack.fid);
+    pack.fid = nullptr;
+    pack.entries.clear();
+    pack.names.clear();
+}
+
+bool32 read_pack_entry(const Pack_Reader& pack, const Pack_Entry& entry, std::vector<uint8>& data) {
+    if (entry.compression == pack_compression_none) {
+        data.resize(entry.size);
+        return entry.size == 0 || utils::read_at(pack.fid, entry.offset, data.data(), entry.size);
+    }
+
+    if (entry.compression != pack_compression_deflate)
+        return false;
+
+    std::vector<uint8> stored(entry.size);
+    if (!utils::read_at(pack.fid, entry.offset, stored.data(), entry.size))
+        return false;
+
+    int raw_size = 0;
+    char* raw = stbi_zlib_decode_malloc_guesssize((const char*)stored.data(), (int)entry.size, (int)entry.raw_size, &raw_size);
+    if (raw == nullptr)
+        return false;
+
+    bool32 ok = ((uint32)raw_size == entry.raw_size);
+    data.assign((uint8*)raw, (uint8*)raw + raw_size);
+    free(raw);
+    return ok;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <map>
+#include <mutex>
+#include <cstdio>
+
+#include <laml/laml.hpp>
+
+/****************************************
+*
+*   PACK FILE LAYOUT (.pack)
+*
+*   [Pack_Header]
+*   (padding) [entry] (padding) [entry] ...
+*   (padding) [Pack_Entry x num_entries]  <- table of contents, sorted by hash
+*   [names]                               <- null-terminated entry paths
+*
+*   Holds every file a conversion produces (.mesh, .matl, .level) in one archive.
+*   Entries are found by the hash of their path relative to the output folder, with
+*   '/' separators (e.g. "render_meshes/crate.mesh"), see pack_hash(). A reader loads
+*   the header and table of contents once, then each entry is a single positioned read
+*   of entry.size bytes at entry.offset. Every entry starts at a multiple of
+*   header.alignment, so an uncompressed entry can also be used straight from a mapping.
+*
+* ************************************/
+const uint32 PACK_VERSION = 1;
+
+const uint32 pack_compression_none    = 0;
+const uint32 pack_compression_deflate = 1; // zlib stream
+
+struct Pack_Header {
+    char   magic[4];         // "PACK"
+    uint32 version;
+    uint32 flag;
+    uint32 alignment;        // power of two, 16 to 4096
+    uint64 filesize;
+    uint64 timestamp;
+    uint64 toc_offset;       // Pack_Entry x num_entries
+    uint64 names_offset;     // names_size bytes, directly after the table of contents
+    uint32 num_entries;
+    uint32 names_size;
+    uint32 reserved[2];
+};
+static_assert(sizeof(Pack_Header) == 64, "Pack_Header size changed");
+
+struct Pack_Entry {
+    uint64 hash;             // pack_hash() of the entry path
+    uint64 offset;           // from the start of the file, multiple of header.alignment
+    uint32 size;             // stored bytes
+    uint32 raw_size;         // bytes after decompression (== size if not compressed)
+    uint32 compression;      // pack_compression_*
+    uint32 name;             // offset of the path in the names block
+};
+static_assert(sizeof(Pack_Entry) == 32, "Pack_Entry size changed");
+
+// hash of a path inside a pack. '\' is treated as '/', so both spellings find the same entry
+uint64 pack_hash(const std::string& path);
+
+// an entry added before the ones reserved ahead of it, held until it is its turn
+struct Pack_Waiting_Entry {
+    std::string path;
+    std::vector<uint8> data;  // as stored (compressed or not)
+    uint32 raw_size;
+    uint32 compression;
+};
+
+// Appends entries to a .pack file as they are added, and writes the
+// table of contents (sorted by hash) on close.
+// With skip_unchanged (set before open) the pack is written next to filename and only replaces
+// it on close if the bytes differ, otherwise it is dropped and unchanged is set.
+// add() can be called from several threads. Entries whose path was passed to reserve()
+// are stored in the order they were reserved, whatever order they are added in, so a pack
+// written by parallel tasks is the same as one written serially. Others are stored as added.
+struct Pack_Writer {
+    FILE* fid = nullptr;
+    uint32 alignment = 0;
+    bool32 compress = false;   // deflate entries that get smaller by doing so
+    bool32 failed = false;
+    uint64 size = 0;
+    uint64 timestamp = 0;      // stored in the header, 0 = the time of close()
+
+    std::string filename;
+    std::string temp_filename; // written instead of filename with skip_unchanged
+    bool32 skip_unchanged = false;
+    bool32 unchanged = false;
+    std::vector<Pack_Entry> entries;
+    std::vector<char> names;
+    std::unordered_map<uint64, uint32> lookup; // hash -> entry, to catch duplicates
+
+    std::mutex mutex;
+    std::unordered_map<uint64, uint32> reserved;      // hash -> position in reserve order
+    uint32 next_reserved = 0;                         // position that is stored next
+    std::map<uint32, Pack_Waiting_Entry> waiting;     // by position
+
+    bool32 open(const std::string& filename, uint32 alignment, bool32 compress);
+    void reserve(const std::string& path);
+    // returns false if the write failed, or an entry with the same hash already exists
+    bool32 add(const std::string& path, const void* data, size_t num_bytes);
+    // stores entries still waiting for a reserved entry that was never added
+    bool32 close();
+};
+
+// Reference reader: the header and table of contents are read in open_pack,
+// read_pack_entry then costs one positioned read (plus decompression).
+struct Pack_Reader {
+    FILE* fid = nullptr;
+    Pack_Header header;
+    std::vector<Pack_Entry> entries;
+    std::vector<char> names;
+
+    // binary search on the hash. returns nullptr if the pack has no such entry
+    const Pack_Entry* find(uint64 hash) const;
+    const Pack_Entry* find(const std::string& path) const { return find(pack_hash(path)); }
+    const char* name(const Pack_Entry& entry) const { return entry.name < names.size() ? names.data() + entry.name : ""; }
+};
+
+bool32 open_pack(const std::string& filename, Pack_Reader& pack);
+void close_pack(Pack_Reader& pack);
+
+// reads (and decompresses) one entry. safe to call from several threads on the same reader
+bool32 read_pack_entry(const Pack_Reader& pack, const Pack_Entry& entry, std::vector<uint8>& data);
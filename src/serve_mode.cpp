@@ -0,0 +1,289 @@
+#include "mesh_converter.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/****************************************
+*
+*   SERVE MODE (meshconv serve path/to/socket)
+*
+*   A long running process answering requests on a Unix domain socket, so tools that call
+*   meshconv over and over do not pay for starting it and parsing the same inputs each time.
+*
+*   A request is one line: a command line without 'meshconv', e.g.
+*       level assets/scene.gltf -o out -compress
+*   Any mode but serve and watch can be requested (mesh, level, anim, batch, disp, upgrade,
+*   verify, bench). Quotes keep an argument with spaces together. The reply is everything
+*   the command printed, then a last line 'meshconv exit <code>', after which the server
+*   closes the connection. 'quit' stops the server. 'meshconv request path/to/socket ...'
+*   sends one request and prints the reply, with the command's exit code as its own.
+*
+*   Requests are run one after another, each with the whole thread pool (-j is taken from
+*   the serve command line, a request giving it is refused). A client that has not sent
+*   its whole request line within request_timeout_ms gets an error reply instead, so one
+*   stuck client can not hold up the others. Relative paths are relative to the server's working folder.
+*   Parsed inputs and what was extracted from them are kept in a Model_Cache (-model-cache
+*   MB, 512 by default), so converting an unchanged input again only encodes and writes.
+*
+* ************************************/
+
+static const char* exit_prefix = "meshconv exit ";
+
+// requests longer than this are cut off
+const size_t max_request_size = 64 * 1024;
+// how long a client has to send its request line
+const int request_timeout_ms = 10 * 1000;
+
+typedef std::chrono::steady_clock::time_point Time_Point;
+
+static double seconds_since(Time_Point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// splits on whitespace, "double quotes" keep arguments with spaces together
+static std::vector<std::string> split_request(const std::string& line) {
+    std::vector<std::string> tokens;
+    for (size_t n = 0; n < line.size();) {
+        if (isspace((unsigned char)line[n])) {
+            n++;
+            continue;
+        }
+        size_t end;
+        if (line[n] == '"') {
+            end = line.find('"', n + 1);
+            if (end == std::string::npos) end = line.size();
+            tokens.push_back(line.substr(n + 1, end - n - 1));
+            n = end + 1;
+        } else {
+            for (end = n; end < line.size() && !isspace((unsigned char)line[end]); end++) {}
+            tokens.push_back(line.substr(n, end - n));
+            n = end;
+        }
+    }
+    return tokens;
+}
+
+#ifndef _WIN32
+static bool32 socket_address(const std::string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        printf("[ERROR] The socket path '%s' is too long\n", path.c_str());
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+static bool32 send_all(int fd, const std::string& data) {
+    for (size_t sent = 0; sent < data.size();) {
+        ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+// the first line the client sends. timed_out is set when it did not arrive within request_timeout_ms
+static bool32 read_request(int fd, std::string& line, bool32& timed_out) {
+    line.clear();
+    timed_out = false;
+    Time_Point start = std::chrono::steady_clock::now();
+    char buffer[4096];
+    while (line.size() < max_request_size) {
+        int remaining = request_timeout_ms - (int)(seconds_since(start) * 1000.0);
+        pollfd readable = { fd, POLLIN, 0 };
+        int ready = remaining > 0 ? poll(&readable, 1, remaining) : 0;
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready == 0) {
+            timed_out = true;
+            line.clear();
+            return false;
+        }
+        if (ready < 0) break;
+
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        line.append(buffer, (size_t)n);
+        if (line.find('\n') != std::string::npos) break;
+    }
+    size_t end = line.find('\n');
+    if (end != std::string::npos) {
+        line.resize(end);
+    }
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    return !line.empty();
+}
+
+// runs the request with stdout going to the client, and returns its exit code
+static int run_request(int client, const std::vector<std::string>& args, const std::function<int(int, char**)>& run) {
+    std::vector<std::string> arg_storage;
+    arg_storage.push_back("meshconv");
+    arg_storage.insert(arg_storage.end(), args.begin(), args.end());
+    std::vector<char*> argv;
+    for (std::string& arg : arg_storage) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(client, STDOUT_FILENO);
+    int code = run((int)arg_storage.size(), argv.data());
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    return code;
+}
+
+bool serve_requests(const Options& opts, const std::function<int(int argc, char** argv)>& run) {
+    sockaddr_un addr;
+    if (!socket_address(opts.socket_path, addr)) {
+        return false;
+    }
+    // a client going away mid-reply is not a reason to stop
+    signal(SIGPIPE, SIG_IGN);
+
+    // a socket left behind by a server that is gone is replaced, a running server is not
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool32 running = probe >= 0 && connect(probe, (const sockaddr*)&addr, sizeof(addr)) == 0;
+    if (probe >= 0) close(probe);
+    if (running) {
+        printf("[ERROR] A server is already listening on '%s'\n", opts.socket_path.c_str());
+        return false;
+    }
+    unlink(opts.socket_path.c_str());
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || bind(server, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 16) != 0) {
+        printf("[ERROR] Can not listen on '%s': %s\n", opts.socket_path.c_str(), strerror(errno));
+        if (server >= 0) close(server);
+        return false;
+    }
+    printf("Serving requests on '%s', send 'quit' to stop.\n", opts.socket_path.c_str());
+    fflush(stdout);
+
+    for (bool32 quit = false; !quit;) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            printf("[ERROR] accept failed: %s\n", strerror(errno));
+            break;
+        }
+
+        std::string line;
+        bool32 timed_out;
+        read_request(client, line, timed_out);
+        std::vector<std::string> args = split_request(line);
+
+        Time_Point start = std::chrono::steady_clock::now();
+        int code = 0;
+        if (timed_out) {
+            char message[96];
+            snprintf(message, sizeof(message), "[ERROR] No request received within %d s\n", request_timeout_ms / 1000);
+            send_all(client, message);
+            line = "(timed out)";
+            code = -1;
+        } else if (args.size() == 1 && args[0] == "quit") {
+            quit = true;
+        } else if (args.empty() || args[0] == "serve" || args[0] == "watch" || args[0] == "request") {
+            send_all(client, args.empty() ? "[ERROR] Empty request\n" : "[ERROR] '" + args[0] + "' can not be requested\n");
+            code = -1;
+        } else if (std::find(args.begin(), args.end(), "-j") != args.end()) {
+            // the thread pool is started once, with the serve command's -j
+            send_all(client, "[ERROR] -j can not be given per request, the server uses the -j it was started with\n");
+            code = -1;
+        } else {
+            code = run_request(client, args, run);
+        }
+
+        char status[64];
+        snprintf(status, sizeof(status), "\n%s%d\n", exit_prefix, code);
+        send_all(client, status);
+        close(client);
+
+        uint64 size = 0;
+        uint32 num_models = opts.models ? model_cache_entries(opts.models, size) : 0;
+        printf("%8.1f ms  exit %3d  [%d inputs kept, %.1f MB]  %s\n", seconds_since(start) * 1000.0, code,
+            (int)num_models, size / (1024.0 * 1024.0), line.c_str());
+        fflush(stdout);
+    }
+
+    close(server);
+    unlink(opts.socket_path.c_str());
+    return true;
+}
+
+int send_request(int argc, char** argv) {
+    if (argc < 2) {
+        printf("usage: meshconv request path/to/socket <mode> [arguments...]\n");
+        return -1;
+    }
+    sockaddr_un addr;
+    if (!socket_address(argv[0], addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+        printf("[ERROR] Can not connect to '%s': %s\n", argv[0], strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    std::string line;
+    for (int n = 1; n < argc; n++) {
+        std::string arg = argv[n];
+        bool quote = arg.empty() || arg.find_first_of(" \t") != std::string::npos;
+        line += (n > 1 ? " " : "") + (quote ? '"' + arg + '"' : arg);
+    }
+    line += '\n';
+    send_all(fd, line);
+
+    std::string reply;
+    char buffer[4096];
+    for (;;) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        reply.append(buffer, (size_t)n);
+    }
+    close(fd);
+
+    // the output, then the exit code on the last line
+    size_t status = reply.rfind(std::string("\n") + exit_prefix);
+    if (status == std::string::npos) {
+        fwrite(reply.data(), 1, reply.size(), stdout);
+        printf("[ERROR] The server closed the connection before the request finished\n");
+        return -1;
+    }
+    fwrite(reply.data(), 1, status, stdout);
+    return std::atoi(reply.c_str() + status + 1 + strlen(exit_prefix));
+}
+#else
+bool serve_requests(const Options& opts, const std::function<int(int argc, char** argv)>& run) {
+    printf("[ERROR] serve mode needs Unix domain sockets, which this build does not support\n");
+    return false;
+}
+
+int send_request(int argc, char** argv) {
+    printf("[ERROR] request needs Unix domain sockets, which this build does not support\n");
+    return -1;
+}
+#endif
@@ -0,0 +1,172 @@
+#include "static_batching.h"
+
+#include <map>
+#include <tuple>
+#include <cmath>
+
+// laml::Mat4 is indexed [col][row]
+static laml::Vec3 transform_point(const laml::Mat4& m, const laml::Vec3& p) {
+    laml::Vec3 out;
+    for (uint32 row = 0; row < 3; row++) {
+        out[row] = m[0][row]*p.x + m[1][row]*p.y + m[2][row]*p.z + m[3][row];
+    }
+    return out;
+}
+
+static laml::Vec3 transform_dir(const laml::Mat4& m, const laml::Vec3& d) {
+    laml::Vec3 out;
+    for (uint32 row = 0; row < 3; row++) {
+        out[row] = m[0][row]*d.x + m[1][row]*d.y + m[2][row]*d.z;
+    }
+    return out;
+}
+
+static bool32 is_batchable(const Mesh& mesh, const std::vector<Material>& materials) {
+    if (mesh.is_rigged || mesh.is_collider)
+        return false;
+
+    for (uint32 n = 0; n < mesh.primitives.size(); n++) {
+        const Mesh_Primitive& prim = mesh.primitives[n];
+        if (prim.prim_type != prim_type::triangles)
+            return false;
+        if (prim.material_index < 0 || prim.material_index >= (int32)materials.size())
+            return false;
+    }
+
+    return mesh.primitives.size() > 0;
+}
+
+// cell of the world-space bounding box center, so a mesh always lands in exactly one cell
+static laml::Vector<int32, 3> find_mesh_cell(const Mesh& mesh, real32 cell_size) {
+    laml::Vec3 min_p( 1e30f);
+    laml::Vec3 max_p(-1e30f);
+    for (uint32 n = 0; n < mesh.primitives.size(); n++) {
+        const Mesh_Primitive& prim = mesh.primitives[n];
+        for (uint32 i = 0; i < prim.positions.size(); i++) {
+            laml::Vec3 p = transform_point(mesh.transform, prim.positions[i]);
+            for (uint32 k = 0; k < 3; k++) {
+                if (p[k] < min_p[k]) min_p[k] = p[k];
+                if (p[k] > max_p[k]) max_p[k] = p[k];
+            }
+        }
+    }
+
+    laml::Vector<int32, 3> cell;
+    for (uint32 k = 0; k < 3; k++) {
+        real32 center = 0.5f * (min_p[k] + max_p[k]);
+        cell[k] = (int32)std::floor(center / cell_size);
+    }
+    return cell;
+}
+
+// appends prim to batch_prim, transformed into world space
+static void append_transformed_prim(const Mesh_Primitive& prim, const laml::Mat4& transform, Mesh_Primitive& batch_prim) {
+    // normal matrix is the inverse-transpose of the upper 3x3: columns (b x c, c x a, a x b) / det
+    laml::Vec3 a(transform[0][0], transform[0][1], transform[0][2]);
+    laml::Vec3 b(transform[1][0], transform[1][1], transform[1][2]);
+    laml::Vec3 c(transform[2][0], transform[2][1], transform[2][2]);
+    laml::Vec3 bc = laml::cross(b, c);
+    laml::Vec3 ca = laml::cross(c, a);
+    laml::Vec3 ab = laml::cross(a, b);
+    real32 det = laml::dot(a, bc);
+    real32 det_sign = (det < 0.0f) ? -1.0f : 1.0f;
+
+    uint32 base_vertex = batch_prim.positions.size();
+    uint32 num_verts = prim.positions.size();
+    for (uint32 i = 0; i < num_verts; i++) {
+        batch_prim.positions.push_back(transform_point(transform, prim.positions[i]));
+
+        const laml::Vec3& n = prim.normals[i];
+        laml::Vec3 normal = (bc*n.x + ca*n.y + ab*n.z) * det_sign;
+        batch_prim.normals.push_back(laml::normalize(normal));
+
+        const laml::Vec4& t = prim.tangents_4[i];
+        laml::Vec3 tangent = laml::normalize(transform_dir(transform, laml::Vec3(t.x, t.y, t.z)));
+        // a mirroring transform flips handedness of the tangent frame
+        batch_prim.tangents_4.push_back(laml::Vec4(tangent.x, tangent.y, tangent.z, t.w * det_sign));
+
+        batch_prim.texcoords.push_back(prim.texcoords[i]);
+    }
+
+    // mirroring also flips the winding order
+    uint32 num_inds = prim.indices.size();
+    for (uint32 i = 0; i + 2 < num_inds; i += 3) {
+        if (det_sign < 0.0f) {
+            batch_prim.indices.push_back(base_vertex + prim.indices[i + 0]);
+            batch_prim.indices.push_back(base_vertex + prim.indices[i + 2]);
+            batch_prim.indices.push_back(base_vertex + prim.indices[i + 1]);
+        } else {
+            batch_prim.indices.push_back(base_vertex + prim.indices[i + 0]);
+            batch_prim.indices.push_back(base_vertex + prim.indices[i + 1]);
+            batch_prim.indices.push_back(base_vertex + prim.indices[i + 2]);
+        }
+    }
+}
+
+void batch_static_meshes(const std::vector<Mesh>& meshes,
+                         const std::vector<Material>& materials,
+                         const Options& opts,
+                         std::vector<Mesh_Batch>& out_batches) {
+    real32 cell_size = opts.batch_cell_size > 0.0f ? opts.batch_cell_size : 32.0f;
+
+    // std::map so the batch order (and therefore the output) is deterministic
+    typedef std::tuple<int32, int32, int32, int32> batch_key;
+    std::map<batch_key, uint32> batch_lookup;
+
+    uint32 num_batched = 0;
+    for (uint32 n = 0; n < meshes.size(); n++) {
+        const Mesh& mesh = meshes[n];
+        if (!is_batchable(mesh, materials))
+            continue;
+
+        laml::Vector<int32, 3> cell = find_mesh_cell(mesh, cell_size);
+        num_batched++;
+
+        for (uint32 p = 0; p < mesh.primitives.size(); p++) {
+            const Mesh_Primitive& prim = mesh.primitives[p];
+
+            batch_key key = std::make_tuple(prim.material_index, cell[0], cell[1], cell[2]);
+            auto it = batch_lookup.find(key);
+            if (it == batch_lookup.end()) {
+                it = batch_lookup.insert(std::make_pair(key, (uint32)out_batches.size())).first;
+
+                Mesh_Batch new_batch;
+                new_batch.material_index = prim.material_index;
+                new_batch.cell = cell;
+                out_batches.push_back(new_batch);
+            }
+            Mesh_Batch& batch = out_batches[it->second];
+
+            if (batch.replaced_entries.empty() || batch.replaced_entries.back() != n) {
+                batch.replaced_entries.push_back(n);
+            }
+
+            if (batch.mesh.primitives.empty()) {
+                batch.mesh.primitives.resize(1);
+                batch.mesh.primitives[0].material_index = prim.material_index;
+                batch.mesh.primitives[0].default_mat_name = prim.default_mat_name;
+                batch.mesh.primitives[0].prim_type = prim_type::triangles;
+            }
+            append_transformed_prim(prim, mesh.transform, batch.mesh.primitives[0]);
+        }
+    }
+
+    // the batched geometry is already in world space
+    for (uint32 n = 0; n < out_batches.size(); n++) {
+        Mesh_Batch& batch = out_batches[n];
+        const Material& mat = materials[batch.material_index];
+
+        char cell_str[64];
+        snprintf(cell_str, sizeof(cell_str), "%d_%d_%d", batch.cell[0], batch.cell[1], batch.cell[2]);
+
+        batch.mesh.transform = laml::Mat4(1.0f);
+        batch.mesh.is_rigged = false;
+        batch.mesh.is_collider = false;
+        batch.mesh.mesh_name = "batch_" + mat.name + "_" + cell_str;
+        batch.mesh.name = batch.mesh.mesh_name;
+
+        log_printf("  Batch %2d: '%s' [%d entries, %d verts]\n", n, batch.mesh.mesh_name.c_str(),
+               (int)batch.replaced_entries.size(), (int)batch.mesh.primitives[0].positions.size());
+    }
+    log_printf("Batched %d meshes into %d batches.\n", num_batched, (int)out_batches.size());
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "mesh_converter.h"
+
+/****************************************
+*
+*   STATIC BATCHING
+*
+* ************************************/
+struct Mesh_Batch {
+    Mesh mesh;                             // pre-transformed, world-space geometry
+    int32 material_index;
+    laml::Vector<int32, 3> cell;           // spatial cell this batch covers
+    std::vector<uint32> replaced_entries;  // indices into the level's mesh list
+};
+
+// Merges all eligible static meshes into world-space batches, one per (material, cell).
+// A mesh is eligible if it is not rigged, not a collider and only has triangle primitives
+// with a material assigned. Every primitive of an eligible mesh ends up in a batch, so
+// each replaced entry is fully covered by the batches that list it.
+void batch_static_meshes(const std::vector<Mesh>& meshes,
+                         const std::vector<Material>& materials,
+                         const Options& opts,
+                         std::vector<Mesh_Batch>& out_batches);
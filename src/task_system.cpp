@@ -0,0 +1,209 @@
+#include "task_system.h"
+#include "utils.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Task {
+    std::function<void()> func;
+    Task_Group* group = nullptr;
+    Log_Buffer* log = nullptr; // where the submitting thread was logging to
+};
+
+struct Task_Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+};
+
+struct Task_System {
+    std::mutex start_mutex;
+    std::atomic<bool> started{false};
+    uint32 num_threads = 1;
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Task_Queue>> queues; // one per worker
+    Task_Queue injector;                             // tasks from threads outside the pool
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<uint32> num_queued{0};
+    bool stopping = false;
+
+    ~Task_System();
+};
+
+static Task_System tasks;
+
+// how often a waiting thread looks for queued tasks again while the group's tasks run elsewhere
+const uint32 wait_poll_ms = 1;
+static thread_local int32 worker_index = -1; // of the current thread, -1 outside the pool
+
+static bool32 pop_back(Task_Queue& queue, Task& task) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+static bool32 pop_front(Task_Queue& queue, Task& task) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return true;
+}
+
+// newest task of our own deque, then the oldest submitted from outside, then steal the oldest of another worker
+static bool32 find_task(Task& task) {
+    if (tasks.num_queued.load() == 0)
+        return false;
+
+    uint32 num_queues = tasks.queues.size();
+    bool32 found = (worker_index >= 0 && pop_back(*tasks.queues[worker_index], task)) || pop_front(tasks.injector, task);
+    for (uint32 n = 1; !found && n <= num_queues; n++) {
+        uint32 victim = (uint32)(worker_index + n) % num_queues;
+        found = pop_front(*tasks.queues[victim], task);
+    }
+
+    if (found)
+        tasks.num_queued--;
+    return found;
+}
+
+// counts a task of the group as finished when it goes out of scope, also when the task throws
+struct Task_Done {
+    Task_Group* group;
+
+    // decremented and signalled under the lock: wait() takes it before returning, so the
+    // group can't be destroyed while we are still notifying it
+    ~Task_Done() {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        if (--group->pending == 0)
+            group->done.notify_all();
+    }
+};
+
+static void execute(Task& task) {
+    Task_Done done = { task.group };
+    Log_Scope scope(task.log);
+    task.func();
+}
+
+static void worker_main(int32 index) {
+    worker_index = index;
+    for (;;) {
+        Task task;
+        if (find_task(task)) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(tasks.sleep_mutex);
+        tasks.wake.wait(lock, []() { return tasks.stopping || tasks.num_queued.load() > 0; });
+        if (tasks.stopping)
+            return;
+    }
+}
+
+Task_System::~Task_System() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void task_system_start(uint32 num_threads) {
+    std::lock_guard<std::mutex> lock(tasks.start_mutex);
+    if (tasks.started)
+        return;
+
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+    tasks.num_threads = num_threads ? num_threads : 1;
+
+    // the thread that waits on a group works too, so there is one worker less than threads
+    for (uint32 n = 0; n + 1 < tasks.num_threads; n++) {
+        tasks.queues.push_back(std::make_unique<Task_Queue>());
+    }
+    for (uint32 n = 0; n + 1 < tasks.num_threads; n++) {
+        tasks.workers.emplace_back(worker_main, (int32)n);
+    }
+    tasks.started = true;
+}
+
+uint32 task_system_threads() {
+    if (!tasks.started)
+        task_system_start(0);
+    return tasks.num_threads;
+}
+
+void Task_Group::run(std::function<void()> task) {
+    if (task_system_threads() == 1) {
+        task();
+        return;
+    }
+
+    pending++;
+    {
+        // counted first and under the lock, so a worker can't miss it between checking and going to sleep
+        std::lock_guard<std::mutex> lock(tasks.sleep_mutex);
+        tasks.num_queued++;
+    }
+    Task_Queue& queue = worker_index >= 0 ? *tasks.queues[worker_index] : tasks.injector;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({ std::move(task), this, current_log() });
+    }
+    tasks.wake.notify_one();
+}
+
+void Task_Group::wait() {
+    for (;;) {
+        Task task;
+        if (pending.load() > 0 && find_task(task)) {
+            execute(task);
+            continue;
+        }
+
+        // nothing to run right now, the group's tasks running elsewhere can still queue more.
+        // the lock is taken before returning, see Task_Done
+        std::unique_lock<std::mutex> lock(mutex);
+        if (done.wait_for(lock, std::chrono::milliseconds(wait_poll_ms), [this]() { return pending.load() == 0; }))
+            return;
+    }
+}
+
+void parallel_for(uint32 count, const std::function<void(uint32)>& func) {
+    uint32 num_tasks = task_system_threads();
+    if (num_tasks > count) num_tasks = count;
+    if (num_tasks <= 1) {
+        for (uint32 n = 0; n < count; n++) {
+            func(n);
+        }
+        return;
+    }
+
+    // one task per thread, each takes the next index until there are none left
+    std::atomic<uint32> next(0);
+    Task_Group group;
+    for (uint32 t = 0; t < num_tasks; t++) {
+        group.run([&]() {
+            for (uint32 n = next++; n < count; n = next++) {
+                func(n);
+            }
+        });
+    }
+    group.wait();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+#include <laml/laml.hpp>
+
+/****************************************
+*
+*   TASK SYSTEM
+*
+*   A fixed pool of worker threads (-j N, all hardware threads by default) with work
+*   stealing: every worker owns a deque it pushes to and pops from at the back, idle
+*   workers steal from the front of the other deques, and tasks submitted from outside
+*   the pool go to a global injector queue. Task_Group::wait() runs queued tasks while it
+*   waits, so tasks can submit and wait on more tasks (a parallel_for inside a task)
+*   without tying up the pool. It keeps doing so until the group's last task finishes,
+*   sleeping briefly whenever nothing is queued.
+*
+*   Tasks write only to their own output slot, and results are combined (and logged) in
+*   submission order afterwards, so the output does not depend on the number of threads.
+*   A task logs to wherever the thread that submitted it was logging to (see Ordered_Log).
+*
+*       Task_Group group;
+*       for (uint32 n = 0; n < count; n++)
+*           group.run([&, n]() { results[n] = work(n); });
+*       group.wait();
+*
+* ************************************/
+
+// num_threads counts the calling thread, 0 = all hardware threads. with 1 every task runs
+// inline on the thread that submits it. started with the default on first use otherwise
+void task_system_start(uint32 num_threads);
+uint32 task_system_threads();
+
+struct Task_Group {
+    std::atomic<uint32> pending{0};
+    std::mutex mutex;
+    std::condition_variable done; // signalled by the task that takes pending to 0
+
+    void run(std::function<void()> task);
+    // returns once every task of the group has finished, running queued tasks meanwhile
+    void wait();
+};
+
+// calls func(n) for n in [0, count) spread over the task system. blocks until done.
+void parallel_for(uint32 count, const std::function<void(uint32)>& func);
@@ -4,21 +4,112 @@
 #include <vector>
 #include <cstdarg>
 #include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <sys/stat.h>
 
-void level_print(int level, const char* format, ...) {
-    va_list args;
-    va_start(args, format);
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static thread_local Log_Buffer* log_buffer = nullptr; // of the calling thread, nullptr = stdout
+
+static void log_write(Log_Buffer* buffer, const char* text, size_t len) {
+    if (buffer == nullptr) {
+        fwrite(text, 1, len, stdout);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->text.append(text, len);
+}
 
+static void log_vprintf(const char* prefix, const char* format, va_list args) {
+    if (log_buffer == nullptr) {
+        fputs(prefix, stdout);
+        vprintf(format, args);
+        return;
+    }
+
+    // formatted in one piece, so concurrent lines don't interleave
+    va_list copy;
+    va_copy(copy, args);
+    std::string text = prefix;
+    size_t start = text.size();
+    int len = vsnprintf(nullptr, 0, format, copy);
+    va_end(copy);
+    if (len > 0) {
+        text.resize(start + len + 1);
+        vsnprintf(&text[start], len + 1, format, args);
+        text.resize(start + len);
+    }
+    log_write(log_buffer, text.data(), text.size());
+}
+
+void level_print(int level, const char* format, ...) {
+    std::string prefix;
     for (int n = 0; n < level; n++) {
-        //printf(" \371 ");
-        printf(" - ");
+        //prefix += " \371 ";
+        prefix += " - ";
     }
 
-    vprintf(format, args);
+    va_list args;
+    va_start(args, format);
+    log_vprintf(prefix.c_str(), format, args);
+    va_end(args);
+}
 
+void log_printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_vprintf("", format, args);
     va_end(args);
 }
 
+Log_Scope::Log_Scope(Log_Buffer* buffer) : previous(log_buffer) {
+    log_buffer = buffer;
+}
+
+Log_Scope::~Log_Scope() {
+    log_buffer = previous;
+}
+
+Log_Buffer* current_log() {
+    return log_buffer;
+}
+
+Ordered_Log::Ordered_Log() : previous(log_buffer) {
+    buffers.emplace_back();
+    log_buffer = &buffers.back();
+}
+
+Ordered_Log::~Ordered_Log() {
+    flush();
+    log_buffer = previous;
+}
+
+Log_Buffer& Ordered_Log::task() {
+    // the task's buffer, then a new one for what this thread logs after it
+    buffers.emplace_back();
+    Log_Buffer& buffer = buffers.back();
+    buffers.emplace_back();
+    log_buffer = &buffers.back();
+    return buffer;
+}
+
+void Ordered_Log::flush() {
+    for (Log_Buffer& buffer : buffers) {
+        log_write(previous, buffer.text.data(), buffer.text.size());
+    }
+    buffers.clear();
+    buffers.emplace_back();
+    log_buffer = &buffers.back();
+}
+
 namespace utils {
 
     char* getCmdOption(char** begin, char** end, const std::string& option)
@@ -164,4 +255,95 @@ namespace utils {
             return std::string();
         }
     }
+
+    uint64 hash_bytes(const void* data, size_t size) {
+        const uint8* bytes = (const uint8*)data;
+        uint64 hash = 0xcbf29ce484222325ull;
+        for (size_t n = 0; n < size; n++) {
+            hash ^= bytes[n];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    uint64 hash_string(const std::string& string) {
+        return hash_bytes(string.data(), string.size());
+    }
+
+    bool file_seek(FILE* fid, uint64 offset) {
+#ifdef _WIN32
+        return _fseeki64(fid, (__int64)offset, SEEK_SET) == 0;
+#else
+        return fseeko(fid, (off_t)offset, SEEK_SET) == 0;
+#endif
+    }
+
+    uint64 file_size(FILE* fid) {
+#ifdef _WIN32
+        _fseeki64(fid, 0, SEEK_END);
+        return (uint64)_ftelli64(fid);
+#else
+        fseeko(fid, 0, SEEK_END);
+        return (uint64)ftello(fid);
+#endif
+    }
+
+    // one positioned read is at most this big (ReadFile takes a DWORD, Linux caps pread below 2 GiB)
+    const size_t read_at_piece_size = 1024 * 1024 * 1024;
+
+    bool read_at(FILE* fid, uint64 offset, void* data, size_t num_bytes) {
+#ifdef _WIN32
+        HANDLE handle = (HANDLE)_get_osfhandle(_fileno(fid));
+#endif
+        uint8* bytes = (uint8*)data;
+        for (size_t done = 0; done < num_bytes;) {
+            size_t n = std::min(num_bytes - done, read_at_piece_size);
+            uint64 at = offset + done;
+#ifdef _WIN32
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = (DWORD)(at & 0xFFFFFFFF);
+            overlapped.OffsetHigh = (DWORD)(at >> 32);
+            DWORD num_read = 0;
+            if (!ReadFile(handle, bytes + done, (DWORD)n, &num_read, &overlapped) || num_read == 0)
+                return false;
+#else
+            ssize_t num_read = pread(fileno(fid), bytes + done, n, (off_t)at);
+            if (num_read < 0 && errno == EINTR)
+                continue;
+            if (num_read <= 0)
+                return false;
+#endif
+            done += (size_t)num_read;
+        }
+        return true;
+    }
+
+    // compared in pieces, the sizes first
+    const size_t compare_read_size = 1024 * 1024;
+
+    bool files_equal(const std::string& filename_a, const std::string& filename_b) {
+        FILE* a = fopen(filename_a.c_str(), "rb");
+        FILE* b = fopen(filename_b.c_str(), "rb");
+        bool equal = a != nullptr && b != nullptr;
+        uint64 size = equal ? file_size(a) : 0;
+        equal = equal && file_size(b) == size;
+
+        std::vector<uint8> buffer_a(equal ? compare_read_size : 0), buffer_b(equal ? compare_read_size : 0);
+        for (uint64 done = 0; equal && done < size;) {
+            size_t n = (size_t)std::min<uint64>(size - done, compare_read_size);
+            equal = read_at(a, done, buffer_a.data(), n) && read_at(b, done, buffer_b.data(), n) &&
+                    memcmp(buffer_a.data(), buffer_b.data(), n) == 0;
+            done += n;
+        }
+        if (a) fclose(a);
+        if (b) fclose(b);
+        return equal;
+    }
+
+    uint64 file_time(const std::string& filename) {
+        struct stat info;
+        if (stat(filename.c_str(), &info) != 0)
+            return 0;
+        return (uint64)info.st_mtime;
+    }
 }
\ No newline at end of file
@@ -2,11 +2,48 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <mutex>
 #include <cstdio>
 
 #include <laml/laml.hpp>
 
 void level_print(int level, const char* format, ...);
+// printf, or into the Log_Buffer the calling thread logs to (see Log_Scope)
+void log_printf(const char* format, ...);
+
+// Console output of one task. Parallel tasks each log into their own buffer, and the
+// buffers are printed in submission order afterwards, so the output reads the same as a
+// serial run. Appends are locked, nested tasks log into the buffer of their parent.
+struct Log_Buffer {
+    std::mutex mutex;
+    std::string text;
+};
+
+// while alive, log_printf and level_print on this thread go to buffer (nullptr = stdout)
+struct Log_Scope {
+    Log_Buffer* previous;
+
+    Log_Scope(Log_Buffer* buffer);
+    Log_Scope(Log_Buffer& buffer) : Log_Scope(&buffer) {}
+    ~Log_Scope();
+};
+// where log output of the calling thread goes, nullptr = stdout
+Log_Buffer* current_log();
+
+// Keeps the output of a stage in order when parts of it come from tasks. While it is alive the
+// calling thread's output is captured, task() reserves a buffer at the current position for
+// one task to log into, and flush() passes everything on in order (once those tasks are done).
+struct Ordered_Log {
+    std::deque<Log_Buffer> buffers;
+    Log_Buffer* previous;
+
+    Ordered_Log();
+    ~Ordered_Log();
+
+    Log_Buffer& task();
+    void flush();
+};
 
 namespace utils {
     char* getCmdOption(char** begin, char** end, const std::string& option);
@@ -20,4 +57,20 @@ namespace utils {
 
     laml::Vec3 map_gltf_vec_to_vec3(const std::vector<double>& gltf_vec);
     std::string mime_type_to_ext(std::string mime_type);
+
+    // 64-bit FNV-1a
+    uint64 hash_bytes(const void* data, size_t size);
+    uint64 hash_string(const std::string& string);
+
+    // fseek/ftell with 64-bit offsets (long is 32 bits on windows)
+    bool file_seek(FILE* fid, uint64 offset);
+    uint64 file_size(FILE* fid);
+    // reads num_bytes at offset, in pieces if needed. threads can share a FILE they only use read_at on.
+    // on Windows it moves the file position, so don't mix it with fread/fseek on the same FILE
+    bool read_at(FILE* fid, uint64 offset, void* data, size_t num_bytes);
+
+    // true if both files exist and hold the same bytes
+    bool files_equal(const std::string& filename_a, const std::string& filename_b);
+    // modification time of a file in seconds since the epoch, 0 if it does not exist
+    uint64 file_time(const std::string& filename);
 }
\ No newline at end of file
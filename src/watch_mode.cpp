@@ -0,0 +1,403 @@
+#include "mesh_converter.h"
+#include "utils.h"
+#include "task_system.h"
+#include "conversion_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/****************************************
+*
+*   WATCH MODE (meshconv watch [inputs...])
+*
+*   Converts its inputs like batch mode, then keeps running and converts an input again
+*   whenever it or a file it read (.bin buffers, images) changes. The inputs are found again
+*   after every change, so files added to a watched folder or to the manifest are picked up.
+*
+*   Every output stays in an in-memory Conversion_Cache (on top of -cache, if given). A changed
+*   input has to be parsed again, but only the meshes, materials and animations that changed
+*   are encoded, the rest is copied from memory. Outputs are written with skip_unchanged, so
+*   files that hold the same bytes are not touched, and inputs that did not change are not
+*   converted at all.
+*
+*   Changes come from inotify on Linux (the folders holding the inputs and the files they
+*   read, folder inputs recursively), and from polling modification times elsewhere. Events
+*   are debounced: converting starts once nothing changed for -debounce ms (200 by default),
+*   so an editor saving several files at once causes one conversion.
+*
+* ************************************/
+
+typedef std::chrono::steady_clock::time_point Time_Point;
+
+static double seconds_since(Time_Point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// how often the files are checked without inotify
+const uint32 poll_interval_ms = 100;
+
+struct Watched_Input {
+    Convert_Input input;
+    bool32 dirty = true;
+
+    // found by its last conversion
+    std::vector<std::string> dependencies; // as watch_path()s
+    std::vector<uint64> cache_keys;        // the cache entries it used, the rest is dropped from memory
+
+    // the last conversion
+    bool32 loaded = false; // any conversion got as far as a loaded input, until then its whole folder is watched
+    bool32 success = false;
+    double seconds = 0;
+    Output_Stats stats;
+    Log_Buffer log;
+};
+
+struct File_Watcher {
+    std::unordered_set<std::string> folders; // watched so far
+#ifdef __linux__
+    int fd = -1;
+    std::unordered_map<int, std::string> watches; // inotify watch descriptor -> folder
+#else
+    std::unordered_map<std::string, uint64> stamps; // polled file or folder -> modification time and size
+#endif
+};
+
+// paths as the watcher reports them: '/' separated, without a leading "./"
+static std::string watch_path(const std::string& path) {
+    std::string result = path;
+    std::replace(result.begin(), result.end(), '\\', '/');
+    while (result.compare(0, 2, "./") == 0) {
+        result = result.substr(2);
+    }
+    return result;
+}
+
+static std::string folder_of(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+}
+
+static std::string join_path(const std::string& folder, const std::string& name) {
+    return folder == "." ? name : folder + '/' + name;
+}
+
+static const char* mode_name(OperationModeType mode) {
+    switch (mode) {
+        case SINGLE_MESH_MODE: return "mesh";
+        case LEVEL_MODE:       return "level";
+        case ANIM_MODE:        return "anim";
+        default:               return "?";
+    }
+}
+
+#ifdef __linux__
+static bool32 start_watcher(File_Watcher& watcher) {
+    watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    return watcher.fd >= 0;
+}
+
+static void watch_folder(File_Watcher& watcher, const std::string& folder) {
+    if (!watcher.folders.insert(folder).second) {
+        return;
+    }
+    // files are saved in place (close_write) or written elsewhere and renamed over (moved_to)
+    int wd = inotify_add_watch(watcher.fd, folder.c_str(),
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE);
+    if (wd < 0) {
+        printf("[WARNING] Can not watch '%s'\n", folder.c_str());
+        watcher.folders.erase(folder);
+        return;
+    }
+    watcher.watches[wd] = folder;
+}
+
+static void watch_file(File_Watcher& watcher, const std::string& filename) {
+    watch_folder(watcher, folder_of(filename)); // events come from the folder
+}
+
+// adds every path that changed to changed, true if any did. waits up to timeout_ms, -1 = forever
+static bool32 read_changes(File_Watcher& watcher, int32 timeout_ms, std::unordered_set<std::string>& changed) {
+    pollfd poll_fd = { watcher.fd, POLLIN, 0 };
+    if (poll(&poll_fd, 1, timeout_ms) <= 0) {
+        return false;
+    }
+
+    alignas(inotify_event) char buffer[16 * 1024];
+    bool32 any = false;
+    for (;;) {
+        ssize_t size = read(watcher.fd, buffer, sizeof(buffer));
+        if (size <= 0) {
+            return any;
+        }
+        for (char* at = buffer; at < buffer + size;) {
+            const inotify_event* event = (const inotify_event*)at;
+            at += sizeof(inotify_event) + event->len;
+
+            auto folder = watcher.watches.find(event->wd);
+            if (folder == watcher.watches.end() || event->len == 0) {
+                continue;
+            }
+            changed.insert(join_path(folder->second, event->name));
+            any = true;
+        }
+    }
+}
+#else
+static bool32 start_watcher(File_Watcher& watcher) {
+    return true;
+}
+
+static uint64 file_stamp(const std::string& path) {
+    std::error_code ec;
+    uint64 size = std::filesystem::is_regular_file(path, ec) ? (uint64)std::filesystem::file_size(path, ec) : 0;
+    return utils::file_time(path) * 1000003 + size;
+}
+
+static void watch_file(File_Watcher& watcher, const std::string& filename) {
+    if (watcher.stamps.count(filename) == 0) {
+        watcher.stamps[filename] = file_stamp(filename);
+    }
+}
+
+// a folder's modification time changes when files are added, removed or renamed in it
+static void watch_folder(File_Watcher& watcher, const std::string& folder) {
+    watcher.folders.insert(folder);
+    watch_file(watcher, folder);
+}
+
+static bool32 read_changes(File_Watcher& watcher, int32 timeout_ms, std::unordered_set<std::string>& changed) {
+    Time_Point start = std::chrono::steady_clock::now();
+    for (;;) {
+        bool32 any = false;
+        for (auto& stamp : watcher.stamps) {
+            uint64 now = file_stamp(stamp.first);
+            if (now != stamp.second) {
+                stamp.second = now;
+                changed.insert(stamp.first);
+                any = true;
+            }
+        }
+        if (any) {
+            return true;
+        }
+        if (timeout_ms >= 0 && seconds_since(start) * 1000.0 >= timeout_ms) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(poll_interval_ms));
+    }
+}
+#endif
+
+// the first change, and every change after it until none came for debounce_ms
+static void wait_for_changes(File_Watcher& watcher, uint32 debounce_ms, std::unordered_set<std::string>& changed) {
+    read_changes(watcher, -1, changed);
+    while (read_changes(watcher, (int32)debounce_ms, changed)) {}
+}
+
+// everything that can change the inputs or what they convert to
+static void update_watches(File_Watcher& watcher, const Options& opts, const std::vector<std::unique_ptr<Watched_Input>>& inputs) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+
+    for (const std::string& input : opts.batch_inputs) {
+        std::string path = watch_path(input);
+        if (fs::is_directory(path, ec)) {
+            // files can be added anywhere below a folder input
+            watch_folder(watcher, path);
+            for (const auto& entry : fs::recursive_directory_iterator(path, ec)) {
+                if (entry.is_directory(ec)) {
+                    watch_folder(watcher, watch_path(entry.path().string()));
+                }
+            }
+        } else {
+            // patterns match files added to their folder
+            watch_folder(watcher, folder_of(path));
+        }
+    }
+    if (!opts.manifest.empty()) {
+        watch_file(watcher, watch_path(opts.manifest));
+    }
+    for (const auto& watched : inputs) {
+        watch_file(watcher, watch_path(watched->input.filename));
+        if (!watched->loaded) {
+            watch_folder(watcher, folder_of(watch_path(watched->input.filename)));
+        }
+        for (const std::string& dep : watched->dependencies) {
+            watch_file(watcher, dep);
+        }
+    }
+}
+
+// the inputs as they are now. unchanged ones keep what their last conversion found, new ones are dirty
+static bool32 refresh_inputs(const Options& opts, std::vector<std::unique_ptr<Watched_Input>>& inputs) {
+    std::vector<Convert_Input> found;
+    if (!find_convert_inputs(opts, found)) {
+        return false;
+    }
+
+    std::vector<std::unique_ptr<Watched_Input>> refreshed;
+    for (const Convert_Input& input : found) {
+        auto existing = std::find_if(inputs.begin(), inputs.end(), [&](const std::unique_ptr<Watched_Input>& watched) {
+            return watched && watched->input.filename == input.filename && watched->input.mode == input.mode &&
+                watched->input.output_folder == input.output_folder;
+        });
+        if (existing != inputs.end()) {
+            refreshed.push_back(std::move(*existing));
+        } else {
+            refreshed.push_back(std::make_unique<Watched_Input>());
+            refreshed.back()->input = input;
+        }
+    }
+    inputs = std::move(refreshed);
+    return true;
+}
+
+static void convert_watched(const Options& opts, Watched_Input& watched) {
+    Options input_opts = opts;
+    input_opts.mode = watched.input.mode;
+    input_opts.input_filename = watched.input.filename;
+    input_opts.output_folder = watched.input.output_folder;
+    input_opts.stats = &watched.stats;
+    input_opts.batch_inputs.clear();
+    input_opts.manifest.clear();
+
+    watched.stats.num_files = 0;
+    watched.stats.num_bytes = 0;
+    watched.stats.num_unchanged = 0;
+    watched.log.text.clear();
+
+    Time_Point start = std::chrono::steady_clock::now();
+    {
+        Log_Scope scope(watched.log);
+        log_printf("  output_folder:  %s\n", watched.input.output_folder.c_str());
+        Conversion_State* state = load_input(input_opts);
+        watched.success = state != nullptr && process_input(input_opts, state) && write_outputs(input_opts, state);
+        // a failed load keeps the dependencies of the last one, a missing file still makes the input dirty
+        if (state != nullptr) {
+            watched.dependencies.clear();
+            watched.cache_keys.clear();
+            conversion_files(state, watched.dependencies, watched.cache_keys);
+            free_conversion(state);
+            for (std::string& dep : watched.dependencies) {
+                dep = watch_path(dep);
+            }
+            watched.loaded = true;
+        }
+    }
+    watched.seconds = seconds_since(start);
+    watched.dirty = false;
+}
+
+// converts the dirty inputs in parallel and prints a line for each
+static void convert_dirty(const Options& opts, std::vector<std::unique_ptr<Watched_Input>>& inputs) {
+    std::vector<Watched_Input*> dirty;
+    for (const auto& watched : inputs) {
+        if (watched->dirty) {
+            dirty.push_back(watched.get());
+        }
+    }
+    if (dirty.empty()) {
+        return;
+    }
+
+    Time_Point start = std::chrono::steady_clock::now();
+    parallel_for((uint32)dirty.size(), [&](uint32 n) { convert_watched(opts, *dirty[n]); });
+    double seconds = seconds_since(start);
+
+    uint32 num_failed = 0;
+    for (Watched_Input* watched : dirty) {
+        if (!watched->success || opts.verbose) {
+            printf("%s", watched->log.text.c_str());
+        }
+        uint32 num_files = watched->stats.num_files.load();
+        uint32 num_unchanged = watched->stats.num_unchanged.load();
+        printf("  %-6s %-5s %8.1f ms  touched %3d of %3d files  %s\n", watched->success ? "ok" : "FAILED",
+            mode_name(watched->input.mode), watched->seconds * 1000.0, (int)(num_files - num_unchanged), (int)num_files,
+            watched->input.filename.c_str());
+        if (!watched->success) {
+            num_failed++;
+        }
+    }
+    printf("Converted %d input%s in %.1f ms", (int)dirty.size(), dirty.size() == 1 ? "" : "s", seconds * 1000.0);
+    if (num_failed) {
+        printf(", %d failed", (int)num_failed);
+    }
+    printf("\n");
+
+    // only what the latest conversions use stays in memory
+    std::unordered_set<uint64> keys;
+    for (const auto& watched : inputs) {
+        keys.insert(watched->cache_keys.begin(), watched->cache_keys.end());
+    }
+    trim_memory_cache(*opts.cache, keys);
+}
+
+bool convert_watch(const Options& opts) {
+    File_Watcher watcher;
+    if (!start_watcher(watcher)) {
+        printf("[ERROR] Can not watch for file changes\n");
+        return false;
+    }
+
+    // a memory-only cache, unless one was given
+    Conversion_Cache memory_cache;
+    Options watch_opts = opts;
+    if (watch_opts.cache == nullptr) {
+        watch_opts.cache = &memory_cache;
+    }
+    watch_opts.cache->in_memory = true;
+    watch_opts.skip_unchanged = true;
+
+    std::vector<std::unique_ptr<Watched_Input>> inputs;
+    if (!refresh_inputs(watch_opts, inputs)) {
+        return false;
+    }
+    convert_dirty(watch_opts, inputs);
+
+    for (;;) {
+        update_watches(watcher, watch_opts, inputs);
+        printf("Watching %d input%s in %d folder%s for changes...\n", (int)inputs.size(), inputs.size() == 1 ? "" : "s",
+            (int)watcher.folders.size(), watcher.folders.size() == 1 ? "" : "s");
+        fflush(stdout); // shows up right away when the output goes to a file or pipe
+
+        // our own outputs cause events too, wait until one of them changes an input
+        for (;;) {
+            update_watches(watcher, watch_opts, inputs); // new folders below a folder input
+            std::unordered_set<std::string> changed;
+            wait_for_changes(watcher, watch_opts.debounce_ms, changed);
+
+            refresh_inputs(watch_opts, inputs);
+            bool32 any_dirty = false;
+            for (const auto& watched : inputs) {
+                if (!watched->dirty) {
+                    watched->dirty = changed.count(watch_path(watched->input.filename)) != 0 ||
+                        std::any_of(watched->dependencies.begin(), watched->dependencies.end(),
+                                    [&](const std::string& dep) { return changed.count(dep) != 0; });
+                }
+                if (!watched->dirty && !watched->loaded) {
+                    // whatever the load was missing can show up anywhere next to the input
+                    std::string folder = folder_of(watch_path(watched->input.filename));
+                    watched->dirty = changed.count(folder) != 0 ||
+                        std::any_of(changed.begin(), changed.end(),
+                                    [&](const std::string& path) { return folder_of(path) == folder; });
+                }
+                any_dirty = any_dirty || watched->dirty;
+            }
+            if (any_dirty) {
+                break;
+            }
+        }
+        convert_dirty(watch_opts, inputs);
+    }
+}